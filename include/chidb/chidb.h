@@ -59,6 +59,108 @@ typedef struct chidb chidb;
 int chidb_open(const char *file, chidb **db); 
 
 
+/* Compacts a chidb file
+ *
+ * Rebuilds B-Trees in key order, packing their entries into as few
+ * pages as possible, and shrinks the file accordingly. If a table is
+ * given, only that table and its indexes are rebuilt, and the pages of
+ * every other B-Tree are simply moved. This is what the VACUUM
+ * statement does.
+ *
+ * Since the B-Trees are moved to other pages, any statement prepared
+ * before calling this function must be prepared again. This function
+ * must not be called while other statements are running on the database.
+ *
+ * Parameters
+ * - db: chidb database
+ * - table: Name of the table to rebuild, or NULL to rebuild every table
+ *          and index.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EINVALIDSQL: There is no such table
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_vacuum(chidb *db, const char *table);
+
+
+/* Prints space and shape statistics of the B-Trees of a chidb file
+ *
+ * For each B-Tree, prints its depth, the number of pages in each level,
+ * the average and minimum fill factor of its pages, how many bytes are
+ * fragmented, how many leaves are stored in the file right after the
+ * previous leaf (in key order), and how big the cells are. This is what
+ * the shell's .analyze command shows, and can be used to decide when to
+ * run VACUUM (see chidb_vacuum).
+ *
+ * Parameters
+ * - db: chidb database
+ * - name: Name of the table or index to analyze (a table includes its
+ *         indexes), or NULL to analyze every B-Tree, including the
+ *         schema table.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EINVALIDSQL: There is no such table or index
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_analyze(chidb *db, const char *name);
+
+
+/* Turns Bloom filters on or off
+ *
+ * When Bloom filters are on, every table and index B-Tree has a Bloom
+ * filter of its keys, which lookups of a single key check first, so
+ * that looking up a key that does not exist usually does not read any
+ * page. Filters are kept in memory: turning them on builds them by
+ * reading every B-Tree, and new B-Trees get one when the schema is
+ * loaded. Every insertion adds its key to the filter of its B-Tree.
+ *
+ * Filters are off when a database is opened.
+ *
+ * Parameters
+ * - db: chidb database
+ * - enable: Whether to use Bloom filters
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_bloom(chidb *db, bool enable);
+
+
+/* Turns write buffering on or off
+ *
+ * When write buffering is on, the rows inserted into a table are kept
+ * in memory, sorted by key, and appended to a log file (the database file
+ * name followed by "-wal"), instead of being written to the table's
+ * B-Tree right away. Once they take enough memory, the rows of every
+ * table are merged into their B-Trees in key order, which writes each
+ * leaf once instead of once per row. Queries see buffered rows right
+ * away. Indexes are not buffered.
+ *
+ * Buffered rows are written to their B-Trees when write buffering is
+ * turned off, before VACUUM and .analyze, and when the database is
+ * closed. If the process dies before that, they are written from the log
+ * the next time the database is opened.
+ *
+ * Write buffering is off when a database is opened.
+ *
+ * Parameters
+ * - db: chidb database
+ * - enable: Whether to buffer the rows inserted into tables
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_buffer(chidb *db, bool enable);
+
+
 /* Prepares a SQL statement for execution
  *
  * Parameters
@@ -112,6 +214,50 @@ int chidb_step(chidb_stmt *stmt);
 int chidb_finalize(chidb_stmt *stmt);
 
 
+/* Binds a value to a parameter of a SQL statement
+ *
+ * A SQL statement can have "?" in place of the values it inserts or
+ * compares columns with. These parameters are numbered from 1, in the
+ * order they appear in the statement, and must be bound before the
+ * statement is stepped through. The value of a parameter must be of the
+ * type of the column it goes with. It stays bound when the statement is
+ * reset, so a statement can be run many times, with different values,
+ * without preparing it again.
+ *
+ * Values can only be bound before the statement is first stepped
+ * through, or after it is reset (see chidb_reset).
+ *
+ * Parameters
+ * - stmt: Prepared SQL statement
+ * - param: Parameter (parameters are numbered from 1)
+ * - value: Value of the parameter. chidb_bind_text makes its own copy
+ *          of the string.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: There is no such parameter, or the statement is running
+ * - CHIDB_EMISMATCH: The parameter is not of this type
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_bind_int(chidb_stmt *stmt, int param, int value);
+int chidb_bind_text(chidb_stmt *stmt, int param, const char *value);
+
+
+/* Resets a SQL statement, so that it can be stepped through again
+ *
+ * The statement runs again from the start the next time chidb_step is
+ * called, with the values currently bound to its parameters. It does not
+ * have to have run to completion.
+ *
+ * Parameters
+ * - stmt: Prepared SQL statement
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_reset(chidb_stmt *stmt);
+
+
 /* Returns the number of columns returned by a SQL statement
  *
  * Parameters
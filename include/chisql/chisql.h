@@ -18,17 +18,20 @@
 #define STMT_SELECT (1)
 #define STMT_INSERT (2)
 #define STMT_DELETE (3)
+#define STMT_VACUUM (4)
 
 typedef struct chisql_statement
 {
     bool explain;
     char *text;
     uint8_t type;
+    int nParams; /* Number of '?' parameters */
     union {
         Create_t *create;
         SRA_t    *select;
         Insert_t *insert;
         Delete_t *delete;
+        char     *vacuum; /* Table to vacuum (NULL for all of them) */
     } stmt;
 } chisql_statement_t;
 
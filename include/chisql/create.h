@@ -24,9 +24,13 @@ typedef struct TableReference_s {
    char *table_name, *alias;
 } TableReference_t;
 
+enum IndexMethod { INDEX_BTREE, INDEX_HASH };
+
 typedef struct Index_s {
    char *name, *table_name, *column_name;
    int unique;
+   enum IndexMethod method;
+   StrList_t *include; /* columns stored in the index entries, or NULL */
 } Index_t;
 
 enum CreateType { CREATE_TABLE, CREATE_INDEX };
@@ -53,6 +57,8 @@ void        TableReference_free(TableReference_t *tref);
 
 Index_t *   Index_make(char *name, char *table_name, char *column_name);
 Index_t *   Index_makeUnique(Index_t *idx);
+Index_t *   Index_setMethod(Index_t *idx, enum IndexMethod method);
+Index_t *   Index_setInclude(Index_t *idx, StrList_t *include);
 void        Index_print(Index_t *idx);
 void        Index_free(Index_t *idx);
 
@@ -13,6 +13,7 @@ union LitVal {
 typedef struct Literal_t {
    enum data_type t;
    union LitVal val;
+   int param; /* n for the n-th '?' of the statement (from 1), 0 otherwise */
    struct Literal_t *next; /* linked list */
 } Literal_t;
 
@@ -20,6 +21,7 @@ Literal_t *litInt(int i);
 Literal_t *litDouble(double d);
 Literal_t *litChar(char c);
 Literal_t *litText(char *str);
+Literal_t *litParam(int n);
 Literal_t *Literal_append(Literal_t *val, Literal_t *toAppend);
 
 void Literal_free(Literal_t *lval);
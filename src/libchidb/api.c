@@ -42,9 +42,14 @@
 
 
 #include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
 #include <chidb/chidb.h>
 #include "dbm.h"
+#include "dbm-cache.h"
 #include "btree.h"
+#include "hash.h"
+#include "memtable.h"
 #include "record.h"
 #include "util.h"
 
@@ -57,6 +62,29 @@ int chidb_stmt_optimize(chidb *db,
 			chisql_statement_t **sql_stmt_opt);
 
   /* your code */
+/* 为根为root_page的B-Tree建立Bloom filter(已有或是哈希索引则不建) */
+static int load_bloom(chidb *db, npage_t root_page)
+{
+	bool is_hash;
+	int rt;
+
+	if (rt = chidb_Hash_isHash(db->bt, root_page, &is_hash))
+		return rt;
+	if (is_hash || chidb_Btree_getBloom(db->bt, root_page) != NULL)
+		return CHIDB_OK;
+
+	return chidb_Btree_bloomBuild(db->bt, root_page);
+}
+
+/* 为表item的B-Tree建立写缓冲(已有或不是表则不建) */
+static int load_buffer(chidb *db, chidb_schema_t *item)
+{
+	if (strcmp(item->type, "table"))
+		return CHIDB_OK;
+
+	return chidb_Memtable_enable(db->bt, item->root_page);
+}
+
 int load_schema(chidb *db, npage_t nroot)
 {
 	Btree *bt = db->bt;
@@ -94,6 +122,12 @@ int load_schema(chidb *db, npage_t nroot)
 			chisql_parser(sql, &item->stmt);
 			// 将该行加入到db中的schema里
 			list_append(&db->schemas, item);
+			// 启用了Bloom filter时, 新的B-Tree也要有filter
+			if (db->bloom)
+				load_bloom(db, item->root_page);
+			// 启用了写缓冲时, 新表也要有写缓冲
+			if (db->buffer)
+				load_buffer(db, item);
 			// 释放空间
 			free(sql);
 			chidb_DBRecord_destroy(dbr);
@@ -111,6 +145,292 @@ int load_schema(chidb *db, npage_t nroot)
 	return CHIDB_OK;
 }
 
+/* 把schema表(从第nroot页开始)写到dst的第1页, 并重建或复制其中每个B-Tree */
+static int vacuum_schema(chidb *db, BTree *dst, npage_t nroot, const char *table, bool *found)
+{
+	BTreeNode *btn;
+	int rt;
+
+	if (rt = chidb_Btree_getNodeByPage(db->bt, nroot, &btn))
+		return rt;
+
+	for (ncell_t i = 0; !rt && i < btn->n_cells; ++i)
+	{
+		BTreeCell cell;
+		if (rt = chidb_Btree_getCell(btn, i, &cell))
+			break;
+
+		if (btn->type == PGTYPE_TABLE_INTERNAL)
+		{
+			rt = vacuum_schema(db, dst, cell.fields.tableInternal.child_page, table, found);
+			continue;
+		}
+
+		DBRecord *dbr, *new_dbr;
+		char *type, *name, *assoc, *sql;
+		int32_t root_page;
+		npage_t new_root;
+		uint8_t *data;
+
+		chidb_DBRecord_unpack(&dbr, cell.fields.tableLeaf.data);
+		chidb_DBRecord_getString(dbr, 0, &type);
+		chidb_DBRecord_getString(dbr, 1, &name);
+		chidb_DBRecord_getString(dbr, 2, &assoc);
+		chidb_DBRecord_getInt32 (dbr, 3, &root_page);
+		chidb_DBRecord_getString(dbr, 4, &sql);
+
+		// 指定了表时, 只重建该表和它的索引, 其他B-Tree原样复制
+		bool is_table = table != NULL && !strcmp(type, "table") && !strcmp(name, table);
+		bool is_index = table != NULL && !strcmp(type, "index") && !strcmp(assoc, table);
+		if (is_table)
+			*found = true;
+
+		// 哈希索引总是重建, 它的桶没有顺序可言
+		bool is_hash;
+		if (!(rt = chidb_Hash_isHash(db->bt, root_page, &is_hash)))
+		{
+			if (is_hash)
+				rt = chidb_Hash_rebuild(db->bt, root_page, dst, &new_root);
+			else if (table == NULL || is_table || is_index)
+				rt = chidb_Btree_rebuild(db->bt, root_page, dst, &new_root);
+			else
+				rt = chidb_Btree_copy(db->bt, root_page, dst, &new_root);
+		}
+
+		// 用新的根页号写回schema表中的这一行
+		if (!rt)
+		{
+			chidb_DBRecord_create(&new_dbr, "|s|s|s|i4|s|", type, name, assoc, new_root, sql);
+			chidb_DBRecord_pack(new_dbr, &data);
+			rt = chidb_Btree_insertInTable(dst, 1, cell.key, data, new_dbr->packed_len);
+			free(data);
+			chidb_DBRecord_destroy(new_dbr);
+		}
+
+		free(type);
+		free(name);
+		free(assoc);
+		free(sql);
+		chidb_DBRecord_destroy(dbr);
+	}
+
+	if (!rt && btn->type != PGTYPE_TABLE_LEAF)
+		rt = vacuum_schema(db, dst, btn->right_page, table, found);
+
+	chidb_Btree_freeMemNode(db->bt, btn);
+	return rt;
+}
+
+int chidb_vacuum(chidb *db, const char *table)
+{
+	char tmpname[] = P_tmpdir "/chidb-vacuum-XXXXXX";
+	Pager *pager = db->bt->pager, *tmp_pager;
+	BTree tmp;
+	npage_t npage;
+	bool found = false;
+	int fd, rt;
+
+	// 写缓冲中的行要先写入B-Tree
+	if (rt = chidb_Memtable_flush(db->bt))
+		return rt;
+
+	// 先在临时文件中重建整个数据库
+	if ((fd = mkstemp(tmpname)) < 0)
+		return CHIDB_EIO;
+	close(fd);
+
+	if (rt = chidb_Pager_open(&tmp_pager, tmpname))
+	{
+		unlink(tmpname);
+		return rt;
+	}
+	chidb_Pager_setPageSize(tmp_pager, pager->page_size);
+	tmp.db = db;
+	tmp.pager = tmp_pager;
+	tmp.blooms = NULL;
+	tmp.wbuf = NULL;
+	tmp.epoch = 0;
+
+	// 临时文件的第1页是schema表的根
+	if (!(rt = chidb_Btree_newNode(&tmp, &npage, PGTYPE_TABLE_LEAF)))
+		rt = vacuum_schema(db, &tmp, 1, table, &found);
+
+	if (!rt && table != NULL && !found)
+		rt = CHIDB_EINVALIDSQL;
+
+	// 再把临时文件的页写回原文件, 并截掉多余的页
+	if (!rt)
+	{
+		npage_t n_pages = tmp_pager->n_pages;
+
+		if (n_pages > pager->n_pages)
+			rt = chidb_Pager_truncate(pager, n_pages);
+
+		for (npage_t i = 1; !rt && i <= n_pages; ++i)
+		{
+			MemPage *page;
+			if (rt = chidb_Pager_readPage(tmp_pager, i, &page))
+				break;
+			rt = chidb_Pager_writePage(pager, page);
+			chidb_Pager_releaseMemPage(tmp_pager, page);
+		}
+
+		if (!rt)
+			rt = chidb_Pager_truncate(pager, n_pages);
+
+		// 根页号变了, 下次编译语句前需重新加载schema, 并重建Bloom filter和写缓冲
+		// 所有页都被改写, 游标的trail都要从根重建
+		db->synced = 0;
+		chidb_Btree_bumpEpoch(db->bt);
+		chidb_Btree_bloomFreeAll(db->bt);
+		chidb_Memtable_freeAll(db->bt);
+	}
+
+	chidb_Pager_close(tmp_pager);
+	unlink(tmpname);
+	return rt;
+}
+
+/* 分析schema表(从第nroot页开始)中每个B-Tree, 并打印统计信息 */
+static int analyze_schema(chidb *db, npage_t nroot, const char *name, bool *found)
+{
+	BTreeNode *btn;
+	int rt;
+
+	if (rt = chidb_Btree_getNodeByPage(db->bt, nroot, &btn))
+		return rt;
+
+	for (ncell_t i = 0; !rt && i < btn->n_cells; ++i)
+	{
+		BTreeCell cell;
+		if (rt = chidb_Btree_getCell(btn, i, &cell))
+			break;
+
+		if (btn->type == PGTYPE_TABLE_INTERNAL)
+		{
+			rt = analyze_schema(db, cell.fields.tableInternal.child_page, name, found);
+			continue;
+		}
+
+		DBRecord *dbr;
+		char *type, *item_name, *assoc;
+		int32_t root_page;
+		BTreeStats stats;
+		HashStats hash_stats;
+		bool is_hash;
+
+		chidb_DBRecord_unpack(&dbr, cell.fields.tableLeaf.data);
+		chidb_DBRecord_getString(dbr, 0, &type);
+		chidb_DBRecord_getString(dbr, 1, &item_name);
+		chidb_DBRecord_getString(dbr, 2, &assoc);
+		chidb_DBRecord_getInt32 (dbr, 3, &root_page);
+
+		// 指定了名字时, 只分析该表(及其索引)或该索引
+		if (name == NULL || !strcmp(item_name, name) || (!strcmp(type, "index") && !strcmp(assoc, name)))
+		{
+			*found = true;
+			if (!(rt = chidb_Hash_isHash(db->bt, root_page, &is_hash)) && is_hash)
+			{
+				if (!(rt = chidb_Hash_analyze(db->bt, root_page, &hash_stats)))
+					chidb_Hash_printStats(type, item_name, root_page, &hash_stats);
+			}
+			else if (!rt && !(rt = chidb_Btree_analyze(db->bt, root_page, &stats)))
+				chidb_Btree_printStats(type, item_name, root_page, &stats);
+		}
+
+		free(type);
+		free(item_name);
+		free(assoc);
+		chidb_DBRecord_destroy(dbr);
+	}
+
+	if (!rt && btn->type != PGTYPE_TABLE_LEAF)
+		rt = analyze_schema(db, btn->right_page, name, found);
+
+	chidb_Btree_freeMemNode(db->bt, btn);
+	return rt;
+}
+
+int chidb_analyze(chidb *db, const char *name)
+{
+	BTreeStats stats;
+	bool found = false;
+	int rt;
+
+	// 写缓冲中的行要先写入B-Tree
+	if (rt = chidb_Memtable_flush(db->bt))
+		return rt;
+
+	// schema表本身也是一个B-Tree
+	if (name == NULL)
+	{
+		if (rt = chidb_Btree_analyze(db->bt, 1, &stats))
+			return rt;
+		chidb_Btree_printStats("table", "(schema)", 1, &stats);
+	}
+
+	if (rt = analyze_schema(db, 1, name, &found))
+		return rt;
+
+	return (name != NULL && !found) ? CHIDB_EINVALIDSQL : CHIDB_OK;
+}
+
+int chidb_bloom(chidb *db, bool enable)
+{
+	int rt;
+
+	db->bloom = enable;
+	if (!enable)
+		return chidb_Btree_bloomFreeAll(db->bt);
+
+	// schema未同步时, 重新加载schema时会建立filter
+	if (!db->synced)
+		return CHIDB_OK;
+
+	// 为schema中已有的每个B-Tree建立filter
+	list_iterator_start(&db->schemas);
+	while (list_iterator_hasnext(&db->schemas))
+	{
+		chidb_schema_t *item = list_iterator_next(&db->schemas);
+		if (rt = load_bloom(db, item->root_page))
+		{
+			list_iterator_stop(&db->schemas);
+			return rt;
+		}
+	}
+	list_iterator_stop(&db->schemas);
+
+	return CHIDB_OK;
+}
+
+int chidb_buffer(chidb *db, bool enable)
+{
+	int rt;
+
+	db->buffer = enable;
+	if (!enable)
+		return chidb_Memtable_freeAll(db->bt);
+
+	// schema未同步时, 重新加载schema时会建立写缓冲
+	if (!db->synced)
+		return CHIDB_OK;
+
+	// 为schema中已有的每个表建立写缓冲
+	list_iterator_start(&db->schemas);
+	while (list_iterator_hasnext(&db->schemas))
+	{
+		chidb_schema_t *item = list_iterator_next(&db->schemas);
+		if (rt = load_buffer(db, item))
+		{
+			list_iterator_stop(&db->schemas);
+			return rt;
+		}
+	}
+	list_iterator_stop(&db->schemas);
+
+	return CHIDB_OK;
+}
+
 int chidb_open(const char *file, chidb **db)
 {
     *db = malloc(sizeof(chidb));
@@ -119,9 +439,16 @@ int chidb_open(const char *file, chidb **db)
     chidb_Btree_open(file, *db, &(*db)->bt);
 
     /* Additional initialization code goes here */
+    (*db)->bloom = 0;
+    (*db)->buffer = 0;
     list_init(&((*db)->schemas));
     load_schema(*db, 1);
     (*db)->synced = 1;
+    if (chidb_dbm_cache_open(&(*db)->cache))
+    {
+        chidb_close(*db);
+        return CHIDB_ENOMEM;
+    }
 
     return CHIDB_OK;
 }
@@ -143,11 +470,15 @@ int chidb_close(chidb *db)
     }
     // 释放list的空间
     list_destroy(&(db->schemas));
+    chidb_dbm_cache_close(db->cache);
     free(db);
     return CHIDB_OK;
 }
 
-int chidb_prepare(chidb *db, const char *sql, chidb_stmt **stmt)
+/* Compile a SQL statement into a DBM program. If the statement cannot be
+ * parsed, *stmt is NULL; if it cannot be compiled, *stmt is the (unusable)
+ * program that was being generated */
+static int compile_stmt(chidb *db, const char *sql, chidb_stmt **stmt)
 {
     int rc;
     chisql_statement_t *sql_stmt, *sql_stmt_opt;
@@ -159,6 +490,7 @@ int chidb_prepare(chidb *db, const char *sql, chidb_stmt **stmt)
     if(rc != CHIDB_OK)
     {
         free(*stmt);
+        *stmt = NULL;
         return rc;
     }
 
@@ -167,6 +499,7 @@ int chidb_prepare(chidb *db, const char *sql, chidb_stmt **stmt)
     if(rc != CHIDB_OK)
     {
         free(*stmt);
+        *stmt = NULL;
         return rc;
     }
 
@@ -175,11 +508,17 @@ int chidb_prepare(chidb *db, const char *sql, chidb_stmt **stmt)
     if(rc != CHIDB_OK)
     {
         free(*stmt);
+        *stmt = NULL;
         return rc;
     }
 
     rc = chidb_stmt_codegen(*stmt, sql_stmt_opt);
 
+    if(rc == CHIDB_OK)
+        rc = chidb_stmt_peephole(*stmt);
+    if(rc == CHIDB_OK)
+        rc = chidb_stmt_verify(*stmt);
+
     free(sql_stmt_opt);
 
     (*stmt)->explain = sql_stmt->explain;
@@ -187,6 +526,83 @@ int chidb_prepare(chidb *db, const char *sql, chidb_stmt **stmt)
     return rc;
 }
 
+/* Copy of the cached program of a normalized statement (see dbm-cache.c),
+ * which is compiled and cached if it is not there yet. Fails like
+ * compile_stmt */
+static int cached_stmt(chidb *db, const char *key, chidb_stmt **stmt)
+{
+	chidb_stmt *prog = chidb_dbm_cache_get(db->cache, key);
+	int rc;
+
+	if(prog == NULL)
+	{
+		if((rc = compile_stmt(db, key, &prog)) != CHIDB_OK)
+		{
+			*stmt = prog;
+			return rc;
+		}
+		if(chidb_dbm_cache_put(db->cache, key, prog) != CHIDB_OK)
+		{
+			*stmt = prog;
+			return CHIDB_OK;
+		}
+	}
+
+	if((*stmt = malloc(sizeof(chidb_stmt))) == NULL)
+		return CHIDB_ENOMEM;
+	if((rc = chidb_stmt_copy(*stmt, prog)) != CHIDB_OK)
+	{
+		chidb_stmt_free(*stmt);
+		free(*stmt);
+		*stmt = NULL;
+	}
+
+	return rc;
+}
+
+int chidb_prepare(chidb *db, const char *sql, chidb_stmt **stmt)
+{
+	chidb_dbm_register_t *values;
+	uint32_t n_values;
+	char *key;
+	int rc;
+
+	// schema变化后(见chidb_stmt_codegen)缓存的程序都已失效
+	if(!db->synced)
+		chidb_dbm_cache_clear(db->cache);
+
+	if((rc = chidb_dbm_cache_normalize(sql, &key, &values, &n_values)) != CHIDB_OK)
+		return rc;
+	if(key == NULL)
+		return compile_stmt(db, sql, stmt);
+
+	rc = cached_stmt(db, key, stmt);
+
+	// 字面量作为参数绑定. 字面量换成参数后无法编译, 或类型与列不符的语句
+	// 不使用缓存, 按原样编译
+	for(uint32_t i = 0; rc == CHIDB_OK && i < n_values; i++)
+	{
+		if(values[i].type == REG_INT32)
+			rc = chidb_bind_int(*stmt, i + 1, values[i].value.i);
+		else
+			rc = chidb_bind_text(*stmt, i + 1, values[i].value.s);
+	}
+	if(rc != CHIDB_OK && *stmt != NULL && n_values > 0)
+	{
+		chidb_stmt_free(*stmt);
+		free(*stmt);
+		rc = compile_stmt(db, sql, stmt);
+	}
+
+	for(uint32_t i = 0; i < n_values; i++)
+		if(values[i].type == REG_STRING)
+			free(values[i].value.s);
+	free(values);
+	free(key);
+
+	return rc;
+}
+
 int chidb_step(chidb_stmt *stmt)
 {
 	if(stmt->explain)
@@ -208,10 +624,59 @@ int chidb_finalize(chidb_stmt *stmt)
     return chidb_stmt_free(stmt);
 }
 
+/* Parameter param of a statement that is not running, or NULL */
+static chidb_dbm_register_t *stmt_param(chidb_stmt *stmt, int param)
+{
+	if(stmt->pc != 0 || param < 1 || param > stmt->nParams)
+		return NULL;
+
+	return &stmt->params[param - 1];
+}
+
+int chidb_bind_int(chidb_stmt *stmt, int param, int value)
+{
+	chidb_dbm_register_t *r = stmt_param(stmt, param);
+
+	if(r == NULL)
+		return CHIDB_EMISUSE;
+	if(stmt->paramTypes[param - 1] != REG_INT32)
+		return CHIDB_EMISMATCH;
+
+	r->type = REG_INT32;
+	r->value.i = value;
+
+	return CHIDB_OK;
+}
+
+int chidb_bind_text(chidb_stmt *stmt, int param, const char *value)
+{
+	chidb_dbm_register_t *r = stmt_param(stmt, param);
+	char *s;
+
+	if(r == NULL)
+		return CHIDB_EMISUSE;
+	if(stmt->paramTypes[param - 1] != REG_STRING)
+		return CHIDB_EMISMATCH;
+	if((s = strdup(value)) == NULL)
+		return CHIDB_ENOMEM;
+
+	if(r->type == REG_STRING)
+		free(r->value.s);
+	r->type = REG_STRING;
+	r->value.s = s;
+
+	return CHIDB_OK;
+}
+
+int chidb_reset(chidb_stmt *stmt)
+{
+	return chidb_stmt_reset(stmt);
+}
+
 int chidb_column_count(chidb_stmt *stmt)
 {
 	if(stmt->explain)
-		return 6;
+		return 7;
 	else
 		return stmt->nCols;
 }
@@ -237,6 +702,8 @@ int chidb_column_type(chidb_stmt *stmt, int col)
 				return SQL_NULL;
 			else
 				return 2 * strlen(op->p4) + SQL_TEXT;
+		case 6:
+			return SQL_INTEGER_4BYTE;
 		default:
 			return SQL_NOTVALID;
 		}
@@ -289,6 +756,8 @@ const char *chidb_column_name(chidb_stmt* stmt, int col)
 			return "p3";
 		case 5:
 			return "p4";
+		case 6:
+			return "p5";
 		default:
 			return NULL;
 		}
@@ -322,6 +791,8 @@ int chidb_column_int(chidb_stmt *stmt, int col)
 			return op->p3;
 		case 5:
 			return 0; /* Undefined */
+		case 6:
+			return op->p5;
 		default:
 			return 0; /* Undefined */
 		}
@@ -370,6 +841,8 @@ const char *chidb_column_text(chidb_stmt *stmt, int col)
 			return NULL; /* Undefined */
 		case 5:
 			return op->p4;
+		case 6:
+			return NULL; /* Undefined */
 		default:
 			return 0; /* Undefined */
 		}
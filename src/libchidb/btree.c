@@ -50,10 +50,36 @@
 #include <chidb/log.h>
 #include "chidbInt.h"
 #include "btree.h"
+#include "memtable.h"
 #include "record.h"
 #include "pager.h"
 #include "util.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CHIDB_X86_SIMD
+#include <immintrin.h>
+#endif
+
+
+
+/* Number of bytes a cell takes up in the given node (not counting its
+ * entry in the cell offset array) */
+static uint16_t chidb_Btree_cellSize(BTreeNode *btn, BTreeCell *btc)
+{
+    switch (btn->type)
+    {
+    case PGTYPE_TABLE_INTERNAL:
+        return (btn->flags & PGFLAG_SUBTREE_COUNTS) ? TABLEINTCELL_SIZE_WITHCOUNT : TABLEINTCELL_SIZE;
+    case PGTYPE_TABLE_LEAF:
+        return TABLELEAFCELL_SIZE_WITHOUTDATA + btc->fields.tableLeaf.data_size;
+    case PGTYPE_INDEX_INTERNAL:
+        return INDEXINTCELL_SIZE;
+    case PGTYPE_INDEX_LEAF:
+        return INDEXLEAFCELL_SIZE + btc->fields.indexLeaf.data_size;
+    default:
+        return 0;
+    }
+}
 
 
 /* Check if a BTreeNode Full
@@ -69,25 +95,7 @@
 int if_BtreeNode_Full(BTreeNode *btn, BTreeCell *btc)
 {
     uint16_t space = btn->cells_offset - btn->free_offset;
-    uint16_t need_size;
-    switch (btn->type)
-    {
-    case PGTYPE_TABLE_INTERNAL:
-        need_size = TABLEINTCELL_SIZE;
-        break;
-    case PGTYPE_TABLE_LEAF:
-        need_size = TABLELEAFCELL_SIZE_WITHOUTDATA + btc->fields.tableLeaf.data_size;
-        break;
-    case PGTYPE_INDEX_INTERNAL:
-        need_size = INDEXINTCELL_SIZE;
-        break;
-    case PGTYPE_INDEX_LEAF:
-        need_size = INDEXLEAFCELL_SIZE;
-        break;
-    default:
-        need_size = 0;
-        break;
-    }
+    uint16_t need_size = chidb_Btree_cellSize(btn, btc);
 
     return (space < (need_size + 2)) ? 1 : 0;
 }
@@ -110,7 +118,12 @@ int get_tempBtreeNode(Btree *bt, BTreeNode **btn, uint8_t type)
     (*btn)->n_cells = 0;
     (*btn)->cells_offset = bt->pager->page_size;
     (*btn)->right_page = 0;
+    (*btn)->right_count = 0;
+    (*btn)->flags = 0;
+    (*btn)->prev_page = SIBLING_UNKNOWN;
+    (*btn)->next_page = SIBLING_UNKNOWN;
     (*btn)->celloffset_array = (*btn)->page->data;
+    (*btn)->cells = NULL;
     return CHIDB_OK;
 }
 
@@ -119,6 +132,7 @@ int get_tempBtreeNode(Btree *bt, BTreeNode **btn, uint8_t type)
  */
 int free_tempBtreeNode(BTreeNode *btn)
 {
+    free(btn->cells);
     free(btn->page->data);
     free(btn->page);
     free(btn);
@@ -220,6 +234,9 @@ int chidb_Btree_open(const char *filename, chidb *db, BTree **bt)
 
     (*bt)->db = db;
     (*bt)->pager = pager;
+    (*bt)->blooms = NULL;
+    (*bt)->wbuf = NULL;
+    (*bt)->epoch = 0;
     db->bt = *bt;
 
     struct stat f_att;
@@ -262,14 +279,16 @@ int chidb_Btree_open(const char *filename, chidb *db, BTree **bt)
         }
     }
 
-    return CHIDB_OK;
+    /* Rows logged by a process that died go to their B-Trees now */
+    return chidb_Memtable_open(*bt, filename);
 }
 
 
 /* Close a B-Tree file
  *
  * This function closes a database file, freeing any resource
- * used in memory, such as the pager.
+ * used in memory, such as the pager. Buffered rows are written to
+ * their B-Trees first (see chidb_Memtable_close).
  *
  * Parameters
  * - bt: B-Tree file to close
@@ -281,6 +300,8 @@ int chidb_Btree_open(const char *filename, chidb *db, BTree **bt)
 int chidb_Btree_close(BTree *bt)
 {
     /* Your code goes here */
+    chidb_Memtable_close(bt);
+    chidb_Btree_bloomFreeAll(bt);
     chidb_Pager_close(bt->pager);
     free(bt);
     return CHIDB_OK;
@@ -291,9 +312,10 @@ int chidb_Btree_close(BTree *bt)
  *
  * Reads a B-Tree node from a page in the disk. All the information regarding
  * the node is stored in a BTreeNode struct (see header file for more details
- * on this struct). *This is the only function that can allocate memory for
- * a BTreeNode struct*. Always use chidb_Btree_freeMemNode to free the memory
- * allocated for a BTreeNode (do not use free() directly on a BTreeNode variable)
+ * on this struct). *This function (or chidb_Btree_loadNode) is the only one
+ * that can allocate memory for a BTreeNode struct*. Always use
+ * chidb_Btree_freeMemNode to free the memory allocated for a BTreeNode (do
+ * not use free() directly on a BTreeNode variable)
  * Any changes made to a BTreeNode variable will not be effective in the database
  * until chidb_Btree_writeNode is called on that BTreeNode.
  *
@@ -311,24 +333,80 @@ int chidb_Btree_close(BTree *bt)
 int chidb_Btree_getNodeByPage(BTree *bt, npage_t npage, BTreeNode **btn)
 {
     /* Your code goes here */
+    *btn = NULL;
+    return chidb_Btree_loadNode(bt, npage, btn);
+}
+
+
+/* Fill in the fields of a BTreeNode from the header of its page */
+static void chidb_Btree_parseNode(BTree *bt, BTreeNode *btn)
+{
+    uint8_t *data = btn->page->data + (btn->page->npage == 1 ? 100 : 0);
+    btn->type = *data;
+    btn->free_offset = get2byte(data + 1);
+    btn->n_cells = get2byte(data + 3);
+    btn->cells_offset = get2byte(data + 5);
+    btn->right_page = (btn->type == PGTYPE_INDEX_INTERNAL || btn->type == PGTYPE_TABLE_INTERNAL) ? get4byte(data + 8) : 0;
+    btn->flags = data[PGHEADER_FLAGS_OFFSET];
+    if((btn->type == PGTYPE_INDEX_LEAF || btn->type == PGTYPE_TABLE_LEAF) &&
+       (btn->flags & PGFLAG_LEAF_SIBLINGS)) {
+        btn->prev_page = get4byte(btn->page->data + LEAFPG_PREVPG_OFFSET(bt->pager->page_size));
+        btn->next_page = get4byte(btn->page->data + LEAFPG_NEXTPG_OFFSET(bt->pager->page_size));
+    } else {
+        btn->prev_page = SIBLING_UNKNOWN;
+        btn->next_page = SIBLING_UNKNOWN;
+    }
+    btn->right_count = (btn->type == PGTYPE_TABLE_INTERNAL && (btn->flags & PGFLAG_SUBTREE_COUNTS)) ?
+                           get4byte(btn->page->data + INTPG_RIGHTCOUNT_OFFSET(bt->pager->page_size)) : 0;
+    btn->celloffset_array = data + ((btn->type == PGTYPE_INDEX_INTERNAL || btn->type == PGTYPE_TABLE_INTERNAL) ? 12 : 8);
+    btn->cells = NULL;
+}
+
+
+/* Loads a B-Tree node from disk, reusing an in-memory node
+ *
+ * Same as chidb_Btree_getNodeByPage if *btn is NULL. Otherwise, *btn must
+ * be a node returned by chidb_Btree_getNodeByPage (or by this function),
+ * and the page is read into its memory instead of allocating a new node;
+ * whatever node it held before is lost. Callers that keep reading nodes
+ * one after the other (like cursors do) save an allocation per node.
+ *
+ * Whatever happens, the caller still owns *btn afterwards, and must free
+ * it with chidb_Btree_freeMemNode unless it is NULL.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - npage: Page of node to load
+ * - btn: In/out parameter. Node to reuse, or NULL to allocate a new one
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EPAGENO: The provided page number is not valid
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_loadNode(BTree *bt, npage_t npage, BTreeNode **btn)
+{
     int rt;
 
-    *btn = (BTreeNode *)malloc(sizeof(BTreeNode));
     if(*btn == NULL) {
-        return CHIDB_ENOMEM;
+        BTreeNode *new_btn = (BTreeNode *)malloc(sizeof(BTreeNode));
+        if(new_btn == NULL) {
+            return CHIDB_ENOMEM;
+        }
+        if(rt = chidb_Pager_readPage(bt->pager, npage, &(new_btn->page))) {
+            free(new_btn);
+            return rt;
+        }
+        *btn = new_btn;
     }
-
-    if(rt = chidb_Pager_readPage(bt->pager, npage, &((*btn)->page))) {
-        return rt;
+    else {
+        free((*btn)->cells);
+        (*btn)->cells = NULL;
+        if(rt = chidb_Pager_readPageInto(bt->pager, npage, (*btn)->page)) { return rt; }
     }
 
-    uint8_t *data = (*btn)->page->data + (npage == 1 ? 100 : 0);
-    (*btn)->type = *data;
-    (*btn)->free_offset = get2byte(data + 1);
-    (*btn)->n_cells = get2byte(data + 3);
-    (*btn)->cells_offset = get2byte(data + 5);
-    (*btn)->right_page = ((*btn)->type == PGTYPE_INDEX_INTERNAL || (*btn)->type == PGTYPE_TABLE_INTERNAL) ? get4byte(data + 8) : 0;
-    (*btn)->celloffset_array = data + (((*btn)->type == PGTYPE_INDEX_INTERNAL || (*btn)->type == PGTYPE_TABLE_INTERNAL) ? 12 : 8);
+    chidb_Btree_parseNode(bt, *btn);
     return CHIDB_OK;
 }
 
@@ -353,11 +431,79 @@ int chidb_Btree_freeMemNode(BTree *bt, BTreeNode *btn)
     if(rt = chidb_Pager_releaseMemPage(bt->pager, btn->page)) {
         return rt;
     }
+    free(btn->cells);
     free(btn);
     return CHIDB_OK;
 }
 
 
+/* Loads a B-Tree node from disk without latching it
+ *
+ * Reads a B-Tree node like chidb_Btree_getNodeByPage, but instead of
+ * latching the page, checks that nobody modified it while it was being
+ * read (see chidb_Pager_readVersion). Readers that descend the tree this
+ * way must also check that the parent has not changed after reading the
+ * child, using the version returned here, and start over otherwise.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - npage: Page of node to load
+ * - btn: Out parameter. Used to return a pointer to newly creater BTreeNode
+ * - version: Out parameter. Version of the page that was read.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ERESTART: The page was modified while it was being read
+ * - CHIDB_EPAGENO: The provided page number is not valid
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_Btree_getNodeOptimistic(BTree *bt, npage_t npage, BTreeNode **btn, uint64_t *version)
+{
+    int rt;
+
+    *btn = NULL;
+    if((rt = chidb_Btree_loadNodeOptimistic(bt, npage, btn, version)) && *btn != NULL) {
+        chidb_Btree_freeMemNode(bt, *btn);
+    }
+    return rt;
+}
+
+
+/* Loads a B-Tree node from disk without latching it, reusing an in-memory
+ * node
+ *
+ * Same as chidb_Btree_getNodeOptimistic, but reuses *btn like
+ * chidb_Btree_loadNode does. The caller still owns *btn afterwards, even
+ * if the page was modified while it was being read.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - npage: Page of node to load
+ * - btn: In/out parameter. Node to reuse, or NULL to allocate a new one
+ * - version: Out parameter. Version of the page that was read.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ERESTART: The page was modified while it was being read
+ * - CHIDB_EPAGENO: The provided page number is not valid
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_Btree_loadNodeOptimistic(BTree *bt, npage_t npage, BTreeNode **btn, uint64_t *version)
+{
+    int rt, valid;
+
+    if(rt = chidb_Pager_readVersion(bt->pager, npage, version)) { return rt; }
+
+    rt = chidb_Btree_loadNode(bt, npage, btn);
+
+    /* If the page was modified, whatever went wrong does not matter */
+    if(valid = chidb_Pager_validate(bt->pager, npage, *version)) {
+        return valid;
+    }
+    return rt;
+}
+
+
 /* Create a new B-Tree node
  *
  * Allocates a new page in the file and initializes it as a B-Tree node.
@@ -477,12 +623,25 @@ int chidb_Btree_writeNode(BTree *bt, BTreeNode *btn)
     /* Your code goes here */
     int rt;
     uint8_t *p = btn->page->data + (btn->page->npage == 1 ? 100 : 0);
+
+    /* The header fields might have been changed directly in btn */
+    free(btn->cells);
+    btn->cells = NULL;
+
     *p = btn->type;
     put2byte(p + 0x01, btn->free_offset);
     put2byte(p + 0x03, btn->n_cells);
     put2byte(p + 0x05, btn->cells_offset);
+    *(p + PGHEADER_FLAGS_OFFSET) = btn->flags;
     if(btn->type == PGTYPE_INDEX_INTERNAL || btn->type == PGTYPE_TABLE_INTERNAL) {
         put4byte(p + 0x08, btn->right_page);
+        if(btn->flags & PGFLAG_SUBTREE_COUNTS) {
+            put4byte(btn->page->data + INTPG_RIGHTCOUNT_OFFSET(bt->pager->page_size), btn->right_count);
+        }
+    }
+    else if(btn->flags & PGFLAG_LEAF_SIBLINGS) {
+        put4byte(btn->page->data + LEAFPG_PREVPG_OFFSET(bt->pager->page_size), btn->prev_page);
+        put4byte(btn->page->data + LEAFPG_NEXTPG_OFFSET(bt->pager->page_size), btn->next_page);
     }
     if(rt = chidb_Pager_writePage(bt->pager, btn->page)) {
         return rt;
@@ -491,613 +650,2712 @@ int chidb_Btree_writeNode(BTree *bt, BTreeNode *btn)
 }
 
 
-/* Read the contents of a cell
+/* Set the sibling links of a leaf node
  *
- * Reads the contents of a cell from a BTreeNode and stores them in a BTreeCell.
- * This involves the following:
- *  1. Find out the offset of the requested cell.
- *  2. Read the cell from the in-memory page, and parse its
- *     contents (refer to The chidb File Format document for
- *     the format of cells).
+ * Leaf nodes can carry the page numbers of the previous and next leaf
+ * of the B-Tree, so that cursors can move from one leaf to the next one
+ * without going back to the parent node. The links are stored in a small
+ * trailer at the end of the page, which is reserved the first time this
+ * function is called on a node. Since the trailer is taken from the cell
+ * area, it can only be reserved while the node is still empty (i.e., on
+ * nodes that are being (re)built by a split).
+ *
+ * As with any other field of BTreeNode, the changes will be effective
+ * once the node is written with chidb_Btree_writeNode.
  *
  * Parameters
- * - btn: BTreeNode where cell is contained
- * - ncell: Cell number
- * - cell: BTreeCell where contents must be stored.
+ * - bt: B-Tree file
+ * - btn: Leaf BTreeNode
+ * - prev_page: Page of the previous leaf (or SIBLING_NONE/SIBLING_UNKNOWN)
+ * - next_page: Page of the next leaf (or SIBLING_NONE/SIBLING_UNKNOWN)
  *
  * Return
  * - CHIDB_OK: Operation successful
- * - CHIDB_ECELLNO: The provided cell number is invalid
+ * - CHIDB_EVALIDEARG: The node is not a leaf, or it is not empty and
+ *                     does not have room for the links yet.
  */
-int chidb_Btree_getCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell)
+int chidb_Btree_setSiblings(BTree *bt, BTreeNode *btn, npage_t prev_page, npage_t next_page)
 {
-    /* Your code goes here */
-    if(ncell < 0 || ncell > btn->n_cells) {
-        return CHIDB_ECELLNO;
+    if(btn->type != PGTYPE_INDEX_LEAF && btn->type != PGTYPE_TABLE_LEAF) {
+        return CHIDB_EVALIDEARG;
     }
 
-    uint8_t *cell_pos = btn->page->data + get2byte(btn->celloffset_array + 2 * ncell);
-
-    switch (btn->type)
-    {
-    case PGTYPE_TABLE_INTERNAL:
-        cell->type = PGTYPE_TABLE_INTERNAL;
-        cell->fields.tableInternal.child_page = get4byte(cell_pos + TABLEINTCELL_CHILD_OFFSET);
-        getVarint32(cell_pos + TABLEINTCELL_KEY_OFFSET, &(cell->key));
-        break;
-    case PGTYPE_TABLE_LEAF:
-        cell->type = PGTYPE_TABLE_LEAF;
-        getVarint32(cell_pos + TABLELEAFCELL_SIZE_OFFSET, &(cell->fields.tableLeaf.data_size));
-        cell->fields.tableLeaf.data = cell_pos + TABLELEAFCELL_DATA_OFFSET;
-        getVarint32(cell_pos + TABLELEAFCELL_KEY_OFFSET, &(cell->key));
-        break;
-    case PGTYPE_INDEX_INTERNAL:
-        cell->type = PGTYPE_INDEX_INTERNAL;
-        cell->key = get4byte(cell_pos + INDEXINTCELL_KEYIDX_OFFSET);
-        cell->fields.indexInternal.child_page = get4byte(cell_pos + INDEXINTCELL_CHILD_OFFSET);
-        cell->fields.indexInternal.keyPk = get4byte(cell_pos + INDEXINTCELL_KEYPK_OFFSET);
-        break;
-    case PGTYPE_INDEX_LEAF:
-        cell->type = PGTYPE_INDEX_LEAF;
-        cell->key = get4byte(cell_pos + INDEXLEAFCELL_KEYIDX_OFFSET);
-        cell->fields.indexLeaf.keyPk = get4byte(cell_pos + INDEXLEAFCELL_KEYPK_OFFSET);
-        break;
-    default:
-        break;
+    if(!(btn->flags & PGFLAG_LEAF_SIBLINGS)) {
+        if(btn->n_cells != 0 || btn->cells_offset != bt->pager->page_size) {
+            return CHIDB_EVALIDEARG;
+        }
+        btn->cells_offset -= LEAFPG_SIBLINGS_SIZE;
+        btn->flags |= PGFLAG_LEAF_SIBLINGS;
     }
+
+    btn->prev_page = prev_page;
+    btn->next_page = next_page;
     return CHIDB_OK;
 }
 
 
-/* Insert a new cell into a B-Tree node
- *
- * Inserts a new cell into a B-Tree node at a specified position ncell.
- * This involves the following:
- *  1. Add the cell at the top of the cell area. This involves "translating"
- *     the BTreeCell into the chidb format (refer to The chidb File Format
- *     document for the format of cells).
- *  2. Modify cells_offset in BTreeNode to reflect the growth in the cell area.
- *  3. Modify the cell offset array so that all values in positions >= ncell
- *     are shifted one position forward in the array. Then, set the value of
- *     position ncell to be the offset of the newly added cell.
+/* Make a table internal node keep subtree row counts
  *
- * This function assumes that there is enough space for this cell in this node.
+ * Counted nodes store, along with each cell, the number of rows under
+ * its child page, and the number of rows under the right page in a
+ * trailer at the end of the page (see PGFLAG_SUBTREE_COUNTS). As with
+ * chidb_Btree_setSiblings, the trailer is taken from the cell area, so a
+ * node can only become counted while it is still empty. The count of the
+ * right page starts at zero; set btn->right_count before writing the node.
  *
  * Parameters
- * - btn: BTreeNode to insert cell in
- * - ncell: Cell number
- * - cell: BTreeCell to insert.
+ * - bt: B-Tree file
+ * - btn: Table internal BTreeNode
  *
  * Return
  * - CHIDB_OK: Operation successful
- * - CHIDB_ECELLNO: The provided cell number is invalid
+ * - CHIDB_EVALIDEARG: The node is not a table internal node, or it is
+ *                     not empty and is not counted yet.
  */
-int chidb_Btree_insertCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell)
+int chidb_Btree_setCounted(BTree *bt, BTreeNode *btn)
 {
-    /* Your code goes here */
-    if(ncell < 0 || ncell > btn->n_cells) {
-        return CHIDB_ECELLNO;
+    if(btn->type != PGTYPE_TABLE_INTERNAL) {
+        return CHIDB_EVALIDEARG;
     }
 
-    uint16_t cell_offset;
-    uint8_t *p = btn->page->data;
-    uint8_t index_magic[4] = {0x0b, 0x03, 0x04, 0x04};
-    
-    switch(btn->type) 
-    {
-    case PGTYPE_TABLE_INTERNAL:
-        cell_offset = btn->cells_offset - TABLEINTCELL_SIZE;
-        put4byte(p + cell_offset + TABLEINTCELL_CHILD_OFFSET, cell->fields.tableInternal.child_page);
-        putVarint32(p + cell_offset + TABLEINTCELL_KEY_OFFSET, cell->key);
-        break;
-    case PGTYPE_TABLE_LEAF:
-        cell_offset = btn->cells_offset - TABLELEAFCELL_SIZE_WITHOUTDATA - cell->fields.tableLeaf.data_size;
-        putVarint32(p + cell_offset + TABLELEAFCELL_KEY_OFFSET, cell->key);
-        putVarint32(p + cell_offset + TABLELEAFCELL_SIZE_OFFSET, cell->fields.tableLeaf.data_size);
-        memcpy(p + cell_offset + TABLELEAFCELL_DATA_OFFSET, cell->fields.tableLeaf.data, cell->fields.tableLeaf.data_size);
-        break;
-    case PGTYPE_INDEX_INTERNAL:
-        cell_offset = btn->cells_offset - INDEXINTCELL_SIZE;
-        put4byte(p + cell_offset + INDEXINTCELL_CHILD_OFFSET, cell->fields.indexInternal.child_page);
-        put4byte(p + cell_offset + INDEXINTCELL_KEYPK_OFFSET, cell->fields.indexInternal.keyPk);
-        put4byte(p + cell_offset + INDEXINTCELL_KEYIDX_OFFSET, cell->key);
-        put4byte(p + cell_offset + 4, index_magic);
-        break;
-    case PGTYPE_INDEX_LEAF:
-        cell_offset = btn->cells_offset - INDEXLEAFCELL_SIZE;
-        put4byte(p + cell_offset, index_magic);
-        put4byte(p + cell_offset + INDEXLEAFCELL_KEYIDX_OFFSET, cell->key);
-        put4byte(p + cell_offset + INDEXLEAFCELL_KEYPK_OFFSET, cell->fields.indexLeaf.keyPk);
-        break;
-    default:
-        break;
+    if(!(btn->flags & PGFLAG_SUBTREE_COUNTS)) {
+        if(btn->n_cells != 0 || btn->cells_offset != bt->pager->page_size) {
+            return CHIDB_EVALIDEARG;
+        }
+        btn->cells_offset -= INTPG_COUNTS_SIZE;
+        btn->flags |= PGFLAG_SUBTREE_COUNTS;
+        btn->right_count = 0;
     }
-
-    btn->cells_offset = cell_offset;
-    memmove(btn->celloffset_array + 2 * ncell + 2, btn->celloffset_array + 2 * ncell, (btn->n_cells - ncell) * 2);
-    put2byte(btn->celloffset_array + 2 * ncell, cell_offset);
-    btn->n_cells++;
-    btn->free_offset += 2;
-
     return CHIDB_OK;
 }
 
-/* Find an entry in a table B-Tree
+
+/* Decode the cells of a B-Tree node
  *
- * Finds the data associated for a given key in a table B-Tree
+ * Parses every cell of a BTreeNode and stores the result in btn->cells
+ * (see the BTreeNodeCells struct in the header file). All the arrays are
+ * allocated in a single block, so the whole decoded node can be freed
+ * with a single call to free().
+ *
+ * This function does nothing if the node has already been decoded and has
+ * not been modified since then. chidb_Btree_insertCell and
+ * chidb_Btree_writeNode discard the decoded cells.
  *
  * Parameters
- * - bt: B-Tree file
- * - nroot: Page number of the root node of the B-Tree we want search in
- * - key: Entry key
- * - data: Out-parameter where a copy of the data must be stored
- * - size: Out-parameter where the number of bytes of data must be stored
+ * - btn: BTreeNode to decode
  *
  * Return
  * - CHIDB_OK: Operation successful
- * - CHIDB_ENOTFOUND: No entry with the given key way found
  * - CHIDB_ENOMEM: Could not allocate memory
- * - CHIDB_EIO: An I/O error has occurred when accessing the file
  */
-int chidb_Btree_find(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t **data, uint16_t *size)
+int chidb_Btree_decodeNode(BTreeNode *btn)
 {
-    /* Your code goes here */
-    BTreeCell cell;
-    BTreeNode *btn;
+    BTreeNodeCells *cells;
+    bool internal = (btn->type == PGTYPE_TABLE_INTERNAL || btn->type == PGTYPE_INDEX_INTERNAL);
+    bool index = (btn->type == PGTYPE_INDEX_INTERNAL || btn->type == PGTYPE_INDEX_LEAF);
+    bool leaf = (btn->type == PGTYPE_TABLE_LEAF || btn->type == PGTYPE_INDEX_LEAF);
+    bool counted = (btn->type == PGTYPE_TABLE_INTERNAL && (btn->flags & PGFLAG_SUBTREE_COUNTS));
+    ncell_t n = btn->n_cells;
+
+    if(btn->cells != NULL) {
+        if(btn->cells->n_cells == n) {
+            return CHIDB_OK;
+        }
+        free(btn->cells);
+        btn->cells = NULL;
+    }
 
-    int rt;
+    size_t size = sizeof(BTreeNodeCells) + n * sizeof(chidb_key_t);
+    if(internal)   size += n * sizeof(npage_t);
+    if(counted)    size += n * sizeof(uint32_t);
+    if(index)      size += n * sizeof(chidb_key_t);
+    if(leaf)       size += 2 * n * sizeof(uint16_t);
 
-    if(rt = chidb_Btree_getNodeByPage(bt, nroot, &btn)) {
-        return rt;
+    if(!(cells = malloc(size))) {
+        return CHIDB_ENOMEM;
     }
 
-    if(btn->type == PGTYPE_TABLE_INTERNAL) {
-        int i;
-        for(i = 0; i < btn->n_cells; i++) {
-            if(rt = chidb_Btree_getCell(btn, i, &cell)) {
-                if(rt = chidb_Btree_freeMemNode(bt, btn)) {
-                    return rt;
-                }
-                return rt;
-            }
-
-            if(cell.key >= key)
-                break;
-        }
-        if(i == btn->n_cells) {
-            if(rt = chidb_Btree_freeMemNode(bt, btn)) {
-                return rt;
-            }
-            return chidb_Btree_find(bt, btn->right_page, key, data, size);
-        }
-        else {
-            if(rt = chidb_Btree_freeMemNode(bt, btn)) {
-                return rt;
+    uint8_t *p = (uint8_t *) (cells + 1);
+    cells->n_cells = n;
+    cells->keys = (chidb_key_t *) p;
+    p += n * sizeof(chidb_key_t);
+    cells->child_pages = internal ? (npage_t *) p : NULL;
+    p += internal ? n * sizeof(npage_t) : 0;
+    cells->counts = counted ? (uint32_t *) p : NULL;
+    p += counted ? n * sizeof(uint32_t) : 0;
+    cells->keyPks = index ? (chidb_key_t *) p : NULL;
+    p += index ? n * sizeof(chidb_key_t) : 0;
+    cells->data_offsets = leaf ? (uint16_t *) p : NULL;
+    p += leaf ? n * sizeof(uint16_t) : 0;
+    cells->data_sizes = leaf ? (uint16_t *) p : NULL;
+
+    for(ncell_t i = 0; i < n; i++) {
+        uint16_t offset = get2byte(btn->celloffset_array + 2 * i);
+        uint8_t *cell_pos = btn->page->data + offset;
+        uint32_t data_size;
+
+        switch (btn->type)
+        {
+        case PGTYPE_TABLE_INTERNAL:
+            cells->child_pages[i] = get4byte(cell_pos + TABLEINTCELL_CHILD_OFFSET);
+            getVarint32(cell_pos + TABLEINTCELL_KEY_OFFSET, &(cells->keys[i]));
+            if(counted) {
+                cells->counts[i] = get4byte(cell_pos + TABLEINTCELL_COUNT_OFFSET);
             }
-            return chidb_Btree_find(bt, cell.fields.tableInternal.child_page, key, data, size);
+            break;
+        case PGTYPE_TABLE_LEAF:
+            getVarint32(cell_pos + TABLELEAFCELL_SIZE_OFFSET, &data_size);
+            getVarint32(cell_pos + TABLELEAFCELL_KEY_OFFSET, &(cells->keys[i]));
+            cells->data_sizes[i] = data_size;
+            cells->data_offsets[i] = offset + TABLELEAFCELL_DATA_OFFSET;
+            break;
+        case PGTYPE_INDEX_INTERNAL:
+            cells->keys[i] = get4byte(cell_pos + INDEXINTCELL_KEYIDX_OFFSET);
+            cells->child_pages[i] = get4byte(cell_pos + INDEXINTCELL_CHILD_OFFSET);
+            cells->keyPks[i] = get4byte(cell_pos + INDEXINTCELL_KEYPK_OFFSET);
+            break;
+        case PGTYPE_INDEX_LEAF:
+            cells->keys[i] = get4byte(cell_pos + INDEXLEAFCELL_KEYIDX_OFFSET);
+            cells->keyPks[i] = get4byte(cell_pos + INDEXLEAFCELL_KEYPK_OFFSET);
+            cells->data_sizes[i] = cell_pos[INDEXLEAFCELL_SIZE_OFFSET] == INDEXLEAFCELL_DATA_MARKER ?
+                                       get2byte(cell_pos + INDEXLEAFCELL_DATASIZE_OFFSET) : 0;
+            cells->data_offsets[i] = offset + INDEXLEAFCELL_DATA_OFFSET;
+            break;
+        default:
+            cells->keys[i] = 0;
+            break;
         }
     }
-    else {
-        int i;
-        for(i = 0; i < btn->n_cells; i++) {
-            if(rt = chidb_Btree_getCell(btn, i, &cell)) {
-                if(rt = chidb_Btree_freeMemNode(bt, btn)) {
-                    return rt;
-                }
-                return rt;
-            }
 
-            if(cell.key == key)
-                break;
-        }
-        if(i == btn->n_cells) {
-            if(rt = chidb_Btree_freeMemNode(bt, btn)) {
-                return rt;
-            }
-            return CHIDB_ENOTFOUND;
+    btn->cells = cells;
+    return CHIDB_OK;
+}
+
+
+/* Lower-bound search over an array of keys
+ *
+ * These functions return the position of the first key in keys[0..n) that
+ * is greater than or equal to key (or n, if there is no such key). The keys
+ * must be sorted. There is a scalar version, and (on x86) two vectorized
+ * versions that compare 8 (AVX2) or 4 (SSE2) keys per instruction. The
+ * vectorized versions first narrow down the search with a binary search,
+ * and then scan the remaining window; since the keys are sorted, the keys
+ * smaller than the searched key are always a prefix of each vector.
+ *
+ * The version to use is chosen the first time a node is searched, according
+ * to what the CPU supports (see chidb_Btree_lowerBound).
+ */
+#define LOWERBOUND_WINDOW (64)
+
+static ncell_t lowerBound_scalar(const chidb_key_t *keys, ncell_t n, chidb_key_t key)
+{
+    ncell_t lo = 0, hi = n;
+    while(lo < hi) {
+        ncell_t mid = lo + (hi - lo) / 2;
+        if(keys[mid] < key) {
+            lo = mid + 1;
         } else {
-            *size = cell.fields.tableLeaf.data_size;
-            *data = malloc(*size);
-            if(*data == NULL) {
-                if(rt = chidb_Btree_freeMemNode(bt, btn)) {
-                    return rt;
-                }
-            }
-            memcpy(*data, cell.fields.tableLeaf.data, *size);
+            hi = mid;
         }
     }
-    if(rt = chidb_Btree_freeMemNode(bt, btn)) {
-        return rt;
-    }
-    return CHIDB_OK;
+    return lo;
 }
 
+#ifdef CHIDB_X86_SIMD
+/* SSE/AVX2 only have signed 32-bit comparisons, so both sides are biased
+ * by 2^31 before comparing them */
+#define SIMD_KEY_BIAS ((int) 0x80000000)
 
+__attribute__((target("avx2")))
+static ncell_t lowerBound_avx2(const chidb_key_t *keys, ncell_t n, chidb_key_t key)
+{
+    ncell_t lo = 0, hi = n;
+    while(hi - lo > LOWERBOUND_WINDOW) {
+        ncell_t mid = lo + (hi - lo) / 2;
+        if(keys[mid] < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
 
-/* Insert an entry into a table B-Tree
- *
- * This is a convenience function that wraps around chidb_Btree_insert.
+    const __m256i bias = _mm256_set1_epi32(SIMD_KEY_BIAS);
+    const __m256i k = _mm256_xor_si256(_mm256_set1_epi32((int) key), bias);
+    for(; lo + 8 <= hi; lo += 8) {
+        __m256i v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *) (keys + lo)), bias);
+        unsigned int lt = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(k, v)));
+        if(lt != 0xFF) {
+            return lo + __builtin_ctz(~lt);
+        }
+    }
+    for(; lo < hi && keys[lo] < key; lo++);
+    return lo;
+}
+
+__attribute__((target("sse2")))
+static ncell_t lowerBound_sse2(const chidb_key_t *keys, ncell_t n, chidb_key_t key)
+{
+    ncell_t lo = 0, hi = n;
+    while(hi - lo > LOWERBOUND_WINDOW) {
+        ncell_t mid = lo + (hi - lo) / 2;
+        if(keys[mid] < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    const __m128i bias = _mm_set1_epi32(SIMD_KEY_BIAS);
+    const __m128i k = _mm_xor_si128(_mm_set1_epi32((int) key), bias);
+    for(; lo + 4 <= hi; lo += 4) {
+        __m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i *) (keys + lo)), bias);
+        unsigned int lt = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(k, v)));
+        if(lt != 0xF) {
+            return lo + __builtin_ctz(~lt);
+        }
+    }
+    for(; lo < hi && keys[lo] < key; lo++);
+    return lo;
+}
+#endif
+
+typedef ncell_t (*lowerBound_fn)(const chidb_key_t *keys, ncell_t n, chidb_key_t key);
+
+static lowerBound_fn chidb_Btree_lowerBound(void)
+{
+    /* Several threads may race to set this, but they all pick the same */
+    static lowerBound_fn lower_bound = NULL;
+    lowerBound_fn cached = __atomic_load_n(&lower_bound, __ATOMIC_RELAXED);
+
+    if(cached == NULL) {
+        lowerBound_fn fn = lowerBound_scalar;
+#ifdef CHIDB_X86_SIMD
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx2")) {
+            fn = lowerBound_avx2;
+        } else if(__builtin_cpu_supports("sse2")) {
+            fn = lowerBound_sse2;
+        }
+#endif
+        __atomic_store_n(&lower_bound, fn, __ATOMIC_RELAXED);
+        cached = fn;
+    }
+    return cached;
+}
+
+
+/* Search for a key in a B-Tree node
+ *
+ * Finds the first cell in a BTreeNode whose key is greater than or equal to
+ * a given key. Since the cells of a node are sorted by key, this is the
+ * cell where the key is (or would have to be inserted), or, in an internal
+ * node, the cell that points to the child that may contain the key.
+ * The search is done on the decoded keys of the node, using the fastest
+ * lower-bound search supported by the CPU.
+ *
+ * Parameters
+ * - btn: BTreeNode to search in
+ * - key: Key to search for
+ * - ncell: Out parameter. Cell number of the first cell with a key greater
+ *          than or equal to key, or btn->n_cells if there is no such cell.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_Btree_searchNode(BTreeNode *btn, chidb_key_t key, ncell_t *ncell)
+{
+    int rt;
+    if(rt = chidb_Btree_decodeNode(btn)) {
+        return rt;
+    }
+
+    *ncell = chidb_Btree_lowerBound()(btn->cells->keys, btn->n_cells, key);
+    return CHIDB_OK;
+}
+
+
+/* Search for an entry in a B-Tree node
+ *
+ * An index can have several entries with the same KeyIdx (one for each
+ * row with that value), so the entries of an index B-Tree are sorted by
+ * (KeyIdx, KeyPk). This function finds the first cell of a BTreeNode whose
+ * (key, keyPk) is greater than or equal to a given one: the key is searched
+ * as in chidb_Btree_searchNode, and then the cells with that key are
+ * searched by keyPk. In a table node, keyPk is ignored.
+ *
+ * Parameters
+ * - btn: BTreeNode to search in
+ * - key: Key (or KeyIdx) to search for
+ * - keyPk: KeyPk to search for
+ * - ncell: Out parameter. Cell number of the first cell with a (key, keyPk)
+ *          greater than or equal to the given one, or btn->n_cells if there
+ *          is no such cell.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_Btree_searchNodePk(BTreeNode *btn, chidb_key_t key, chidb_key_t keyPk, ncell_t *ncell)
+{
+    int rt;
+    if(rt = chidb_Btree_searchNode(btn, key, ncell)) {
+        return rt;
+    }
+    if(btn->cells->keyPks == NULL) {
+        return CHIDB_OK;
+    }
+
+    /* No key from *ncell on is lower than key, so only the cells with an
+     * equal key and a lower keyPk come before the entry */
+    const chidb_key_t *keys = btn->cells->keys, *keyPks = btn->cells->keyPks;
+    ncell_t lo = *ncell, hi = btn->n_cells;
+    while(lo < hi) {
+        ncell_t mid = lo + (hi - lo) / 2;
+        if(keys[mid] == key && keyPks[mid] < keyPk) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    *ncell = lo;
+    return CHIDB_OK;
+}
+
+
+/* Epoch of a B-Tree file
+ *
+ * The epoch goes up every time cells move from one page to another (when
+ * a node is split, or when the whole file is rewritten by a vacuum), and
+ * only then: inserting a cell into a node that has room for it leaves the
+ * epoch alone. A reader that got the epoch before reading a path from the
+ * root down to a leaf knows, as long as the epoch has not changed, that
+ * every key it saw is still on the same page, and that only the leaf needs
+ * to be read again to see the cells inserted since (see
+ * chidb_dbm_cursor_revalidate).
+ *
+ * Parameters
+ * - bt: B-Tree file
+ *
+ * Return
+ * - The current epoch
+ */
+uint64_t chidb_Btree_epoch(BTree *bt)
+{
+    return __atomic_load_n(&bt->epoch, __ATOMIC_ACQUIRE);
+}
+
+/* Start a new epoch (see chidb_Btree_epoch), once the pages of a change to
+ * the shape of a B-Tree have been written */
+void chidb_Btree_bumpEpoch(BTree *bt)
+{
+    __atomic_add_fetch(&bt->epoch, 1, __ATOMIC_RELEASE);
+}
+
+
+/* KeyPk of an index cell, or 0 for a table cell, which only has a key.
+ * Cells are ordered by (key, keyPk) (see chidb_Btree_searchNodePk). */
+chidb_key_t chidb_Btree_cellKeyPk(BTreeCell *btc)
+{
+    switch(btc->type)
+    {
+    case PGTYPE_INDEX_INTERNAL:
+        return btc->fields.indexInternal.keyPk;
+    case PGTYPE_INDEX_LEAF:
+        return btc->fields.indexLeaf.keyPk;
+    default:
+        return 0;
+    }
+}
+
+/* Key of a text value in an index
+ *
+ * Index entries have a 32-bit KeyIdx, so a text value is indexed by its
+ * first four bytes, packed big-endian (and padded with zeros if the text
+ * is shorter). The keys of two texts are in the same order as the texts
+ * themselves, but texts with the same first four bytes share a key, so
+ * the rows found through the key must be checked against the whole text.
+ *
+ * Parameters
+ * - text: NUL-terminated text
+ *
+ * Return
+ * - The KeyIdx of the text
+ */
+chidb_key_t chidb_Btree_textKey(const char *text)
+{
+    chidb_key_t key = 0;
+
+    for(int i = 0; i < 4; i++) {
+        key <<= 8;
+        if(*text) {
+            key |= (uint8_t) *text++;
+        }
+    }
+    return key;
+}
+
+/* Compare two cells by (key, keyPk) */
+static int chidb_Btree_cellCmp(BTreeCell *a, BTreeCell *b)
+{
+    chidb_key_t pk_a = chidb_Btree_cellKeyPk(a), pk_b = chidb_Btree_cellKeyPk(b);
+
+    if(a->key != b->key) {
+        return a->key < b->key ? -1 : 1;
+    }
+    return pk_a < pk_b ? -1 : pk_a > pk_b;
+}
+
+
+/* Read the contents of a cell
+ *
+ * Reads the contents of a cell from a BTreeNode and stores them in a BTreeCell.
+ * This involves the following:
+ *  1. Make sure the cells of the node have been decoded (the first call
+ *     on a node parses the cell offset array and every cell, and the
+ *     following calls reuse the result; see chidb_Btree_decodeNode).
+ *  2. Copy the decoded fields of the requested cell into the BTreeCell
+ *     (refer to The chidb File Format document for the format of cells).
+ *
+ * Parameters
+ * - btn: BTreeNode where cell is contained
+ * - ncell: Cell number
+ * - cell: BTreeCell where contents must be stored.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECELLNO: The provided cell number is invalid
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_Btree_getCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell)
+{
+    /* Your code goes here */
+    int rt;
+    if(ncell < 0 || ncell >= btn->n_cells) {
+        return CHIDB_ECELLNO;
+    }
+
+    if(rt = chidb_Btree_decodeNode(btn)) {
+        return rt;
+    }
+
+    BTreeNodeCells *cells = btn->cells;
+    cell->type = btn->type;
+    cell->key = cells->keys[ncell];
+
+    switch (btn->type)
+    {
+    case PGTYPE_TABLE_INTERNAL:
+        cell->fields.tableInternal.child_page = cells->child_pages[ncell];
+        cell->fields.tableInternal.count = cells->counts ? cells->counts[ncell] : 0;
+        break;
+    case PGTYPE_TABLE_LEAF:
+        cell->fields.tableLeaf.data_size = cells->data_sizes[ncell];
+        cell->fields.tableLeaf.data = btn->page->data + cells->data_offsets[ncell];
+        break;
+    case PGTYPE_INDEX_INTERNAL:
+        cell->fields.indexInternal.child_page = cells->child_pages[ncell];
+        cell->fields.indexInternal.keyPk = cells->keyPks[ncell];
+        break;
+    case PGTYPE_INDEX_LEAF:
+        cell->fields.indexLeaf.keyPk = cells->keyPks[ncell];
+        cell->fields.indexLeaf.data_size = cells->data_sizes[ncell];
+        cell->fields.indexLeaf.data = btn->page->data + cells->data_offsets[ncell];
+        break;
+    default:
+        break;
+    }
+    return CHIDB_OK;
+}
+
+
+/* Insert a new cell into a B-Tree node
+ *
+ * Inserts a new cell into a B-Tree node at a specified position ncell.
+ * This involves the following:
+ *  1. Add the cell at the top of the cell area. This involves "translating"
+ *     the BTreeCell into the chidb format (refer to The chidb File Format
+ *     document for the format of cells).
+ *  2. Modify cells_offset in BTreeNode to reflect the growth in the cell area.
+ *  3. Modify the cell offset array so that all values in positions >= ncell
+ *     are shifted one position forward in the array. Then, set the value of
+ *     position ncell to be the offset of the newly added cell.
+ *
+ * This function assumes that there is enough space for this cell in this node.
+ *
+ * Parameters
+ * - btn: BTreeNode to insert cell in
+ * - ncell: Cell number
+ * - cell: BTreeCell to insert.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECELLNO: The provided cell number is invalid
+ */
+int chidb_Btree_insertCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell)
+{
+    /* Your code goes here */
+    if(ncell < 0 || ncell > btn->n_cells) {
+        return CHIDB_ECELLNO;
+    }
+
+    uint16_t cell_offset;
+    uint8_t *p = btn->page->data;
+    uint8_t index_magic[4] = {0x0b, 0x03, 0x04, 0x04};
+    
+    switch(btn->type) 
+    {
+    case PGTYPE_TABLE_INTERNAL:
+        if(btn->flags & PGFLAG_SUBTREE_COUNTS) {
+            cell_offset = btn->cells_offset - TABLEINTCELL_SIZE_WITHCOUNT;
+            put4byte(p + cell_offset + TABLEINTCELL_COUNT_OFFSET, cell->fields.tableInternal.count);
+        }
+        else {
+            cell_offset = btn->cells_offset - TABLEINTCELL_SIZE;
+        }
+        put4byte(p + cell_offset + TABLEINTCELL_CHILD_OFFSET, cell->fields.tableInternal.child_page);
+        putVarint32(p + cell_offset + TABLEINTCELL_KEY_OFFSET, cell->key);
+        break;
+    case PGTYPE_TABLE_LEAF:
+        cell_offset = btn->cells_offset - TABLELEAFCELL_SIZE_WITHOUTDATA - cell->fields.tableLeaf.data_size;
+        putVarint32(p + cell_offset + TABLELEAFCELL_KEY_OFFSET, cell->key);
+        putVarint32(p + cell_offset + TABLELEAFCELL_SIZE_OFFSET, cell->fields.tableLeaf.data_size);
+        memcpy(p + cell_offset + TABLELEAFCELL_DATA_OFFSET, cell->fields.tableLeaf.data, cell->fields.tableLeaf.data_size);
+        break;
+    case PGTYPE_INDEX_INTERNAL:
+        cell_offset = btn->cells_offset - INDEXINTCELL_SIZE;
+        put4byte(p + cell_offset + INDEXINTCELL_CHILD_OFFSET, cell->fields.indexInternal.child_page);
+        put4byte(p + cell_offset + INDEXINTCELL_KEYPK_OFFSET, cell->fields.indexInternal.keyPk);
+        put4byte(p + cell_offset + INDEXINTCELL_KEYIDX_OFFSET, cell->key);
+        memcpy(p + cell_offset + 4, index_magic, 4);
+        break;
+    case PGTYPE_INDEX_LEAF:
+        cell_offset = btn->cells_offset - INDEXLEAFCELL_SIZE - cell->fields.indexLeaf.data_size;
+        memcpy(p + cell_offset, index_magic, 4);
+        put4byte(p + cell_offset + INDEXLEAFCELL_KEYIDX_OFFSET, cell->key);
+        put4byte(p + cell_offset + INDEXLEAFCELL_KEYPK_OFFSET, cell->fields.indexLeaf.keyPk);
+        if(cell->fields.indexLeaf.data_size > 0) {
+            p[cell_offset + INDEXLEAFCELL_SIZE_OFFSET] = INDEXLEAFCELL_DATA_MARKER;
+            put2byte(p + cell_offset + INDEXLEAFCELL_DATASIZE_OFFSET, cell->fields.indexLeaf.data_size);
+            memcpy(p + cell_offset + INDEXLEAFCELL_DATA_OFFSET, cell->fields.indexLeaf.data, cell->fields.indexLeaf.data_size);
+        }
+        break;
+    default:
+        break;
+    }
+
+    free(btn->cells);
+    btn->cells = NULL;
+
+    btn->cells_offset = cell_offset;
+    memmove(btn->celloffset_array + 2 * ncell + 2, btn->celloffset_array + 2 * ncell, (btn->n_cells - ncell) * 2);
+    put2byte(btn->celloffset_array + 2 * ncell, cell_offset);
+    btn->n_cells++;
+    btn->free_offset += 2;
+
+    return CHIDB_OK;
+}
+
+static int chidb_Btree_findOptimistic(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t **data, uint16_t *size);
+static int chidb_Btree_findLatched(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t **data, uint16_t *size);
+
+/* Find an entry in a table B-Tree
+ *
+ * Finds the data associated for a given key in a table B-Tree
+ *
+ * This function can be called concurrently with other lookups and
+ * insertions on the same B-Tree. It first descends the tree without
+ * latching any node, validating each node against its version (see
+ * chidb_Btree_getNodeOptimistic), and starts over if one of them is
+ * modified. After BTREE_OPTIMISTIC_RETRIES failed attempts, it descends
+ * using latch crabbing instead: the child is latched (in shared mode)
+ * before the latch on its parent is released, so a node can never be split
+ * between the moment we choose it and the moment we read it.
+ *
+ * If the table is buffered, its memtable is searched first (see
+ * chidb_Memtable_seek). If the B-Tree has a Bloom filter that rules the
+ * key out, no page is read at all.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree we want search in
+ * - key: Entry key
+ * - data: Out-parameter where a copy of the data must be stored
+ * - size: Out-parameter where the number of bytes of data must be stored
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: No entry with the given key way found
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_find(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t **data, uint16_t *size)
+{
+    /* Your code goes here */
+    int rt;
+
+    if((rt = chidb_Memtable_seek(bt, nroot, key, MEMTABLE_EQ, NULL, data, size)) != CHIDB_ENOTFOUND) {
+        return rt;
+    }
+
+    if(!chidb_Btree_bloomMayContain(bt, nroot, key)) {
+        return CHIDB_ENOTFOUND;
+    }
+
+    return chidb_Btree_findInTree(bt, nroot, key, data, size);
+}
+
+/* Same as chidb_Btree_find, but only searches the B-Tree itself, not its
+ * memtable, and does not check its Bloom filter */
+int chidb_Btree_findInTree(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t **data, uint16_t *size)
+{
+    int rt;
+
+    for(int i = 0; i < BTREE_OPTIMISTIC_RETRIES; i++) {
+        if((rt = chidb_Btree_findOptimistic(bt, nroot, key, data, size)) != CHIDB_ERESTART) {
+            return rt;
+        }
+    }
+    return chidb_Btree_findLatched(bt, nroot, key, data, size);
+}
+
+/* Copy the data of the cell with the given key out of a table leaf */
+static int chidb_Btree_findInLeaf(BTreeNode *btn, ncell_t i, chidb_key_t key, uint8_t **data, uint16_t *size)
+{
+    BTreeCell cell;
+    int rt;
+
+    if(i == btn->n_cells || btn->cells->keys[i] != key) {
+        return CHIDB_ENOTFOUND;
+    }
+
+    if(rt = chidb_Btree_getCell(btn, i, &cell)) { return rt; }
+    *size = cell.fields.tableLeaf.data_size;
+    *data = malloc(*size);
+    if(*data == NULL) {
+        return CHIDB_ENOMEM;
+    }
+    memcpy(*data, cell.fields.tableLeaf.data, *size);
+    return CHIDB_OK;
+}
+
+/* chidb_Btree_find without latches. Returns CHIDB_ERESTART if a node was
+ * modified during the descent. */
+static int chidb_Btree_findOptimistic(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t **data, uint16_t *size)
+{
+    BTreeNode *btn, *child;
+    ncell_t i;
+    npage_t npage = nroot, nchild;
+    uint64_t version, child_version;
+
+    int rt;
+
+    if(rt = chidb_Btree_getNodeOptimistic(bt, npage, &btn, &version)) { return rt; }
+
+    for(;;) {
+        if(rt = chidb_Btree_searchNode(btn, key, &i)) {
+            chidb_Btree_freeMemNode(bt, btn);
+            return rt;
+        }
+
+        if(btn->type != PGTYPE_TABLE_INTERNAL) {
+            break;
+        }
+
+        nchild = (i == btn->n_cells) ? btn->right_page : btn->cells->child_pages[i];
+        chidb_Btree_freeMemNode(bt, btn);
+
+        /* The child must be read before checking that the parent still
+         * points to it */
+        rt = chidb_Btree_getNodeOptimistic(bt, nchild, &child, &child_version);
+        if(!rt && (rt = chidb_Pager_validate(bt->pager, npage, version))) {
+            chidb_Btree_freeMemNode(bt, child);
+        }
+        if(rt) {
+            return rt;
+        }
+        btn = child;
+        npage = nchild;
+        version = child_version;
+    }
+
+    rt = chidb_Btree_findInLeaf(btn, i, key, data, size);
+    chidb_Btree_freeMemNode(bt, btn);
+    return rt;
+}
+
+/* chidb_Btree_find with latch crabbing */
+static int chidb_Btree_findLatched(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t **data, uint16_t *size)
+{
+    BTreeNode *btn;
+    ncell_t i;
+    npage_t npage = nroot, child;
+
+    int rt;
+
+    if(rt = chidb_Pager_latch(bt->pager, npage, LATCH_SHARED)) {
+        return rt;
+    }
+
+    for(;;) {
+        if(rt = chidb_Btree_getNodeByPage(bt, npage, &btn)) {
+            chidb_Pager_unlatch(bt->pager, npage);
+            return rt;
+        }
+
+        if(rt = chidb_Btree_searchNode(btn, key, &i)) {
+            break;
+        }
+
+        if(btn->type != PGTYPE_TABLE_INTERNAL) {
+            break;
+        }
+
+        child = (i == btn->n_cells) ? btn->right_page : btn->cells->child_pages[i];
+        chidb_Btree_freeMemNode(bt, btn);
+
+        if(rt = chidb_Pager_latch(bt->pager, child, LATCH_SHARED)) {
+            chidb_Pager_unlatch(bt->pager, npage);
+            return rt;
+        }
+        chidb_Pager_unlatch(bt->pager, npage);
+        npage = child;
+    }
+
+    if(rt == CHIDB_OK) {
+        rt = chidb_Btree_findInLeaf(btn, i, key, data, size);
+    }
+
+    chidb_Btree_freeMemNode(bt, btn);
+    chidb_Pager_unlatch(bt->pager, npage);
+    return rt;
+}
+
+
+
+/* Insert an entry into a table B-Tree
+ *
+ * This is a convenience function that wraps around chidb_Btree_insert.
  * It takes a key and data, and creates a BTreeCell that can be passed
  * along to chidb_Btree_insert.
  *
  * Parameters
  * - bt: B-Tree file
- * - nroot: Page number of the root node of the B-Tree we want to insert
- *          this entry in.
- * - key: Entry key
- * - data: Pointer to data we want to insert
- * - size: Number of bytes of data
+ * - nroot: Page number of the root node of the B-Tree we want to insert
+ *          this entry in.
+ * - key: Entry key
+ * - data: Pointer to data we want to insert
+ * - size: Number of bytes of data
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EDUPLICATE: An entry with that key already exists
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_insertInTable(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t *data, uint16_t size)
+{
+    /* Your code goes here */
+    BTreeCell cell;
+
+    cell.type = PGTYPE_TABLE_LEAF;
+    cell.key = key;
+    cell.fields.tableLeaf.data_size = size;
+    cell.fields.tableLeaf.data = data;
+
+    return chidb_Btree_insert(bt, nroot, &cell);
+}
+
+
+/* Insert an entry into an index B-Tree
+ *
+ * This is a convenience function that wraps around chidb_Btree_insert.
+ * It takes a KeyIdx and a KeyPk, and creates a BTreeCell that can be passed
+ * along to chidb_Btree_insert.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree we want to insert
+ *          this entry in.
+ * - keyIdx: See The chidb File Format.
+ * - keyPk: See The chidb File Format.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EDUPLICATE: The (keyIdx, keyPk) entry already exists (other
+ *                     entries with the same keyIdx are allowed)
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_insertInIndex(BTree *bt, npage_t nroot, chidb_key_t keyIdx, chidb_key_t keyPk)
+{
+    /* Your code goes here */
+    BTreeCell cell;
+
+    cell.type = PGTYPE_INDEX_LEAF;
+    cell.key = keyIdx;
+    cell.fields.indexLeaf.keyPk = keyPk;
+    cell.fields.indexLeaf.data_size = 0;
+
+    return chidb_Btree_insert(bt, nroot, &cell);
+}
+
+
+static int chidb_Btree_insertRoot(BTree *bt, npage_t nroot, BTreeCell *btc);
+static int chidb_Btree_recount(BTree *bt, npage_t nroot, BTreeCell *btc);
+static void chidb_Btree_bloomAdd(BTree *bt, npage_t nroot, chidb_key_t key);
+static int chidb_Btree_insertBatchNonFull(BTree *bt, npage_t npage, BTreeCell *cells, size_t n_cells, size_t *done);
+static int chidb_Btree_splitNode(BTree *bt, npage_t npage_parent, npage_t npage_child, ncell_t parent_ncell, bool append, npage_t *npage_child2);
+
+/* Insert a BTreeCell into a B-Tree
+ *
+ * The chidb_Btree_insert and chidb_Btree_insertNonFull functions
+ * are responsible for inserting new entries into a B-Tree, although
+ * chidb_Btree_insertNonFull is the one that actually does the
+ * insertion. chidb_Btree_insert, however, first checks if the root
+ * has to be split (a splitting operation that is different from
+ * splitting any other node). If so, chidb_Btree_split is called
+ * before calling chidb_Btree_insertNonFull.
+ *
+ * Insertions can run concurrently with lookups and other insertions on
+ * the same B-Tree. The root is latched in exclusive mode, and the latch
+ * is handed over to chidb_Btree_insertNonFull, which crabs down the tree
+ * (see chidb_Btree_insertNonFull).
+ *
+ * The key is added to the Bloom filter of the B-Tree (if any) before the
+ * cell is inserted, so that a lookup that could find the cell never sees
+ * a filter without its key.
+ *
+ * If the B-Tree is a buffered table, the cell goes to its memtable instead
+ * (see chidb_Memtable_insert).
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree we want to insert
+ *          this cell in.
+ * - btc: BTreeCell to insert into B-Tree
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EDUPLICATE: An entry with that key already exists
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_insert(BTree *bt, npage_t nroot, BTreeCell *btc)
+{
+    /* Your code goes here */
+    int rt;
+
+    if(btc->type == PGTYPE_TABLE_LEAF && chidb_Memtable_get(bt, nroot) != NULL) {
+        return chidb_Memtable_insert(bt, nroot, btc);
+    }
+
+    chidb_Btree_bloomAdd(bt, nroot, btc->key);
+
+    if(rt = chidb_Pager_latch(bt->pager, nroot, LATCH_EXCLUSIVE)) { return rt; }
+    if(rt = chidb_Btree_insertRoot(bt, nroot, btc)) {
+        chidb_Pager_unlatch(bt->pager, nroot);
+        return rt;
+    }
+
+    /* The counts along the path of a cell that did not go in have to be
+     * taken back */
+    if(rt = chidb_Btree_insertNonFull(bt, nroot, btc)) {
+        chidb_Btree_recount(bt, nroot, btc);
+    }
+    return rt;
+}
+
+/* Number of rows under a node: its number of cells, if it is a leaf, or
+ * the sum of its subtree counts, if it is a counted table internal node */
+static int chidb_Btree_nodeCount(BTreeNode *btn, uint32_t *count)
+{
+    int rt;
+
+    if(btn->type == PGTYPE_TABLE_LEAF || btn->type == PGTYPE_INDEX_LEAF) {
+        *count = btn->n_cells;
+        return CHIDB_OK;
+    }
+    if(!(btn->flags & PGFLAG_SUBTREE_COUNTS)) {
+        return CHIDB_EVALIDEARG;
+    }
+    if(rt = chidb_Btree_decodeNode(btn)) {
+        return rt;
+    }
+
+    *count = btn->right_count;
+    for(ncell_t i = 0; i < btn->n_cells; i++) {
+        *count += btn->cells->counts[i];
+    }
+    return CHIDB_OK;
+}
+
+/* Add delta to the count of the entry ncell of a counted node (the right
+ * page, if ncell is the number of cells). As with the other fields, the
+ * change is effective once the node is written. */
+static void chidb_Btree_addCount(BTreeNode *btn, ncell_t ncell, int32_t delta)
+{
+    if(ncell == btn->n_cells) {
+        btn->right_count += delta;
+        return;
+    }
+
+    uint8_t *cell = btn->page->data + get2byte(btn->celloffset_array + 2 * ncell);
+    put4byte(cell + TABLEINTCELL_COUNT_OFFSET, get4byte(cell + TABLEINTCELL_COUNT_OFFSET) + delta);
+    free(btn->cells);
+    btn->cells = NULL;
+}
+
+/* Add delta to the count of the entry ncell of the counted node in npage,
+ * once rows have been inserted under it. The caller must hold the latch
+ * on npage. */
+static int chidb_Btree_updateCount(BTree *bt, npage_t npage, ncell_t ncell, int32_t delta)
+{
+    BTreeNode *btn;
+    int rt;
+
+    if(rt = chidb_Btree_getNodeByPage(bt, npage, &btn)) { return rt; }
+    chidb_Btree_addCount(btn, ncell, delta);
+    rt = chidb_Btree_writeNode(bt, btn);
+    chidb_Btree_freeMemNode(bt, btn);
+    return rt;
+}
+
+/* Count of the entry ncell of a counted node (the right page, if ncell is
+ * the number of cells) */
+static int chidb_Btree_getCount(BTreeNode *btn, ncell_t ncell, uint32_t *count)
+{
+    BTreeCell cell;
+    int rt;
+
+    if(ncell == btn->n_cells) {
+        *count = btn->right_count;
+        return CHIDB_OK;
+    }
+    if(rt = chidb_Btree_getCell(btn, ncell, &cell)) { return rt; }
+    *count = cell.fields.tableInternal.count;
+    return CHIDB_OK;
+}
+
+/* Make the counts along the path of a cell match the rows under them, and
+ * return the number of rows under npage. The caller must hold an exclusive
+ * latch on npage; the nodes below it are latched on the way down and
+ * released on the way up. */
+static int chidb_Btree_recountNode(BTree *bt, npage_t npage, BTreeCell *btc, uint32_t *count)
+{
+    BTreeNode *btn;
+    BTreeCell cell;
+    npage_t npage_child;
+    uint32_t old, child_count;
+    ncell_t i;
+    int rt;
+
+    if(rt = chidb_Btree_getNodeByPage(bt, npage, &btn)) { return rt; }
+    if(btn->type == PGTYPE_TABLE_LEAF || !(btn->flags & PGFLAG_SUBTREE_COUNTS)) {
+        rt = chidb_Btree_nodeCount(btn, count);
+        chidb_Btree_freeMemNode(bt, btn);
+        return rt;
+    }
+
+    if(rt = chidb_Btree_searchNodePk(btn, btc->key, chidb_Btree_cellKeyPk(btc), &i)) { goto out; }
+    if(i == btn->n_cells) {
+        npage_child = btn->right_page;
+    }
+    else {
+        if(rt = chidb_Btree_getCell(btn, i, &cell)) { goto out; }
+        npage_child = cell.fields.tableInternal.child_page;
+    }
+
+    if(rt = chidb_Pager_latch(bt->pager, npage_child, LATCH_EXCLUSIVE)) { goto out; }
+    rt = chidb_Btree_recountNode(bt, npage_child, btc, &child_count);
+    chidb_Pager_unlatch(bt->pager, npage_child);
+    if(rt) { goto out; }
+
+    if(rt = chidb_Btree_getCount(btn, i, &old)) { goto out; }
+    if(old != child_count) {
+        chidb_Btree_addCount(btn, i, (int32_t) (child_count - old));
+        if(rt = chidb_Btree_writeNode(bt, btn)) { goto out; }
+    }
+    rt = chidb_Btree_nodeCount(btn, count);
+
+out:
+    chidb_Btree_freeMemNode(bt, btn);
+    return rt;
+}
+
+/* Take back the counts that chidb_Btree_insertNonFull added along the path
+ * of a cell that could not be inserted (because its key was already there,
+ * or because of an error).
+ *
+ * The counts are not simply decremented, since the nodes along the path
+ * may have been split in the meantime: each one is set to the rows under
+ * its child, bottom up, with the whole path latched. Nothing else can be
+ * in the middle of an insertion in those children, so this is their
+ * actual count, and a path that another failed insertion has already
+ * fixed is left as it is. This is slower than an insertion, but it only
+ * happens when one fails. */
+static int chidb_Btree_recount(BTree *bt, npage_t nroot, BTreeCell *btc)
+{
+    uint32_t count;
+    int rt;
+
+    if(btc->type != PGTYPE_TABLE_LEAF) {
+        return CHIDB_OK;
+    }
+
+    if(rt = chidb_Pager_latch(bt->pager, nroot, LATCH_EXCLUSIVE)) { return rt; }
+    rt = chidb_Btree_recountNode(bt, nroot, btc, &count);
+    chidb_Pager_unlatch(bt->pager, nroot);
+    return rt;
+}
+
+/* Split the root of a B-Tree, if needed, before inserting a cell into it
+ * (see chidb_Btree_insert). The caller must hold the latch on the root.
+ *
+ * The new root of a table is counted (see PGFLAG_SUBTREE_COUNTS) if the
+ * old one was a leaf or was counted itself, so a table that grows from an
+ * empty leaf has counts in all of its internal nodes. */
+static int chidb_Btree_insertRoot(BTree *bt, npage_t nroot, BTreeCell *btc)
+{
+    BTreeNode *root;
+    BTreeCell temp_cell;
+
+    int rt;
+
+    if(rt = chidb_Btree_getNodeByPage(bt, nroot, &root)) { return rt; }
+
+    if(if_BtreeNode_Full(root, btc)) { // root need to be splited
+        BTreeNode *rchild;
+        npage_t nrchild;
+        BTreeNode *lchild;
+        npage_t nlchild;
+        uint8_t root_type = root->type;
+        bool counted = root->type == PGTYPE_TABLE_LEAF || (root->flags & PGFLAG_SUBTREE_COUNTS);
+        uint32_t lcount, rcount;
+
+        if(root_type == PGTYPE_INDEX_LEAF) {
+            root_type = PGTYPE_INDEX_INTERNAL;
+        } else if(root_type == PGTYPE_TABLE_LEAF) {
+            root_type = PGTYPE_TABLE_INTERNAL;
+        }
+
+        if(rt = chidb_Btree_newNode(bt, &nrchild, root->type)) { return rt; }
+        if(rt = chidb_Btree_getNodeByPage(bt, nrchild, &rchild)) { return rt; }
+        if(rt = chidb_Btree_newNode(bt, &nlchild, root->type)) { return rt; }
+        if(rt = chidb_Btree_getNodeByPage(bt, nlchild, &lchild)) { return rt; }
+
+        if(root->type == PGTYPE_INDEX_LEAF || root->type == PGTYPE_TABLE_LEAF) {
+            if(rt = chidb_Btree_setSiblings(bt, lchild, SIBLING_NONE, nrchild)) { return rt; }
+            if(rt = chidb_Btree_setSiblings(bt, rchild, nlchild, SIBLING_NONE)) { return rt; }
+        }
+        else if(root->flags & PGFLAG_SUBTREE_COUNTS) {
+            if(rt = chidb_Btree_setCounted(bt, lchild)) { return rt; }
+            if(rt = chidb_Btree_setCounted(bt, rchild)) { return rt; }
+        }
+
+        ncell_t nmid_cell = root->n_cells / 2;
+        BTreeCell mid_cell, new_cell;
+
+        if(rt = chidb_Btree_getCell(root, nmid_cell, &mid_cell)) { return rt; }
+
+        for(int i = 0; i < nmid_cell; i++) {
+            BTreeCell cell;
+            if(rt = chidb_Btree_getCell(root, i, &cell)) { return rt; }
+            if(rt = chidb_Btree_insertCell(lchild, i, &cell)) { return rt; }
+        }
+
+        switch(mid_cell.type) {
+            case PGTYPE_INDEX_LEAF:
+                if(rt = chidb_Btree_insertCell(lchild, nmid_cell, &mid_cell)) { return rt; }
+                new_cell.type = PGTYPE_INDEX_INTERNAL;
+                new_cell.key = mid_cell.key;
+                new_cell.fields.indexInternal.child_page = nlchild;
+                new_cell.fields.indexInternal.keyPk = mid_cell.fields.indexLeaf.keyPk;
+                lchild->right_page = nrchild;
+                break;
+            case PGTYPE_INDEX_INTERNAL:
+                new_cell.type = PGTYPE_INDEX_INTERNAL;
+                new_cell.key = mid_cell.key;
+                new_cell.fields.indexInternal.child_page = nlchild;
+                new_cell.fields.indexInternal.keyPk = mid_cell.fields.indexInternal.keyPk;
+                lchild->right_page = mid_cell.fields.indexInternal.child_page;
+                break;
+            case PGTYPE_TABLE_LEAF:
+                if(rt = chidb_Btree_insertCell(lchild, nmid_cell, &mid_cell)) { return rt; }
+                new_cell.type = PGTYPE_TABLE_INTERNAL;
+                new_cell.key = mid_cell.key;
+                new_cell.fields.tableInternal.child_page = nlchild;
+                lchild->right_page = nrchild;
+                break;
+            case PGTYPE_TABLE_INTERNAL:
+                new_cell.type = PGTYPE_TABLE_INTERNAL;
+                new_cell.key = mid_cell.key;
+                new_cell.fields.tableInternal.child_page = nlchild;
+                lchild->right_page = mid_cell.fields.tableInternal.child_page;
+                lchild->right_count = mid_cell.fields.tableInternal.count;
+                break;
+            default:
+                break;
+        }
+
+        for(int i = nmid_cell + 1, j = 0; i < root->n_cells; i++, j++) {
+            BTreeCell cell;
+            if(rt = chidb_Btree_getCell(root, i, &cell)) { return rt; }
+            if(rt = chidb_Btree_insertCell(rchild, j, &cell)) { return rt; }
+        }
+        rchild->right_page = root->right_page;
+        rchild->right_count = root->right_count;
+
+        if(counted) {
+            if(rt = chidb_Btree_nodeCount(lchild, &lcount)) { return rt; }
+            if(rt = chidb_Btree_nodeCount(rchild, &rcount)) { return rt; }
+            new_cell.fields.tableInternal.count = lcount;
+        }
+
+        if(rt = chidb_Btree_freeMemNode(bt, root)) { return rt; }
+        if(rt = chidb_Btree_initEmptyNode(bt, nroot, root_type)) { return rt; }
+        if(rt = chidb_Btree_getNodeByPage(bt, nroot, &root)) { return rt; }
+        if(counted) {
+            if(rt = chidb_Btree_setCounted(bt, root)) { return rt; }
+            root->right_count = rcount;
+        }
+
+        if(rt = chidb_Btree_insertCell(root, 0, &new_cell)) { return rt; }
+        root->right_page = nrchild;
+
+        if(rt = chidb_Btree_writeNode(bt, lchild)) { return rt; }
+        if(rt = chidb_Btree_freeMemNode(bt, lchild)) { return rt; }
+        lchild = NULL;
+
+        if(rt = chidb_Btree_writeNode(bt, rchild)) { return rt; }
+        if(rt = chidb_Btree_freeMemNode(bt, rchild)) { return rt; }
+        rchild = NULL;
+
+        if(rt = chidb_Btree_writeNode(bt, root)) { return rt; }
+        chidb_Btree_bumpEpoch(bt);
+    }
+    else if(rt = chidb_Btree_writeNode(bt, root)) { return rt; }
+
+    if(rt = chidb_Btree_freeMemNode(bt, root)) { return rt; }
+    root = NULL;
+
+    return CHIDB_OK;
+}
+
+/* Insert a BTreeCell into a non-full B-Tree node
+ *
+ * chidb_Btree_insertNonFull inserts a BTreeCell into a node that is
+ * assumed not to be full (i.e., does not require splitting). If the
+ * node is a leaf node, the cell is directly added in the appropriate
+ * position according to its key (and keyPk, in an index). If the node is an internal node, the
+ * function will determine what child node it must insert it in, and
+ * calls itself recursively on that child node. However, before doing so
+ * it will check if the child node is full or not. If it is, then it will
+ * have to be split first.
+ *
+ * The caller must hold an exclusive latch on npage, which this function
+ * releases before returning. The child is latched before it is examined,
+ * and since it is split if it is full, the latch on the parent can be
+ * released as soon as we move down to the child: the child will never
+ * need to add a cell to the parent. The count of the child in a counted
+ * node (see PGFLAG_SUBTREE_COUNTS) is incremented before the latch on the
+ * node is released, so a count may take in a cell that is still on its
+ * way down; if the cell does not go in after all, chidb_Btree_insert puts
+ * the counts along its path right (see chidb_Btree_recount).
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree we want to insert
+ *          this cell in.
+ * - btc: BTreeCell to insert into B-Tree
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EDUPLICATE: An entry with that key already exists
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_insertNonFull(BTree *bt, npage_t npage, BTreeCell *btc)
+{
+    /* Your code goes here */
+    BTreeNode *btn;
+    int rt;
+    BTreeCell cell;
+    ncell_t i;
+    npage_t npage_child;
+    bool counted;
+
+    if(rt = chidb_Btree_getNodeByPage(bt, npage, &btn)) {
+        chidb_Pager_unlatch(bt->pager, npage);
+        return rt;
+    }
+    counted = btn->flags & PGFLAG_SUBTREE_COUNTS;
+
+    if(rt = chidb_Btree_searchNodePk(btn, btc->key, chidb_Btree_cellKeyPk(btc), &i)) { goto out; }
+    if(i < btn->n_cells) {
+        if(rt = chidb_Btree_getCell(btn, i, &cell)) { goto out; }
+    }
+
+    if(i == btn->n_cells) {
+        npage_child = btn->right_page;
+    }
+    else {
+        if(cell.type == btc->type && chidb_Btree_cellCmp(&cell, btc) == 0) {
+            rt = CHIDB_EDUPLICATE;
+            goto out;
+        }
+        npage_child = btn->type == PGTYPE_INDEX_INTERNAL ?
+                        cell.fields.indexInternal.child_page :
+                        cell.fields.tableInternal.child_page;
+    }
+
+    if(btn->type == btc->type) {
+        if(rt = chidb_Btree_insertCell(btn, i, btc)) { goto out; }
+        rt = chidb_Btree_writeNode(bt, btn);
+        goto out;
+    }
+
+    if(rt = chidb_Btree_freeMemNode(bt, btn)) {
+        chidb_Pager_unlatch(bt->pager, npage);
+        return rt;
+    }
+
+    BTreeNode *child;
+    npage_t napge_child2;
+
+    if(rt = chidb_Pager_latch(bt->pager, npage_child, LATCH_EXCLUSIVE)) {
+        chidb_Pager_unlatch(bt->pager, npage);
+        return rt;
+    }
+    if(rt = chidb_Btree_getNodeByPage(bt, npage_child, &child)) {
+        chidb_Pager_unlatch(bt->pager, npage_child);
+        chidb_Pager_unlatch(bt->pager, npage);
+        return rt;
+    }
+    int full = if_BtreeNode_Full(child, btc);
+    rt = chidb_Btree_freeMemNode(bt, child);
+    if(!rt && full) {
+        rt = chidb_Btree_split(bt, npage, npage_child, i, &napge_child2);
+        chidb_Pager_unlatch(bt->pager, npage_child);
+        if(rt) {
+            chidb_Pager_unlatch(bt->pager, npage);
+            return rt;
+        }
+        return chidb_Btree_insertNonFull(bt, npage, btc);
+    }
+    if(!rt && counted) {
+        rt = chidb_Btree_updateCount(bt, npage, i, 1);
+    }
+    chidb_Pager_unlatch(bt->pager, npage);
+    if(rt) {
+        chidb_Pager_unlatch(bt->pager, npage_child);
+        return rt;
+    }
+    return chidb_Btree_insertNonFull(bt, npage_child, btc);
+
+out:
+    chidb_Btree_freeMemNode(bt, btn);
+    chidb_Pager_unlatch(bt->pager, npage);
+    return rt;
+}
+
+
+/* Insert a batch of BTreeCells into a B-Tree
+ *
+ * Inserts cells sorted by key, descending the B-Tree once for every leaf
+ * the cells go to, instead of once for every cell. All the cells that go
+ * to the same leaf (and fit in it) are inserted in a single pass, and the
+ * leaf is written only once. As in chidb_Btree_insertNonFull, a full node
+ * is split before descending into it; if all the cells that go to a full
+ * leaf come after its last cell, the leaf is split so that it stays full
+ * and the rest of the batch goes to a new, empty leaf (see
+ * chidb_Btree_splitNode). Appending sorted cells to a B-Tree thus fills
+ * its leaves, instead of leaving every leaf half full.
+ *
+ * The B-Tree is latched as in chidb_Btree_insert, once per descent. The
+ * cells always go to the B-Tree itself, even if the table is buffered
+ * (this is how memtables are flushed, see chidb_Memtable_flush).
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree we want to insert
+ *          the cells in.
+ * - cells: BTreeCells to insert, all of the same type (PGTYPE_TABLE_LEAF
+ *          or PGTYPE_INDEX_LEAF), sorted by strictly increasing key (or
+ *          (KeyIdx, KeyPk), for index cells)
+ * - n_cells: Number of cells to insert
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EDUPLICATE: An entry with the key of one of the cells already
+ *                     exists (the cells before it have been inserted)
+ * - CHIDB_EVALIDEARG: The cells are not sorted, or not all of the same type
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_insertBatch(BTree *bt, npage_t nroot, BTreeCell *cells, size_t n_cells)
+{
+    size_t done;
+    int rt;
+
+    for(size_t i = 1; i < n_cells; i++) {
+        if(cells[i].type != cells[0].type || chidb_Btree_cellCmp(&cells[i], &cells[i-1]) <= 0) {
+            return CHIDB_EVALIDEARG;
+        }
+    }
+
+    for(size_t i = 0; i < n_cells; i++) {
+        chidb_Btree_bloomAdd(bt, nroot, cells[i].key);
+    }
+
+    for(size_t i = 0; i < n_cells; i += done) {
+        if(rt = chidb_Pager_latch(bt->pager, nroot, LATCH_EXCLUSIVE)) { return rt; }
+        if(rt = chidb_Btree_insertRoot(bt, nroot, &cells[i])) {
+            chidb_Pager_unlatch(bt->pager, nroot);
+            return rt;
+        }
+        if(rt = chidb_Btree_insertBatchNonFull(bt, nroot, cells + i, n_cells - i, &done)) { return rt; }
+    }
+
+    return CHIDB_OK;
+}
+
+/* Insert the first cells of a batch into a non-full B-Tree node (see
+ * chidb_Btree_insertBatch). The node must be able to hold the first
+ * cell. Only the cells that go to the same leaf as the first one are
+ * inserted, and their number is returned in done (even if an error
+ * stops the batch halfway). Latches are handled as in
+ * chidb_Btree_insertNonFull. */
+static int chidb_Btree_insertBatchNonFull(BTree *bt, npage_t npage, BTreeCell *cells, size_t n_cells, size_t *done)
+{
+    BTreeNode *btn, *child;
+    BTreeCell cell;
+    ncell_t i;
+    npage_t npage_child, npage_child2;
+    size_t n = n_cells;
+    bool full, counted, append = false;
+    int rt;
+
+    *done = 0;
+    if(rt = chidb_Btree_getNodeByPage(bt, npage, &btn)) {
+        chidb_Pager_unlatch(bt->pager, npage);
+        return rt;
+    }
+    counted = btn->flags & PGFLAG_SUBTREE_COUNTS;
+
+    if(btn->type == cells[0].type) {
+        chidb_key_t *keys = NULL, *keyPks = NULL;
+        ncell_t n_keys = btn->n_cells, pos = 0;
+
+        /* Both the leaf and the batch are sorted, so they are merged in a
+         * single pass. The keys (and keyPks) of the leaf are copied, since
+         * inserting a cell discards the decoded cells of the node. */
+        if(!(rt = chidb_Btree_decodeNode(btn)) && n_keys > 0) {
+            if(keys = malloc(2 * n_keys * sizeof(chidb_key_t))) {
+                memcpy(keys, btn->cells->keys, n_keys * sizeof(chidb_key_t));
+                if(btn->cells->keyPks != NULL) {
+                    keyPks = keys + n_keys;
+                    memcpy(keyPks, btn->cells->keyPks, n_keys * sizeof(chidb_key_t));
+                }
+            } else {
+                rt = CHIDB_ENOMEM;
+            }
+        }
+
+        for(n = 0; !rt && n < n_cells; n++) {
+            chidb_key_t keyPk = chidb_Btree_cellKeyPk(&cells[n]);
+            if(if_BtreeNode_Full(btn, &cells[n])) { break; }
+            while(pos < n_keys && (keys[pos] < cells[n].key ||
+                                   (keyPks && keys[pos] == cells[n].key && keyPks[pos] < keyPk))) { pos++; }
+            if(pos < n_keys && keys[pos] == cells[n].key && (!keyPks || keyPks[pos] == keyPk)) {
+                rt = CHIDB_EDUPLICATE;
+                break;
+            }
+            if(rt = chidb_Btree_insertCell(btn, pos + n, &cells[n])) { break; }
+        }
+        free(keys);
+
+        if(n > 0) {
+            int rt_write = chidb_Btree_writeNode(bt, btn);
+            if(!rt) { rt = rt_write; }
+        }
+        *done = n;
+        goto out;
+    }
+
+    if(rt = chidb_Btree_searchNodePk(btn, cells[0].key, chidb_Btree_cellKeyPk(&cells[0]), &i)) { goto out; }
+    if(i == btn->n_cells) {
+        npage_child = btn->right_page;
+    }
+    else {
+        if(rt = chidb_Btree_getCell(btn, i, &cell)) { goto out; }
+        npage_child = btn->type == PGTYPE_INDEX_INTERNAL ?
+                        cell.fields.indexInternal.child_page :
+                        cell.fields.tableInternal.child_page;
+
+        /* Only the cells up to the entry of this cell go to its child */
+        for(n = 1; n < n_cells && chidb_Btree_cellCmp(&cells[n], &cell) <= 0; n++);
+    }
+
+    if(rt = chidb_Btree_freeMemNode(bt, btn)) {
+        chidb_Pager_unlatch(bt->pager, npage);
+        return rt;
+    }
+
+    if(rt = chidb_Pager_latch(bt->pager, npage_child, LATCH_EXCLUSIVE)) {
+        chidb_Pager_unlatch(bt->pager, npage);
+        return rt;
+    }
+    if(rt = chidb_Btree_getNodeByPage(bt, npage_child, &child)) {
+        chidb_Pager_unlatch(bt->pager, npage_child);
+        chidb_Pager_unlatch(bt->pager, npage);
+        return rt;
+    }
+    full = if_BtreeNode_Full(child, &cells[0]);
+    if(full && child->type == cells[0].type && child->n_cells > 0) {
+        rt = chidb_Btree_getCell(child, child->n_cells - 1, &cell);
+        append = !rt && chidb_Btree_cellCmp(&cells[0], &cell) > 0;
+    }
+    if(!rt) {
+        rt = chidb_Btree_freeMemNode(bt, child);
+    } else {
+        chidb_Btree_freeMemNode(bt, child);
+    }
+    if(!rt && full) {
+        rt = chidb_Btree_splitNode(bt, npage, npage_child, i, append, &npage_child2);
+        chidb_Pager_unlatch(bt->pager, npage_child);
+        if(rt) {
+            chidb_Pager_unlatch(bt->pager, npage);
+            return rt;
+        }
+        return chidb_Btree_insertBatchNonFull(bt, npage, cells, n_cells, done);
+    }
+    if(!rt && counted) {
+        rt = chidb_Btree_insertBatchNonFull(bt, npage_child, cells, n, done);
+        if(*done > 0) {
+            int rt_count = chidb_Btree_updateCount(bt, npage, i, *done);
+            if(!rt) { rt = rt_count; }
+        }
+        chidb_Pager_unlatch(bt->pager, npage);
+        return rt;
+    }
+    chidb_Pager_unlatch(bt->pager, npage);
+    if(rt) {
+        chidb_Pager_unlatch(bt->pager, npage_child);
+        return rt;
+    }
+    return chidb_Btree_insertBatchNonFull(bt, npage_child, cells, n, done);
+
+out:
+    chidb_Btree_freeMemNode(bt, btn);
+    chidb_Pager_unlatch(bt->pager, npage);
+    return rt;
+}
+
+
+/* Split a B-Tree node
+ *
+ * Splits a B-Tree node N. This involves the following:
+ * - Find the median cell in N.
+ * - Create a new B-Tree node M.
+ * - Move the cells before the median cell to M (if the
+ *   cell is a table leaf cell, the median cell is moved too)
+ * - Add a cell to the parent (which, by definition, will be an
+ *   internal page) with the median key and the page number of M.
+ * - If N is a leaf, link M into the leaf chain, between N and
+ *   the leaf that used to precede N.
+ *
+ * The caller must hold exclusive latches on the parent and on N. The
+ * leaf that precedes N is latched here, while its link is updated.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - npage_parent: Page number of the parent node
+ * - npage_child: Page number of the node to split
+ * - parent_ncell: Position in the parent where the new cell will
+ *                 be inserted.
+ * - npage_child2: Out parameter. Used to return the page of the new child node.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_split(BTree *bt, npage_t npage_parent, npage_t npage_child, ncell_t parent_ncell, npage_t *npage_child2)
+{
+    return chidb_Btree_splitNode(bt, npage_parent, npage_child, parent_ncell, false, npage_child2);
+}
+
+/* Split a B-Tree node (see chidb_Btree_split). If append is true and the
+ * node is a leaf, all of its cells are moved to the new node, instead of
+ * only the ones up to the median, and the node that is split is left
+ * empty. This is what the batch insertion does when the cells it still
+ * has to insert all go after the last cell of a full leaf, so that
+ * appending sorted cells fills leaves completely instead of leaving every
+ * leaf half full.
+ *
+ * The halves of a counted node are counted too, and if the parent is
+ * counted, the entries of both halves are set to the rows under them. */
+static int chidb_Btree_splitNode(BTree *bt, npage_t npage_parent, npage_t npage_child, ncell_t parent_ncell, bool append, npage_t *npage_child2)
+{
+    BTreeNode *parent, *rchild, *lchild; // parent:npage_parent, rchild:npage_child, lchild:npage_child2
+    BTreeNode *temp_node;
+    int rt;
+
+    if(rt = chidb_Btree_getNodeByPage(bt, npage_parent, &parent)) { return rt; }
+    if(rt = chidb_Btree_getNodeByPage(bt, npage_child, &rchild)) { return rt; }
+
+    if(rt = chidb_Btree_newNode(bt, npage_child2, rchild->type)) { return rt; }
+    if(rt = chidb_Btree_getNodeByPage(bt, *npage_child2, &lchild)) { return rt; }
+
+    /* The new node goes right before the split node in the leaf chain */
+    int is_leaf = (rchild->type == PGTYPE_INDEX_LEAF || rchild->type == PGTYPE_TABLE_LEAF);
+    npage_t prev_page = rchild->prev_page;
+    npage_t next_page = rchild->next_page;
+    if(is_leaf) {
+        if(rt = chidb_Btree_setSiblings(bt, lchild, prev_page, npage_child)) { return rt; }
+    }
+
+    get_tempBtreeNode(bt, &temp_node, rchild->type);
+
+    bool counted = rchild->flags & PGFLAG_SUBTREE_COUNTS;
+    if(counted) {
+        if(rt = chidb_Btree_setCounted(bt, lchild)) { return rt; }
+        if(rt = chidb_Btree_setCounted(bt, temp_node)) { return rt; }
+    }
+
+    ncell_t nmid_cell = (append && is_leaf) ? rchild->n_cells - 1 : rchild->n_cells / 2;
+    BTreeCell mid_cell, new_cell;
+    uint32_t lcount;
+
+    if(chidb_Btree_getCell(rchild, nmid_cell, &mid_cell)) { return rt; }
+
+    for(int i = 0; i < nmid_cell; i++) {
+        BTreeCell cell;
+        if(rt = chidb_Btree_getCell(rchild, i, &cell)) { return rt; }
+        if(rt = chidb_Btree_insertCell(lchild, i, &cell)) { return rt; }
+    }
+
+    switch(mid_cell.type) {
+        case PGTYPE_INDEX_LEAF:
+            if(rt = chidb_Btree_insertCell(lchild, nmid_cell, &mid_cell)) { return rt; }
+            new_cell.type = PGTYPE_INDEX_INTERNAL;
+            new_cell.key = mid_cell.key;
+            new_cell.fields.indexInternal.child_page = *npage_child2;
+            new_cell.fields.indexInternal.keyPk = mid_cell.fields.indexLeaf.keyPk;
+            lchild->right_page = npage_child;
+            break;
+        case PGTYPE_INDEX_INTERNAL:
+            new_cell.type = PGTYPE_INDEX_INTERNAL;
+            new_cell.key = mid_cell.key;
+            new_cell.fields.indexInternal.child_page = *npage_child2;
+            new_cell.fields.indexInternal.keyPk = mid_cell.fields.indexInternal.keyPk;
+            lchild->right_page = mid_cell.fields.indexInternal.child_page;
+            break;
+        case PGTYPE_TABLE_LEAF:
+            if(rt = chidb_Btree_insertCell(lchild, nmid_cell, &mid_cell)) { return rt; }
+            new_cell.type = PGTYPE_TABLE_INTERNAL;
+            new_cell.key = mid_cell.key;
+            new_cell.fields.tableInternal.child_page = *npage_child2;
+            lchild->right_page = npage_child;
+            break;
+        case PGTYPE_TABLE_INTERNAL:
+            new_cell.type = PGTYPE_TABLE_INTERNAL;
+            new_cell.key = mid_cell.key;
+            new_cell.fields.tableInternal.child_page = *npage_child2;
+            lchild->right_page = mid_cell.fields.tableInternal.child_page;
+            lchild->right_count = mid_cell.fields.tableInternal.count;
+            break;
+        default:
+            break;
+    }
+
+    for(int i = nmid_cell + 1, j = 0; i < rchild->n_cells; i++, j++) {
+        BTreeCell cell;
+        if(rt = chidb_Btree_getCell(rchild, i, &cell)) { return rt; }
+        if(rt = chidb_Btree_insertCell(temp_node, j, &cell)) { return rt; }
+    }
+    temp_node->right_page = rchild->right_page;
+    temp_node->right_count = rchild->right_count;
+
+    if(parent->flags & PGFLAG_SUBTREE_COUNTS) {
+        if(rt = chidb_Btree_nodeCount(lchild, &lcount)) { return rt; }
+        new_cell.fields.tableInternal.count = lcount;
+    }
+    if(rt = chidb_Btree_insertCell(parent, parent_ncell, &new_cell)) { return rt; }
+
+    uint8_t rchild_type = rchild->type;
+    if(rt = chidb_Btree_freeMemNode(bt, rchild)) { return rt; }
+    if(rt = chidb_Btree_initEmptyNode(bt, npage_child, rchild_type)) { return rt; }
+    if(rt = chidb_Btree_getNodeByPage(bt, npage_child, &rchild)) { return rt; }
+    if(is_leaf) {
+        if(rt = chidb_Btree_setSiblings(bt, rchild, *npage_child2, next_page)) { return rt; }
+    }
+    else if(counted) {
+        if(rt = chidb_Btree_setCounted(bt, rchild)) { return rt; }
+    }
+
+    for(int i = 0; i < temp_node->n_cells; i++) {
+        BTreeCell cell;
+        if(rt = chidb_Btree_getCell(temp_node, i, &cell)) { return rt; }
+        if(rt = chidb_Btree_insertCell(rchild, i, &cell)) { return rt; }
+    }
+    rchild->right_page = temp_node->right_page;
+    rchild->right_count = temp_node->right_count;
+
+    /* The entry of the split node is set to the rows left in it, rather
+     * than decremented, so that a count that an insertion which failed
+     * below it has not taken back yet (see chidb_Btree_recount) does not
+     * end up in the wrong half */
+    if(parent->flags & PGFLAG_SUBTREE_COUNTS) {
+        uint32_t rcount, old;
+        if(rt = chidb_Btree_nodeCount(rchild, &rcount)) { return rt; }
+        if(rt = chidb_Btree_getCount(parent, parent_ncell + 1, &old)) { return rt; }
+        chidb_Btree_addCount(parent, parent_ncell + 1, (int32_t) (rcount - old));
+    }
+
+    free_tempBtreeNode(temp_node);
+    temp_node = NULL;
+
+    if(rt = chidb_Btree_writeNode(bt, parent)) { return rt; }
+    if(rt = chidb_Btree_writeNode(bt, rchild)) { return rt; }
+    if(rt = chidb_Btree_writeNode(bt, lchild)) { return rt; }
+
+    if(rt = chidb_Btree_freeMemNode(bt, parent)) { return rt; }
+    if(rt = chidb_Btree_freeMemNode(bt, rchild)) { return rt; }
+    if(rt = chidb_Btree_freeMemNode(bt, lchild)) { return rt; }
+    parent = lchild = rchild = NULL;
+
+    if(is_leaf && prev_page != SIBLING_NONE && prev_page != SIBLING_UNKNOWN) {
+        BTreeNode *prev;
+        if(rt = chidb_Pager_latch(bt->pager, prev_page, LATCH_EXCLUSIVE)) { return rt; }
+        if(!(rt = chidb_Btree_getNodeByPage(bt, prev_page, &prev))) {
+            if(prev->flags & PGFLAG_LEAF_SIBLINGS) {
+                prev->next_page = *npage_child2;
+                rt = chidb_Btree_writeNode(bt, prev);
+            }
+            chidb_Btree_freeMemNode(bt, prev);
+        }
+        chidb_Pager_unlatch(bt->pager, prev_page);
+        if(rt) { return rt; }
+    }
+
+    chidb_Btree_bumpEpoch(bt);
+    return CHIDB_OK;
+}
+
+
+
+/* Number of entries under a node. Counted nodes and leaves know it; under
+ * any other node, every leaf is visited. The caller must hold a latch on
+ * the node or on one of its ancestors, which keeps writers out of the
+ * whole subtree. */
+static int chidb_Btree_subtreeCount(BTree *bt, npage_t npage, uint32_t *count)
+{
+    BTreeNode *btn;
+    uint32_t child_count;
+    int rt;
+
+    if(rt = chidb_Btree_getNodeByPage(bt, npage, &btn)) { return rt; }
+
+    if(btn->type == PGTYPE_TABLE_LEAF || btn->type == PGTYPE_INDEX_LEAF ||
+       (btn->flags & PGFLAG_SUBTREE_COUNTS)) {
+        rt = chidb_Btree_nodeCount(btn, count);
+        chidb_Btree_freeMemNode(bt, btn);
+        return rt;
+    }
+
+    if(!(rt = chidb_Btree_subtreeCount(bt, btn->right_page, count)) &&
+       !(rt = chidb_Btree_decodeNode(btn))) {
+        for(ncell_t i = 0; i < btn->n_cells; i++) {
+            if(rt = chidb_Btree_subtreeCount(bt, btn->cells->child_pages[i], &child_count)) { break; }
+            *count += child_count;
+        }
+    }
+    chidb_Btree_freeMemNode(bt, btn);
+    return rt;
+}
+
+/* Number of entries under the child of entry ncell of an internal node
+ * (the right page, if ncell is the number of cells) */
+static int chidb_Btree_childCount(BTree *bt, BTreeNode *btn, ncell_t ncell, uint32_t *count)
+{
+    int rt;
+
+    if(rt = chidb_Btree_decodeNode(btn)) { return rt; }
+    if(btn->flags & PGFLAG_SUBTREE_COUNTS) {
+        *count = ncell == btn->n_cells ? btn->right_count : btn->cells->counts[ncell];
+        return CHIDB_OK;
+    }
+    return chidb_Btree_subtreeCount(bt, ncell == btn->n_cells ? btn->right_page : btn->cells->child_pages[ncell], count);
+}
+
+
+/* Count the entries of a B-Tree
+ *
+ * Returns the number of rows of a table B-Tree (or entries of an index
+ * B-Tree). If the internal nodes of the B-Tree are counted (see
+ * PGFLAG_SUBTREE_COUNTS), which is the case for every table that has
+ * grown from an empty leaf or that has been rebuilt, only the root is
+ * read. Otherwise, the uncounted nodes are walked down to their leaves.
+ * Rows in the write buffer of the table are not counted (see
+ * chidb_Memtable_count), while rows that are being inserted at the same
+ * time may be, even if their insertion fails (see
+ * chidb_Btree_insertNonFull).
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree
+ * - count: Out parameter. Number of entries.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_count(BTree *bt, npage_t nroot, uint32_t *count)
+{
+    int rt;
+
+    if(rt = chidb_Pager_latch(bt->pager, nroot, LATCH_SHARED)) { return rt; }
+    rt = chidb_Btree_subtreeCount(bt, nroot, count);
+    chidb_Pager_unlatch(bt->pager, nroot);
+    return rt;
+}
+
+
+/* Count the entries of a B-Tree with a key lower than a given one
+ *
+ * Descends the B-Tree towards key, adding up the counts of the children
+ * to the left of the path and, in the leaf, the cells before key. On a
+ * counted B-Tree this reads a single node per level, so the number of
+ * rows in a key range [a, b) is rank(b) - rank(a). Nodes are latched as
+ * in chidb_Btree_find.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree
+ * - key: Key (or KeyIdx)
+ * - rank: Out parameter. Number of entries with a key lower than key.
  *
  * Return
  * - CHIDB_OK: Operation successful
- * - CHIDB_EDUPLICATE: An entry with that key already exists
  * - CHIDB_ENOMEM: Could not allocate memory
  * - CHIDB_EIO: An I/O error has occurred when accessing the file
  */
-int chidb_Btree_insertInTable(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t *data, uint16_t size)
+int chidb_Btree_rank(BTree *bt, npage_t nroot, chidb_key_t key, uint32_t *rank)
 {
-    /* Your code goes here */
-    BTreeCell cell;
+    BTreeNode *btn;
+    npage_t npage = nroot, child;
+    uint32_t count;
+    ncell_t i;
+    int rt;
 
-    cell.type = PGTYPE_TABLE_LEAF;
-    cell.key = key;
-    cell.fields.tableLeaf.data_size = size;
-    cell.fields.tableLeaf.data = data;
+    *rank = 0;
+    if(rt = chidb_Pager_latch(bt->pager, npage, LATCH_SHARED)) { return rt; }
 
-    return chidb_Btree_insert(bt, nroot, &cell);
+    for(;;) {
+        if(rt = chidb_Btree_getNodeByPage(bt, npage, &btn)) { break; }
+        if(rt = chidb_Btree_searchNode(btn, key, &i)) { goto out; }
+
+        if(btn->type == PGTYPE_TABLE_LEAF || btn->type == PGTYPE_INDEX_LEAF) {
+            *rank += i;
+            goto out;
+        }
+        for(ncell_t j = 0; j < i; j++) {
+            if(rt = chidb_Btree_childCount(bt, btn, j, &count)) { goto out; }
+            *rank += count;
+        }
+
+        child = (i == btn->n_cells) ? btn->right_page : btn->cells->child_pages[i];
+        chidb_Btree_freeMemNode(bt, btn);
+        if(rt = chidb_Pager_latch(bt->pager, child, LATCH_SHARED)) { break; }
+        chidb_Pager_unlatch(bt->pager, npage);
+        npage = child;
+    }
+    chidb_Pager_unlatch(bt->pager, npage);
+    return rt;
+
+out:
+    chidb_Btree_freeMemNode(bt, btn);
+    chidb_Pager_unlatch(bt->pager, npage);
+    return rt;
 }
 
 
-/* Insert an entry into an index B-Tree
+/* Find the n-th entry of a B-Tree
  *
- * This is a convenience function that wraps around chidb_Btree_insert.
- * It takes a KeyIdx and a KeyPk, and creates a BTreeCell that can be passed
- * along to chidb_Btree_insert.
+ * Descends the B-Tree into the child that holds the n-th entry (in key
+ * order, starting at 0), skipping the entries to the left of it. On a
+ * counted B-Tree this reads a single node per level, instead of every
+ * leaf before the entry. Nodes are latched as in chidb_Btree_find.
  *
  * Parameters
  * - bt: B-Tree file
- * - nroot: Page number of the root node of the B-Tree we want to insert
- *          this entry in.
- * - keyIdx: See The chidb File Format.
- * - keyPk: See The chidb File Format.
+ * - nroot: Page number of the root node of the B-Tree
+ * - n: Position of the entry
+ * - key: Out parameter. Key (or KeyIdx) of the n-th entry.
  *
  * Return
  * - CHIDB_OK: Operation successful
- * - CHIDB_EDUPLICATE: An entry with that key already exists
+ * - CHIDB_ENOTFOUND: The B-Tree has n entries or fewer
  * - CHIDB_ENOMEM: Could not allocate memory
  * - CHIDB_EIO: An I/O error has occurred when accessing the file
  */
-int chidb_Btree_insertInIndex(BTree *bt, npage_t nroot, chidb_key_t keyIdx, chidb_key_t keyPk)
+int chidb_Btree_nthKey(BTree *bt, npage_t nroot, uint32_t n, chidb_key_t *key)
 {
-    /* Your code goes here */
-    BTreeCell cell;
+    BTreeNode *btn;
+    npage_t npage = nroot, child;
+    uint32_t count;
+    ncell_t i;
+    int rt;
 
-    cell.type = PGTYPE_INDEX_LEAF;
-    cell.key = keyIdx;
-    cell.fields.indexLeaf.keyPk = keyPk;
+    if(rt = chidb_Pager_latch(bt->pager, npage, LATCH_SHARED)) { return rt; }
 
-    return chidb_Btree_insert(bt, nroot, &cell);
+    for(;;) {
+        if(rt = chidb_Btree_getNodeByPage(bt, npage, &btn)) { break; }
+        if(rt = chidb_Btree_decodeNode(btn)) { goto out; }
+
+        if(btn->type == PGTYPE_TABLE_LEAF || btn->type == PGTYPE_INDEX_LEAF) {
+            if(n < btn->n_cells) {
+                *key = btn->cells->keys[n];
+            } else {
+                rt = CHIDB_ENOTFOUND;
+            }
+            goto out;
+        }
+        for(i = 0; ; i++) {
+            if(rt = chidb_Btree_childCount(bt, btn, i, &count)) { goto out; }
+            if(n < count) { break; }
+            if(i == btn->n_cells) {
+                rt = CHIDB_ENOTFOUND;
+                goto out;
+            }
+            n -= count;
+        }
+
+        child = (i == btn->n_cells) ? btn->right_page : btn->cells->child_pages[i];
+        chidb_Btree_freeMemNode(bt, btn);
+        if(rt = chidb_Pager_latch(bt->pager, child, LATCH_SHARED)) { break; }
+        chidb_Pager_unlatch(bt->pager, npage);
+        npage = child;
+    }
+    chidb_Pager_unlatch(bt->pager, npage);
+    return rt;
+
+out:
+    chidb_Btree_freeMemNode(bt, btn);
+    chidb_Pager_unlatch(bt->pager, npage);
+    return rt;
 }
 
 
-/* Insert a BTreeCell into a B-Tree
+
+/* A child of a node that the bulk loader has not placed in a parent yet,
+ * together with the largest entry under it (which is used as the key of
+ * the cell that points to it) and the number of entries under it */
+typedef struct BTreeLoaderChild
+{
+    npage_t npage;
+    chidb_key_t key;
+    chidb_key_t keyPk;
+    uint32_t count;
+} BTreeLoaderChild;
+
+/* State of a B-Tree being built bottom-up (see chidb_Btree_loaderOpen) */
+struct BTreeLoader
+{
+    BTree *bt;
+    uint8_t type;              /* Type of the leaves */
+    BTreeNode *leaf;           /* Leaf being filled */
+    BTreeCell last;            /* Last entry added to the leaf */
+    BTreeLoaderChild *children;
+    size_t n_children;
+    size_t max_children;
+};
+
+static int chidb_Btree_loaderPush(BTreeLoader *ldr, BTreeLoaderChild child)
+{
+    if(ldr->n_children == ldr->max_children) {
+        size_t max = ldr->max_children ? 2 * ldr->max_children : 64;
+        BTreeLoaderChild *children = realloc(ldr->children, max * sizeof(BTreeLoaderChild));
+        if(children == NULL) {
+            return CHIDB_ENOMEM;
+        }
+        ldr->children = children;
+        ldr->max_children = max;
+    }
+    ldr->children[ldr->n_children++] = child;
+    return CHIDB_OK;
+}
+
+/* Start a new leaf after the current one (if any), and write the current
+ * one now that we know what page comes after it */
+static int chidb_Btree_loaderNewLeaf(BTreeLoader *ldr)
+{
+    BTreeNode *leaf;
+    npage_t npage, prev_page = SIBLING_NONE;
+    int rt;
+
+    if(rt = chidb_Btree_newNode(ldr->bt, &npage, ldr->type)) { return rt; }
+    if(rt = chidb_Btree_getNodeByPage(ldr->bt, npage, &leaf)) { return rt; }
+
+    if(ldr->leaf != NULL) {
+        prev_page = ldr->leaf->page->npage;
+        ldr->leaf->next_page = npage;
+        if(rt = chidb_Btree_writeNode(ldr->bt, ldr->leaf)) { return rt; }
+        if(rt = chidb_Btree_freeMemNode(ldr->bt, ldr->leaf)) { return rt; }
+    }
+    ldr->leaf = leaf;
+
+    return chidb_Btree_setSiblings(ldr->bt, leaf, prev_page, SIBLING_NONE);
+}
+
+
+/* Start building a B-Tree from its entries
  *
- * The chidb_Btree_insert and chidb_Btree_insertNonFull functions
- * are responsible for inserting new entries into a B-Tree, although
- * chidb_Btree_insertNonFull is the one that actually does the
- * insertion. chidb_Btree_insert, however, first checks if the root
- * has to be split (a splitting operation that is different from
- * splitting any other node). If so, chidb_Btree_split is called
- * before calling chidb_Btree_insertNonFull.
+ * The bulk loader builds a B-Tree bottom-up: entries are packed into
+ * leaves as densely as possible, and then each level of internal nodes is
+ * built from the one below it. All the nodes of a level are allocated
+ * consecutively, so the leaves of the B-Tree end up in key order in the
+ * file. The entries must be added in increasing key order with
+ * chidb_Btree_loaderAppend, and chidb_Btree_loaderClose builds the
+ * internal nodes and returns the root of the B-Tree.
  *
  * Parameters
  * - bt: B-Tree file
- * - nroot: Page number of the root node of the B-Tree we want to insert
- *          this cell in.
- * - btc: BTreeCell to insert into B-Tree
+ * - type: Type of the leaves (PGTYPE_TABLE_LEAF or PGTYPE_INDEX_LEAF)
+ * - ldr: Out parameter. Used to return the bulk loader.
  *
  * Return
  * - CHIDB_OK: Operation successful
- * - CHIDB_EDUPLICATE: An entry with that key already exists
  * - CHIDB_ENOMEM: Could not allocate memory
  * - CHIDB_EIO: An I/O error has occurred when accessing the file
  */
-int chidb_Btree_insert(BTree *bt, npage_t nroot, BTreeCell *btc)
+int chidb_Btree_loaderOpen(BTree *bt, uint8_t type, BTreeLoader **ldr)
 {
-    /* Your code goes here */
-    BTreeNode *root;
-    BTreeCell temp_cell;
-
     int rt;
 
-    if(rt = chidb_Btree_getNodeByPage(bt, nroot, &root)) { return rt; }
+    *ldr = calloc(1, sizeof(BTreeLoader));
+    if(*ldr == NULL) {
+        return CHIDB_ENOMEM;
+    }
+    (*ldr)->bt = bt;
+    (*ldr)->type = type;
 
-    if(if_BtreeNode_Full(root, btc)) { // root need to be splited
-        BTreeNode *rchild;
-        npage_t nrchild;
-        BTreeNode *lchild;
-        npage_t nlchild;
-        uint8_t root_type = root->type;
+    if(rt = chidb_Btree_loaderNewLeaf(*ldr)) {
+        chidb_Btree_loaderFree(*ldr);
+        return rt;
+    }
+    return CHIDB_OK;
+}
 
-        if(root_type == PGTYPE_INDEX_LEAF) {
-            root_type = PGTYPE_INDEX_INTERNAL;
-        } else if(root_type == PGTYPE_TABLE_LEAF) {
-            root_type = PGTYPE_TABLE_INTERNAL;
+
+/* Add an entry to a B-Tree being built by the bulk loader
+ *
+ * An index entry equal to the last one added is ignored, so the entries of
+ * an index B-Tree can be taken from both its internal nodes and its leaves.
+ *
+ * Parameters
+ * - ldr: Bulk loader
+ * - btc: Entry to add. Must be a leaf cell with a key (or, for an index,
+ *        a (KeyIdx, KeyPk)) larger than that of every entry added so far.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EVALIDEARG: The cell does not fit in an empty leaf
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_loaderAppend(BTreeLoader *ldr, BTreeCell *btc)
+{
+    int rt;
+
+    if(ldr->leaf->n_cells > 0) {
+        if(btc->type == PGTYPE_INDEX_LEAF && btc->key == ldr->last.key &&
+           btc->fields.indexLeaf.keyPk == ldr->last.fields.indexLeaf.keyPk) {
+            return CHIDB_OK;
         }
 
-        if(rt = chidb_Btree_newNode(bt, &nrchild, root->type)) { return rt; }
-        if(rt = chidb_Btree_getNodeByPage(bt, nrchild, &rchild)) { return rt; }
-        if(rt = chidb_Btree_newNode(bt, &nlchild, root->type)) { return rt; }
-        if(rt = chidb_Btree_getNodeByPage(bt, nlchild, &lchild)) { return rt; }
+        if(if_BtreeNode_Full(ldr->leaf, btc)) {
+            BTreeLoaderChild child = {ldr->leaf->page->npage, ldr->last.key,
+                                      ldr->last.fields.indexLeaf.keyPk, ldr->leaf->n_cells};
+            if(rt = chidb_Btree_loaderPush(ldr, child)) { return rt; }
+            if(rt = chidb_Btree_loaderNewLeaf(ldr)) { return rt; }
+        }
+    }
 
-        ncell_t nmid_cell = root->n_cells / 2;
-        BTreeCell mid_cell, new_cell;
+    if(if_BtreeNode_Full(ldr->leaf, btc)) {
+        return CHIDB_EVALIDEARG;
+    }
+    if(rt = chidb_Btree_insertCell(ldr->leaf, ldr->leaf->n_cells, btc)) { return rt; }
+    ldr->last = *btc;
+    if(btc->type != PGTYPE_INDEX_LEAF) {
+        ldr->last.fields.indexLeaf.keyPk = 0;
+    }
+    return CHIDB_OK;
+}
 
-        if(rt = chidb_Btree_getCell(root, nmid_cell, &mid_cell)) { return rt; }
 
-        for(int i = 0; i < nmid_cell; i++) {
-            BTreeCell cell;
-            if(rt = chidb_Btree_getCell(root, i, &cell)) { return rt; }
-            if(rt = chidb_Btree_insertCell(lchild, i, &cell)) { return rt; }
-        }
+/* Build one level of internal nodes over the children in ldr->children,
+ * which are replaced by the new nodes. Children are spread evenly over
+ * as few nodes as possible, so that no node ends up with a single child.
+ * The internal nodes of a table are counted (see PGFLAG_SUBTREE_COUNTS). */
+static int chidb_Btree_loaderLevel(BTreeLoader *ldr)
+{
+    uint8_t type = ldr->type == PGTYPE_TABLE_LEAF ? PGTYPE_TABLE_INTERNAL : PGTYPE_INDEX_INTERNAL;
+    uint16_t cell_size = type == PGTYPE_TABLE_INTERNAL ? TABLEINTCELL_SIZE_WITHCOUNT : INDEXINTCELL_SIZE;
+    uint16_t trailer = type == PGTYPE_TABLE_INTERNAL ? INTPG_COUNTS_SIZE : 0;
+    size_t fanout = (ldr->bt->pager->page_size - trailer - INTPG_CELLSOFFSET_OFFSET) / (cell_size + 2) + 1;
+    size_t n = ldr->n_children;
+    size_t n_nodes = (n + fanout - 1) / fanout;
+    size_t next = 0;
+    int rt;
 
-        switch(mid_cell.type) {
-            case PGTYPE_INDEX_LEAF:
-                if(rt = chidb_Btree_insertCell(lchild, nmid_cell, &mid_cell)) { return rt; }
-                new_cell.type = PGTYPE_INDEX_INTERNAL;
-                new_cell.key = mid_cell.key;
-                new_cell.fields.indexInternal.child_page = nlchild;
-                new_cell.fields.indexInternal.keyPk = mid_cell.fields.indexLeaf.keyPk;
-                lchild->right_page = nrchild;
-                break;
-            case PGTYPE_INDEX_INTERNAL:
-                new_cell.type = PGTYPE_INDEX_INTERNAL;
-                new_cell.key = mid_cell.key;
-                new_cell.fields.indexInternal.child_page = nlchild;
-                new_cell.fields.indexInternal.keyPk = mid_cell.fields.indexInternal.keyPk;
-                lchild->right_page = mid_cell.fields.indexInternal.child_page;
-                break;
-            case PGTYPE_TABLE_LEAF:
-                if(rt = chidb_Btree_insertCell(lchild, nmid_cell, &mid_cell)) { return rt; }
-                new_cell.type = PGTYPE_TABLE_INTERNAL;
-                new_cell.key = mid_cell.key;
-                new_cell.fields.tableInternal.child_page = nlchild;
-                lchild->right_page = nrchild;
-                break;
-            case PGTYPE_TABLE_INTERNAL:
-                new_cell.type = PGTYPE_TABLE_INTERNAL;
-                new_cell.key = mid_cell.key;
-                new_cell.fields.tableInternal.child_page = nlchild;
-                lchild->right_page = mid_cell.fields.tableInternal.child_page;
-                break;
-            default:
-                break;
+    for(size_t j = 0; j < n_nodes; j++) {
+        size_t count = n / n_nodes + (j < n % n_nodes ? 1 : 0);
+        BTreeLoaderChild *first = ldr->children + next;
+        BTreeLoaderChild last = first[count - 1];
+        BTreeNode *btn;
+        npage_t npage;
+
+        if(rt = chidb_Btree_newNode(ldr->bt, &npage, type)) { return rt; }
+        if(rt = chidb_Btree_getNodeByPage(ldr->bt, npage, &btn)) { return rt; }
+        if(type == PGTYPE_TABLE_INTERNAL) {
+            if(rt = chidb_Btree_setCounted(ldr->bt, btn)) { return rt; }
         }
 
-        for(int i = nmid_cell + 1, j = 0; i < root->n_cells; i++, j++) {
+        for(size_t k = 0; k + 1 < count; k++) {
             BTreeCell cell;
-            if(rt = chidb_Btree_getCell(root, i, &cell)) { return rt; }
-            if(rt = chidb_Btree_insertCell(rchild, j, &cell)) { return rt; }
+            cell.type = type;
+            cell.key = first[k].key;
+            last.count += first[k].count;
+            if(type == PGTYPE_TABLE_INTERNAL) {
+                cell.fields.tableInternal.child_page = first[k].npage;
+                cell.fields.tableInternal.count = first[k].count;
+            } else {
+                cell.fields.indexInternal.child_page = first[k].npage;
+                cell.fields.indexInternal.keyPk = first[k].keyPk;
+            }
+            if(rt = chidb_Btree_insertCell(btn, k, &cell)) { return rt; }
         }
-        rchild->right_page = root->right_page;
+        btn->right_page = last.npage;
+        btn->right_count = first[count - 1].count;
+        if(rt = chidb_Btree_writeNode(ldr->bt, btn)) { return rt; }
+        if(rt = chidb_Btree_freeMemNode(ldr->bt, btn)) { return rt; }
+
+        /* Nodes are only ever written over children already consumed */
+        last.npage = npage;
+        ldr->children[j] = last;
+        next += count;
+    }
+    ldr->n_children = n_nodes;
+    return CHIDB_OK;
+}
 
-        if(rt = chidb_Btree_freeMemNode(bt, root)) { return rt; }
-        if(rt = chidb_Btree_initEmptyNode(bt, nroot, root_type)) { return rt; }
-        if(rt = chidb_Btree_getNodeByPage(bt, nroot, &root)) { return rt; }
 
-        if(rt = chidb_Btree_insertCell(root, 0, &new_cell)) { return rt; }
-        root->right_page = nrchild;
+/* Finish building a B-Tree with the bulk loader
+ *
+ * Writes the last leaf, builds the internal nodes, and frees the loader.
+ *
+ * Parameters
+ * - ldr: Bulk loader
+ * - nroot: Out parameter. Page number of the root of the new B-Tree.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_loaderClose(BTreeLoader *ldr, npage_t *nroot)
+{
+    BTreeLoaderChild child = {ldr->leaf->page->npage, ldr->last.key,
+                              ldr->last.fields.indexLeaf.keyPk, ldr->leaf->n_cells};
+    int rt;
 
-        if(rt = chidb_Btree_writeNode(bt, lchild)) { return rt; }
-        if(rt = chidb_Btree_freeMemNode(bt, lchild)) { return rt; }
-        lchild = NULL;
+    if(rt = chidb_Btree_writeNode(ldr->bt, ldr->leaf)) { goto out; }
+    if(rt = chidb_Btree_loaderPush(ldr, child)) { goto out; }
 
-        if(rt = chidb_Btree_writeNode(bt, rchild)) { return rt; }
-        if(rt = chidb_Btree_freeMemNode(bt, rchild)) { return rt; }
-        rchild = NULL;
+    while(ldr->n_children > 1) {
+        if(rt = chidb_Btree_loaderLevel(ldr)) { goto out; }
+    }
+    *nroot = ldr->children[0].npage;
+
+out:
+    chidb_Btree_loaderFree(ldr);
+    return rt;
+}
+
+
+/* Free a bulk loader without finishing the B-Tree (see chidb_Btree_loaderOpen) */
+int chidb_Btree_loaderFree(BTreeLoader *ldr)
+{
+    if(ldr->leaf != NULL) {
+        chidb_Btree_freeMemNode(ldr->bt, ldr->leaf);
+    }
+    free(ldr->children);
+    free(ldr);
+    return CHIDB_OK;
+}
+
+
+/* Add every entry of a B-Tree (in key order) to a bulk loader */
+static int chidb_Btree_loadEntries(BTree *bt, npage_t npage, BTreeLoader *ldr)
+{
+    BTreeNode *btn;
+    BTreeCell cell;
+    int rt;
+
+    if(rt = chidb_Btree_getNodeByPage(bt, npage, &btn)) { return rt; }
+
+    for(ncell_t i = 0; i < btn->n_cells; i++) {
+        if(rt = chidb_Btree_getCell(btn, i, &cell)) { break; }
+
+        if(cell.type == PGTYPE_TABLE_INTERNAL) {
+            rt = chidb_Btree_loadEntries(bt, cell.fields.tableInternal.child_page, ldr);
+        }
+        else if(cell.type == PGTYPE_INDEX_INTERNAL) {
+            /* Entries of internal index nodes are entries of the index too */
+            BTreeCell entry;
+            entry.type = PGTYPE_INDEX_LEAF;
+            entry.key = cell.key;
+            entry.fields.indexLeaf.keyPk = cell.fields.indexInternal.keyPk;
+            entry.fields.indexLeaf.data_size = 0;
+            if(!(rt = chidb_Btree_loadEntries(bt, cell.fields.indexInternal.child_page, ldr))) {
+                rt = chidb_Btree_loaderAppend(ldr, &entry);
+            }
+        }
+        else {
+            rt = chidb_Btree_loaderAppend(ldr, &cell);
+        }
+        if(rt) { break; }
+    }
+
+    if(!rt && (btn->type == PGTYPE_TABLE_INTERNAL || btn->type == PGTYPE_INDEX_INTERNAL)) {
+        rt = chidb_Btree_loadEntries(bt, btn->right_page, ldr);
+    }
+
+    chidb_Btree_freeMemNode(bt, btn);
+    return rt;
+}
+
+
+/* Rebuild a B-Tree compactly in key order
+ *
+ * Reads every entry of a B-Tree and loads them into a new B-Tree with the
+ * bulk loader (see chidb_Btree_loaderOpen). The new B-Tree can be in
+ * another file, which is how chidb_vacuum compacts a database.
+ *
+ * Parameters
+ * - bt: B-Tree file of the B-Tree to rebuild
+ * - nroot: Page number of the root of the B-Tree to rebuild
+ * - dst: B-Tree file where the new B-Tree is built (might be bt)
+ * - new_nroot: Out parameter. Page number of the root of the new B-Tree.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_rebuild(BTree *bt, npage_t nroot, BTree *dst, npage_t *new_nroot)
+{
+    BTreeNode *root;
+    BTreeLoader *ldr;
+    uint8_t type;
+    int rt;
+
+    if(rt = chidb_Btree_getNodeByPage(bt, nroot, &root)) { return rt; }
+    type = (root->type == PGTYPE_TABLE_INTERNAL || root->type == PGTYPE_TABLE_LEAF) ?
+                PGTYPE_TABLE_LEAF : PGTYPE_INDEX_LEAF;
+    chidb_Btree_freeMemNode(bt, root);
+
+    if(rt = chidb_Btree_loaderOpen(dst, type, &ldr)) { return rt; }
+    if(rt = chidb_Btree_loadEntries(bt, nroot, ldr)) {
+        chidb_Btree_loaderFree(ldr);
+        return rt;
+    }
+    return chidb_Btree_loaderClose(ldr, new_nroot);
+}
+
+
+/* State of chidb_Btree_copy: the last leaf copied is only written once
+ * the page of the next leaf is known */
+typedef struct BTreeCopy
+{
+    BTree *bt;
+    BTree *dst;
+    MemPage *leaf;
+    bool leaf_links;
+} BTreeCopy;
+
+static int chidb_Btree_copyLeafDone(BTreeCopy *cp, npage_t next_page)
+{
+    int rt;
+
+    if(cp->leaf == NULL) {
+        return CHIDB_OK;
+    }
+    if(cp->leaf_links) {
+        put4byte(cp->leaf->data + LEAFPG_NEXTPG_OFFSET(cp->dst->pager->page_size), next_page);
     }
+    rt = chidb_Pager_writePage(cp->dst->pager, cp->leaf);
+    chidb_Pager_releaseMemPage(cp->dst->pager, cp->leaf);
+    cp->leaf = NULL;
+    return rt;
+}
 
-    if(rt = chidb_Btree_writeNode(bt, root)) { return rt; }
-    if(rt = chidb_Btree_freeMemNode(bt, root)) { return rt; }
-    root = NULL;
+static int chidb_Btree_copyNode(BTreeCopy *cp, npage_t npage, npage_t *new_npage)
+{
+    BTreeNode *btn;
+    MemPage *page;
+    int rt;
+
+    if(rt = chidb_Btree_getNodeByPage(cp->bt, npage, &btn)) { return rt; }
+    if(rt = chidb_Pager_allocatePage(cp->dst->pager, new_npage)) { goto out; }
+    if(rt = chidb_Pager_readPage(cp->dst->pager, *new_npage, &page)) { goto out; }
+    memcpy(page->data, btn->page->data, cp->bt->pager->page_size);
+
+    if(btn->type == PGTYPE_TABLE_INTERNAL || btn->type == PGTYPE_INDEX_INTERNAL) {
+        npage_t child;
+        for(ncell_t i = 0; !rt && i < btn->n_cells; i++) {
+            uint8_t *cell = page->data + get2byte(btn->celloffset_array + 2 * i);
+            if(!(rt = chidb_Btree_copyNode(cp, get4byte(cell), &child))) {
+                put4byte(cell, child);
+            }
+        }
+        if(!rt && !(rt = chidb_Btree_copyNode(cp, btn->right_page, &child))) {
+            put4byte(page->data + PGHEADER_RIGHTPG_OFFSET, child);
+        }
+        if(!rt) {
+            rt = chidb_Pager_writePage(cp->dst->pager, page);
+        }
+        chidb_Pager_releaseMemPage(cp->dst->pager, page);
+    }
+    else {
+        npage_t prev_page = cp->leaf ? cp->leaf->npage : SIBLING_NONE;
+        if(rt = chidb_Btree_copyLeafDone(cp, *new_npage)) {
+            chidb_Pager_releaseMemPage(cp->dst->pager, page);
+            goto out;
+        }
+        cp->leaf = page;
+        cp->leaf_links = btn->flags & PGFLAG_LEAF_SIBLINGS;
+        if(cp->leaf_links) {
+            put4byte(page->data + LEAFPG_PREVPG_OFFSET(cp->dst->pager->page_size), prev_page);
+        }
+    }
 
-    return chidb_Btree_insertNonFull(bt, nroot, btc);
+out:
+    chidb_Btree_freeMemNode(cp->bt, btn);
+    return rt;
 }
 
-/* Insert a BTreeCell into a non-full B-Tree node
+
+/* Copy a B-Tree to other pages
  *
- * chidb_Btree_insertNonFull inserts a BTreeCell into a node that is
- * assumed not to be full (i.e., does not require splitting). If the
- * node is a leaf node, the cell is directly added in the appropriate
- * position according to its key. If the node is an internal node, the
- * function will determine what child node it must insert it in, and
- * calls itself recursively on that child node. However, before doing so
- * it will check if the child node is full or not. If it is, then it will
- * have to be split first.
+ * Copies every node of a B-Tree as is, to newly allocated pages, updating
+ * the page numbers of children and sibling leaves. Unlike
+ * chidb_Btree_rebuild, the shape of the B-Tree does not change, but its
+ * pages are allocated consecutively (in depth-first order).
+ *
+ * The root of the B-Tree cannot be page 1, since the node
+ * in page 1 does not start at the beginning of the page.
  *
  * Parameters
- * - bt: B-Tree file
- * - nroot: Page number of the root node of the B-Tree we want to insert
- *          this cell in.
- * - btc: BTreeCell to insert into B-Tree
+ * - bt: B-Tree file of the B-Tree to copy
+ * - nroot: Page number of the root of the B-Tree to copy
+ * - dst: B-Tree file where the B-Tree is copied to (with the same page size)
+ * - new_nroot: Out parameter. Page number of the root of the copy.
  *
  * Return
  * - CHIDB_OK: Operation successful
- * - CHIDB_EDUPLICATE: An entry with that key already exists
+ * - CHIDB_EVALIDEARG: nroot is page 1, or the page sizes are different
  * - CHIDB_ENOMEM: Could not allocate memory
  * - CHIDB_EIO: An I/O error has occurred when accessing the file
  */
-int chidb_Btree_insertNonFull(BTree *bt, npage_t npage, BTreeCell *btc)
+int chidb_Btree_copy(BTree *bt, npage_t nroot, BTree *dst, npage_t *new_nroot)
 {
-    /* Your code goes here */
-    BTreeNode *btn;
+    BTreeCopy cp = {bt, dst, NULL, false};
     int rt;
-    BTreeCell cell;
-    int i;
-    npage_t npage_child;
 
-    if(rt = chidb_Btree_getNodeByPage(bt, npage, &btn)) { return rt; }
+    if(nroot == 1 || bt->pager->page_size != dst->pager->page_size) {
+        return CHIDB_EVALIDEARG;
+    }
 
-    for(i = 0; i < btn->n_cells; i++) {
-        if(rt = chidb_Btree_getCell(btn, i, &cell)) { return rt; }
-        if(cell.key >= btc->key) {
-            break;
+    rt = chidb_Btree_copyNode(&cp, nroot, new_nroot);
+    if(rt) {
+        if(cp.leaf != NULL) {
+            chidb_Pager_releaseMemPage(dst->pager, cp.leaf);
         }
+        return rt;
     }
+    return chidb_Btree_copyLeafDone(&cp, SIBLING_NONE);
+}
 
-    if(i == btn->n_cells) {
-        npage_child = btn->right_page;
-    }
-    else {
-        if(cell.key == btc->key && cell.type == btc->type) {
-            if(rt = chidb_Btree_freeMemNode(bt, btn)) { return rt; }
-            return CHIDB_EDUPLICATE;
-        }
-        npage_child = btn->type == PGTYPE_INDEX_INTERNAL ?
-                        cell.fields.indexInternal.child_page :
-                        cell.fields.tableInternal.child_page;
+
+/* Adds a node (and, recursively, its children) to the statistics of
+ * chidb_Btree_analyze. last_leaf is the previous leaf in key order. */
+static int chidb_Btree_analyzeNode(BTree *bt, npage_t npage, uint32_t level, BTreeStats *stats, npage_t *last_leaf)
+{
+    BTreeNode *btn;
+    BTreeCell btc;
+    uint32_t usable, used;
+    double fill;
+    bool leaf;
+    int rt;
+
+    if(level >= BTREE_STATS_MAX_DEPTH) {
+        return CHIDB_ECORRUPT;
     }
 
-    if(btn->type == btc->type) {
-        if(rt = chidb_Btree_insertCell(btn, i, btc)) { return rt; }
-        if(rt = chidb_Btree_writeNode(bt, btn)) { return rt; }
-        if(rt = chidb_Btree_freeMemNode(bt, btn)) { return rt; }
-        return CHIDB_OK;
+    if(rt = chidb_Btree_getNodeByPage(bt, npage, &btn)) {
+        return rt;
     }
 
-    if(rt = chidb_Btree_freeMemNode(bt, btn)) { return rt; }
+    leaf = btn->type == PGTYPE_TABLE_LEAF || btn->type == PGTYPE_INDEX_LEAF;
+    usable = bt->pager->page_size - (npage == 1 ? 100 : 0);
+    if(leaf && (btn->flags & PGFLAG_LEAF_SIBLINGS)) {
+        usable -= LEAFPG_SIBLINGS_SIZE;
+    }
+    if(!leaf && (btn->flags & PGFLAG_SUBTREE_COUNTS)) {
+        usable -= INTPG_COUNTS_SIZE;
+    }
+    used = (leaf ? LEAFPG_CELLSOFFSET_OFFSET : INTPG_CELLSOFFSET_OFFSET) + 2 * btn->n_cells;
 
-    BTreeNode *child;
-    npage_t napge_child2;
+    for(ncell_t i = 0; i < btn->n_cells; i++)
+    {
+        uint16_t size;
 
-    if(rt = chidb_Btree_getNodeByPage(bt, npage_child, &child)) { return rt; }
-    int full = if_BtreeNode_Full(child, btc);
-    if(rt = chidb_Btree_freeMemNode(bt, child)) { return rt; }
-    if(full) {
-        if(rt = chidb_Btree_split(bt, npage, npage_child, i, &napge_child2)) {
+        if(rt = chidb_Btree_getCell(btn, i, &btc)) {
+            chidb_Btree_freeMemNode(bt, btn);
             return rt;
         }
-        return chidb_Btree_insertNonFull(bt, npage, btc);
+
+        size = chidb_Btree_cellSize(btn, &btc);
+        used += size;
+        if(size > stats->max_cell_size) {
+            stats->max_cell_size = size;
+        }
+        if(size > usable / 4) {
+            stats->n_large_cells++;
+        }
+
+        if(!leaf)
+        {
+            npage_t child = btc.type == PGTYPE_TABLE_INTERNAL ?
+                                btc.fields.tableInternal.child_page :
+                                btc.fields.indexInternal.child_page;
+            if(rt = chidb_Btree_analyzeNode(bt, child, level + 1, stats, last_leaf)) {
+                chidb_Btree_freeMemNode(bt, btn);
+                return rt;
+            }
+        }
     }
-    return chidb_Btree_insertNonFull(bt, npage_child, btc);
+
+    if(!leaf) {
+        rt = chidb_Btree_analyzeNode(bt, btn->right_page, level + 1, stats, last_leaf);
+    }
+    else
+    {
+        if(*last_leaf != SIBLING_NONE && npage == *last_leaf + 1) {
+            stats->n_leaves_in_order++;
+        }
+        *last_leaf = npage;
+        stats->n_leaves++;
+    }
+
+    fill = (double) used / usable;
+    if(stats->n_pages == 0 || fill < stats->min_fill) {
+        stats->min_fill = fill;
+    }
+    stats->avg_fill += fill;
+    stats->n_pages++;
+    stats->level_pages[level]++;
+    if(level + 1 > stats->depth) {
+        stats->depth = level + 1;
+    }
+    if(level == 0) {
+        stats->type = btn->type;
+    }
+    stats->n_cells += btn->n_cells;
+    stats->usable_bytes += usable;
+    stats->used_bytes += used;
+    stats->fragmented_bytes += usable - used - (btn->cells_offset - btn->free_offset);
+
+    chidb_Btree_freeMemNode(bt, btn);
+    return rt;
 }
 
 
-/* Split a B-Tree node
+/* Analyze the space usage and shape of a B-Tree
  *
- * Splits a B-Tree node N. This involves the following:
- * - Find the median cell in N.
- * - Create a new B-Tree node M.
- * - Move the cells before the median cell to M (if the
- *   cell is a table leaf cell, the median cell is moved too)
- * - Add a cell to the parent (which, by definition, will be an
- *   internal page) with the median key and the page number of M.
+ * Visits every node of the B-Tree, and collects the statistics described
+ * in BTreeStats: the number of pages in each level, how full they are,
+ * how much of their free space is fragmented, how many leaves are stored
+ * in the file in the same order as their keys (which is what makes a
+ * scan read the file sequentially), and how big the cells are. This
+ * information can be used to decide when a B-Tree should be rebuilt
+ * (see chidb_Btree_rebuild).
+ *
+ * chidb has no overflow pages, so a cell always has to fit in a single
+ * page. Cells bigger than a quarter of a page (which SQLite would spill
+ * to overflow pages) are counted instead, since a few of them are
+ * enough to fill a node.
  *
  * Parameters
  * - bt: B-Tree file
- * - npage_parent: Page number of the parent node
- * - npage_child: Page number of the node to split
- * - parent_ncell: Position in the parent where the new cell will
- *                 be inserted.
- * - npage_child2: Out parameter. Used to return the page of the new child node.
+ * - nroot: Page number of the root of the B-Tree
+ * - stats: Out parameter. Statistics of the B-Tree.
  *
  * Return
  * - CHIDB_OK: Operation successful
+ * - CHIDB_ECORRUPT: The B-Tree is deeper than BTREE_STATS_MAX_DEPTH
  * - CHIDB_ENOMEM: Could not allocate memory
  * - CHIDB_EIO: An I/O error has occurred when accessing the file
  */
-int chidb_Btree_split(BTree *bt, npage_t npage_parent, npage_t npage_child, ncell_t parent_ncell, npage_t *npage_child2)
+int chidb_Btree_analyze(BTree *bt, npage_t nroot, BTreeStats *stats)
 {
-    /* Your code goes here */
-    BTreeNode *parent, *rchild, *lchild; // parent:npage_parent, rchild:npage_child, lchild:npage_child2
-    BTreeNode *temp_node;
+    npage_t last_leaf = SIBLING_NONE;
     int rt;
 
-    if(rt = chidb_Btree_getNodeByPage(bt, npage_parent, &parent)) { return rt; }
-    if(rt = chidb_Btree_getNodeByPage(bt, npage_child, &rchild)) { return rt; }
+    memset(stats, 0, sizeof(BTreeStats));
 
-    if(rt = chidb_Btree_newNode(bt, npage_child2, rchild->type)) { return rt; }
-    if(rt = chidb_Btree_getNodeByPage(bt, *npage_child2, &lchild)) { return rt; }
+    if(rt = chidb_Btree_analyzeNode(bt, nroot, 0, stats, &last_leaf)) {
+        return rt;
+    }
+    stats->avg_fill /= stats->n_pages;
 
-    get_tempBtreeNode(bt, &temp_node, rchild->type);
+    return CHIDB_OK;
+}
 
-    ncell_t nmid_cell = rchild->n_cells / 2;
-    BTreeCell mid_cell, new_cell;
 
-    if(chidb_Btree_getCell(rchild, nmid_cell, &mid_cell)) { return rt; }
+/* Bit positions of a key in a Bloom filter. The BTREE_BLOOM_NHASHES
+ * positions are h1 + i * h2, where h1 and h2 are two hashes of the key
+ * (h2 is odd, so that the positions are all different) */
+static uint32_t chidb_Btree_bloomMix(uint32_t h)
+{
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
 
-    for(int i = 0; i < nmid_cell; i++) {
-        BTreeCell cell;
-        if(rt = chidb_Btree_getCell(rchild, i, &cell)) { return rt; }
-        if(rt = chidb_Btree_insertCell(lchild, i, &cell)) { return rt; }
+#define BLOOM_H1(key) (chidb_Btree_bloomMix(key))
+#define BLOOM_H2(key) (chidb_Btree_bloomMix((key) ^ 0x9e3779b9) | 1)
+
+
+/* Find the Bloom filter of a B-Tree
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root of the B-Tree
+ *
+ * Return
+ * - The Bloom filter of the B-Tree, or NULL if it has none
+ */
+BTreeBloom *chidb_Btree_getBloom(BTree *bt, npage_t nroot)
+{
+    for(BTreeBloom *bloom = bt->blooms; bloom != NULL; bloom = bloom->next)
+        if(bloom->nroot == nroot)
+            return bloom;
+    return NULL;
+}
+
+
+/* Add a key to the Bloom filter of a B-Tree, if it has one. Bits are set
+ * atomically, since other threads might be inserting into or looking up
+ * the same B-Tree. */
+static void chidb_Btree_bloomAdd(BTree *bt, npage_t nroot, chidb_key_t key)
+{
+    BTreeBloom *bloom = chidb_Btree_getBloom(bt, nroot);
+    uint32_t h1 = BLOOM_H1(key), h2 = BLOOM_H2(key);
+
+    if(bloom == NULL)
+        return;
+
+    for(int i = 0; i < BTREE_BLOOM_NHASHES; i++, h1 += h2)
+    {
+        uint32_t bit = h1 & (bloom->n_bits - 1);
+        __atomic_fetch_or(&bloom->bits[bit / 64], 1ull << (bit % 64), __ATOMIC_RELEASE);
     }
+    __atomic_add_fetch(&bloom->n_keys, 1, __ATOMIC_RELAXED);
+}
 
-    switch(mid_cell.type) {
-        case PGTYPE_INDEX_LEAF:
-            if(rt = chidb_Btree_insertCell(lchild, nmid_cell, &mid_cell)) { return rt; }
-            new_cell.type = PGTYPE_INDEX_INTERNAL;
-            new_cell.key = mid_cell.key;
-            new_cell.fields.indexInternal.child_page = *npage_child2;
-            new_cell.fields.indexInternal.keyPk = mid_cell.fields.indexLeaf.keyPk;
-            lchild->right_page = npage_child;
-            break;
-        case PGTYPE_INDEX_INTERNAL:
-            new_cell.type = PGTYPE_INDEX_INTERNAL;
-            new_cell.key = mid_cell.key;
-            new_cell.fields.indexInternal.child_page = *npage_child2;
-            new_cell.fields.indexInternal.keyPk = mid_cell.fields.indexInternal.keyPk;
-            lchild->right_page = mid_cell.fields.indexInternal.child_page;
-            break;
-        case PGTYPE_TABLE_LEAF:
-            if(rt = chidb_Btree_insertCell(lchild, nmid_cell, &mid_cell)) { return rt; }
-            new_cell.type = PGTYPE_TABLE_INTERNAL;
-            new_cell.key = mid_cell.key;
-            new_cell.fields.tableInternal.child_page = *npage_child2;
-            lchild->right_page = npage_child;
-            break;
-        case PGTYPE_TABLE_INTERNAL:
-            new_cell.type = PGTYPE_TABLE_INTERNAL;
-            new_cell.key = mid_cell.key;
-            new_cell.fields.tableInternal.child_page = *npage_child2;
-            lchild->right_page = mid_cell.fields.tableInternal.child_page;
-            break;
-        default:
-            break;
+
+/* Check whether a key might be in a B-Tree
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root of the B-Tree
+ * - key: Key to look for
+ *
+ * Return
+ * - false if the key is definitely not in the B-Tree
+ * - true if the key might be in the B-Tree (always the case when the
+ *   B-Tree has no Bloom filter)
+ */
+bool chidb_Btree_bloomMayContain(BTree *bt, npage_t nroot, chidb_key_t key)
+{
+    BTreeBloom *bloom = chidb_Btree_getBloom(bt, nroot);
+    uint32_t h1 = BLOOM_H1(key), h2 = BLOOM_H2(key);
+
+    if(bloom == NULL)
+        return true;
+
+    for(int i = 0; i < BTREE_BLOOM_NHASHES; i++, h1 += h2)
+    {
+        uint32_t bit = h1 & (bloom->n_bits - 1);
+        if(!(__atomic_load_n(&bloom->bits[bit / 64], __ATOMIC_ACQUIRE) & (1ull << (bit % 64))))
+            return false;
     }
+    return true;
+}
 
-    for(int i = nmid_cell + 1, j = 0; i < rchild->n_cells; i++, j++) {
-        BTreeCell cell;
-        if(rt = chidb_Btree_getCell(rchild, i, &cell)) { return rt; }
-        if(rt = chidb_Btree_insertCell(temp_node, j, &cell)) { return rt; }
+
+/* Keys of a B-Tree, gathered by chidb_Btree_bloomCollect */
+typedef struct BTreeKeys
+{
+    chidb_key_t *keys;
+    uint32_t n_keys;
+    uint32_t capacity;
+} BTreeKeys;
+
+/* Gather the key of every cell of a B-Tree. In an index B-Tree, internal
+ * cells are entries too; in a table B-Tree, their keys are also in the
+ * leaves, so adding them to the filter only costs a few bits. */
+static int chidb_Btree_bloomCollect(BTree *bt, npage_t npage, BTreeKeys *keys)
+{
+    BTreeNode *btn;
+    BTreeCell cell;
+    int rt = CHIDB_OK;
+
+    if(rt = chidb_Btree_getNodeByPage(bt, npage, &btn)) { return rt; }
+
+    for(ncell_t i = 0; !rt && i < btn->n_cells; i++)
+    {
+        if(rt = chidb_Btree_getCell(btn, i, &cell)) { break; }
+
+        if(keys->n_keys == keys->capacity)
+        {
+            uint32_t capacity = keys->capacity ? keys->capacity * 2 : BTREE_BLOOM_MIN_KEYS;
+            chidb_key_t *grown = realloc(keys->keys, capacity * sizeof(chidb_key_t));
+            if(grown == NULL)
+            {
+                rt = CHIDB_ENOMEM;
+                break;
+            }
+            keys->keys = grown;
+            keys->capacity = capacity;
+        }
+        keys->keys[keys->n_keys++] = cell.key;
+
+        if(cell.type == PGTYPE_TABLE_INTERNAL)
+            rt = chidb_Btree_bloomCollect(bt, cell.fields.tableInternal.child_page, keys);
+        else if(cell.type == PGTYPE_INDEX_INTERNAL)
+            rt = chidb_Btree_bloomCollect(bt, cell.fields.indexInternal.child_page, keys);
     }
-    temp_node->right_page = rchild->right_page;
 
-    if(rt = chidb_Btree_insertCell(parent, parent_ncell, &new_cell)) { return rt; }
+    if(!rt && (btn->type == PGTYPE_TABLE_INTERNAL || btn->type == PGTYPE_INDEX_INTERNAL))
+        rt = chidb_Btree_bloomCollect(bt, btn->right_page, keys);
 
-    uint8_t rchild_type = rchild->type;
-    if(rt = chidb_Btree_freeMemNode(bt, rchild)) { return rt; }
-    if(rt = chidb_Btree_initEmptyNode(bt, npage_child, rchild_type)) { return rt; }
-    if(rt = chidb_Btree_getNodeByPage(bt, npage_child, &rchild)) { return rt; }
+    chidb_Btree_freeMemNode(bt, btn);
+    return rt;
+}
 
-    for(int i = 0; i < temp_node->n_cells; i++) {
-        BTreeCell cell;
-        if(rt = chidb_Btree_getCell(temp_node, i, &cell)) { return rt; }
-        if(rt = chidb_Btree_insertCell(rchild, i, &cell)) { return rt; }
+
+/* Build the Bloom filter of a B-Tree
+ *
+ * Reads every key of a B-Tree and builds a Bloom filter of them, which
+ * replaces the filter the B-Tree had, if any. The filter has room for
+ * twice as many keys as the B-Tree has now; inserting more keys than
+ * that does not make lookups wrong, only makes the filter less useful,
+ * until it is built again.
+ *
+ * This function must not run concurrently with other operations on the
+ * same B-Tree file (for example, it can be called after opening the file).
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root of the B-Tree
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_bloomBuild(BTree *bt, npage_t nroot)
+{
+    BTreeKeys keys = { NULL, 0, 0 };
+    BTreeBloom *bloom;
+    uint64_t *bits;
+    uint64_t n_bits = 64;
+    int rt;
+
+    if(rt = chidb_Btree_bloomCollect(bt, nroot, &keys))
+    {
+        free(keys.keys);
+        return rt;
     }
-    rchild->right_page = temp_node->right_page;
 
-    free_tempBtreeNode(temp_node);
-    temp_node = NULL;
+    uint64_t capacity = (uint64_t) keys.n_keys * 2;
+    if(capacity < BTREE_BLOOM_MIN_KEYS)
+        capacity = BTREE_BLOOM_MIN_KEYS;
+    while(n_bits < capacity * BTREE_BLOOM_BITS_PER_KEY && n_bits < (1ull << 31))
+        n_bits *= 2;
 
-    if(rt = chidb_Btree_writeNode(bt, parent)) { return rt; }
-    if(rt = chidb_Btree_writeNode(bt, rchild)) { return rt; }
-    if(rt = chidb_Btree_writeNode(bt, lchild)) { return rt; }
+    if((bits = calloc(n_bits / 64, sizeof(uint64_t))) == NULL)
+    {
+        free(keys.keys);
+        return CHIDB_ENOMEM;
+    }
 
-    if(rt = chidb_Btree_freeMemNode(bt, parent)) { return rt; }
-    if(rt = chidb_Btree_freeMemNode(bt, rchild)) { return rt; }
-    if(rt = chidb_Btree_freeMemNode(bt, lchild)) { return rt; }
-    parent = lchild = rchild = NULL;
+    if((bloom = chidb_Btree_getBloom(bt, nroot)) == NULL)
+    {
+        if((bloom = calloc(1, sizeof(BTreeBloom))) == NULL)
+        {
+            free(bits);
+            free(keys.keys);
+            return CHIDB_ENOMEM;
+        }
+        bloom->nroot = nroot;
+        bloom->next = bt->blooms;
+        bt->blooms = bloom;
+    }
+    free(bloom->bits);
+    bloom->bits = bits;
+    bloom->n_bits = n_bits;
+    bloom->n_keys = 0;
+
+    for(uint32_t i = 0; i < keys.n_keys; i++)
+        chidb_Btree_bloomAdd(bt, nroot, keys.keys[i]);
 
+    free(keys.keys);
     return CHIDB_OK;
 }
 
+
+/* Free every Bloom filter of a B-Tree file
+ *
+ * Lookups in the B-Trees of the file stop using Bloom filters until they
+ * are built again (see chidb_Btree_bloomBuild). This must be done whenever
+ * the B-Trees of a file are moved to other root pages, and must not run
+ * concurrently with other operations on the file.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_Btree_bloomFreeAll(BTree *bt)
+{
+    while(bt->blooms != NULL)
+    {
+        BTreeBloom *next = bt->blooms->next;
+        free(bt->blooms->bits);
+        free(bt->blooms);
+        bt->blooms = next;
+    }
+    return CHIDB_OK;
+}
@@ -57,6 +57,30 @@
 #define PGHEADER_ZERO_OFFSET (7)
 #define PGHEADER_RIGHTPG_OFFSET (8)
 
+/* Byte 7 of the page header is always zero in the chidb file format. We
+ * use it as a set of flags; a page that has never been touched by a split
+ * still has all of them cleared. */
+#define PGHEADER_FLAGS_OFFSET PGHEADER_ZERO_OFFSET
+#define PGFLAG_LEAF_SIBLINGS (0x01)
+
+/* Leaves flagged with PGFLAG_LEAF_SIBLINGS reserve the last bytes of the
+ * page for the page numbers of their previous and next leaf (in key order) */
+#define LEAFPG_SIBLINGS_SIZE (8)
+#define LEAFPG_PREVPG_OFFSET(page_size) ((page_size) - 8)
+#define LEAFPG_NEXTPG_OFFSET(page_size) ((page_size) - 4)
+
+/* Table internal nodes flagged with PGFLAG_SUBTREE_COUNTS store, in each
+ * cell, the number of rows under its child page, and reserve the last bytes
+ * of the page for the number of rows under the right page. A B-Tree whose
+ * internal nodes are all counted can count its rows, and find the n-th one,
+ * by reading a single path (see chidb_Btree_count) */
+#define PGFLAG_SUBTREE_COUNTS (0x02)
+#define INTPG_COUNTS_SIZE (4)
+#define INTPG_RIGHTCOUNT_OFFSET(page_size) ((page_size) - 4)
+
+#define SIBLING_NONE (0)            /* First (or last) leaf of the tree */
+#define SIBLING_UNKNOWN (0xFFFFFFFF) /* Leaf without sibling links */
+
 #define LEAFPG_CELLSOFFSET_OFFSET (8)
 #define INTPG_CELLSOFFSET_OFFSET (12)
 
@@ -64,12 +88,14 @@
 
 #define TABLEINTCELL_CHILD_OFFSET (0)
 #define TABLEINTCELL_KEY_OFFSET (4)
+#define TABLEINTCELL_COUNT_OFFSET (8)
 
 #define TABLELEAFCELL_SIZE_OFFSET (0)
 #define TABLELEAFCELL_KEY_OFFSET (4)
 #define TABLELEAFCELL_DATA_OFFSET (8)
 
 #define TABLEINTCELL_SIZE (8)
+#define TABLEINTCELL_SIZE_WITHCOUNT (12)
 #define TABLELEAFCELL_SIZE_WITHOUTDATA (8)
 
 #define INDEXINTCELL_CHILD_OFFSET (0)
@@ -80,22 +106,67 @@
 #define INDEXLEAFCELL_KEYIDX_OFFSET (4)
 #define INDEXLEAFCELL_KEYPK_OFFSET (8)
 
+/* An index leaf cell of a covering index (see CREATE INDEX ... INCLUDE) is
+ * followed by a record with the included columns. Its first byte is
+ * INDEXLEAFCELL_DATA_MARKER instead of 0x0B, and the size of the record is
+ * stored in the two bytes at INDEXLEAFCELL_DATASIZE_OFFSET */
+#define INDEXLEAFCELL_DATA_MARKER (0x0C)
+#define INDEXLEAFCELL_DATASIZE_OFFSET (2)
+#define INDEXLEAFCELL_DATA_OFFSET (12)
+
 #define INDEXINTCELL_SIZE (16)
 #define INDEXLEAFCELL_SIZE (12)
 
+/* Number of times a reader descends the tree without latches (see
+ * chidb_Btree_getNodeOptimistic) before falling back to latch crabbing */
+#define BTREE_OPTIMISTIC_RETRIES (4)
+
+/* Sizing of Bloom filters (see chidb_Btree_bloomBuild): a filter is built
+ * with room for twice the keys its B-Tree has (and at least
+ * BTREE_BLOOM_MIN_KEYS), at BTREE_BLOOM_BITS_PER_KEY bits per key, which
+ * gives about 1% false positives when the filter is full */
+#define BTREE_BLOOM_BITS_PER_KEY (10)
+#define BTREE_BLOOM_NHASHES (7)
+#define BTREE_BLOOM_MIN_KEYS (512)
+
 // Advance declarations
 typedef struct BTreeCell BTreeCell;
 typedef struct BTreeNode BTreeNode;
+typedef struct BTreeNodeCells BTreeNodeCells;
+typedef struct BTreeLoader BTreeLoader;
+typedef struct BTreeBloom BTreeBloom;
+typedef struct WriteBuffer WriteBuffer;
 
 /* The BTree struct represent a "B-Tree file". It contains a pointer to the
  * chidb database it is a part of, and a pointer to a Pager, which it will
- * use to access pages on the file */
+ * use to access pages on the file, the Bloom filters of the B-Trees
+ * that have one, and the write buffers of the tables that are buffered
+ * (see memtable.h). Its epoch counts the changes to the shape of its
+ * B-Trees (see chidb_Btree_epoch). */
 typedef struct BTree
 {
     chidb *db;
     Pager *pager;
+    BTreeBloom *blooms;
+    WriteBuffer *wbuf;
+    uint64_t epoch;
 } Btree;
 
+/* A BTreeBloom is a Bloom filter of the keys of a B-Tree, which lookups
+ * check before descending the tree, so that most lookups of a key that is
+ * not in the B-Tree do not read any page. Filters only live in memory: they
+ * are built from the keys of their B-Tree (see chidb_Btree_bloomBuild),
+ * and every insertion into the B-Tree adds its key to the filter.
+ */
+struct BTreeBloom
+{
+    npage_t nroot;             /* Root page of the B-Tree */
+    uint32_t n_bits;           /* Number of bits (a power of two) */
+    uint32_t n_keys;           /* Number of keys added */
+    uint64_t *bits;            /* The filter itself */
+    BTreeBloom *next;          /* Filter of another B-Tree of the file */
+};
+
 /* The BTreeNode struct is an in-memory representation of a B-Tree node. Thus,
  * most of the values in this struct are simply a copy, for ease of access,
  * of what can be found in the raw disk page. When modifying type, free_offset,
@@ -116,9 +187,61 @@ struct BTreeNode
     ncell_t n_cells;           /* Number of cells */
     uint16_t cells_offset;     /* Byte offset of start of cells in page */
     npage_t right_page;        /* Right page (internal nodes only) */
+    uint32_t right_count;      /* Number of rows under the right page (counted nodes only) */
+    uint8_t flags;             /* Page flags (PGFLAG_*) */
+    npage_t prev_page;         /* Previous leaf (leaf nodes only, SIBLING_* if none) */
+    npage_t next_page;         /* Next leaf (leaf nodes only, SIBLING_* if none) */
     uint8_t *celloffset_array; /* Pointer to start of cell offset array in the in-memory page */
+    BTreeNodeCells *cells;     /* Decoded cells (NULL until first needed) */
+};
+
+/* BTreeNodeCells is a decoded copy of the cells of a BTreeNode. Each field
+ * of the cells is stored in its own contiguous array (indexed by cell number),
+ * so that searching a node only has to touch the keys. It is built the
+ * first time a cell of the node is accessed, and discarded whenever the node
+ * is modified or written (see chidb_Btree_decodeNode).
+ */
+struct BTreeNodeCells
+{
+    ncell_t n_cells;           /* Number of cells decoded */
+    chidb_key_t *keys;         /* Key (or KeyIdx) of each cell */
+    npage_t *child_pages;      /* Child page of each cell (internal nodes only) */
+    chidb_key_t *keyPks;       /* KeyPk of each cell (index nodes only) */
+    uint16_t *data_offsets;    /* Offset of the data of each cell in the page (leaves only) */
+    uint16_t *data_sizes;      /* Number of bytes of data of each cell (leaves only) */
+    uint32_t *counts;          /* Number of rows under each child page (counted nodes only) */
 };
 
+/* Largest depth chidb_Btree_analyze keeps per-level counts for. With at
+ * least two cells per node, a B-Tree this deep would not fit in a file. */
+#define BTREE_STATS_MAX_DEPTH (32)
+
+/* BTreeStats describes the shape of a B-Tree and how well its pages are
+ * used (see chidb_Btree_analyze). A page's "usable" bytes are those not
+ * taken by the file header (on page 1), the leaf sibling links or the
+ * subtree counts trailer; the "used" bytes are the page header, the cell
+ * offset array and the cells. Whatever is left is either the free space
+ * between the cell offset array and the cells, or fragmented space inside
+ * the cell area.
+ */
+typedef struct BTreeStats
+{
+    uint8_t type;                 /* Type of the root page */
+    uint32_t depth;               /* Number of levels (1 if the root is a leaf) */
+    npage_t n_pages;              /* Number of pages in the B-Tree */
+    npage_t level_pages[BTREE_STATS_MAX_DEPTH]; /* Number of pages in each level, root first */
+    uint32_t n_cells;             /* Number of cells, in all nodes */
+    uint64_t usable_bytes;        /* Usable bytes, in all pages */
+    uint64_t used_bytes;          /* Used bytes, in all pages */
+    uint64_t fragmented_bytes;    /* Unused bytes inside the cell areas */
+    double avg_fill;              /* Average of used / usable bytes, per page */
+    double min_fill;              /* Lowest used / usable bytes of any page */
+    npage_t n_leaves;             /* Number of leaves */
+    npage_t n_leaves_in_order;    /* Leaves stored on the page right after the previous leaf in key order */
+    uint16_t max_cell_size;       /* Largest cell, in bytes */
+    uint32_t n_large_cells;       /* Cells bigger than a quarter of a usable page */
+} BTreeStats;
+
 /* BTreeCell is an in-memory representation of a cell. See The chidb File Format
  * document for more details on the meaning of each field */
 struct BTreeCell
@@ -130,6 +253,7 @@ struct BTreeCell
         struct
         {
             npage_t child_page;  /* Child page with keys <= key */
+            uint32_t count;      /* Number of rows under child_page (counted nodes only) */
         } tableInternal;
         struct
         {
@@ -139,11 +263,13 @@ struct BTreeCell
         struct
         {
             chidb_key_t keyPk;         /* Primary key of row where the indexed field is equal to key */
-            npage_t child_page;  /* Child page with keys < key */
+            npage_t child_page;  /* Child page with entries <= (key, keyPk) */
         } indexInternal;
         struct
         {
             chidb_key_t keyPk;         /* Primary key of row where the indexed field is equal to key */
+            uint32_t data_size;  /* Number of bytes of included columns (0 if the index covers none) */
+            uint8_t *data;       /* Pointer to in-memory copy of the record of included columns */
         } indexLeaf;
     } fields;
 };
@@ -154,21 +280,54 @@ int chidb_Btree_close(BTree *bt);
 
 int chidb_Btree_getNodeByPage(BTree *bt, npage_t npage, BTreeNode **node);
 int chidb_Btree_freeMemNode(BTree *bt, BTreeNode *btn);
+int chidb_Btree_getNodeOptimistic(BTree *bt, npage_t npage, BTreeNode **btn, uint64_t *version);
+int chidb_Btree_loadNode(BTree *bt, npage_t npage, BTreeNode **btn);
+int chidb_Btree_loadNodeOptimistic(BTree *bt, npage_t npage, BTreeNode **btn, uint64_t *version);
 
 int chidb_Btree_newNode(BTree *bt, npage_t *npage, uint8_t type);
 int chidb_Btree_initEmptyNode(BTree *bt, npage_t npage, uint8_t type);
 int chidb_Btree_writeNode(BTree *bt, BTreeNode *node);
+int chidb_Btree_setSiblings(BTree *bt, BTreeNode *btn, npage_t prev_page, npage_t next_page);
+int chidb_Btree_setCounted(BTree *bt, BTreeNode *btn);
+
+int chidb_Btree_decodeNode(BTreeNode *btn);
+int chidb_Btree_searchNode(BTreeNode *btn, chidb_key_t key, ncell_t *ncell);
+int chidb_Btree_searchNodePk(BTreeNode *btn, chidb_key_t key, chidb_key_t keyPk, ncell_t *ncell);
+chidb_key_t chidb_Btree_cellKeyPk(BTreeCell *btc);
+uint64_t chidb_Btree_epoch(BTree *bt);
+void chidb_Btree_bumpEpoch(BTree *bt);
+chidb_key_t chidb_Btree_textKey(const char *text);
 
 int chidb_Btree_getCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell);
 int chidb_Btree_insertCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell);
 
 int chidb_Btree_find(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t **data, uint16_t *size);
+int chidb_Btree_findInTree(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t **data, uint16_t *size);
 
 int chidb_Btree_insertInTable(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t *data, uint16_t size);
 int chidb_Btree_insertInIndex(BTree *bt, npage_t nroot, chidb_key_t keyIdx, chidb_key_t keyPk);
 int chidb_Btree_insert(BTree *bt, npage_t nroot, BTreeCell *btc);
 int chidb_Btree_insertNonFull(BTree *bt, npage_t npage, BTreeCell *btc);
+int chidb_Btree_insertBatch(BTree *bt, npage_t nroot, BTreeCell *cells, size_t n_cells);
 int chidb_Btree_split(BTree *bt, npage_t npage_parent, npage_t npage_child, ncell_t parent_cell, npage_t *npage_child2);
 
+int chidb_Btree_count(BTree *bt, npage_t nroot, uint32_t *count);
+int chidb_Btree_rank(BTree *bt, npage_t nroot, chidb_key_t key, uint32_t *rank);
+int chidb_Btree_nthKey(BTree *bt, npage_t nroot, uint32_t n, chidb_key_t *key);
+
+int chidb_Btree_loaderOpen(BTree *bt, uint8_t type, BTreeLoader **ldr);
+int chidb_Btree_loaderAppend(BTreeLoader *ldr, BTreeCell *btc);
+int chidb_Btree_loaderClose(BTreeLoader *ldr, npage_t *nroot);
+int chidb_Btree_loaderFree(BTreeLoader *ldr);
+int chidb_Btree_rebuild(BTree *bt, npage_t nroot, BTree *dst, npage_t *new_nroot);
+int chidb_Btree_copy(BTree *bt, npage_t nroot, BTree *dst, npage_t *new_nroot);
+
+int chidb_Btree_analyze(BTree *bt, npage_t nroot, BTreeStats *stats);
+
+int chidb_Btree_bloomBuild(BTree *bt, npage_t nroot);
+BTreeBloom *chidb_Btree_getBloom(BTree *bt, npage_t nroot);
+bool chidb_Btree_bloomMayContain(BTree *bt, npage_t nroot, chidb_key_t key);
+int chidb_Btree_bloomFreeAll(BTree *bt);
+
 
 #endif /*BTREE_H_*/
@@ -64,6 +64,7 @@
 #define CHIDB_EMOVE (-1)
 
 #define CHIDB_EVALIDEARG (11)
+#define CHIDB_ERESTART (12)
 
 #define DEFAULT_PAGE_SIZE (1024)
 
@@ -75,6 +76,7 @@ typedef uint32_t chidb_key_t;
 
 /* Forward declaration */
 typedef struct BTree BTree;
+typedef struct chidb_dbm_cache chidb_dbm_cache_t;
 
 typedef struct chidb_schema
 {
@@ -96,6 +98,9 @@ struct chidb
     BTree   *bt;
     list_t schemas;
     int synced; // 1 已同步， 0 创建新表后未同步
+    int bloom;  // 1 为每个B-Tree维护Bloom filter (见chidb_bloom)
+    int buffer; // 1 表的插入先进入写缓冲 (见chidb_buffer)
+    chidb_dbm_cache_t *cache; // 编译好的语句 (见chidb_prepare)
 };
 
 #endif /*CHIDBINT_H_*/
@@ -54,9 +54,59 @@ chidb_dbm_op_t *make_op(opcode_t code, int32_t p1, int32_t p2, int32_t p3, char
     op->p2 = p2;
     op->p3 = p3;
     op->p4 = p4;
+    op->p5 = 0;
     return op;
 }
 
+// 参数?的类型是与它比较(或插入)的列的类型, 绑定的值必须是这个类型. 列的类型不能存入寄存器时返回0
+static int chidb_codegen_param_type(chidb_stmt *stmt, Literal_t *val, enum data_type type)
+{
+    if(!val->param) {
+        return 1;
+    }
+    if(type == TYPE_INT) {
+        stmt->paramTypes[val->param - 1] = REG_INT32;
+    }
+    else if(type == TYPE_TEXT) {
+        stmt->paramTypes[val->param - 1] = REG_STRING;
+    }
+    else {
+        return 0;
+    }
+    val->t = type;
+    return 1;
+}
+
+// 把值存入寄存器reg. 参数?的值在运行时由Variable取出
+static void chidb_codegen_literal(list_t *ops, Literal_t *val, int reg)
+{
+    if(val->param) {
+        list_append(ops, make_op(
+            Op_Variable, val->param, reg, 0, NULL
+        ));
+        return;
+    }
+    switch (val->t)
+    {
+    case TYPE_INT:
+        list_append(ops, make_op(
+            Op_Integer, val->val.ival, reg, 0, NULL
+        ));
+        break;
+    case TYPE_TEXT:
+        list_append(ops, make_op(
+            Op_String, strlen(val->val.strval), reg, 0, val->val.strval
+        ));
+        break;
+    case TYPE_CHAR:
+        break;
+    case TYPE_DOUBLE:
+        break;
+    default:
+        break;
+    }
+}
+
 int chidb_codegen_create(chidb_stmt *stmt, chisql_statement_t *sql_stmt, list_t *ops)
 {
     if(sql_stmt->stmt.create->t == CREATE_TABLE){
@@ -127,6 +177,22 @@ int chidb_codegen_create(chidb_stmt *stmt, chisql_statement_t *sql_stmt, list_t
             return CHIDB_EINVALIDSQL;
         }
         int n_col = index_of_column(&cols, sql_stmt->stmt.create->index->column_name);
+        int text_col = chidb_get_type_of_column(stmt->db->schemas, sql_stmt->stmt.create->index->table_name,
+                                                sql_stmt->stmt.create->index->column_name) == TYPE_TEXT;
+        // 文本的索引键只是前4个字符, 不唯一, 不能放进哈希索引
+        if(text_col && sql_stmt->stmt.create->index->method == INDEX_HASH) {
+            return CHIDB_EINVALIDSQL;
+        }
+        // 覆盖索引的列存在B-Tree索引的叶子记录中, 哈希索引只存主键
+        StrList_t *include = sql_stmt->stmt.create->index->include;
+        if(include && sql_stmt->stmt.create->index->method == INDEX_HASH) {
+            return CHIDB_EINVALIDSQL;
+        }
+        for(StrList_t *inc = include; inc; inc = inc->next) {
+            if(index_of_column(&cols, inc->str) < 0) {
+                return CHIDB_EINVALIDSQL;
+            }
+        }
 
         (sql_stmt->text)[strlen(sql_stmt->text)-1] = 0;
 
@@ -139,8 +205,8 @@ int chidb_codegen_create(chidb_stmt *stmt, chisql_statement_t *sql_stmt, list_t
         )); // 在cursor0打开根为rr0存的整数的页的表，有5列
 
         list_append(ops, make_op(
-            Op_CreateIndex, 4, 0, 0, NULL
-        )); // 新建一个index，并将rootpage存在rr4
+            sql_stmt->stmt.create->index->method == INDEX_HASH ? Op_CreateHash : Op_CreateIndex, 4, 0, 0, NULL
+        )); // 新建一个index(B-Tree或哈希索引)，并将rootpage存在rr4
 
         list_append(ops, make_op(
             Op_String, 5, 1, 0, "index"
@@ -184,13 +250,14 @@ int chidb_codegen_create(chidb_stmt *stmt, chisql_statement_t *sql_stmt, list_t
             Op_OpenRead, 0, 0, list_size(&cols), NULL
         ));
 
-        chidb_dbm_op_t *table_rewind = make_op(Op_Rewind, 0, 0, 0, NULL);
-        list_append(ops, table_rewind);
-
+        // 先打开索引的cursor, 表为空时Rewind会直接跳到关闭两个cursor处
         list_append(ops, make_op(
             Op_OpenWrite, 1, 4, 0, NULL
         ));
 
+        chidb_dbm_op_t *table_rewind = make_op(Op_Rewind, 0, 0, 0, NULL);
+        list_append(ops, table_rewind);
+
         int jmp_pc = list_size(ops);
 
         list_append(ops, make_op(
@@ -201,8 +268,35 @@ int chidb_codegen_create(chidb_stmt *stmt, chisql_statement_t *sql_stmt, list_t
             Op_Column, 0, n_col, regi++, NULL
         ));
 
+        // 文本列按其索引键插入
+        int key_reg = regi-1;
+        if(text_col) {
+            list_append(ops, make_op(
+                Op_TextKey, regi-1, regi, 0, NULL
+            ));
+            key_reg = regi++;
+        }
+
+        // 覆盖索引: 主键和INCLUDE的列组合成一条记录, 和索引项存在一起
+        int pk_reg = 1;
+        if(include) {
+            int rec_start = regi;
+            list_append(ops, make_op(
+                Op_Key, 0, regi++, 0, NULL
+            ));
+            for(StrList_t *inc = include; inc; inc = inc->next) {
+                int k = index_of_column(&cols, inc->str);
+                list_append(ops, k == 0 ? make_op(Op_Key, 0, regi++, 0, NULL)
+                                        : make_op(Op_Column, 0, k, regi++, NULL));
+            }
+            list_append(ops, make_op(
+                Op_MakeRecord, rec_start, regi-rec_start, regi, NULL
+            ));
+            pk_reg = regi++;
+        }
+
         list_append(ops, make_op(
-            Op_IdxInsert, 1, regi-1, regi-2, NULL
+            Op_IdxInsert, 1, key_reg, pk_reg, NULL
         ));
 
         list_append(ops, make_op(
@@ -227,6 +321,62 @@ int chidb_codegen_create(chidb_stmt *stmt, chisql_statement_t *sql_stmt, list_t
     return CHIDB_OK;
 }
 
+// 第n_col列上有索引时, 生成把该列的值插入索引的指令. 主键在rr1, 第k(>0)列的值
+// 在rr(k+2), 从free_reg开始的寄存器没有用到
+static void chidb_codegen_index_insert(chidb_stmt *stmt, list_t *ops, char *table, list_t *cols, int n_col, int free_reg)
+{
+    Column_t *col = list_get_at(cols, n_col);
+    int reg = n_col + 2;
+    int pk_reg = 1;
+    int index_page = chidb_check_index_exist(stmt->db->schemas, table, col->name);
+    if(!index_page) {
+        return;
+    }
+
+    list_append(ops, make_op(
+        Op_Integer, index_page, 0, 0, NULL
+    ));
+
+    list_append(ops, make_op(
+        Op_OpenWrite, 1, 0, 0, NULL
+    ));
+
+    // 文本按其索引键插入, rr0在打开cursor后就不再用了
+    if(col->type == TYPE_TEXT) {
+        list_append(ops, make_op(
+            Op_TextKey, reg, 0, 0, NULL
+        ));
+        reg = 0;
+    }
+
+    // 覆盖索引: 主键和INCLUDE的列组合成一条记录, 和索引项存在一起
+    StrList_t *include = chidb_get_index_include(stmt->db->schemas, table, col->name);
+    if(include) {
+        int n = 0;
+        list_append(ops, make_op(
+            Op_SCopy, 1, free_reg, 0, NULL
+        ));
+        for(StrList_t *inc = include; inc; inc = inc->next) {
+            int k = index_of_column(cols, inc->str);
+            list_append(ops, make_op(
+                Op_SCopy, k == 0 ? 1 : k + 2, free_reg + ++n, 0, NULL
+            ));
+        }
+        list_append(ops, make_op(
+            Op_MakeRecord, free_reg, n + 1, free_reg + n + 1, NULL
+        ));
+        pk_reg = free_reg + n + 1;
+    }
+
+    list_append(ops, make_op(
+        Op_IdxInsert, 1, reg, pk_reg, NULL
+    ));
+
+    list_append(ops, make_op(
+        Op_Close, 1, 0, 0, NULL
+    ));
+}
+
 int chidb_codegen_insert(chidb_stmt *stmt, chisql_statement_t *sql_stmt, list_t *ops)
 {
     if (!chidb_check_table_exist(stmt->db->schemas, sql_stmt->stmt.insert->table_name)) {
@@ -248,7 +398,7 @@ int chidb_codegen_insert(chidb_stmt *stmt, chisql_statement_t *sql_stmt, list_t
             list_destroy(&cols);
             return CHIDB_EINVALIDSQL;
         }
-        if(val->t != col->type) {
+        if(!chidb_codegen_param_type(stmt, val, col->type) || val->t != col->type) {
             list_destroy(&cols);
             return CHIDB_EINVALIDSQL;
         }
@@ -269,48 +419,8 @@ int chidb_codegen_insert(chidb_stmt *stmt, chisql_statement_t *sql_stmt, list_t
     int i = 1;
     val = value;
     while(val) {
-        switch (val->t)
-        {
-        case TYPE_INT:
-            list_append(ops, make_op(
-                Op_Integer, val->val.ival, i++, 0, NULL
-            ));
-// ================ 支持索引 ================
-            if(i > 2) {
-                Column_t *col = list_get_at(&cols, i-3);
-                fflush(stdout);
-                int index_page = chidb_check_index_exist(stmt->db->schemas, sql_stmt->stmt.insert->table_name, col->name);
-                if(index_page) {
-                    list_append(ops, make_op(
-                        Op_Integer, index_page, 0, 0, NULL
-                    ));
-
-                    list_append(ops, make_op(
-                        Op_OpenWrite, 1, 0, 0, NULL
-                    ));
-
-                    list_append(ops, make_op(
-                        Op_IdxInsert, 1, i-1, 1, NULL
-                    ));
-
-                    list_append(ops, make_op(
-                        Op_Close, 1, 0, 0, NULL
-                    ));
-                }
-            }
-// ================ 支持索引 ================
-            break;
-        case TYPE_TEXT:
-            list_append(ops, make_op(
-                Op_String, strlen(val->val.strval), i++, 0, val->val.strval
-            ));
-            break;
-        case TYPE_CHAR:
-            break;
-        case TYPE_DOUBLE:
-            break;
-        default:
-            break;
+        if(val->t == TYPE_INT || val->t == TYPE_TEXT) {
+            chidb_codegen_literal(ops, val, i++);
         }
         if(i == 2) {
             list_append(ops, make_op(
@@ -321,6 +431,16 @@ int chidb_codegen_insert(chidb_stmt *stmt, chisql_statement_t *sql_stmt, list_t
         val = val->next;
     }
 
+// ================ 支持索引 ================
+    // 所有的值都在寄存器中之后再插入索引, 覆盖索引的记录可能要用到后面的列
+    for(int k = 1; k < list_size(&cols); k++) {
+        Column_t *col = list_get_at(&cols, k);
+        if(col->type == TYPE_INT || col->type == TYPE_TEXT) {
+            chidb_codegen_index_insert(stmt, ops, sql_stmt->stmt.insert->table_name, &cols, k, i);
+        }
+    }
+// ================ 支持索引 ================
+
     list_append(ops, make_op(
         Op_MakeRecord, 2, i-2, i, NULL
     )); // 从rr2到regi-2的数据组合成一条记录
@@ -337,6 +457,119 @@ int chidb_codegen_insert(chidb_stmt *stmt, chisql_statement_t *sql_stmt, list_t
     return CHIDB_OK;
 }
 
+// 列colname在覆盖索引记录中的位置(第0列是主键), 不在其中返回-1
+static int chidb_codegen_include_field(StrList_t *include, char *colname)
+{
+    for(int field = 1; include; include = include->next, field++) {
+        if(!strcmp(include->str, colname)) {
+            return field;
+        }
+    }
+    return -1;
+}
+
+// 把主键与整数的比较(可以用AND连接)收窄为主键的范围[*lo, *hi]. 条件中有别的比较时返回0.
+// 与参数?比较的边界在运行时才知道, 放在*lo_param/*hi_param中(不含参数的值时在*excl中标出),
+// 这一边不能再有别的比较
+static int chidb_codegen_key_range(chidb_stmt *stmt, list_t *table_cols, Condition_t *cond, int64_t *lo, int64_t *hi,
+                                   Literal_t **lo_param, Literal_t **hi_param, int *excl)
+{
+    if(cond->t == RA_COND_AND) {
+        return chidb_codegen_key_range(stmt, table_cols, cond->cond.binary.cond1, lo, hi, lo_param, hi_param, excl) &&
+               chidb_codegen_key_range(stmt, table_cols, cond->cond.binary.cond2, lo, hi, lo_param, hi_param, excl);
+    }
+    if(cond->t > RA_COND_GEQ) {
+        return 0;
+    }
+
+    Expression_t *col = cond->cond.comp.expr1, *val = cond->cond.comp.expr2;
+    if(col->t != EXPR_TERM || col->expr.term.t != TERM_COLREF ||
+       val->t != EXPR_TERM || val->expr.term.t != TERM_LITERAL || val->expr.term.val->t != TYPE_INT ||
+       index_of_column(table_cols, col->expr.term.ref->columnName) != 0) {
+        return 0;
+    }
+
+    Literal_t *lit = val->expr.term.val;
+    int lo_side = cond->t != RA_COND_LT && cond->t != RA_COND_LEQ;
+    int hi_side = cond->t != RA_COND_GT && cond->t != RA_COND_GEQ;
+    if((lo_side && *lo_param) || (hi_side && *hi_param)) {
+        return 0;
+    }
+    if(lit->param) {
+        if((lo_side && *lo != 0) || (hi_side && *hi != UINT32_MAX)) {
+            return 0;
+        }
+        chidb_codegen_param_type(stmt, lit, TYPE_INT);
+        if(lo_side) {
+            *lo_param = lit;
+            *excl |= cond->t == RA_COND_GT ? SEEKRANGE_LO_EXCL : 0;
+        }
+        if(hi_side) {
+            *hi_param = lit;
+            *excl |= cond->t == RA_COND_LT ? SEEKRANGE_HI_EXCL : 0;
+        }
+        return 1;
+    }
+
+    int64_t v = lit->val.ival;
+    switch (cond->t)
+    {
+    case RA_COND_EQ:
+        *lo = v > *lo ? v : *lo;
+        *hi = v < *hi ? v : *hi;
+        break;
+    case RA_COND_GT:
+        *lo = v + 1 > *lo ? v + 1 : *lo;
+        break;
+    case RA_COND_GEQ:
+        *lo = v > *lo ? v : *lo;
+        break;
+    case RA_COND_LT:
+        *hi = v - 1 < *hi ? v - 1 : *hi;
+        break;
+    case RA_COND_LEQ:
+        *hi = v < *hi ? v : *hi;
+        break;
+    default:
+        break;
+    }
+    return 1;
+}
+
+// SELECT COUNT(*) FROM table: 表B-Tree的内部节点记录了子树的行数, 不用逐行扫描
+static int chidb_codegen_count(chidb_stmt *stmt, char *tablename, list_t *ops)
+{
+    list_append(ops, make_op(
+        Op_Integer, chidb_get_root_page_of_table(stmt->db->schemas, tablename), 0, 0, NULL
+    )); // root_page存入r0
+
+    list_append(ops, make_op(
+        Op_OpenRead, 0, 0, 0, NULL
+    )); // 只读的方式打开表cursor0
+
+    list_append(ops, make_op(
+        Op_Count, 0, 1, 0, NULL
+    )); // 表的行数存入r1
+
+    list_append(ops, make_op(
+        Op_ResultRow, 1, 1, 0, NULL
+    ));
+
+    list_append(ops, make_op(
+        Op_Close, 0, 0, 0, NULL
+    ));
+
+    list_append(ops, make_op(
+        Op_Halt, 0, 0, 0, NULL
+    ));
+
+    stmt->nCols = 1;
+    stmt->nRR = 1;
+    stmt->cols = malloc(sizeof(char*));
+    stmt->cols[0] = strdup("COUNT(*)");
+    return CHIDB_OK;
+}
+
 int chidb_codegen_select(chidb_stmt *stmt, chisql_statement_t *sql_stmt, list_t *ops)
 {
     list_t table_cols, select_cols;
@@ -364,10 +597,26 @@ int chidb_codegen_select(chidb_stmt *stmt, chisql_statement_t *sql_stmt, list_t
         return CHIDB_EINVALIDSQL;
     }
 
+    // 聚合函数: 目前只支持不带WHERE的COUNT(*)
+    Expression_t *exp = project->expr_list;
+    if(exp->t == EXPR_TERM && exp->expr.term.t == TERM_FUNC) {
+        Expression_t *arg = exp->expr.term.f.expr;
+        if(exp->next || select || exp->expr.term.f.t != FUNC_COUNT ||
+           !arg || arg->t != EXPR_TERM || arg->expr.term.t != TERM_COLREF ||
+           strcmp(arg->expr.term.ref->columnName, "*")) {
+            return CHIDB_EINVALIDSQL;
+        }
+        return chidb_codegen_count(stmt, tablename, ops);
+    }
+
     // 列检查
     chidb_get_columns_of_table(stmt->db->schemas, tablename, &table_cols);
-    Expression_t *exp = project->expr_list;
     while(exp) {
+        if(exp->t != EXPR_TERM || exp->expr.term.t != TERM_COLREF) {
+            list_destroy(&table_cols);
+            list_destroy(&select_cols);
+            return CHIDB_EINVALIDSQL;
+        }
         char *colname = exp->expr.term.ref->columnName;
         if(!strcmp(colname, "*")) {
             list_iterator_start(&table_cols);
@@ -405,86 +654,79 @@ int chidb_codegen_select(chidb_stmt *stmt, chisql_statement_t *sql_stmt, list_t
 
     // 根据select条件生成判断指令
     int need_loop = 1, using_pk = 0;
-    int next_to_pc;
-    chidb_dbm_op_t *jmp_op = NULL, *idx_jmp_op = NULL;
-    if(select) {
+    int covered = 0; // 结果行的列都可以从覆盖索引中取出, 不用再查表
+    int idx_hash = 0; // 通过哈希索引查找, 用HashNext取同一个键的下一条记录
+    StrList_t *include = NULL;
+    int next_to_pc, idx_next_pc = -1;
+    chidb_dbm_op_t *jmp_op = NULL, *idx_jmp_op = NULL, *idx_end_op = NULL, *recheck_op = NULL;
+    int64_t key_lo = 0, key_hi = UINT32_MAX;
+    Literal_t *lo_param = NULL, *hi_param = NULL;
+    int excl = 0;
+    // 主键的范围: 游标定位到下界, 越过上界后Next结束循环, 不再扫描表的其余部分
+    if(select && select->cond->t != RA_COND_EQ &&
+       chidb_codegen_key_range(stmt, &table_cols, select->cond, &key_lo, &key_hi, &lo_param, &hi_param, &excl)) {
+        if(key_lo > key_hi) { // 空范围
+            key_lo = 1;
+            key_hi = 0;
+        }
+        if(lo_param) {
+            chidb_codegen_literal(ops, lo_param, regi++);
+        }
+        else {
+            list_append(ops, make_op(
+                Op_Integer, (int32_t) key_lo, regi++, 0, NULL
+            ));
+        }
+        if(hi_param) {
+            chidb_codegen_literal(ops, hi_param, regi++);
+        }
+        else {
+            list_append(ops, make_op(
+                Op_Integer, (int32_t) key_hi, regi++, 0, NULL
+            ));
+        }
+        jmp_op = make_op(
+            Op_SeekRange, 0, 0, regi-2, NULL
+        );
+        jmp_op->p5 = excl;
+        list_append(ops, jmp_op);
+        using_pk = 1;
+        next_to_pc = list_size(ops);
+    }
+    else if(select) {
         Condition_t *cond = select->cond;
+
+        // 除主键的范围外, 只支持单个比较
+        if(cond->t > RA_COND_GEQ) {
+            list_destroy(&table_cols);
+            list_destroy(&select_cols);
+            return CHIDB_EINVALIDSQL;
+        }
         char *cond_col = cond->cond.comp.expr1->expr.term.ref->columnName;
         Literal_t *val = cond->cond.comp.expr2->expr.term.val;
 
         // 检查比较的值类型是否匹配
-        if(val->t != chidb_get_type_of_column(stmt->db->schemas, tablename, cond_col)) {
+        int cond_type = chidb_get_type_of_column(stmt->db->schemas, tablename, cond_col);
+        if(!chidb_codegen_param_type(stmt, val, cond_type) || val->t != cond_type) {
             list_destroy(&table_cols);
             list_destroy(&select_cols);
             return CHIDB_EINVALIDSQL;
         }
 
-        switch (val->t)
-        {
-        case TYPE_INT:
-            list_append(ops, make_op(
-                Op_Integer, val->val.ival, regi++, 0, NULL
-            ));
-            break;
-        case TYPE_TEXT:
-            list_append(ops, make_op(
-                Op_String, strlen(val->val.strval), regi++, 0, val->val.strval
-            ));
-            break;
-        case TYPE_CHAR:
-            break;
-        case TYPE_DOUBLE:
-            break;
-        default:
-            break;
+        if(val->t == TYPE_INT || val->t == TYPE_TEXT) {
+            chidb_codegen_literal(ops, val, regi++);
         }
 
 
         int col_index = index_of_column(&table_cols, cond_col);
-        // 条件列是主键
+        // 条件列是主键(其他比较已经作为范围处理)
         if(col_index == 0) {
-            opcode_t seek_opcode;
-            switch (cond->t)
-            {
-            case RA_COND_EQ:
-                seek_opcode = Op_Seek;
-                break;
-            case RA_COND_GT:
-                seek_opcode = Op_SeekGt;
-                break;
-            case RA_COND_GEQ:
-                seek_opcode = Op_SeekGe;
-                break;
-            case RA_COND_LEQ:
-                seek_opcode = Op_Gt;
-                break;
-            case RA_COND_LT:
-                seek_opcode = Op_Ge;
-                break;
-            default:
-                break;
-            }
-
-            if(seek_opcode == Op_Ge || seek_opcode == Op_Gt) {
-                next_to_pc = list_size(ops);
-                list_append(ops, make_op(
-                    Op_Key, 0, regi++, 0, NULL
-                ));
-                jmp_op = make_op(
-                    seek_opcode, regi-2, 0, regi-1, NULL
-                );
-                list_append(ops, jmp_op);
-            }
-            else {
-                if(seek_opcode == Op_Seek) {
-                    need_loop = 0;
-                }
-                jmp_op = make_op(
-                    seek_opcode, 0, 0, regi-1, NULL
-                );
-                list_append(ops, jmp_op);
-                next_to_pc = list_size(ops);
-            }
+            need_loop = 0;
+            jmp_op = make_op(
+                Op_Seek, 0, 0, regi-1, NULL
+            );
+            list_append(ops, jmp_op);
+            next_to_pc = list_size(ops);
         }
         // 条件列不是主键
         else {
@@ -522,23 +764,83 @@ int chidb_codegen_select(chidb_stmt *stmt, chisql_statement_t *sql_stmt, list_t
                     Op_OpenRead, 1, 0, 0, NULL
                 ));
 
-                idx_jmp_op = make_op(
-                    Op_Seek, 1, 0, regi-1, NULL
-                );
-                list_append(ops, idx_jmp_op);
+                // 哈希索引只需读目录页和一个桶页. 同一个键可以有多条(键, 主键)记录,
+                // 桶中没有顺序, HashNext按主键从小到大逐条取出
+                if(chidb_check_index_hash(stmt->db->schemas, tablename, cond_col)) {
+                    idx_hash = 1;
+                    idx_jmp_op = make_op(
+                        Op_HashSeek, 1, 0, regi-1, NULL
+                    );
+                    list_append(ops, idx_jmp_op);
 
-                list_append(ops, make_op(
-                    Op_IdxPKey, 1, regi-1,0 ,NULL
-                ));
-
-                list_append(ops, make_op(
-                    Op_Close, 1, 0, 0, NULL
-                ));
+                    idx_next_pc = list_size(ops);
+                    list_append(ops, make_op(
+                        Op_IdxPKey, 1, regi++, 0, NULL
+                    ));
 
-                jmp_op = make_op(
-                    Op_Seek, 0, 0, regi-1, NULL
-                );
-                list_append(ops, jmp_op);
+                    jmp_op = make_op(
+                        Op_Seek, 0, 0, regi-1, NULL
+                    );
+                    list_append(ops, jmp_op);
+                }
+                // B-Tree索引中同一个键可以有多条(键, 主键)记录, 按主键排序,
+                // 从第一条开始逐条取出, 直到遇到更大的键
+                else {
+                    int val_reg = regi-1;
+
+                    include = chidb_get_index_include(stmt->db->schemas, tablename, cond_col);
+                    covered = include != NULL &&
+                              (val->t != TYPE_TEXT || chidb_codegen_include_field(include, cond_col) > 0);
+                    list_iterator_start(&select_cols);
+                    while(covered && list_iterator_hasnext(&select_cols)) {
+                        char *colname = list_iterator_next(&select_cols);
+                        // 整数列的索引键就是它的值
+                        covered = index_of_column(&table_cols, colname) == 0 ||
+                                  chidb_codegen_include_field(include, colname) > 0 ||
+                                  (!strcmp(colname, cond_col) && val->t == TYPE_INT);
+                    }
+                    list_iterator_stop(&select_cols);
+
+                    // 文本按其索引键(前4个字符)查找
+                    if(val->t == TYPE_TEXT) {
+                        list_append(ops, make_op(
+                            Op_TextKey, val_reg, regi++, 0, NULL
+                        ));
+                    }
+
+                    idx_jmp_op = make_op(
+                        Op_SeekGe, 1, 0, regi-1, NULL
+                    );
+                    list_append(ops, idx_jmp_op);
+
+                    idx_next_pc = list_size(ops);
+                    idx_end_op = make_op(
+                        Op_IdxGt, 1, 0, regi-1, NULL
+                    );
+                    list_append(ops, idx_end_op);
+
+                    if(!covered) {
+                        list_append(ops, make_op(
+                            Op_IdxPKey, 1, regi++, 0, NULL
+                        ));
+
+                        jmp_op = make_op(
+                            Op_Seek, 0, 0, regi-1, NULL
+                        );
+                        list_append(ops, jmp_op);
+                    }
+
+                    // 索引键相同的文本不一定相同, 还要比较整个文本
+                    if(val->t == TYPE_TEXT) {
+                        list_append(ops, covered ?
+                            make_op(Op_Column, 1, chidb_codegen_include_field(include, cond_col), regi++, NULL) :
+                            make_op(Op_Column, 0, col_index, regi++, NULL));
+                        recheck_op = make_op(
+                            Op_Ne, val_reg, 0, regi-1, NULL
+                        );
+                        list_append(ops, recheck_op);
+                    }
+                }
             }
 // ================ 支持索引 ================
             else {
@@ -562,7 +864,28 @@ int chidb_codegen_select(chidb_stmt *stmt, chisql_statement_t *sql_stmt, list_t
     while(list_iterator_hasnext(&select_cols)) {
         char *colname = list_iterator_next(&select_cols);
         int col_index = index_of_column(&table_cols, colname);
-        if(col_index == 0) {
+// ================ 支持索引 ================
+        // 从覆盖索引的当前项中取出
+        if(covered) {
+            int field = chidb_codegen_include_field(include, colname);
+            if(col_index == 0) {
+                list_append(ops, make_op(
+                    Op_IdxPKey, 1, regi++, 0, NULL
+                ));
+            }
+            else if(field > 0) {
+                list_append(ops, make_op(
+                    Op_Column, 1, field, regi++, NULL
+                ));
+            }
+            else {
+                list_append(ops, make_op(
+                    Op_Key, 1, regi++, 0, NULL
+                ));
+            }
+        }
+// ================ 支持索引 ================
+        else if(col_index == 0) {
             list_append(ops, make_op(
                 Op_Key, 0, regi++, 0, NULL
             ));
@@ -583,6 +906,10 @@ int chidb_codegen_select(chidb_stmt *stmt, chisql_statement_t *sql_stmt, list_t
         jmp_op->p2 = list_size(ops);
     }
 
+    if(recheck_op) {
+        recheck_op->p2 = list_size(ops);
+    }
+
     // 跳转循环生成结果行
     if(need_loop) {
         list_append(ops, make_op(
@@ -594,9 +921,25 @@ int chidb_codegen_select(chidb_stmt *stmt, chisql_statement_t *sql_stmt, list_t
         jmp_op->p2 = list_size(ops);
     }
 // ================ 支持索引 ================
+    // 取索引中的下一条记录
+    if(idx_end_op || idx_hash) {
+        list_append(ops, make_op(
+            idx_hash ? Op_HashNext : Op_Next, 1, idx_next_pc, 0, NULL
+        ));
+    }
+    if(idx_end_op) {
+        idx_end_op->p2 = list_size(ops);
+    }
+
     if(idx_jmp_op) {
         idx_jmp_op->p2 = list_size(ops);
     }
+
+    if(idx_end_op || idx_hash) {
+        list_append(ops, make_op(
+            Op_Close, 1, 0, 0, NULL
+        ));
+    }
 // ================ 支持索引 ================
     chidb_dbm_op_t *rewind_op = list_get_at(ops, 2);
     rewind_op->p2 = list_size(ops);
@@ -621,6 +964,25 @@ int chidb_codegen_select(chidb_stmt *stmt, chisql_statement_t *sql_stmt, list_t
     return CHIDB_OK;
 }
 
+int chidb_codegen_vacuum(chidb_stmt *stmt, chisql_statement_t *sql_stmt, list_t *ops)
+{
+    char *table = sql_stmt->stmt.vacuum;
+
+    if(table != NULL && !chidb_check_table_exist(stmt->db->schemas, table)) {
+        return CHIDB_EINVALIDSQL;
+    }
+
+    list_append(ops, make_op(
+        Op_Vacuum, 0, 0, 0, table
+    )); // 重建表(p4为NULL时重建所有表和索引)
+
+    list_append(ops, make_op(
+        Op_Halt, 0, 0, 0, NULL
+    ));
+
+    return CHIDB_OK;
+}
+
 int chidb_stmt_codegen(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
 {
     if (stmt->db->synced == 0)
@@ -641,6 +1003,15 @@ int chidb_stmt_codegen(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
         stmt->db->synced = 1;
     }
 
+    // 参数?的类型在生成指令时才确定
+    stmt->nParams = sql_stmt->nParams;
+    stmt->params = calloc(stmt->nParams, sizeof(chidb_dbm_register_t));
+    stmt->paramTypes = calloc(stmt->nParams, sizeof(register_type_t));
+    if (stmt->nParams > 0 && (stmt->params == NULL || stmt->paramTypes == NULL))
+    {
+        return CHIDB_ENOMEM;
+    }
+
     list_t ops;
     list_init(&ops);
 
@@ -657,10 +1028,20 @@ int chidb_stmt_codegen(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
     case STMT_INSERT:
         rt = chidb_codegen_insert(stmt, sql_stmt, &ops);
         break;
+    case STMT_VACUUM:
+        rt = chidb_codegen_vacuum(stmt, sql_stmt, &ops);
+        break;
     default:
         break;
     }
 
+    // 参数?只能作为插入或比较的值, 在别处时没有类型
+    for (uint32_t i = 0; rt == CHIDB_OK && i < stmt->nParams; i++)
+    {
+        if (stmt->paramTypes[i] == REG_UNSPECIFIED)
+            rt = CHIDB_EINVALIDSQL;
+    }
+
     if (rt != CHIDB_OK)
     {
         while (!list_empty(&ops))
@@ -672,8 +1053,8 @@ int chidb_stmt_codegen(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
     }
 
     stmt->sql = sql_stmt;
-    stmt->nOps = list_size(&ops);
 
+    // 指令数组不够大时由chidb_stmt_set_op扩大
     int i = 0;
     list_iterator_start(&ops);
     while (list_iterator_hasnext(&ops))
@@ -0,0 +1,381 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ * This module contains the statement cache of a database. chidb_prepare
+ * looks SELECT and INSERT statements up in it by their normalized text
+ * (see chidb_dbm_cache_normalize), in which the integer and string
+ * literals have been replaced by ?'s, so that statements that only differ
+ * in their literals share the same DBM program. The cache keeps the
+ * DBM_CACHE_SIZE programs used most recently, and the program of each
+ * statement that is prepared is a copy of the cached one, to which the
+ * literals are bound as parameters. Programs depend on the schema, so the
+ * cache is emptied whenever the schema is reloaded.
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include "dbm-cache.h"
+
+
+/* Unlink an entry from the list of a cache */
+static void chidb_dbm_cache_unlink(chidb_dbm_cache_t *cache, chidb_dbm_cache_entry_t *e)
+{
+    if(e->prev)
+        e->prev->next = e->next;
+    else
+        cache->head = e->next;
+    if(e->next)
+        e->next->prev = e->prev;
+    else
+        cache->tail = e->prev;
+    e->prev = e->next = NULL;
+}
+
+/* Put an entry at the front of the list of a cache */
+static void chidb_dbm_cache_push(chidb_dbm_cache_t *cache, chidb_dbm_cache_entry_t *e)
+{
+    e->prev = NULL;
+    e->next = cache->head;
+    if(cache->head)
+        cache->head->prev = e;
+    else
+        cache->tail = e;
+    cache->head = e;
+}
+
+/* Free an entry that is no longer in a cache */
+static void chidb_dbm_cache_free_entry(chidb_dbm_cache_entry_t *e)
+{
+    chidb_stmt_free(e->stmt);
+    free(e->stmt);
+    free(e->key);
+    free(e);
+}
+
+
+/* Create an empty statement cache
+ *
+ * Parameters
+ * - cache: Out-parameter for the new cache
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_dbm_cache_open(chidb_dbm_cache_t **cache)
+{
+    if((*cache = calloc(1, sizeof(chidb_dbm_cache_t))) == NULL)
+        return CHIDB_ENOMEM;
+
+    return CHIDB_OK;
+}
+
+
+/* Free a statement cache, and the programs in it
+ *
+ * Parameters
+ * - cache: Statement cache (may be NULL)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_dbm_cache_close(chidb_dbm_cache_t *cache)
+{
+    if(cache == NULL)
+        return CHIDB_OK;
+
+    chidb_dbm_cache_clear(cache);
+    free(cache);
+
+    return CHIDB_OK;
+}
+
+
+/* Remove every program from a statement cache
+ *
+ * Used when the schema changes, since the programs refer to the root
+ * pages and the columns of the tables. The counts of hits and misses
+ * are kept.
+ *
+ * Parameters
+ * - cache: Statement cache
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_dbm_cache_clear(chidb_dbm_cache_t *cache)
+{
+    while(cache->head)
+    {
+        chidb_dbm_cache_entry_t *e = cache->head;
+        chidb_dbm_cache_unlink(cache, e);
+        chidb_dbm_cache_free_entry(e);
+    }
+    cache->n_entries = 0;
+
+    return CHIDB_OK;
+}
+
+
+/* Normalize a SQL statement into the key of its program
+ *
+ * Runs of whitespace become a single space, and the integer and string
+ * literals are replaced by ?'s, their values being returned in the order
+ * in which they appear. Only the literals whose program does not depend
+ * on their value are replaced: integers with a sign or that are part of
+ * a real number, and strings of a single character (which the parser
+ * takes for a character), are left as they are. If the statement has ?'s
+ * of its own, no literal is replaced, so that its parameters keep their
+ * numbers.
+ *
+ * Only SELECT and INSERT statements are cached. Any other statement, or
+ * one with comments or an unterminated string, has no key.
+ *
+ * Parameters
+ * - sql: SQL statement
+ * - key: Out-parameter for the key (malloc'd), or NULL if the statement
+ *        is not cached
+ * - values: Out-parameter for the values of the literals (malloc'd, and
+ *           the strings in it too), of type REG_INT32 or REG_STRING
+ * - n_values: Out-parameter for the number of values
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_dbm_cache_normalize(const char *sql, char **key, chidb_dbm_register_t **values, uint32_t *n_values)
+{
+    size_t len = strlen(sql), n = 0;
+    const char *p;
+    char *k;
+    bool lift = true;
+
+    *key = NULL;
+    *values = NULL;
+    *n_values = 0;
+
+    while(isspace((unsigned char) *sql))
+        sql++;
+    if(strncasecmp(sql, "select", 6) && strncasecmp(sql, "insert", 6))
+        return CHIDB_OK;
+    if(isalnum((unsigned char) sql[6]) || sql[6] == '_')
+        return CHIDB_OK;
+
+    /* Check that the statement can be cached, and whether it has ?'s */
+    for(p = sql; *p; p++)
+    {
+        if(*p == '"' || *p == '\'')
+        {
+            const char *end = strchr(p + 1, *p);
+            if(end == NULL)
+                return CHIDB_OK;
+            p = end;
+        }
+        else if(*p == '?')
+            lift = false;
+        else if((p[0] == '-' && p[1] == '-') || (p[0] == '/' && p[1] == '*'))
+            return CHIDB_OK;
+    }
+
+    /* The key is never longer than the statement */
+    if((k = malloc(len + 1)) == NULL)
+        return CHIDB_ENOMEM;
+    if(lift && (*values = malloc(len * sizeof(chidb_dbm_register_t))) == NULL)
+    {
+        free(k);
+        return CHIDB_ENOMEM;
+    }
+
+    for(p = sql; *p; )
+    {
+        if(isspace((unsigned char) *p))
+        {
+            while(isspace((unsigned char) *p))
+                p++;
+            if(*p)
+                k[n++] = ' ';
+        }
+        else if(isalpha((unsigned char) *p))
+        {
+            /* Identifiers are copied whole, digits included */
+            while(isalnum((unsigned char) *p) || *p == '_')
+                k[n++] = *p++;
+        }
+        else if(*p == '"' || *p == '\'')
+        {
+            const char *end = strchr(p + 1, *p);
+            size_t slen = end - p - 1;
+
+            if(!lift || slen == 1)
+            {
+                memcpy(k + n, p, slen + 2);
+                n += slen + 2;
+            }
+            else
+            {
+                chidb_dbm_register_t *v = &(*values)[(*n_values)++];
+                v->type = REG_STRING;
+                if((v->value.s = strndup(p + 1, slen)) == NULL)
+                {
+                    (*n_values)--;
+                    goto nomem;
+                }
+                k[n++] = '?';
+            }
+            p = end + 1;
+        }
+        else if(isdigit((unsigned char) *p))
+        {
+            const char *end = p;
+            while(isdigit((unsigned char) *end))
+                end++;
+
+            char prev = n > 0 ? k[n - 1] : ' ';
+            if(!lift || prev == '+' || prev == '-' || prev == '.' ||
+               (end[0] == '.' && isdigit((unsigned char) end[1])))
+            {
+                /* A real number is copied whole */
+                if(end[0] == '.' && isdigit((unsigned char) end[1]))
+                    for(end++; isdigit((unsigned char) *end); end++);
+                memcpy(k + n, p, end - p);
+                n += end - p;
+            }
+            else
+            {
+                chidb_dbm_register_t *v = &(*values)[(*n_values)++];
+                v->type = REG_INT32;
+                v->value.i = atoi(p);
+                k[n++] = '?';
+            }
+            p = end;
+        }
+        else
+            k[n++] = *p++;
+    }
+    k[n] = '\0';
+
+    *key = k;
+    return CHIDB_OK;
+
+nomem:
+    free(k);
+    for(uint32_t i = 0; i < *n_values; i++)
+        if((*values)[i].type == REG_STRING)
+            free((*values)[i].value.s);
+    free(*values);
+    *values = NULL;
+    *n_values = 0;
+    return CHIDB_ENOMEM;
+}
+
+
+/* Look a program up in a statement cache
+ *
+ * The program found becomes the most recently used one. It still belongs
+ * to the cache, so it must be copied (see chidb_stmt_copy) to be run.
+ *
+ * Parameters
+ * - cache: Statement cache
+ * - key: Normalized SQL statement (see chidb_dbm_cache_normalize)
+ *
+ * Return
+ * - The program of the statement, or NULL if it is not in the cache
+ */
+chidb_stmt *chidb_dbm_cache_get(chidb_dbm_cache_t *cache, const char *key)
+{
+    for(chidb_dbm_cache_entry_t *e = cache->head; e != NULL; e = e->next)
+    {
+        if(!strcmp(e->key, key))
+        {
+            if(e != cache->head)
+            {
+                chidb_dbm_cache_unlink(cache, e);
+                chidb_dbm_cache_push(cache, e);
+            }
+            cache->hits++;
+            return e->stmt;
+        }
+    }
+
+    cache->misses++;
+    return NULL;
+}
+
+
+/* Add a program to a statement cache
+ *
+ * The cache takes ownership of the program (which must have been malloc'd)
+ * and frees it when it is evicted. If the cache is full, the least recently
+ * used program is evicted first.
+ *
+ * Parameters
+ * - cache: Statement cache
+ * - key: Normalized SQL statement, which must not be in the cache already
+ * - stmt: Program compiled from key
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory (the program is not added,
+ *                 and is still owned by the caller)
+ */
+int chidb_dbm_cache_put(chidb_dbm_cache_t *cache, const char *key, chidb_stmt *stmt)
+{
+    chidb_dbm_cache_entry_t *e;
+
+    if((e = malloc(sizeof(chidb_dbm_cache_entry_t))) == NULL)
+        return CHIDB_ENOMEM;
+    if((e->key = strdup(key)) == NULL)
+    {
+        free(e);
+        return CHIDB_ENOMEM;
+    }
+    e->stmt = stmt;
+
+    if(cache->n_entries == DBM_CACHE_SIZE)
+    {
+        chidb_dbm_cache_entry_t *lru = cache->tail;
+        chidb_dbm_cache_unlink(cache, lru);
+        chidb_dbm_cache_free_entry(lru);
+        cache->n_entries--;
+    }
+
+    chidb_dbm_cache_push(cache, e);
+    cache->n_entries++;
+
+    return CHIDB_OK;
+}
@@ -0,0 +1,77 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Statement cache header file. See dbm-cache.c for description of functions.
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef DBM_CACHE_H_
+#define DBM_CACHE_H_
+
+#include "dbm.h"
+
+/* Number of programs a cache keeps before it evicts the least recently
+ * used one */
+#define DBM_CACHE_SIZE (64)
+
+typedef struct chidb_dbm_cache_entry chidb_dbm_cache_entry_t;
+
+/* A compiled statement, whose program is copied for every use */
+struct chidb_dbm_cache_entry
+{
+    char *key;                       /* Normalized SQL */
+    chidb_stmt *stmt;                /* Program compiled from the key */
+    chidb_dbm_cache_entry_t *prev;   /* Entry used more recently */
+    chidb_dbm_cache_entry_t *next;   /* Entry used less recently */
+};
+
+/* The compiled statements of a database, most recently used first */
+struct chidb_dbm_cache
+{
+    chidb_dbm_cache_entry_t *head;
+    chidb_dbm_cache_entry_t *tail;
+    uint32_t n_entries;
+    uint64_t hits;                   /* Lookups that found their program */
+    uint64_t misses;                 /* Lookups that did not */
+};
+
+int chidb_dbm_cache_open(chidb_dbm_cache_t **cache);
+int chidb_dbm_cache_close(chidb_dbm_cache_t *cache);
+int chidb_dbm_cache_clear(chidb_dbm_cache_t *cache);
+int chidb_dbm_cache_normalize(const char *sql, char **key, chidb_dbm_register_t **values, uint32_t *n_values);
+chidb_stmt *chidb_dbm_cache_get(chidb_dbm_cache_t *cache, const char *key);
+int chidb_dbm_cache_put(chidb_dbm_cache_t *cache, const char *key, chidb_stmt *stmt);
+
+#endif /*DBM_CACHE_H_*/
@@ -39,90 +39,344 @@
 
 
 #include "dbm-cursor.h"
+#include "hash.h"
+#include "memtable.h"
+#include "record.h"
+#include "util.h"
 
 /* Your code goes here */
 
+static int chidb_dbm_cursor_tree_next(chidb_dbm_cursor_t *cursor);
+static int chidb_dbm_cursor_tree_prev(chidb_dbm_cursor_t *cursor);
+static int chidb_dbm_cursor_tree_seek(chidb_dbm_cursor_t *cursor, chidb_key_t key, chidb_key_t keyPk, chidb_dbm_seek_type_t seek_type);
+
+/* Whether a cell is the entry (key, keyPk). Index B-Trees can have several
+ * entries with the same key, which are told apart (and ordered) by their
+ * keyPk (see chidb_Btree_searchNodePk); table cells only have a key. */
+static bool chidb_dbm_cell_at(BTreeCell *cell, chidb_key_t key, chidb_key_t keyPk)
+{
+    if(cell->key != key)
+        return false;
+    if(cell->type != PGTYPE_INDEX_LEAF && cell->type != PGTYPE_INDEX_INTERNAL)
+        return true;
+    return chidb_Btree_cellKeyPk(cell) == keyPk;
+}
+
 int chidb_dbm_cursor_init(Btree *bt, chidb_dbm_cursor_t *cursor, npage_t root_page, uint32_t n_cols)
 {
     int rt;
+    bool is_hash;
     chidb_dbm_trail_t *trail;
 
-    if(rt = chidb_dbm_trail_new(bt, &trail, root_page)) { return rt; }
-
-    list_init(&(cursor->trail_list));
+    if(rt = chidb_Hash_isHash(bt, root_page, &is_hash)) { return rt; }
 
+    for(uint32_t i = 0; i <= CURSOR_MAX_DEPTH; i++)
+        cursor->trail[i].btn = NULL;
+    cursor->trail_depth = 0;
     cursor->bt = bt;
     cursor->root_page = root_page;
     cursor->n_cols = n_cols;
-    list_append(&(cursor->trail_list), trail);
+    cursor->stale_trail = false;
+    cursor->hash = is_hash;
+    cursor->bt_valid = false;
+    cursor->bt_dir = 0;
+    cursor->mem_data = NULL;
+    cursor->lo = 0;
+    cursor->hi = UINT32_MAX;
+    if(!is_hash && (rt = chidb_dbm_trail_push(cursor, root_page, &trail))) { return rt; }
 
     return CHIDB_OK;
 }
 
-int chidb_dbm_cursor_destroy(chidb_dbm_cursor_t *cursor)
+/* Drop the layers of the trail below the first depth ones */
+static void chidb_dbm_trail_truncate(chidb_dbm_cursor_t *cursor, uint32_t depth)
 {
-    chidb_dbm_trail_t *trail;
-
-    while(!list_empty(&(cursor->trail_list)))
-    {
-        trail = (chidb_dbm_trail_t *)list_fetch(&(cursor->trail_list));
-        chidb_dbm_trail_destroy(cursor, trail);
-    }
+    while(cursor->trail_depth > depth)
+        chidb_dbm_trail_pop(cursor);
+}
 
-    list_destroy(&(cursor->trail_list));
+int chidb_dbm_cursor_destroy(chidb_dbm_cursor_t *cursor)
+{
+    chidb_dbm_trail_truncate(cursor, 0);
+    for(uint32_t i = 0; i <= CURSOR_MAX_DEPTH && cursor->trail[i].btn != NULL; i++)
+        chidb_Btree_freeMemNode(cursor->bt, cursor->trail[i].btn);
+    free(cursor->mem_data);
 
     return CHIDB_OK;
 }
 
-int chidb_dbm_trail_new(Btree *bt, chidb_dbm_trail_t **trail, npage_t npage)
+/* Read a node while holding a shared latch on its page, so that we never
+ * see a page that another thread is halfway through writing. Descents that
+ * must not lose track of a concurrent split crab their latches instead
+ * (see chidb_dbm_cursor_seek_helper). *btn is reused if it is not NULL
+ * (see chidb_Btree_loadNode). */
+static int chidb_dbm_read_node(Btree *bt, npage_t npage, BTreeNode **btn, uint64_t *version)
 {
     int rt;
-    BTreeNode *btn;
 
-    (*trail) = malloc(sizeof(chidb_dbm_trail_t));
-    if((*trail) == NULL) {
-        return CHIDB_ENOMEM;
+    if(rt = chidb_Pager_latch(bt->pager, npage, LATCH_SHARED)) { return rt; }
+    if(!(rt = chidb_Pager_readVersion(bt->pager, npage, version)))
+        rt = chidb_Btree_loadNode(bt, npage, btn);
+    chidb_Pager_unlatch(bt->pager, npage);
+    return rt;
+}
+
+/* The frame below the bottom layer of the trail, where the next layer goes.
+ * A trail read again from the root is as recent as the epoch of the file
+ * before the root is read (see chidb_dbm_cursor_revalidate). */
+static int chidb_dbm_trail_frame(chidb_dbm_cursor_t *cursor, chidb_dbm_trail_t **trail)
+{
+    if(cursor->trail_depth == CURSOR_MAX_DEPTH) {
+        return CHIDB_ECORRUPT;
+    }
+    if(cursor->trail_depth == 0) {
+        cursor->epoch = chidb_Btree_epoch(cursor->bt);
     }
 
-    if(rt = chidb_Btree_getNodeByPage(bt, npage, &btn)) { return rt; }
+    (*trail) = &(cursor->trail[cursor->trail_depth]);
+    return CHIDB_OK;
+}
+
+/* Same as chidb_dbm_trail_push, for a page the caller has already latched */
+static int chidb_dbm_trail_push_latched(chidb_dbm_cursor_t *cursor, npage_t npage, chidb_dbm_trail_t **trail)
+{
+    int rt;
 
-    (*trail)->btn = btn;
+    if(rt = chidb_dbm_trail_frame(cursor, trail)) { return rt; }
+    if(rt = chidb_Pager_readVersion(cursor->bt->pager, npage, &((*trail)->version))) { return rt; }
+    if(rt = chidb_Btree_loadNode(cursor->bt, npage, &((*trail)->btn))) { return rt; }
     (*trail)->n_cur_cell = 0;
-    (*trail)->depth = 0;
+    cursor->trail_depth++;
+    return CHIDB_OK;
+}
+
+/* Same as chidb_dbm_trail_push, reading the page without latching it (see
+ * chidb_Btree_loadNodeOptimistic) */
+static int chidb_dbm_trail_push_optimistic(chidb_dbm_cursor_t *cursor, npage_t npage, chidb_dbm_trail_t **trail, uint64_t *version)
+{
+    int rt;
 
+    if(rt = chidb_dbm_trail_frame(cursor, trail)) { return rt; }
+    if(rt = chidb_Btree_loadNodeOptimistic(cursor->bt, npage, &((*trail)->btn), version)) { return rt; }
+    (*trail)->version = *version;
+    (*trail)->n_cur_cell = 0;
+    cursor->trail_depth++;
     return CHIDB_OK;
 }
 
-int chidb_dbm_trail_destroy(chidb_dbm_cursor_t *cursor, chidb_dbm_trail_t *trail)
+/* Add a layer for page npage at the bottom of the trail, on its first cell.
+ * The frames of the trail live in the cursor, and each frame keeps (pins)
+ * its node when its layer is removed, so the page is read into the memory
+ * of the last node that was in the frame. Once the trail has been as deep
+ * as the B-Tree, moving the cursor only costs a page read per new node.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECORRUPT: The trail is already CURSOR_MAX_DEPTH layers deep
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_dbm_trail_push(chidb_dbm_cursor_t *cursor, npage_t npage, chidb_dbm_trail_t **trail)
 {
     int rt;
-    if(rt = chidb_Btree_freeMemNode(cursor->bt, trail->btn)) { return rt; }
-    free(trail);
+
+    if(rt = chidb_dbm_trail_frame(cursor, trail)) { return rt; }
+    if(rt = chidb_dbm_read_node(cursor->bt, npage, &((*trail)->btn), &((*trail)->version))) { return rt; }
+    (*trail)->n_cur_cell = 0;
+    cursor->trail_depth++;
     return CHIDB_OK;
 }
 
+/* Remove the bottom layer of the trail. Its node stays pinned in the frame
+ * until the cursor is destroyed, to be reused by the next layer pushed
+ * there. */
+void chidb_dbm_trail_pop(chidb_dbm_cursor_t *cursor)
+{
+    if(cursor->trail_depth > 0)
+        cursor->trail_depth--;
+}
+
+/* The bottom layer of the trail, which is on the leaf of the current cell */
+static chidb_dbm_trail_t *chidb_dbm_trail_leaf(chidb_dbm_cursor_t *cursor)
+{
+    return &(cursor->trail[cursor->trail_depth - 1]);
+}
+
+/* Replace the leaf of the trail (its bottom layer) with one of its
+ * siblings. The upper layers of the trail are left untouched, so they no
+ * longer lead to the new leaf (see chidb_dbm_cursor_resync). The sibling
+ * is read into the spare frame below the leaf, and the two frames swap
+ * their nodes.
+ *
+ * The sibling is read under a shared latch, but the latch on the current
+ * leaf is not held, so the leaves may have been split since the current
+ * leaf was read. A split always puts the new (lower) node in front of the
+ * node being split, so the hop is only accepted if the sibling still
+ * links back to the current leaf; otherwise the current leaf is read again
+ * to get its up-to-date link. The cursor is then positioned by key on the
+ * first cell after (or before) the current one, skipping leaves that do
+ * not have any such cell.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMOVE: There are no more cells in that direction
+ */
+int chidb_dbm_trail_hop(chidb_dbm_cursor_t *cursor, chidb_dbm_trail_t *trail, bool forward)
+{
+    int rt;
+    BTreeNode *btn;
+    npage_t npage, back;
+    chidb_key_t key = cursor->cur_cell.key;
+    chidb_key_t keyPk = chidb_Btree_cellKeyPk(&(cursor->cur_cell));
+    chidb_dbm_trail_t *spare = &(cursor->trail[cursor->trail_depth]);
+    BTreeCell cell;
+    uint64_t version;
+    ncell_t i;
+
+    for(;;) {
+        npage = forward ? trail->btn->next_page : trail->btn->prev_page;
+        if(npage == SIBLING_NONE) {
+            return CHIDB_EMOVE;
+        }
+
+        if(rt = chidb_dbm_read_node(cursor->bt, npage, &(spare->btn), &version)) { return rt; }
+        btn = spare->btn;
+
+        back = forward ? btn->prev_page : btn->next_page;
+        if(back != trail->btn->page->npage) {
+            /* A split got between the two leaves: follow the new link */
+            npage = trail->btn->page->npage;
+            if(rt = chidb_dbm_read_node(cursor->bt, npage, &(trail->btn), &(trail->version))) { return rt; }
+            continue;
+        }
+
+        spare->btn = trail->btn;
+        trail->btn = btn;
+        trail->version = version;
+        cursor->stale_trail = true;
+
+        if(rt = chidb_Btree_searchNodePk(btn, key, keyPk, &i)) { return rt; }
+        if(forward) {
+            if(i < btn->n_cells && !(rt = chidb_Btree_getCell(btn, i, &cell)) &&
+               chidb_dbm_cell_at(&cell, key, keyPk)) {
+                i++;
+            }
+            if(rt) { return rt; }
+            if(i < btn->n_cells) {
+                trail->n_cur_cell = i;
+                return CHIDB_OK;
+            }
+        }
+        else if(i > 0) {
+            trail->n_cur_cell = i - 1;
+            return CHIDB_OK;
+        }
+    }
+}
+
+/* Rebuild the whole trail down to the current cell, so that the cursor can
+ * walk through the upper layers again */
+int chidb_dbm_cursor_resync(chidb_dbm_cursor_t *cursor)
+{
+    return chidb_dbm_cursor_tree_seek(cursor, cursor->cur_cell.key,
+                                      chidb_Btree_cellKeyPk(&(cursor->cur_cell)), SEEKEQ);
+}
+
+/* Put the cursor back on its current row after the B-Tree was modified
+ *
+ * The nodes of the trail are copies of the pages, which an insertion does
+ * not update. Unless a node was split since the trail was read from the
+ * root (see chidb_Btree_epoch), every key is still on the page the trail
+ * has for it, and the upper layers of the trail are still right: only the
+ * leaf has to be read again, and only if its page was modified since it
+ * was read. This is what lets a program insert row after row without a
+ * descent from the root after each one. Otherwise, or if the current row
+ * is not in the B-Tree (but in the memtable of the table), the cursor
+ * seeks its current key from the root.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: The current key was sought again and is not there
+ *                    (the cursor was not on a row)
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_dbm_cursor_revalidate(chidb_dbm_cursor_t *cursor)
+{
+    chidb_dbm_trail_t *trail;
+    chidb_key_t key = cursor->cur_cell.key;
+    chidb_key_t keyPk = chidb_Btree_cellKeyPk(&(cursor->cur_cell));
+    npage_t npage;
+    uint64_t version;
+    BTreeCell cell;
+    ncell_t i;
+    int rt;
+
+    if(cursor->hash)
+        return CHIDB_OK;
+
+    if(cursor->trail_depth > 0 && cursor->bt_valid && chidb_dbm_cell_at(&(cursor->bt_cell), key, keyPk) &&
+       cursor->epoch == chidb_Btree_epoch(cursor->bt)) {
+        trail = chidb_dbm_trail_leaf(cursor);
+        npage = trail->btn->page->npage;
+
+        rt = chidb_Pager_readVersion(cursor->bt->pager, npage, &version);
+        if(rt && rt != CHIDB_ERESTART) { return rt; }
+        if(!rt && version == trail->version) {
+            return CHIDB_OK;
+        }
+
+        /* The cells after the current one may have moved in the leaf */
+        if(rt = chidb_dbm_read_node(cursor->bt, npage, &(trail->btn), &(trail->version))) { return rt; }
+        if(rt = chidb_Btree_searchNodePk(trail->btn, key, keyPk, &i)) { return rt; }
+        if(i < trail->btn->n_cells) {
+            if(rt = chidb_Btree_getCell(trail->btn, i, &cell)) { return rt; }
+            if(chidb_dbm_cell_at(&cell, key, keyPk)) {
+                trail->n_cur_cell = i;
+                cursor->bt_cell = cursor->cur_cell = cell;
+                return CHIDB_OK;
+            }
+        }
+        /* A split got in after we read the epoch */
+    }
+
+    return chidb_dbm_cursor_seek(cursor, key, SEEKEQ);
+}
+
 int chidb_dbm_cursor_table_rewind(chidb_dbm_cursor_t *cursor)
 {
     int rt;
-    uint32_t trail_loc = list_size(&(cursor->trail_list)) - 1;
-    if(trail_loc < 0) {
+    if(cursor->trail_depth == 0) {
         return CHIDB_EEMPTY;
     }
 
-    chidb_dbm_trail_t *trail = list_get_at(&(cursor->trail_list), trail_loc);
+    chidb_dbm_trail_t *trail = chidb_dbm_trail_leaf(cursor);
 
     if(trail->btn->type == PGTYPE_TABLE_INTERNAL) {
         BTreeCell cell;
         trail->n_cur_cell = 0;
-        if(rt = chidb_Btree_getCell(trail->btn, trail->n_cur_cell, &cell)) { return rt; }
+        npage_t npage = trail->btn->page->npage;
+        if(rt = chidb_Btree_getCell(trail->btn, trail->n_cur_cell, &cell)) {
+            chidb_Pager_unlatch(cursor->bt->pager, npage);
+            return rt;
+        }
         chidb_dbm_trail_t *new_trail;
-        chidb_dbm_trail_new(cursor->bt, &new_trail, cell.fields.tableInternal.child_page);
-        new_trail->depth = trail->depth + 1;
-        list_append(&(cursor->trail_list), new_trail);
+        npage_t child_page = cell.fields.tableInternal.child_page;
+        if(rt = chidb_Pager_latch(cursor->bt->pager, child_page, LATCH_SHARED)) {
+            chidb_Pager_unlatch(cursor->bt->pager, npage);
+            return rt;
+        }
+        rt = chidb_dbm_trail_push_latched(cursor, child_page, &new_trail);
+        chidb_Pager_unlatch(cursor->bt->pager, npage);
+        if(rt) {
+            chidb_Pager_unlatch(cursor->bt->pager, child_page);
+            return rt;
+        }
         return chidb_dbm_cursor_table_rewind(cursor);
     }
     else {
         trail->n_cur_cell = 0;
+        chidb_Pager_unlatch(cursor->bt->pager, trail->btn->page->npage);
         if(rt = chidb_Btree_getCell(trail->btn, trail->n_cur_cell, &(cursor->cur_cell))) { return rt; }
         return CHIDB_OK;
     }
@@ -131,34 +385,51 @@ int chidb_dbm_cursor_table_rewind(chidb_dbm_cursor_t *cursor)
 int chidb_dbm_cursor_index_rewind(chidb_dbm_cursor_t *cursor)
 {
     int rt;
-    uint32_t trail_loc = list_size(&(cursor->trail_list)) - 1;
-    if(trail_loc < 0) {
+    if(cursor->trail_depth == 0) {
         return CHIDB_EEMPTY;
     }
 
-    chidb_dbm_trail_t *trail = list_get_at(&(cursor->trail_list), trail_loc);
+    chidb_dbm_trail_t *trail = chidb_dbm_trail_leaf(cursor);
 
     if(trail->btn->type == PGTYPE_INDEX_INTERNAL) {
         BTreeCell cell;
         trail->n_cur_cell = 0;
-        if(rt = chidb_Btree_getCell(trail->btn, trail->n_cur_cell, &cell)) { return rt; }
+        npage_t npage = trail->btn->page->npage;
+        if(rt = chidb_Btree_getCell(trail->btn, trail->n_cur_cell, &cell)) {
+            chidb_Pager_unlatch(cursor->bt->pager, npage);
+            return rt;
+        }
         chidb_dbm_trail_t *new_trail;
-        chidb_dbm_trail_new(cursor->bt, &new_trail, cell.fields.indexInternal.child_page);
-        new_trail->depth = trail->depth + 1;
-        list_append(&(cursor->trail_list), new_trail);
+        npage_t child_page = cell.fields.indexInternal.child_page;
+        if(rt = chidb_Pager_latch(cursor->bt->pager, child_page, LATCH_SHARED)) {
+            chidb_Pager_unlatch(cursor->bt->pager, npage);
+            return rt;
+        }
+        rt = chidb_dbm_trail_push_latched(cursor, child_page, &new_trail);
+        chidb_Pager_unlatch(cursor->bt->pager, npage);
+        if(rt) {
+            chidb_Pager_unlatch(cursor->bt->pager, child_page);
+            return rt;
+        }
         return chidb_dbm_cursor_index_rewind(cursor);
     }
     else {
         trail->n_cur_cell = 0;
+        chidb_Pager_unlatch(cursor->bt->pager, trail->btn->page->npage);
         if(rt = chidb_Btree_getCell(trail->btn, trail->n_cur_cell, &(cursor->cur_cell))) { return rt; }
         return CHIDB_OK;
     }
 }
 
+/* Move the trail to the next (or previous) child of an upper layer. This is
+ * only used on leaves without sibling links, and unlike chidb_dbm_trail_hop
+ * it does not notice nodes that were split after the trail was built. The
+ * layers below the one that moved are dropped and read again from the new
+ * child. */
 int chidb_dbm_trail_layer_next(chidb_dbm_cursor_t *cursor, int layer)
 {
-    uint32_t trail_loc = list_size(&(cursor->trail_list)) + layer;
-    chidb_dbm_trail_t *trail = list_get_at(&(cursor->trail_list), trail_loc);
+    uint32_t trail_loc = cursor->trail_depth + layer;
+    chidb_dbm_trail_t *trail = &(cursor->trail[trail_loc]);
     int rt;
 
     if(trail->n_cur_cell == trail->btn->n_cells) {
@@ -166,7 +437,6 @@ int chidb_dbm_trail_layer_next(chidb_dbm_cursor_t *cursor, int layer)
             return CHIDB_EMOVE;
         }
         if(rt = chidb_dbm_trail_layer_next(cursor, layer - 1)) { return rt; }
-        trail = list_get_at(&(cursor->trail_list), trail_loc);
     }
     else {
         trail->n_cur_cell++;
@@ -183,20 +453,15 @@ int chidb_dbm_trail_layer_next(chidb_dbm_cursor_t *cursor, int layer)
     }
 
     chidb_dbm_trail_t *new_trail;
-    new_trail = list_extract_at(&(cursor->trail_list), trail_loc + 1);
-    chidb_dbm_trail_destroy(cursor, new_trail);
-    
-    chidb_dbm_trail_new(cursor->bt, &new_trail, child_page);
-    new_trail->depth = trail->depth + 1;
-    new_trail->n_cur_cell = 0;
-    list_insert_at(&(cursor->trail_list), new_trail, trail_loc + 1);
+    chidb_dbm_trail_truncate(cursor, trail_loc + 1);
+    if(rt = chidb_dbm_trail_push(cursor, child_page, &new_trail)) { return rt; }
     return CHIDB_OK;
 }
 
 int chidb_dbm_trail_layer_prev(chidb_dbm_cursor_t *cursor, int layer)
 {
-    uint32_t trail_loc = list_size(&(cursor->trail_list)) + layer;
-    chidb_dbm_trail_t *trail = list_get_at(&(cursor->trail_list), trail_loc);
+    uint32_t trail_loc = cursor->trail_depth + layer;
+    chidb_dbm_trail_t *trail = &(cursor->trail[trail_loc]);
     int rt;
 
     if(trail->n_cur_cell == 0) {
@@ -204,7 +469,6 @@ int chidb_dbm_trail_layer_prev(chidb_dbm_cursor_t *cursor, int layer)
             return CHIDB_EMOVE;
         }
         if(rt = chidb_dbm_trail_layer_prev(cursor, layer - 1)) { return rt; }
-        trail = list_get_at(&(cursor->trail_list), trail_loc);
     }
     else {
         trail->n_cur_cell--;
@@ -222,42 +486,60 @@ int chidb_dbm_trail_layer_prev(chidb_dbm_cursor_t *cursor, int layer)
     }
 
     chidb_dbm_trail_t *new_trail;
-    new_trail = list_extract_at(&(cursor->trail_list), trail_loc + 1);
-    chidb_dbm_trail_destroy(cursor, new_trail);
-    
-    chidb_dbm_trail_new(cursor->bt, &new_trail, child_page);
-    new_trail->depth = trail->depth + 1;
+    chidb_dbm_trail_truncate(cursor, trail_loc + 1);
+    if(rt = chidb_dbm_trail_push(cursor, child_page, &new_trail)) { return rt; }
     new_trail->n_cur_cell = new_trail->btn->n_cells;
-    list_insert_at(&(cursor->trail_list), new_trail, trail_loc + 1);
     return CHIDB_OK;
 }
 
-int chidb_dbm_cursor_seek_helper(chidb_dbm_cursor_t *cursor, chidb_key_t key)
+/* Position the cursor on the cell of a leaf found by a search */
+static int chidb_dbm_cursor_seek_leaf(chidb_dbm_cursor_t *cursor, chidb_dbm_trail_t *trail)
 {
-    uint32_t trail_loc = list_size(&(cursor->trail_list)) - 1;
-    chidb_dbm_trail_t *trail = list_get_at(&(cursor->trail_list), trail_loc);
+    int rt;
+
+    if(trail->n_cur_cell == trail->btn->n_cells) {
+        trail->n_cur_cell--;
+        if(trail->btn->n_cells > 0 &&
+           (rt = chidb_Btree_getCell(trail->btn, trail->n_cur_cell, &(cursor->cur_cell)))) { return rt; }
+        return CHIDB_ENOTFOUND;
+    }
+
+    if(rt = chidb_Btree_getCell(trail->btn, trail->n_cur_cell, &(cursor->cur_cell))) { return rt; }
+    return CHIDB_OK;
+}
+
+/* Descend from the last node of the trail down to the leaf where the entry
+ * (key, keyPk) is (or would be), appending a trail node for each layer.
+ * keyPk is only used in index B-Trees.
+ *
+ * The caller must hold a shared latch on the page of the last node of the
+ * trail. Latches are crabbed on the way down (the child is latched before
+ * the parent is released), and the latch on the leaf is released before
+ * returning.
+ */
+int chidb_dbm_cursor_seek_helper(chidb_dbm_cursor_t *cursor, chidb_key_t key, chidb_key_t keyPk)
+{
+    chidb_dbm_trail_t *trail = chidb_dbm_trail_leaf(cursor);
+    npage_t npage = trail->btn->page->npage;
     int rt = 0;
 
-    if(trail->btn->type == PGTYPE_INDEX_LEAF || trail->btn->type == PGTYPE_TABLE_LEAF) {
-        for(; trail->n_cur_cell < trail->btn->n_cells; trail->n_cur_cell++) {
-            if(rt = chidb_Btree_getCell(trail->btn, trail->n_cur_cell, &(cursor->cur_cell))) { return rt; }
-            if(cursor->cur_cell.key >= key)
-                break;
-        }
-        if(trail->n_cur_cell == trail->btn->n_cells) {
-            trail->n_cur_cell--;
-            return CHIDB_ENOTFOUND;
-        }
+    if(rt = chidb_Btree_searchNodePk(trail->btn, key, keyPk, &(trail->n_cur_cell))) {
+        chidb_Pager_unlatch(cursor->bt->pager, npage);
+        return rt;
+    }
 
-        return CHIDB_OK;
+    if(trail->btn->type == PGTYPE_INDEX_LEAF || trail->btn->type == PGTYPE_TABLE_LEAF) {
+        chidb_Pager_unlatch(cursor->bt->pager, npage);
+        return chidb_dbm_cursor_seek_leaf(cursor, trail);
     }
     else {
         BTreeCell cell;
         npage_t lower_layer_page;
-        for(; trail->n_cur_cell < trail->btn->n_cells; trail->n_cur_cell++) {
-            if(rt = chidb_Btree_getCell(trail->btn, trail->n_cur_cell, &cell)) { return rt; }
-            if(cell.key >= key)
-                break;
+        if(trail->n_cur_cell < trail->btn->n_cells) {
+            if(rt = chidb_Btree_getCell(trail->btn, trail->n_cur_cell, &cell)) {
+                chidb_Pager_unlatch(cursor->bt->pager, npage);
+                return rt;
+            }
         }
         if(trail->n_cur_cell == trail->btn->n_cells) {
             lower_layer_page = trail->btn->right_page;
@@ -268,28 +550,70 @@ int chidb_dbm_cursor_seek_helper(chidb_dbm_cursor_t *cursor, chidb_key_t key)
         }
 
         chidb_dbm_trail_t *new_trail;
-        chidb_dbm_trail_new(cursor->bt, &new_trail, lower_layer_page);
-        new_trail->depth = trail->depth + 1;
-        new_trail->n_cur_cell = 0;
-        list_append(&(cursor->trail_list), new_trail);
-        return chidb_dbm_cursor_seek_helper(cursor, key);
+        if(rt = chidb_Pager_latch(cursor->bt->pager, lower_layer_page, LATCH_SHARED)) {
+            chidb_Pager_unlatch(cursor->bt->pager, npage);
+            return rt;
+        }
+        rt = chidb_dbm_trail_push_latched(cursor, lower_layer_page, &new_trail);
+        chidb_Pager_unlatch(cursor->bt->pager, npage);
+        if(rt) {
+            chidb_Pager_unlatch(cursor->bt->pager, lower_layer_page);
+            return rt;
+        }
+        return chidb_dbm_cursor_seek_helper(cursor, key, keyPk);
     }
 }
 
-int chidb_dbm_cursor_rewind(chidb_dbm_cursor_t *cursor)
+/* Build the trail from the root down to the leaf where (key, keyPk) is (or
+ * would be) without latching any node, like chidb_Btree_find does (see
+ * chidb_Btree_getNodeOptimistic). Returns CHIDB_ERESTART if a node was
+ * modified during the descent, in which case the trail must be discarded. */
+static int chidb_dbm_cursor_seek_optimistic(chidb_dbm_cursor_t *cursor, chidb_key_t key, chidb_key_t keyPk)
 {
-    chidb_dbm_trail_t *tmp_trail;
-    while(!list_empty(&(cursor->trail_list)))
-    {
-        tmp_trail = (chidb_dbm_trail_t *)list_fetch(&(cursor->trail_list));
-        chidb_dbm_trail_destroy(cursor, tmp_trail);
+    chidb_dbm_trail_t *trail;
+    BTreeNode *btn;
+    npage_t npage = cursor->root_page, child_page;
+    uint64_t version, child_version;
+    int rt;
+
+    if(rt = chidb_dbm_trail_push_optimistic(cursor, npage, &trail, &version)) { return rt; }
+
+    for(;;) {
+        btn = trail->btn;
+        if(rt = chidb_Btree_searchNodePk(btn, key, keyPk, &(trail->n_cur_cell))) { return rt; }
+
+        if(btn->type == PGTYPE_INDEX_LEAF || btn->type == PGTYPE_TABLE_LEAF) {
+            return chidb_dbm_cursor_seek_leaf(cursor, trail);
+        }
+
+        child_page = trail->n_cur_cell == btn->n_cells ? btn->right_page
+                                                       : btn->cells->child_pages[trail->n_cur_cell];
+
+        if(rt = chidb_dbm_trail_push_optimistic(cursor, child_page, &trail, &child_version)) { return rt; }
+        if(rt = chidb_Pager_validate(cursor->bt->pager, npage, version)) { return rt; }
+        npage = child_page;
+        version = child_version;
     }
+}
+
+static int chidb_dbm_cursor_tree_rewind(chidb_dbm_cursor_t *cursor)
+{
+    chidb_dbm_trail_t *tmp_trail;
 
-    chidb_dbm_trail_new(cursor->bt, &tmp_trail, cursor->root_page);
-    list_append(&(cursor->trail_list), tmp_trail);
+    chidb_dbm_trail_truncate(cursor, 0);
 
-    if(tmp_trail->btn->n_cells == 0)
+    int rt;
+    if(rt = chidb_Pager_latch(cursor->bt->pager, cursor->root_page, LATCH_SHARED)) { return rt; }
+    if(rt = chidb_dbm_trail_push_latched(cursor, cursor->root_page, &tmp_trail)) {
+        chidb_Pager_unlatch(cursor->bt->pager, cursor->root_page);
+        return rt;
+    }
+    cursor->stale_trail = false;
+
+    if(tmp_trail->btn->n_cells == 0) {
+        chidb_Pager_unlatch(cursor->bt->pager, cursor->root_page);
         return CHIDB_ENOTFOUND;
+    }
 
     if(tmp_trail->btn->type == PGTYPE_TABLE_INTERNAL ||
         tmp_trail->btn->type == PGTYPE_TABLE_LEAF) {
@@ -300,18 +624,26 @@ int chidb_dbm_cursor_rewind(chidb_dbm_cursor_t *cursor)
     }
 }
 
-int chidb_dbm_cursor_next(chidb_dbm_cursor_t *cursor)
+static int chidb_dbm_cursor_tree_next(chidb_dbm_cursor_t *cursor)
 {
-    uint32_t trail_loc = list_size(&(cursor->trail_list)) - 1;
-    chidb_dbm_trail_t *trail = list_get_at(&(cursor->trail_list), trail_loc);
+    uint32_t trail_loc = cursor->trail_depth - 1;
+    chidb_dbm_trail_t *trail = &(cursor->trail[trail_loc]);
     int rt = 0;
     if(trail->n_cur_cell == trail->btn->n_cells - 1) {
         if(trail_loc == 0)
             return CHIDB_EMOVE;
-        if(rt = chidb_dbm_trail_layer_next(cursor, -2)) {
-            return rt;
+        if(trail->btn->next_page != SIBLING_UNKNOWN) {
+            if(rt = chidb_dbm_trail_hop(cursor, trail, true)) { return rt; }
+        }
+        else {
+            if(cursor->stale_trail && (rt = chidb_dbm_cursor_resync(cursor))) {
+                return rt;
+            }
+            if(rt = chidb_dbm_trail_layer_next(cursor, -2)) {
+                return rt;
+            }
+            trail = chidb_dbm_trail_leaf(cursor);
         }
-        trail = list_get_at(&(cursor->trail_list), trail_loc);
     }
     else {
         trail->n_cur_cell++;
@@ -321,19 +653,27 @@ int chidb_dbm_cursor_next(chidb_dbm_cursor_t *cursor)
     return CHIDB_OK;
 }
 
-int chidb_dbm_cursor_prev(chidb_dbm_cursor_t *cursor)
+static int chidb_dbm_cursor_tree_prev(chidb_dbm_cursor_t *cursor)
 {
-    uint32_t trail_loc = list_size(&(cursor->trail_list)) - 1;
-    chidb_dbm_trail_t *trail = list_get_at(&(cursor->trail_list), trail_loc);
+    uint32_t trail_loc = cursor->trail_depth - 1;
+    chidb_dbm_trail_t *trail = &(cursor->trail[trail_loc]);
     int rt = 0;
     if(trail->n_cur_cell == 0) {
         if(trail_loc == 0)
             return CHIDB_EMOVE;
-        if(rt = chidb_dbm_trail_layer_prev(cursor, -2)) {
-            return rt;
+        if(trail->btn->prev_page != SIBLING_UNKNOWN) {
+            if(rt = chidb_dbm_trail_hop(cursor, trail, false)) { return rt; }
+        }
+        else {
+            if(cursor->stale_trail && (rt = chidb_dbm_cursor_resync(cursor))) {
+                return rt;
+            }
+            if(rt = chidb_dbm_trail_layer_prev(cursor, -2)) {
+                return rt;
+            }
+            trail = chidb_dbm_trail_leaf(cursor);
+            trail->n_cur_cell--;
         }
-        trail = list_get_at(&(cursor->trail_list), trail_loc);
-        trail->n_cur_cell--;
     }
     else {
         trail->n_cur_cell--;
@@ -343,19 +683,82 @@ int chidb_dbm_cursor_prev(chidb_dbm_cursor_t *cursor)
     return CHIDB_OK;
 }
 
-int chidb_dbm_cursor_seek(chidb_dbm_cursor_t *cursor, chidb_key_t key, chidb_dbm_seek_type_t seek_type)
+/* Hash indexes have no order, so a cursor on one can only find the entries
+ * with a given key: a seek finds the one with the smallest KeyPk, and Next
+ * the following ones (see chidb_dbm_cursor_hash_next). The entry becomes
+ * the current cell as an index leaf cell, so that the cursor can be used
+ * like a cursor on an index B-Tree. */
+static void chidb_dbm_cursor_hash_cell(chidb_dbm_cursor_t *cursor, chidb_key_t key, chidb_key_t keyPk)
+{
+    cursor->cur_cell.type = PGTYPE_INDEX_LEAF;
+    cursor->cur_cell.key = key;
+    cursor->cur_cell.fields.indexLeaf.keyPk = keyPk;
+    cursor->cur_cell.fields.indexLeaf.data_size = 0;
+}
+
+static int chidb_dbm_cursor_hash_seek(chidb_dbm_cursor_t *cursor, chidb_key_t key, chidb_dbm_seek_type_t seek_type)
+{
+    chidb_key_t keyPk;
+    int rt;
+
+    if(seek_type != SEEKEQ)
+        return CHIDB_EMISUSE;
+
+    if(rt = chidb_Hash_find(cursor->bt, cursor->root_page, key, &keyPk)) { return rt; }
+
+    chidb_dbm_cursor_hash_cell(cursor, key, keyPk);
+    return CHIDB_OK;
+}
+
+/* Move a cursor on a hash index to the next entry with the key of the
+ * current one. Returns CHIDB_EMOVE, leaving the cursor where it was, if
+ * there is none. */
+static int chidb_dbm_cursor_hash_next(chidb_dbm_cursor_t *cursor)
+{
+    chidb_key_t key = cursor->cur_cell.key, keyPk;
+    int rt;
+
+    rt = chidb_Hash_findNext(cursor->bt, cursor->root_page, key, cursor->cur_cell.fields.indexLeaf.keyPk, &keyPk);
+    if(rt) { return rt == CHIDB_ENOTFOUND ? CHIDB_EMOVE : rt; }
+
+    chidb_dbm_cursor_hash_cell(cursor, key, keyPk);
+    return CHIDB_OK;
+}
+
+/* Seek the trail to an entry of the B-Tree. In an index B-Tree, the entries
+ * are ordered by (key, keyPk), and the seek is relative to (key, keyPk):
+ * SEEKEQ and SEEKGE with a keyPk of 0 find the first entry with the key,
+ * and SEEKLE and SEEKGT with a keyPk of UINT32_MAX the last one (or the
+ * entry after it). */
+static int chidb_dbm_cursor_tree_seek(chidb_dbm_cursor_t *cursor, chidb_key_t key, chidb_key_t keyPk, chidb_dbm_seek_type_t seek_type)
 {
     chidb_dbm_trail_t *tmp_trail;
-    while(!list_empty(&(cursor->trail_list)))
-    {
-        tmp_trail = (chidb_dbm_trail_t *)list_fetch(&(cursor->trail_list));
-        chidb_dbm_trail_destroy(cursor, tmp_trail);
+    int rt = CHIDB_ERESTART;
+
+    /* A key the Bloom filter rules out is not worth a descent; the cursor
+     * stays where it was */
+    if(seek_type == SEEKEQ && !chidb_Btree_bloomMayContain(cursor->bt, cursor->root_page, key))
+        return CHIDB_ENOTFOUND;
+
+    cursor->stale_trail = false;
+
+    /* Try without latches first, and crab latches if the tree keeps
+     * changing under us */
+    for(int i = 0; i < BTREE_OPTIMISTIC_RETRIES && rt == CHIDB_ERESTART; i++) {
+        chidb_dbm_trail_truncate(cursor, 0);
+        rt = chidb_dbm_cursor_seek_optimistic(cursor, key, keyPk);
     }
-    int rt;
-    if(rt = chidb_dbm_trail_new(cursor->bt, &tmp_trail, cursor->root_page)) { return rt; }
-    list_append(&(cursor->trail_list), tmp_trail);
 
-    rt = chidb_dbm_cursor_seek_helper(cursor, key);
+    if(rt == CHIDB_ERESTART) {
+        chidb_dbm_trail_truncate(cursor, 0);
+        if(rt = chidb_Pager_latch(cursor->bt->pager, cursor->root_page, LATCH_SHARED)) { return rt; }
+        if(rt = chidb_dbm_trail_push_latched(cursor, cursor->root_page, &tmp_trail)) {
+            chidb_Pager_unlatch(cursor->bt->pager, cursor->root_page);
+            return rt;
+        }
+
+        rt = chidb_dbm_cursor_seek_helper(cursor, key, keyPk);
+    }
 
     switch(seek_type){
 
@@ -374,8 +777,13 @@ int chidb_dbm_cursor_seek(chidb_dbm_cursor_t *cursor, chidb_key_t key, chidb_dbm
         if(rt && rt != CHIDB_ENOTFOUND) {
             return rt;
         }
-        else if(cursor->cur_cell.key != key){
-            if(rt = chidb_dbm_cursor_prev(cursor)) {
+        else if(rt && rt == CHIDB_ENOTFOUND) {
+            /* The last entry of the tree is the one, unless it has none */
+            tmp_trail = chidb_dbm_trail_leaf(cursor);
+            return tmp_trail->btn->n_cells > 0 ? CHIDB_OK : CHIDB_ENOTFOUND;
+        }
+        else if(!chidb_dbm_cell_at(&(cursor->cur_cell), key, keyPk)){
+            if(rt = chidb_dbm_cursor_tree_prev(cursor)) {
                 return CHIDB_ENOTFOUND;
             }
             return CHIDB_OK;
@@ -397,10 +805,12 @@ int chidb_dbm_cursor_seek(chidb_dbm_cursor_t *cursor, chidb_key_t key, chidb_dbm
             return rt;
         }
         else if(rt && rt == CHIDB_ENOTFOUND) {
-            return CHIDB_OK;
+            /* Every key of the tree is lower, unless it has none */
+            tmp_trail = chidb_dbm_trail_leaf(cursor);
+            return tmp_trail->btn->n_cells > 0 ? CHIDB_OK : CHIDB_ENOTFOUND;
         }
         else {
-            if(rt = chidb_dbm_cursor_prev(cursor)) {
+            if(rt = chidb_dbm_cursor_tree_prev(cursor)) {
                 return CHIDB_ENOTFOUND;
             }
             return CHIDB_OK;
@@ -410,8 +820,8 @@ int chidb_dbm_cursor_seek(chidb_dbm_cursor_t *cursor, chidb_key_t key, chidb_dbm
         if(rt) {
             return rt;
         }
-        else if(cursor->cur_cell.key == key){
-            if(rt = chidb_dbm_cursor_next(cursor)) {
+        else if(chidb_dbm_cell_at(&(cursor->cur_cell), key, keyPk)){
+            if(rt = chidb_dbm_cursor_tree_next(cursor)) {
                 return CHIDB_ENOTFOUND;
             }
             return CHIDB_OK;
@@ -425,3 +835,412 @@ int chidb_dbm_cursor_seek(chidb_dbm_cursor_t *cursor, chidb_key_t key, chidb_dbm
 
     return CHIDB_OK;
 }
+
+
+/* A cursor on a buffered table (see memtable.h) walks two sorted sequences
+ * at once: the B-Tree, through its trail, and the memtable of the table,
+ * which is searched by key at every move. The cell of the B-Tree the trail
+ * is on is kept in bt_cell, and the current cell is whichever of bt_cell
+ * and the row found in the memtable comes first in the direction of the
+ * move. A key found in both (which only happens while the memtable is
+ * being flushed) is a single row.
+ *
+ * bt_dir says where bt_cell is relative to the current key, so that moving
+ * on in the same direction does not search the B-Tree again: 1 if it is the
+ * first cell of the B-Tree at or after the current key, -1 if it is the
+ * last one at or before it, and 0 if we do not know. bt_valid is false if
+ * there is no such cell.
+ *
+ * Most tables are not buffered; their memtable never has a row, and the
+ * cursor only walks the B-Tree.
+ */
+
+/* Find the row of the memtable to compare with bt_cell. The row is
+ * returned as a table leaf cell, with a copy of its data in *data. */
+static int chidb_dbm_cursor_mem_seek(chidb_dbm_cursor_t *cursor, chidb_key_t key, chidb_memtable_seek_t seek,
+                                     BTreeCell *cell, uint8_t **data)
+{
+    uint16_t size;
+    int rt;
+
+    *data = NULL;
+    if(rt = chidb_Memtable_seek(cursor->bt, cursor->root_page, key, seek, &cell->key, data, &size)) { return rt; }
+
+    cell->type = PGTYPE_TABLE_LEAF;
+    cell->fields.tableLeaf.data_size = size;
+    cell->fields.tableLeaf.data = *data;
+    return CHIDB_OK;
+}
+
+/* Make the current cell the first (or last, if !forward) of bt_cell and
+ * the row found in the memtable (if mem_rt is CHIDB_OK). The current cell
+ * is left alone if there is neither, or if that cell is outside the range
+ * of the cursor. */
+static int chidb_dbm_cursor_pick(chidb_dbm_cursor_t *cursor, bool forward, int mem_rt, BTreeCell *mem_cell, uint8_t *mem_data)
+{
+    BTreeCell *cell;
+
+    if(mem_rt != CHIDB_OK && mem_rt != CHIDB_ENOTFOUND) {
+        return mem_rt;
+    }
+
+    if(mem_rt == CHIDB_OK && (!cursor->bt_valid || (forward ? mem_cell->key <= cursor->bt_cell.key
+                                                            : mem_cell->key >= cursor->bt_cell.key))) {
+        cell = mem_cell;
+    }
+    else {
+        free(mem_data);
+        mem_data = NULL;
+        if(!cursor->bt_valid) {
+            return CHIDB_ENOTFOUND;
+        }
+        cell = &(cursor->bt_cell);
+    }
+
+    if(cell->key < cursor->lo || cell->key > cursor->hi) {
+        free(mem_data);
+        return CHIDB_ENOTFOUND;
+    }
+
+    if(cell == mem_cell) {
+        free(cursor->mem_data);
+        cursor->mem_data = mem_data;
+    }
+    cursor->cur_cell = *cell;
+    return CHIDB_OK;
+}
+
+/* Keep the cell a move of the trail landed on (rt being the result of the
+ * move) as bt_cell */
+static int chidb_dbm_cursor_keep_tree(chidb_dbm_cursor_t *cursor, int rt, int8_t dir)
+{
+    if(rt && rt != CHIDB_ENOTFOUND && rt != CHIDB_EMOVE) {
+        return rt;
+    }
+    cursor->bt_cell = cursor->cur_cell;
+    cursor->bt_valid = !rt;
+    cursor->bt_dir = dir;
+    return CHIDB_OK;
+}
+
+/* Move bt_cell to the first cell of the B-Tree after (or before, if
+ * !forward) the current key. This changes the current cell. */
+static int chidb_dbm_cursor_tree_step(chidb_dbm_cursor_t *cursor, bool forward)
+{
+    chidb_key_t key = cursor->cur_cell.key;
+    chidb_key_t keyPk = chidb_Btree_cellKeyPk(&(cursor->cur_cell));
+    int8_t dir = forward ? 1 : -1;
+    int rt;
+
+    if(cursor->bt_valid && chidb_dbm_cell_at(&(cursor->bt_cell), key, keyPk)) {
+        cursor->cur_cell = cursor->bt_cell;
+        rt = forward ? chidb_dbm_cursor_tree_next(cursor) : chidb_dbm_cursor_tree_prev(cursor);
+    }
+    else if(cursor->bt_dir != dir) {
+        rt = chidb_dbm_cursor_tree_seek(cursor, key, keyPk, forward ? SEEKGT : SEEKLT);
+    }
+    else {
+        return CHIDB_OK;
+    }
+
+    return chidb_dbm_cursor_keep_tree(cursor, rt, dir);
+}
+
+/* Bound a cursor to a range of keys
+ *
+ * Limits the rows a cursor moves on to those with a key in [lo, hi] (for
+ * an index, the entries with an IdxKey in that range). A rewind moves the
+ * cursor to the first row at or after lo, and Next stops with CHIDB_EMOVE
+ * before the first row after hi, instead of walking the rest of the table.
+ * Prev and seeks are bounded in the same way. A cursor is opened with the
+ * range [0, UINT32_MAX]; lo > hi is an empty range.
+ *
+ * The cursor is not moved: rewind or seek it to get on a row in the range.
+ *
+ * Parameters
+ * - cursor: A cursor on a table or a B-Tree index
+ * - lo: Lowest key of the range
+ * - hi: Highest key of the range
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The cursor is on a hash index, which has no order
+ */
+int chidb_dbm_cursor_set_range(chidb_dbm_cursor_t *cursor, chidb_key_t lo, chidb_key_t hi)
+{
+    if(cursor->hash)
+        return CHIDB_EMISUSE;
+
+    cursor->lo = lo;
+    cursor->hi = hi;
+    return CHIDB_OK;
+}
+
+int chidb_dbm_cursor_rewind(chidb_dbm_cursor_t *cursor)
+{
+    BTreeCell mem_cell;
+    uint8_t *mem_data;
+    int rt;
+
+    if(cursor->hash)
+        return CHIDB_EMISUSE;
+
+    /* A bounded cursor starts at its lower bound, not at the first leaf */
+    if(cursor->lo > 0)
+        return chidb_dbm_cursor_seek(cursor, cursor->lo, SEEKGE);
+
+    rt = chidb_dbm_cursor_tree_rewind(cursor);
+    if(rt = chidb_dbm_cursor_keep_tree(cursor, rt, 1)) { return rt; }
+
+    rt = chidb_dbm_cursor_mem_seek(cursor, 0, MEMTABLE_GE, &mem_cell, &mem_data);
+    return chidb_dbm_cursor_pick(cursor, true, rt, &mem_cell, mem_data);
+}
+
+/* Move the cursor to the next (or previous) cell. Returns CHIDB_EMOVE,
+ * leaving the cursor where it was, if there is none. */
+static int chidb_dbm_cursor_move(chidb_dbm_cursor_t *cursor, bool forward)
+{
+    BTreeCell cur = cursor->cur_cell, mem_cell;
+    uint8_t *mem_data;
+    int rt;
+
+    if(cursor->hash)
+        return forward ? chidb_dbm_cursor_hash_next(cursor) : CHIDB_EMISUSE;
+
+    rt = chidb_dbm_cursor_tree_step(cursor, forward);
+    cursor->cur_cell = cur;
+    if(rt) { return rt; }
+
+    rt = chidb_dbm_cursor_mem_seek(cursor, cur.key, forward ? MEMTABLE_GT : MEMTABLE_LT, &mem_cell, &mem_data);
+    rt = chidb_dbm_cursor_pick(cursor, forward, rt, &mem_cell, mem_data);
+    return rt == CHIDB_ENOTFOUND ? CHIDB_EMOVE : rt;
+}
+
+int chidb_dbm_cursor_next(chidb_dbm_cursor_t *cursor)
+{
+    return chidb_dbm_cursor_move(cursor, true);
+}
+
+int chidb_dbm_cursor_prev(chidb_dbm_cursor_t *cursor)
+{
+    return chidb_dbm_cursor_move(cursor, false);
+}
+
+int chidb_dbm_cursor_seek(chidb_dbm_cursor_t *cursor, chidb_key_t key, chidb_dbm_seek_type_t seek_type)
+{
+    static const chidb_memtable_seek_t mem_seek[] = {
+        [SEEKEQ] = MEMTABLE_EQ, [SEEKLE] = MEMTABLE_LE, [SEEKGE] = MEMTABLE_GE,
+        [SEEKLT] = MEMTABLE_LT, [SEEKGT] = MEMTABLE_GT
+    };
+    bool forward = seek_type != SEEKLE && seek_type != SEEKLT;
+    /* Seeks on an index are relative to all the entries with the key */
+    chidb_key_t keyPk = seek_type == SEEKGT || seek_type == SEEKLE ? UINT32_MAX : 0;
+    BTreeCell mem_cell;
+    uint8_t *mem_data;
+    int rt;
+
+    if(cursor->hash)
+        return chidb_dbm_cursor_hash_seek(cursor, key, seek_type);
+
+    /* A seek from outside the range of the cursor starts at its bound */
+    if((seek_type == SEEKGE || seek_type == SEEKGT) && key < cursor->lo) {
+        key = cursor->lo;
+        seek_type = SEEKGE;
+        keyPk = 0;
+    }
+    else if((seek_type == SEEKLE || seek_type == SEEKLT) && key > cursor->hi) {
+        key = cursor->hi;
+        seek_type = SEEKLE;
+        keyPk = UINT32_MAX;
+    }
+
+    rt = chidb_dbm_cursor_tree_seek(cursor, key, keyPk, seek_type);
+    if(rt = chidb_dbm_cursor_keep_tree(cursor, rt, seek_type == SEEKEQ ? 0 : forward ? 1 : -1)) { return rt; }
+
+    rt = chidb_dbm_cursor_mem_seek(cursor, key, mem_seek[seek_type], &mem_cell, &mem_data);
+    return chidb_dbm_cursor_pick(cursor, forward, rt, &mem_cell, mem_data);
+}
+
+
+/* Add a row to a batch, decoding the selected columns of its record in
+ * place. An index entry without a record (data_size of 0) reads as NULL in
+ * every column, like in chidb_dbm_op_Column. Returns false, leaving the
+ * batch as it was, if the texts of the row do not fit in its text buffer. */
+static bool chidb_dbm_batch_add(chidb_dbm_batch_t *batch, chidb_key_t key, chidb_key_t keyPk,
+                                uint8_t *data, uint32_t size)
+{
+    uint32_t types[UINT8_MAX + 1], offsets[UINT8_MAX + 1];
+    uint32_t row = batch->n_rows, need = 0;
+    uint8_t n = 0, nfields = 0;
+
+    for(uint32_t j = 0; j < batch->n_cols; j++)
+        if(batch->cols[j].col >= nfields)
+            nfields = batch->cols[j].col + 1;
+    if(size > 0)
+        chidb_DBRecord_peek(data, nfields, types, offsets, &n);
+
+    for(uint32_t j = 0; j < batch->n_cols; j++) {
+        uint8_t col = batch->cols[j].col;
+        if(col < n && types[col] >= SQL_TEXT && (types[col] - SQL_TEXT) % 2 == 0)
+            need += (types[col] - SQL_TEXT) / 2;
+    }
+    if(batch->text_used + need > batch->text_size) {
+        return false;
+    }
+
+    batch->keys[row] = key;
+    if(batch->keyPks != NULL)
+        batch->keyPks[row] = keyPk;
+
+    for(uint32_t j = 0; j < batch->n_cols; j++) {
+        chidb_dbm_column_t *c = &(batch->cols[j]);
+        uint32_t type = c->col < n ? types[c->col] : SQL_NULL;
+        uint8_t *value = c->col < n ? data + offsets[c->col] : NULL;
+
+        switch(type) {
+        case SQL_NULL:
+            c->types[row] = SQL_NULL;
+            break;
+        case SQL_INTEGER_1BYTE:
+            c->types[row] = SQL_INTEGER_4BYTE;
+            c->ints[row] = (int8_t) value[0];
+            break;
+        case SQL_INTEGER_2BYTE:
+            c->types[row] = SQL_INTEGER_4BYTE;
+            c->ints[row] = (int16_t) get2byte(value);
+            break;
+        case SQL_INTEGER_4BYTE:
+            c->types[row] = SQL_INTEGER_4BYTE;
+            c->ints[row] = (int32_t) get4byte(value);
+            break;
+        default:
+            if(type >= SQL_TEXT && (type - SQL_TEXT) % 2 == 0) {
+                c->types[row] = SQL_TEXT;
+                c->lens[row] = (type - SQL_TEXT) / 2;
+                c->texts[row] = batch->text + batch->text_used;
+                memcpy(c->texts[row], value, c->lens[row]);
+                batch->text_used += c->lens[row];
+            }
+            else {
+                c->types[row] = SQL_NOTVALID;
+            }
+            break;
+        }
+    }
+
+    batch->n_rows++;
+    return true;
+}
+
+/* Add the current cell to a batch */
+static bool chidb_dbm_batch_add_cell(chidb_dbm_batch_t *batch, BTreeCell *cell)
+{
+    if(cell->type == PGTYPE_INDEX_LEAF)
+        return chidb_dbm_batch_add(batch, cell->key, cell->fields.indexLeaf.keyPk,
+                                   cell->fields.indexLeaf.data, cell->fields.indexLeaf.data_size);
+    return chidb_dbm_batch_add(batch, cell->key, cell->key,
+                               cell->fields.tableLeaf.data, cell->fields.tableLeaf.data_size);
+}
+
+/* Add the cells of the leaf after the current one to a batch, straight from
+ * the decoded leaf, until the first buffered row that comes before one of
+ * them or the end of the range of the cursor. The cursor is left on the last cell added, unless the batch filled
+ * up before the end of the leaf: then it is left on the first cell that was
+ * not added, and *full is set. */
+static int chidb_dbm_cursor_fetch_leaf(chidb_dbm_cursor_t *cursor, chidb_dbm_batch_t *batch, bool *full)
+{
+    chidb_key_t key = cursor->cur_cell.key, limit = 0;
+    bool limited;
+    chidb_dbm_trail_t *trail;
+    BTreeNodeCells *cells;
+    uint8_t *page;
+    ncell_t i;
+    int rt;
+
+    *full = false;
+
+    /* Only if the current cell is the one the trail is on */
+    if(!cursor->bt_valid || !chidb_dbm_cell_at(&(cursor->bt_cell), key, chidb_Btree_cellKeyPk(&(cursor->cur_cell)))) {
+        return CHIDB_OK;
+    }
+
+    rt = chidb_Memtable_seek(cursor->bt, cursor->root_page, key, MEMTABLE_GT, &limit, NULL, NULL);
+    if(rt && rt != CHIDB_ENOTFOUND) { return rt; }
+    limited = !rt;
+
+    trail = chidb_dbm_trail_leaf(cursor);
+    if(rt = chidb_Btree_decodeNode(trail->btn)) { return rt; }
+    cells = trail->btn->cells;
+    page = trail->btn->page->data;
+
+    for(i = trail->n_cur_cell + 1; i < trail->btn->n_cells; i++) {
+        if((limited && cells->keys[i] >= limit) || cells->keys[i] > cursor->hi) {
+            break;
+        }
+        if(batch->n_rows == batch->capacity ||
+           !chidb_dbm_batch_add(batch, cells->keys[i], cells->keyPks ? cells->keyPks[i] : cells->keys[i],
+                                page + cells->data_offsets[i], cells->data_sizes[i])) {
+            *full = true;
+            break;
+        }
+    }
+
+    if(!*full) {
+        i--;
+    }
+    if(i != trail->n_cur_cell) {
+        trail->n_cur_cell = i;
+        if(rt = chidb_Btree_getCell(trail->btn, i, &(cursor->cur_cell))) { return rt; }
+        cursor->bt_cell = cursor->cur_cell;
+        cursor->bt_dir = 1;
+    }
+    return CHIDB_OK;
+}
+
+/* Fetch a batch of consecutive rows
+ *
+ * Fills a batch with the current row and the rows after it, until the
+ * batch is full (or its text buffer is). Only the columns selected in the
+ * batch are decoded, straight from the records, and the rest of the leaf
+ * the cursor is on is added in a single pass, so a scan pays for a move
+ * of the cursor once per leaf instead of once per row.
+ *
+ * The cursor is left on the first row after the batch, so that the next
+ * batch starts there, or on the last row of the batch if there are no
+ * more rows.
+ *
+ * Parameters
+ * - cursor: A cursor on a row (after a rewind or a seek)
+ * - batch: Batch to fill (see chidb_dbm_batch_t)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful, and there are more rows
+ * - CHIDB_EMOVE: Operation successful, and the batch has the last row
+ * - CHIDB_ENOMEM: The texts of the current row do not fit in the text
+ *                 buffer of the batch
+ * - CHIDB_EMISUSE: The cursor is on a hash index, which has no order
+ */
+int chidb_dbm_cursor_fetch(chidb_dbm_cursor_t *cursor, chidb_dbm_batch_t *batch)
+{
+    bool full;
+    int rt;
+
+    batch->n_rows = 0;
+    batch->text_used = 0;
+
+    if(cursor->hash)
+        return CHIDB_EMISUSE;
+
+    while(batch->n_rows < batch->capacity) {
+        if(!chidb_dbm_batch_add_cell(batch, &(cursor->cur_cell))) {
+            return batch->n_rows > 0 ? CHIDB_OK : CHIDB_ENOMEM;
+        }
+        if(rt = chidb_dbm_cursor_fetch_leaf(cursor, batch, &full)) { return rt; }
+        if(full) {
+            return CHIDB_OK;
+        }
+        if(rt = chidb_dbm_cursor_next(cursor)) { return rt; }
+    }
+
+    return CHIDB_OK;
+}
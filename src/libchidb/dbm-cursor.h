@@ -43,7 +43,6 @@
 
 #include "chidbInt.h"
 #include "btree.h"
-#include "../simclist/simclist.h"
 
 typedef enum chidb_dbm_cursor_type
 {
@@ -52,10 +51,14 @@ typedef enum chidb_dbm_cursor_type
     CURSOR_WRITE
 } chidb_dbm_cursor_type_t;
 
+/* The trail has one frame per layer of the B-Tree, so it never needs more
+ * frames than the deepest B-Tree a file can hold (see BTREE_STATS_MAX_DEPTH) */
+#define CURSOR_MAX_DEPTH (BTREE_STATS_MAX_DEPTH)
+
 typedef struct chidb_dbm_trail {
-    u_int32_t depth;    // 该块在Btree中的深度
     BTreeNode *btn;     // BtreeNode
     ncell_t n_cur_cell;        // 当前行在该btn中对应或能索引到的cell编号
+    uint64_t version;   // 读入btn时其页的版本(见chidb_Pager_readVersion)
 } chidb_dbm_trail_t;
 
 typedef struct chidb_dbm_cursor
@@ -63,14 +66,53 @@ typedef struct chidb_dbm_cursor
     chidb_dbm_cursor_type_t type;
 
     /* Your code goes here */
-    list_t trail_list;
+    chidb_dbm_trail_t trail[CURSOR_MAX_DEPTH + 1];  // 从根到叶子的路径，trail[i]对应Btree中深度为i的块。多出的一项供trail_hop读兄弟叶子
+    uint32_t trail_depth;                           // trail中的层数，trail[trail_depth - 1]是叶子。更深的项保留其btn(pinned)，供下次读页时复用
+    uint64_t epoch;                                 // 从根读trail时B-Tree文件的epoch(见chidb_Btree_epoch)
     Btree *bt;
     BTreeCell cur_cell;
     npage_t root_page;
     uint32_t n_cols;
+    bool stale_trail;   // 通过叶子兄弟指针移动后，上层trail不再指向当前叶子
+    bool hash;          // 根页是哈希索引的目录页，没有trail，只能按键查找
+    BTreeCell bt_cell;  // trail所在的cell。表有写缓冲时，当前cell可能是写缓冲中的行
+    bool bt_valid;      // bt_cell是否有效(该方向上B-Tree中还有cell)
+    int8_t bt_dir;      // 1: bt_cell是B-Tree中不小于当前键的第一个cell; -1: 不大于当前键的最后一个; 0: 未知
+    uint8_t *mem_data;  // 写缓冲中的行作为当前cell时，其数据的副本
+    chidb_key_t lo;     // 游标只在键在[lo, hi]内的行上移动(见chidb_dbm_cursor_set_range)
+    chidb_key_t hi;
 
 } chidb_dbm_cursor_t;
 
+/* A column of a batch of rows (see chidb_dbm_cursor_fetch). The value of
+ * row i has type types[i]: SQL_NULL, SQL_INTEGER_4BYTE for an integer of
+ * any size (whose value is ints[i]), SQL_TEXT (whose lens[i] bytes, not
+ * NUL-terminated, start at texts[i]) or SQL_NOTVALID. */
+typedef struct chidb_dbm_column
+{
+    uint8_t col;        // 列在记录中的编号
+    int8_t *types;      // 每行该列的类型
+    int32_t *ints;      // 整数值
+    uint8_t **texts;    // 文本值，指向batch的text缓冲区
+    uint16_t *lens;     // 文本长度
+} chidb_dbm_column_t;
+
+/* A batch of consecutive rows, stored by column. The caller provides every
+ * array, with room for capacity rows, and the buffer the texts are copied
+ * to. */
+typedef struct chidb_dbm_batch
+{
+    uint32_t capacity;          // 每个数组的长度，即一批最多的行数
+    uint32_t n_rows;            // 取到的行数
+    chidb_key_t *keys;          // keys[i]: 第i行的键
+    chidb_key_t *keyPks;        // keyPks[i]: 索引项的主键(可为NULL，表游标不填)
+    uint32_t n_cols;            // 选取的列数
+    chidb_dbm_column_t *cols;   // 选取的列
+    uint8_t *text;              // 文本缓冲区
+    uint32_t text_size;         // 文本缓冲区大小
+    uint32_t text_used;         // 文本缓冲区已用的字节数
+} chidb_dbm_batch_t;
+
 typedef enum chidb_dbm_seek_type
 {
     SEEKEQ,
@@ -85,12 +127,17 @@ typedef enum chidb_dbm_seek_type
 int chidb_dbm_cursor_init(Btree *bt, chidb_dbm_cursor_t *cursor, npage_t root_page, chidb_dbm_cursor_type_t type);
 int chidb_dbm_cursor_destroy(chidb_dbm_cursor_t *cursor);
 
-int chidb_dbm_trail_new(Btree *bt, chidb_dbm_trail_t **trail, npage_t npage);
-int chidb_dbm_trail_destroy(chidb_dbm_cursor_t *cursor, chidb_dbm_trail_t *trail);
+int chidb_dbm_trail_push(chidb_dbm_cursor_t *cursor, npage_t npage, chidb_dbm_trail_t **trail);
+void chidb_dbm_trail_pop(chidb_dbm_cursor_t *cursor);
+int chidb_dbm_trail_hop(chidb_dbm_cursor_t *cursor, chidb_dbm_trail_t *trail, bool forward);
+int chidb_dbm_cursor_resync(chidb_dbm_cursor_t *cursor);
+int chidb_dbm_cursor_revalidate(chidb_dbm_cursor_t *cursor);
 
+int chidb_dbm_cursor_set_range(chidb_dbm_cursor_t *cursor, chidb_key_t lo, chidb_key_t hi);
 int chidb_dbm_cursor_rewind(chidb_dbm_cursor_t *cursor);
 int chidb_dbm_cursor_next(chidb_dbm_cursor_t *cursor);
 int chidb_dbm_cursor_prev(chidb_dbm_cursor_t *cursor);
 int chidb_dbm_cursor_seek(chidb_dbm_cursor_t *cursor, chidb_key_t key, chidb_dbm_seek_type_t seek_type);
+int chidb_dbm_cursor_fetch(chidb_dbm_cursor_t *cursor, chidb_dbm_batch_t *batch);
 
 #endif /* DBM_CURSOR_H_ */
@@ -226,6 +226,7 @@ int __chidb_dbm_file_parse_instruction(char *line, chidb_dbm_op_t *op)
     op->p2 = tokens[2][0]=='_' ? 0 : atoi(tokens[2]);
     op->p3 = tokens[3][0]=='_' ? 0 : atoi(tokens[3]);
     op->p4 = tokens[4][0]=='_' ? NULL : strdup(tokens[4]);
+    op->p5 = 0;
 
     free(linedup);
     return CHIDB_OK;
@@ -458,6 +459,20 @@ int __chidb_dbm_file_load(const char* filename, chidb_dbm_file_t **_dbmf, chidb
         	    {
         	        return rc;
         	    }
+
+        	    rc = chidb_stmt_peephole(&dbmf->stmt);
+
+        	    if(rc != CHIDB_OK)
+        	    {
+        	        return rc;
+        	    }
+
+        	    rc = chidb_stmt_verify(&dbmf->stmt);
+
+        	    if(rc != CHIDB_OK)
+        	    {
+        	        return rc;
+        	    }
         	}
             break;
         case QUERY_RESULT:
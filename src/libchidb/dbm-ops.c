@@ -40,7 +40,10 @@
 
 #include "dbm.h"
 #include "btree.h"
+#include "hash.h"
+#include "memtable.h"
 #include "record.h"
+#include "util.h"
 
 
 /* Function pointer for dispatch table */
@@ -83,8 +86,8 @@ int realloc_reg(chidb_stmt *stmt, uint32_t size);
 int chidb_dbm_op_WriteReg(chidb_stmt *stmt, int regNo, int reg_type, void *data)
 {
     int rt;
-    if(IS_VALID_REGISTER(stmt, regNo) && regNo > stmt->nReg)
-        if(rt = realloc_reg(stmt, regNo)) {
+    if(regNo >= 0 && regNo >= stmt->nReg)
+        if(rt = realloc_reg(stmt, regNo + 1)) {
             return rt;
         }
 
@@ -99,6 +102,99 @@ int chidb_dbm_op_WriteReg(chidb_stmt *stmt, int regNo, int reg_type, void *data)
     return CHIDB_OK;
 }
 
+/* Whether a comparison instruction (Eq, Ne, Lt, Le, Gt or Ge, or the
+ * Column* instruction made out of one) jumps, given its registers p1
+ * (reg1) and p3 (reg2). Registers of different types never compare. */
+static bool chidb_dbm_reg_jumps(opcode_t opcode, chidb_dbm_register_t *reg1, chidb_dbm_register_t *reg2)
+{
+    int cmp;
+
+    if(reg1->type == REG_INT32 && reg2->type == REG_INT32)
+        cmp = reg1->value.i < reg2->value.i ? -1 : reg1->value.i > reg2->value.i;
+    else if(reg1->type == REG_STRING && reg2->type == REG_STRING) {
+        if(opcode == Op_Eq || opcode == Op_Ne || opcode == Op_ColumnEq || opcode == Op_ColumnNe)
+            cmp = strcmp(reg1->value.s, reg2->value.s);
+        else
+            cmp = strncmp(reg1->value.s, reg2->value.s, strlen(reg1->value.s));
+    }
+    else
+        return false;
+
+    switch(opcode)
+    {
+    case Op_Eq:
+    case Op_ColumnEq:
+        return cmp == 0;
+    case Op_Ne:
+    case Op_ColumnNe:
+        return cmp != 0;
+    case Op_Lt:
+    case Op_ColumnLt:
+        return cmp > 0;
+    case Op_Le:
+    case Op_ColumnLe:
+        return cmp >= 0;
+    case Op_Gt:
+    case Op_ColumnGt:
+        return cmp < 0;
+    case Op_Ge:
+    case Op_ColumnGe:
+        return cmp <= 0;
+    default:
+        return false;
+    }
+}
+
+/* The record of the row at a cursor, or NULL for an index entry that has
+ * no included columns */
+static uint8_t *chidb_dbm_cursor_record(chidb_dbm_cursor_t *c)
+{
+    if(c->cur_cell.type == PGTYPE_INDEX_LEAF) {
+        if(c->cur_cell.fields.indexLeaf.data_size == 0)
+            return NULL;
+        return c->cur_cell.fields.indexLeaf.data;
+    }
+    return c->cur_cell.fields.tableLeaf.data;
+}
+
+/* Read a field of a record (of the given type, located with
+ * chidb_DBRecord_peek) into a register, as Column does */
+static int chidb_dbm_field_reg(uint32_t type, uint8_t *value, chidb_dbm_register_t *r)
+{
+    switch(type)
+    {
+    case SQL_NULL:
+        r->type = REG_NULL;
+        break;
+    case SQL_INTEGER_1BYTE:
+        r->type = REG_INT32;
+        r->value.i = (int8_t) value[0];
+        break;
+    case SQL_INTEGER_2BYTE:
+        r->type = REG_INT32;
+        r->value.i = (int16_t) get2byte(value);
+        break;
+    case SQL_INTEGER_4BYTE:
+        r->type = REG_INT32;
+        r->value.i = (int32_t) get4byte(value);
+        break;
+    default:
+        if(type >= SQL_TEXT && (type - SQL_TEXT) % 2 == 0) {
+            uint32_t len = (type - SQL_TEXT) / 2;
+            char *s = malloc(len + 1);
+            if(s == NULL)
+                return CHIDB_ENOMEM;
+            memcpy(s, value, len);
+            s[len] = '\0';
+            r->type = REG_STRING;
+            r->value.s = s;
+        }
+        else
+            r->type = REG_UNSPECIFIED;
+    }
+    return CHIDB_OK;
+}
+
 /*** INSTRUCTION HANDLER IMPLEMENTATIONS ***/
 
 
@@ -127,6 +223,35 @@ int chidb_dbm_op_OpenRead (chidb_stmt *stmt, chidb_dbm_op_t *op)
 }
 
 
+/* OpenReadConst p1 p2 p3 *
+ *
+ * p1: cursor
+ * p2: root page
+ * p3: number of columns
+ *
+ * OpenRead, with the root page given in the instruction (Integer followed
+ * by OpenRead, see chidb_stmt_peephole)
+ */
+int chidb_dbm_op_OpenReadConst (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    int rt;
+
+    if(op->p1 < 0)
+        return CHIDB_EVALIDEARG;
+    if(!EXISTS_CURSOR(stmt, op->p1))
+        if(rt = realloc_cur(stmt, op->p1 + 1)) {
+            return rt;
+        }
+
+    chidb_dbm_cursor_t *c = &((stmt)->cursors[op->p1]);
+    chidb_dbm_cursor_init(stmt->db->bt, c, op->p2, op->p3);
+    chidb_dbm_cursor_rewind(c);
+
+    c->type = CURSOR_READ;
+    return CHIDB_OK;
+}
+
+
 int chidb_dbm_op_OpenWrite (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     /* Your code goes here */
@@ -154,6 +279,7 @@ int chidb_dbm_op_Close (chidb_stmt *stmt, chidb_dbm_op_t *op)
 
     chidb_dbm_cursor_t *c = &((stmt)->cursors[op->p1]);
     chidb_dbm_cursor_destroy(c);
+    c->type = CURSOR_UNSPECIFIED;
 
     return CHIDB_OK;
 }
@@ -374,6 +500,133 @@ int chidb_dbm_op_SeekLe (chidb_stmt *stmt, chidb_dbm_op_t *op)
     return CHIDB_OK;
 }
 
+
+/* SeekRange p1 p2 p3 *
+ *
+ * p1: cursor
+ * p2: jump address
+ * p3: register containing the lowest key (register p3+1: the highest key)
+ * p5: SEEKRANGE_LO_EXCL and/or SEEKRANGE_HI_EXCL
+ *
+ * bound cursor p1 to the keys in [register p3, register p3+1], and move it
+ * to the first row in that range. jump to p2 if there is none. Next on the
+ * cursor stops after the last row in the range. With the flags of p5, the
+ * bounds themselves are left out of the range.
+ */
+int chidb_dbm_op_SeekRange (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    if(!IS_VALID_REGISTER(stmt, op->p3) || !IS_VALID_REGISTER(stmt, op->p3 + 1)) {
+        return CHIDB_EVALIDEARG;
+    }
+    if(!IS_VALID_CURSOR(stmt, op->p1)) {
+        return CHIDB_EVALIDEARG;
+    }
+    if(!IS_VALID_ADDRESS(stmt, op->p2)) {
+        return CHIDB_EVALIDEARG;
+    }
+
+    uint32_t lo = stmt->reg[op->p3].value.i;
+    uint32_t hi = stmt->reg[op->p3 + 1].value.i;
+    chidb_dbm_cursor_t *c = &((stmt)->cursors[op->p1]);
+
+    if((op->p5 & SEEKRANGE_LO_EXCL && lo++ == UINT32_MAX) ||
+       (op->p5 & SEEKRANGE_HI_EXCL && hi-- == 0)) {
+        lo = 1; // 空范围
+        hi = 0;
+    }
+
+    int rt = chidb_dbm_cursor_set_range(c, lo, hi);
+    if(rt) {
+        return rt;
+    }
+
+    rt = chidb_dbm_cursor_rewind(c);
+    if(rt == CHIDB_ENOTFOUND) {
+        stmt->pc = op->p2;
+    }
+    else if(rt) {
+        return rt;
+    }
+    return CHIDB_OK;
+}
+
+
+/* HashSeek p1 p2 p3 *
+ *
+ * p1: cursor (on a hash index)
+ * p2: jump address
+ * p3: register containing IdxKey
+ *
+ * move cursor p1 to the first entry of the hash index with key (register
+ * p3), so that IdxPKey can read its PKey. jump to p2 if there is no such
+ * entry. the other entries with the key are visited with HashNext.
+ */
+int chidb_dbm_op_HashSeek (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    if(!IS_VALID_REGISTER(stmt, op->p3)) {
+        return CHIDB_EVALIDEARG;
+    }
+    if(!IS_VALID_CURSOR(stmt, op->p1)) {
+        return CHIDB_EVALIDEARG;
+    }
+    if(!IS_VALID_ADDRESS(stmt, op->p2)) {
+        return CHIDB_EVALIDEARG;
+    }
+
+    chidb_dbm_register_t *r1 = &((stmt)->reg[op->p3]);
+    uint32_t key = r1->value.i;
+    chidb_dbm_cursor_t *c = &((stmt)->cursors[op->p1]);
+
+    if(!c->hash) {
+        return CHIDB_EMISUSE;
+    }
+
+    int rt = chidb_dbm_cursor_seek(c, key, SEEKEQ);
+
+    if(rt == CHIDB_ENOTFOUND) {
+        stmt->pc = op->p2;
+    }
+    else if(rt) {
+        return rt;
+    }
+    return CHIDB_OK;
+}
+
+/* HashNext p1 p2 * *
+ *
+ * p1: cursor (on a hash index)
+ * p2: jump address
+ *
+ * move cursor p1 to the next entry of the hash index with the key of its
+ * current entry, and jump to p2. if there is none, go on to the next
+ * instruction.
+ */
+int chidb_dbm_op_HashNext (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    if(!IS_VALID_CURSOR(stmt, op->p1)) {
+        return CHIDB_EVALIDEARG;
+    }
+    if(!IS_VALID_ADDRESS(stmt, op->p2)) {
+        return CHIDB_EVALIDEARG;
+    }
+
+    chidb_dbm_cursor_t *c = &((stmt)->cursors[op->p1]);
+
+    if(!c->hash) {
+        return CHIDB_EMISUSE;
+    }
+
+    int rt = chidb_dbm_cursor_next(c);
+
+    if(rt == CHIDB_OK) {
+        stmt->pc = op->p2;
+    }
+    else if(rt != CHIDB_EMOVE) {
+        return rt;
+    }
+    return CHIDB_OK;
+}
+
 int chidb_dbm_op_Column (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     /* Your code goes here */
@@ -387,9 +640,19 @@ int chidb_dbm_op_Column (chidb_stmt *stmt, chidb_dbm_op_t *op)
 
     int rt;
     chidb_dbm_cursor_t *c = &((stmt)->cursors[op->p1]);
+    uint8_t *data = c->cur_cell.fields.tableLeaf.data;
+
+    // the columns of an index entry are those of its record of
+    // (PKey, included columns), which entries without one read as NULL
+    if(c->cur_cell.type == PGTYPE_INDEX_LEAF) {
+        if(c->cur_cell.fields.indexLeaf.data_size == 0) {
+            return chidb_dbm_op_WriteReg(stmt, op->p3, REG_NULL, NULL);
+        }
+        data = c->cur_cell.fields.indexLeaf.data;
+    }
 
     DBRecord *dbr;
-    if(rt = chidb_DBRecord_unpack(&dbr, c->cur_cell.fields.tableLeaf.data)) {
+    if(rt = chidb_DBRecord_unpack(&dbr, data)) {
         return rt;
     }
 
@@ -430,6 +693,133 @@ int chidb_dbm_op_Column (chidb_stmt *stmt, chidb_dbm_op_t *op)
 }
 
 
+/* Columns p1 p2 p3 * p5
+ *
+ * p1: cursor
+ * p2: first column
+ * p3: first register
+ * p5: number of columns
+ *
+ * store columns p2..p2+p5-1 of (the row at cursor p1) in registers
+ * p3..p3+p5-1, reading the record once (consecutive Columns, see
+ * chidb_stmt_peephole)
+ */
+int chidb_dbm_op_Columns (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    uint32_t types[256], offsets[256];
+    uint8_t *data;
+    uint8_t n = 0;
+    int rt;
+
+    if(!IS_VALID_CURSOR(stmt, op->p1))
+        return CHIDB_EVALIDEARG;
+    if(op->p2 < 0 || op->p3 < 0 || op->p5 < 0 || op->p2 + op->p5 > 255)
+        return CHIDB_EVALIDEARG;
+    if(op->p3 + op->p5 > stmt->nReg)
+        if(rt = realloc_reg(stmt, op->p3 + op->p5)) {
+            return rt;
+        }
+
+    data = chidb_dbm_cursor_record(&((stmt)->cursors[op->p1]));
+    if(data != NULL)
+        chidb_DBRecord_peek(data, op->p2 + op->p5, types, offsets, &n);
+
+    for(int32_t i = 0; i < op->p5; i++) {
+        int32_t col = op->p2 + i;
+        chidb_dbm_register_t *r = &((stmt)->reg[op->p3 + i]);
+
+        if(data == NULL)
+            r->type = REG_NULL;
+        else if(col >= n)
+            r->type = REG_UNSPECIFIED;
+        else if(rt = chidb_dbm_field_reg(types[col], data + offsets[col], r))
+            return rt;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* ColumnEq p1 p2 p3 * p5 (and ColumnNe, ColumnLt, ColumnLe, ColumnGt,
+ *                         ColumnGe)
+ *
+ * p1: register
+ * p2: jump address
+ * p3: cursor
+ * p5: column
+ *
+ * Column followed by Eq (Ne, Lt, ...) on the register it wrote: if
+ * (column p5 of the row at cursor p3) == (register p1), jump to p2. The
+ * column is not kept in a register (see chidb_stmt_peephole).
+ */
+static int chidb_dbm_column_compare(chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    uint32_t types[256], offsets[256];
+    chidb_dbm_register_t col;
+    uint8_t *data;
+    uint8_t n;
+    int rt;
+
+    if(!IS_VALID_REGISTER(stmt, op->p1))
+        return CHIDB_EVALIDEARG;
+    if(!IS_VALID_CURSOR(stmt, op->p3))
+        return CHIDB_EVALIDEARG;
+    if(!IS_VALID_ADDRESS(stmt, op->p2))
+        return CHIDB_EVALIDEARG;
+    if(op->p5 < 0 || op->p5 > 254)
+        return CHIDB_EVALIDEARG;
+
+    data = chidb_dbm_cursor_record(&((stmt)->cursors[op->p3]));
+    col.type = REG_NULL;
+    if(data != NULL) {
+        chidb_DBRecord_peek(data, op->p5 + 1, types, offsets, &n);
+        col.type = REG_UNSPECIFIED;
+        if(op->p5 < n)
+            if(rt = chidb_dbm_field_reg(types[op->p5], data + offsets[op->p5], &col)) {
+                return rt;
+            }
+    }
+
+    if(chidb_dbm_reg_jumps(op->opcode, &((stmt)->reg[op->p1]), &col)) {
+        stmt->pc = (uint32_t)op->p2;
+    }
+    if(col.type == REG_STRING)
+        free(col.value.s);
+
+    return CHIDB_OK;
+}
+
+int chidb_dbm_op_ColumnEq (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    return chidb_dbm_column_compare(stmt, op);
+}
+
+int chidb_dbm_op_ColumnNe (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    return chidb_dbm_column_compare(stmt, op);
+}
+
+int chidb_dbm_op_ColumnLt (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    return chidb_dbm_column_compare(stmt, op);
+}
+
+int chidb_dbm_op_ColumnLe (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    return chidb_dbm_column_compare(stmt, op);
+}
+
+int chidb_dbm_op_ColumnGt (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    return chidb_dbm_column_compare(stmt, op);
+}
+
+int chidb_dbm_op_ColumnGe (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    return chidb_dbm_column_compare(stmt, op);
+}
+
+
 int chidb_dbm_op_Key (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     /* Your code goes here */
@@ -447,6 +837,37 @@ int chidb_dbm_op_Key (chidb_stmt *stmt, chidb_dbm_op_t *op)
 }
 
 
+/* Count p1 p2 * *
+ *
+ * p1: cursor
+ * p2: register
+ *
+ * store the number of entries in (the B-Tree of cursor p1) in (register at p2)
+ */
+int chidb_dbm_op_Count (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    if(!IS_VALID_CURSOR(stmt, op->p1))
+        return CHIDB_EVALIDEARG;
+
+    int rt;
+    uint32_t count;
+    chidb_dbm_cursor_t *c = &((stmt)->cursors[op->p1]);
+
+    if(c->hash)
+        return CHIDB_EVALIDEARG;
+
+    /* Rows still in the write buffer count too */
+    if(rt = chidb_Memtable_count(c->bt, c->root_page, &count)) {
+        return rt;
+    }
+    if(rt = chidb_dbm_op_WriteReg(stmt, op->p2, REG_INT32, &count)) {
+        return rt;
+    }
+
+    return CHIDB_OK;
+}
+
+
 int chidb_dbm_op_Integer (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     /* Your code goes here */
@@ -480,6 +901,37 @@ int chidb_dbm_op_Null (chidb_stmt *stmt, chidb_dbm_op_t *op)
 }
 
 
+/* Variable p1 p2 * *
+ *
+ * p1: parameter number (from 1)
+ * p2: register
+ *
+ * store the value bound to parameter p1 (see chidb_bind_int) in register p2.
+ * fails with CHIDB_EMISUSE if the parameter has not been bound.
+ */
+int chidb_dbm_op_Variable (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    int rt;
+    if(op->p1 < 1 || op->p1 > stmt->nParams) {
+        return CHIDB_EVALIDEARG;
+    }
+
+    chidb_dbm_register_t *param = &stmt->params[op->p1 - 1];
+    switch(param->type)
+    {
+    case REG_INT32:
+        rt = chidb_dbm_op_WriteReg(stmt, op->p2, REG_INT32, &param->value.i);
+        break;
+    case REG_STRING:
+        rt = chidb_dbm_op_WriteReg(stmt, op->p2, REG_STRING, strdup(param->value.s));
+        break;
+    default:
+        return CHIDB_EMISUSE;
+    }
+    return rt;
+}
+
+
 int chidb_dbm_op_ResultRow (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     /* Your code goes here */
@@ -530,6 +982,7 @@ int chidb_dbm_op_MakeRecord (chidb_stmt *stmt, chidb_dbm_op_t *op)
 
     if(rt = chidb_dbm_op_WriteReg(stmt, nr2, REG_BINARY, NULL))
         return rt;
+    r2 = &((stmt)->reg[nr2]);
     r2->type = REG_BINARY;
     r2->value.bin.nbytes = len;
     r2->value.bin.bytes = data;
@@ -558,8 +1011,7 @@ int chidb_dbm_op_Insert (chidb_stmt *stmt, chidb_dbm_op_t *op)
 
     chidb_Btree_insert(stmt->db->bt, c->root_page, &cell);
 
-    chidb_key_t cur_key = c->cur_cell.key;
-    chidb_dbm_cursor_seek(c, cur_key, SEEKEQ);
+    chidb_dbm_cursor_revalidate(c);
 
     return CHIDB_OK;
 }
@@ -578,15 +1030,8 @@ int chidb_dbm_op_Eq (chidb_stmt *stmt, chidb_dbm_op_t *op)
     chidb_dbm_register_t *reg1 = &((stmt)->reg[op->p1]);
     chidb_dbm_register_t *reg2 = &((stmt)->reg[op->p3]);
 
-    if(reg1->type == REG_INT32 && reg2->type == REG_INT32) {
-        if(reg1->value.i == reg2->value.i) {
-            stmt->pc = (uint32_t)op->p2;
-        }
-    }
-    else if(reg1->type == REG_STRING && reg2->type == REG_STRING) {
-        if(!strncmp(reg1->value.s,reg2->value.s, strlen(reg1->value.s))) {
-            stmt->pc = (uint32_t)op->p2;
-        }
+    if(chidb_dbm_reg_jumps(op->opcode, reg1, reg2)) {
+        stmt->pc = (uint32_t)op->p2;
     }
     return CHIDB_OK;
 }
@@ -605,15 +1050,8 @@ int chidb_dbm_op_Ne (chidb_stmt *stmt, chidb_dbm_op_t *op)
     chidb_dbm_register_t *reg1 = &((stmt)->reg[op->p1]);
     chidb_dbm_register_t *reg2 = &((stmt)->reg[op->p3]);
 
-    if(reg1->type == REG_INT32 && reg2->type == REG_INT32) {
-        if(reg1->value.i != reg2->value.i) {
-            stmt->pc = (uint32_t)op->p2;
-        }
-    }
-    else if(reg1->type == REG_STRING && reg2->type == REG_STRING) {
-        if(strncmp(reg1->value.s,reg2->value.s, strlen(reg1->value.s))) {
-            stmt->pc = (uint32_t)op->p2;
-        }
+    if(chidb_dbm_reg_jumps(op->opcode, reg1, reg2)) {
+        stmt->pc = (uint32_t)op->p2;
     }
     return CHIDB_OK;
 }
@@ -632,15 +1070,8 @@ int chidb_dbm_op_Lt (chidb_stmt *stmt, chidb_dbm_op_t *op)
     chidb_dbm_register_t *reg1 = &((stmt)->reg[op->p1]);
     chidb_dbm_register_t *reg2 = &((stmt)->reg[op->p3]);
 
-    if(reg1->type == REG_INT32 && reg2->type == REG_INT32) {
-        if(reg1->value.i > reg2->value.i) {
-            stmt->pc = (uint32_t)op->p2;
-        }
-    }
-    else if(reg1->type == REG_STRING && reg2->type == REG_STRING) {
-        if(strncmp(reg1->value.s,reg2->value.s, strlen(reg1->value.s)) > 0) {
-            stmt->pc = (uint32_t)op->p2;
-        }
+    if(chidb_dbm_reg_jumps(op->opcode, reg1, reg2)) {
+        stmt->pc = (uint32_t)op->p2;
     }
     return CHIDB_OK;
 }
@@ -659,15 +1090,8 @@ int chidb_dbm_op_Le (chidb_stmt *stmt, chidb_dbm_op_t *op)
     chidb_dbm_register_t *reg1 = &((stmt)->reg[op->p1]);
     chidb_dbm_register_t *reg2 = &((stmt)->reg[op->p3]);
 
-    if(reg1->type == REG_INT32 && reg2->type == REG_INT32) {
-        if(reg1->value.i >= reg2->value.i) {
-            stmt->pc = (uint32_t)op->p2;
-        }
-    }
-    else if(reg1->type == REG_STRING && reg2->type == REG_STRING) {
-        if(strncmp(reg1->value.s,reg2->value.s, strlen(reg1->value.s)) >= 0) {
-            stmt->pc = (uint32_t)op->p2;
-        }
+    if(chidb_dbm_reg_jumps(op->opcode, reg1, reg2)) {
+        stmt->pc = (uint32_t)op->p2;
     }
     return CHIDB_OK;
 }
@@ -686,15 +1110,8 @@ int chidb_dbm_op_Gt (chidb_stmt *stmt, chidb_dbm_op_t *op)
     chidb_dbm_register_t *reg1 = &((stmt)->reg[op->p1]);
     chidb_dbm_register_t *reg2 = &((stmt)->reg[op->p3]);
 
-    if(reg1->type == REG_INT32 && reg2->type == REG_INT32) {
-        if(reg1->value.i < reg2->value.i) {
-            stmt->pc = (uint32_t)op->p2;
-        }
-    }
-    else if(reg1->type == REG_STRING && reg2->type == REG_STRING) {
-        if(strncmp(reg1->value.s,reg2->value.s, strlen(reg1->value.s)) < 0) {
-            stmt->pc = (uint32_t)op->p2;
-        }
+    if(chidb_dbm_reg_jumps(op->opcode, reg1, reg2)) {
+        stmt->pc = (uint32_t)op->p2;
     }
     return CHIDB_OK;
 }
@@ -713,15 +1130,8 @@ int chidb_dbm_op_Ge (chidb_stmt *stmt, chidb_dbm_op_t *op)
     chidb_dbm_register_t *reg1 = &((stmt)->reg[op->p1]);
     chidb_dbm_register_t *reg2 = &((stmt)->reg[op->p3]);
 
-    if(reg1->type == REG_INT32 && reg2->type == REG_INT32) {
-        if(reg1->value.i <= reg2->value.i) {
-            stmt->pc = (uint32_t)op->p2;
-        }
-    }
-    else if(reg1->type == REG_STRING && reg2->type == REG_STRING) {
-        if(strncmp(reg1->value.s,reg2->value.s, strlen(reg1->value.s)) <= 0) {
-            stmt->pc = (uint32_t)op->p2;
-        }
+    if(chidb_dbm_reg_jumps(op->opcode, reg1, reg2)) {
+        stmt->pc = (uint32_t)op->p2;
     }
     return CHIDB_OK;
 }
@@ -875,9 +1285,12 @@ int chidb_dbm_op_IdxPKey (chidb_stmt *stmt, chidb_dbm_op_t *op)
  *
  * p1: cursor
  * p2: register containing IdxKey
- * p2: register containing PKey
+ * p3: register containing PKey, or a record (see MakeRecord) whose first
+ *     column is the PKey and whose other columns are included in the entry
  *
- * add new (IdkKey,PKey) entry in index BTree pointed at by cursor at p1
+ * add new (IdkKey,PKey) entry in index BTree pointed at by cursor at p1.
+ * Given a record, the whole record is stored in the entry, and Column on
+ * the cursor reads its columns back.
  */
 int chidb_dbm_op_IdxInsert (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
@@ -894,11 +1307,63 @@ int chidb_dbm_op_IdxInsert (chidb_stmt *stmt, chidb_dbm_op_t *op)
     cell.type = PGTYPE_INDEX_LEAF;
     cell.key = (uint32_t)reg1->value.i;
     cell.fields.indexLeaf.keyPk = (uint32_t)reg2->value.i;
+    cell.fields.indexLeaf.data_size = 0;
+
+    if(reg2->type == REG_BINARY) {
+        DBRecord *dbr;
+        int32_t pkey;
+        int rt;
+
+        if(rt = chidb_DBRecord_unpack(&dbr, reg2->value.bin.bytes)) {
+            return rt;
+        }
+        rt = chidb_DBRecord_getInt32(dbr, 0, &pkey);
+        chidb_DBRecord_destroy(dbr);
+        if(rt) {
+            return rt;
+        }
+        cell.fields.indexLeaf.keyPk = (uint32_t)pkey;
+        cell.fields.indexLeaf.data_size = reg2->value.bin.nbytes;
+        cell.fields.indexLeaf.data = reg2->value.bin.bytes;
+    }
+
+    // hash indexes have no trail that the insert could invalidate
+    if(c->hash) {
+        return chidb_Hash_insert(stmt->db->bt, c->root_page, cell.key, cell.fields.indexLeaf.keyPk);
+    }
 
     chidb_Btree_insert(stmt->db->bt, c->root_page, &cell);
 
-    chidb_key_t cur_key = c->cur_cell.key;
-    chidb_dbm_cursor_seek(c, cur_key, SEEKEQ);
+    chidb_dbm_cursor_revalidate(c);
+
+    return CHIDB_OK;
+}
+
+/* TextKey p1 p2 * *
+ *
+ * p1: register containing a string
+ * p2: register
+ *
+ * store the IdxKey of (the string in register p1) in (register at p2),
+ * so that it can be used with the other Idx instructions (see
+ * chidb_Btree_textKey). Texts with the same first four characters have
+ * the same IdxKey.
+ */
+int chidb_dbm_op_TextKey (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    if(!IS_VALID_REGISTER(stmt, op->p1))
+        return CHIDB_EVALIDEARG;
+
+    chidb_dbm_register_t *r1 = &((stmt)->reg[op->p1]);
+    if(r1->type != REG_STRING)
+        return CHIDB_EVALIDEARG;
+
+    int32_t key = (int32_t) chidb_Btree_textKey(r1->value.s);
+
+    int rt;
+    if(rt = chidb_dbm_op_WriteReg(stmt, op->p2, REG_INT32, &key)) {
+        return rt;
+    }
 
     return CHIDB_OK;
 }
@@ -913,6 +1378,10 @@ int chidb_dbm_op_CreateTable (chidb_stmt *stmt, chidb_dbm_op_t *op)
     if(rt)
         return rt;
 
+    /* Programs compiled since this statement was are out of date (see
+     * chidb_prepare) */
+    stmt->db->synced = 0;
+
     if(rt = chidb_dbm_op_WriteReg(stmt, op->p1, REG_INT32, &root))
         return rt;
 
@@ -929,6 +1398,32 @@ int chidb_dbm_op_CreateIndex (chidb_stmt *stmt, chidb_dbm_op_t *op)
     if(rt)
         return rt;
 
+    stmt->db->synced = 0;
+
+    if(rt = chidb_dbm_op_WriteReg(stmt, op->p1, REG_INT32, &root))
+        return rt;
+
+    return CHIDB_OK;
+}
+
+
+/* CreateHash p1 * * *
+ *
+ * p1: register
+ *
+ * create a new (empty) hash index, and store the page number of its
+ * directory in (register p1)
+ */
+int chidb_dbm_op_CreateHash (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    npage_t root;
+
+    int rt = chidb_Hash_create(stmt->db->bt, &root);
+    if(rt)
+        return rt;
+
+    stmt->db->synced = 0;
+
     if(rt = chidb_dbm_op_WriteReg(stmt, op->p1, REG_INT32, &root))
         return rt;
 
@@ -936,22 +1431,73 @@ int chidb_dbm_op_CreateIndex (chidb_stmt *stmt, chidb_dbm_op_t *op)
 }
 
 
+/* Copy p1 p2 * *
+ *
+ * p1: register
+ * p2: register
+ *
+ * store a copy of (the value in register p1) in (register at p2)
+ */
 int chidb_dbm_op_Copy (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
-    /* Your code goes here */
+    if(!IS_VALID_REGISTER(stmt, op->p1))
+        return CHIDB_EVALIDEARG;
+
+    int rt;
+    chidb_dbm_register_t *r1 = &((stmt)->reg[op->p1]);
+
+    if(r1->type == REG_STRING) {
+        char *s = strdup(r1->value.s);
+        if(s == NULL)
+            return CHIDB_ENOMEM;
+        return chidb_dbm_op_WriteReg(stmt, op->p2, REG_STRING, s);
+    }
+
+    if(rt = chidb_dbm_op_SCopy(stmt, op))
+        return rt;
+
+    chidb_dbm_register_t *r2 = &((stmt)->reg[op->p2]);
+    if(r2->type == REG_BINARY) {
+        uint8_t *bytes = malloc(r2->value.bin.nbytes);
+        if(bytes == NULL)
+            return CHIDB_ENOMEM;
+        memcpy(bytes, r2->value.bin.bytes, r2->value.bin.nbytes);
+        r2->value.bin.bytes = bytes;
+    }
 
     return CHIDB_OK;
 }
 
 
+/* SCopy p1 p2 * *
+ *
+ * p1: register
+ * p2: register
+ *
+ * store (the value in register p1) in (register at p2), without copying
+ * strings and records: register p2 is only valid while p1 is not changed
+ */
 int chidb_dbm_op_SCopy (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
-    /* Your code goes here */
+    if(!IS_VALID_REGISTER(stmt, op->p1))
+        return CHIDB_EVALIDEARG;
+
+    int rt;
+    if(rt = chidb_dbm_op_WriteReg(stmt, op->p2, REG_NULL, NULL))
+        return rt;
+
+    stmt->reg[op->p2] = stmt->reg[op->p1];
 
     return CHIDB_OK;
 }
 
 
+int chidb_dbm_op_Vacuum (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    return chidb_vacuum(stmt->db, op->p4);
+}
+
+
 int chidb_dbm_op_Halt (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     /* Your code goes here */
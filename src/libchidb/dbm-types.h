@@ -58,6 +58,7 @@
 #define FOREACH_OP(OP)  \
         OP(Noop)        \
         OP(OpenRead)    \
+        OP(OpenReadConst) \
         OP(OpenWrite)   \
         OP(Close)       \
         OP(Rewind)      \
@@ -68,11 +69,23 @@
         OP(SeekGe)      \
         OP(SeekLt)      \
         OP(SeekLe)      \
+        OP(SeekRange)   \
+        OP(HashSeek)    \
+        OP(HashNext)    \
         OP(Column)      \
+        OP(Columns)     \
+        OP(ColumnEq)    \
+        OP(ColumnNe)    \
+        OP(ColumnLt)    \
+        OP(ColumnLe)    \
+        OP(ColumnGt)    \
+        OP(ColumnGe)    \
         OP(Key)         \
+        OP(Count)       \
         OP(Integer)     \
         OP(String)      \
         OP(Null)        \
+        OP(Variable)    \
         OP(ResultRow)   \
         OP(MakeRecord)  \
         OP(Insert)      \
@@ -88,10 +101,13 @@
         OP(IdxLe)       \
         OP(IdxPKey)     \
         OP(IdxInsert)   \
+        OP(TextKey)     \
         OP(CreateTable) \
         OP(CreateIndex) \
+        OP(CreateHash)  \
         OP(Copy)        \
         OP(SCopy)       \
+        OP(Vacuum)      \
         OP(Halt)
 
 /* The following generates an enum type for the opcode. It expands to:
@@ -155,8 +171,16 @@ typedef struct chidb_dbm_op
     int32_t p2;
     int32_t p3;
     char *p4;
+    int32_t p5;     /* Fourth integer operand, only used by the instructions
+                     * that chidb_stmt_peephole makes out of several ones,
+                     * and by SeekRange */
 } chidb_dbm_op_t;
 
+/* Flags of SeekRange (p5): the bound in the register is excluded from the
+ * range, for bounds that are only known when the program runs */
+#define SEEKRANGE_LO_EXCL (1)
+#define SEEKRANGE_HI_EXCL (2)
+
 
 /* A register can be of type integer, string, null or binary.
  * Additionally we define a REG_UNSPECIFIED type, which is
@@ -259,6 +283,19 @@ struct chidb_stmt
      * per operation */
     bool explain;
 
+    /* Has the program passed chidb_stmt_verify since it last changed? If
+     * so, the operands of its instructions need not be checked when they
+     * run (see chidb_stmt_exec) */
+    bool verified;
+
+    /* Parameters: the values bound to the ?'s of the SQL statement (numbered
+     * from 1, stored from 0), which Variable loads into registers. An unbound
+     * parameter has type REG_UNSPECIFIED. paramTypes is the type each one
+     * must be bound to, which is that of the column it goes with */
+    chidb_dbm_register_t *params;
+    register_type_t *paramTypes;
+    uint32_t nParams;
+
     /* Additional fields go here */
 };
 
@@ -40,6 +40,15 @@
 #include <assert.h>
 #include <stdbool.h>
 #include "dbm.h"
+#include "record.h"
+#include "util.h"
+
+/* With GCC's labels as values, every instruction jumps straight to the
+ * code of the next one (see chidb_stmt_exec). Define CHIDB_DBM_SWITCH to
+ * use a plain switch instead. */
+#if defined(__GNUC__) && !defined(CHIDB_DBM_SWITCH)
+#define CHIDB_DBM_THREADED
+#endif
 
 /* Forward declaration of auxiliary functions. */
 int realloc_ops(chidb_stmt *stmt, uint32_t size);
@@ -74,6 +83,7 @@ int chidb_stmt_init(chidb_stmt *stmt, chidb *db)
     stmt->db = db;
     stmt->sql = NULL;
     stmt->explain = false;
+    stmt->verified = false;
 
     /* The program starts running in instruction 0 */
     stmt->pc = 0;
@@ -110,6 +120,11 @@ int chidb_stmt_init(chidb_stmt *stmt, chidb *db)
     stmt->cols = NULL;
     stmt->nCols = 0;
 
+    /* The code generator sets up the parameters, if there are any */
+    stmt->params = NULL;
+    stmt->paramTypes = NULL;
+    stmt->nParams = 0;
+
     return CHIDB_OK;
 }
 
@@ -128,6 +143,108 @@ int chidb_stmt_free(chidb_stmt *stmt)
 	free(stmt->ops);
 	free(stmt->reg);
 	free(stmt->cursors);
+    for(uint32_t i = 0; i < stmt->nParams; i++)
+        if(stmt->params[i].type == REG_STRING)
+            free(stmt->params[i].value.s);
+    free(stmt->params);
+    free(stmt->paramTypes);
+    return CHIDB_OK;
+}
+
+
+/* Reset a DBM
+ *
+ * Gets a DBM ready to run again from its first instruction: the cursors
+ * it left open are closed, and its registers are emptied. The program, and
+ * the values bound to its parameters, are kept, so that a statement can be
+ * run many times without compiling it again.
+ *
+ * Parameters
+ * - stmt: DBM to reset
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_stmt_reset(chidb_stmt *stmt)
+{
+    for(uint32_t i = 0; i < stmt->nCursors; i++)
+    {
+        if(stmt->cursors[i].type != CURSOR_UNSPECIFIED)
+        {
+            chidb_dbm_cursor_destroy(&stmt->cursors[i]);
+            stmt->cursors[i].type = CURSOR_UNSPECIFIED;
+        }
+    }
+
+    for(uint32_t i = 0; i < stmt->nReg; i++)
+        stmt->reg[i].type = REG_UNSPECIFIED;
+
+    stmt->pc = 0;
+
+    return CHIDB_OK;
+}
+
+
+/* Copy a DBM
+ *
+ * Initializes a DBM with the program of another one (e.g., one in the
+ * statement cache, see chidb_prepare), so that the copy can be run while
+ * the original is left untouched. The copy has as many registers and
+ * cursors as the original, none of them in use, and its parameters are
+ * unbound.
+ *
+ * Parameters
+ * - stmt: Pointer to chidb_stmt to be initialized. Assumes it
+ *         points to enough memory to contain a chidb_stmt struct.
+ * - src: DBM to copy, which must not be running
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_stmt_copy(chidb_stmt *stmt, chidb_stmt *src)
+{
+    int rc;
+
+    if((rc = chidb_stmt_init(stmt, src->db)) != CHIDB_OK)
+        return rc;
+
+    for(uint32_t i = 0; i < src->endOp; i++)
+        if((rc = chidb_stmt_set_op(stmt, &src->ops[i], i)) != CHIDB_OK)
+            return rc;
+
+    if(src->nReg > stmt->nReg && (rc = realloc_reg(stmt, src->nReg)) != CHIDB_OK)
+        return rc;
+    if(src->nCursors > stmt->nCursors && (rc = realloc_cur(stmt, src->nCursors)) != CHIDB_OK)
+        return rc;
+
+    stmt->explain = src->explain;
+    stmt->startRR = src->startRR;
+    stmt->nRR = src->nRR;
+
+    if(src->nCols > 0)
+    {
+        if((stmt->cols = malloc(src->nCols * sizeof(char*))) == NULL)
+            return CHIDB_ENOMEM;
+        for(uint32_t i = 0; i < src->nCols; i++)
+            if((stmt->cols[i] = strdup(src->cols[i])) == NULL)
+                return CHIDB_ENOMEM;
+        stmt->nCols = src->nCols;
+    }
+
+    if(src->nParams > 0)
+    {
+        stmt->params = calloc(src->nParams, sizeof(chidb_dbm_register_t));
+        stmt->paramTypes = malloc(src->nParams * sizeof(register_type_t));
+        if(stmt->params == NULL || stmt->paramTypes == NULL)
+            return CHIDB_ENOMEM;
+        memcpy(stmt->paramTypes, src->paramTypes, src->nParams * sizeof(register_type_t));
+        stmt->nParams = src->nParams;
+    }
+
+    /* The copy is the same program, so it need not be verified again */
+    stmt->verified = src->verified;
+
     return CHIDB_OK;
 }
 
@@ -167,13 +284,626 @@ int chidb_stmt_set_op(chidb_stmt *stmt, chidb_dbm_op_t *op, uint32_t pos)
     if(pos >= stmt->endOp)
         stmt->endOp = pos + 1;
 
+    stmt->verified = false;
+
+    return CHIDB_OK;
+}
+
+
+/* What an operand of an instruction is, for chidb_stmt_verify */
+enum dbm_operand
+{
+    OPND_NONE = 0,  /* Unused, or a literal */
+    OPND_READ,      /* Register that is read */
+    OPND_INT,       /* Register that is read as an integer */
+    OPND_INT_PAIR,  /* Two consecutive registers read as integers */
+    OPND_TEXT,      /* Register that is read as a string */
+    OPND_RECORD,    /* Register that is read as a record */
+    OPND_RANGE,     /* First of the registers read, their number being p2 */
+    OPND_WRITE,     /* Register that is written (see dbm_op_operands.out) */
+    OPND_WRITES,    /* First of the registers written, their number being p5 */
+    OPND_CURSOR,    /* Cursor that must be open */
+    OPND_OPEN,      /* Cursor that is opened */
+    OPND_CLOSE,     /* Cursor that is closed */
+    OPND_JUMP       /* Jump address */
+};
+
+/* Static type of a register that was written, but whose type is only known
+ * at run time */
+#define DBM_REG_ANY (REG_BINARY + 1)
+/* Static type of the register written by Copy and SCopy: that of p1 */
+#define DBM_REG_COPY (REG_BINARY + 2)
+
+struct dbm_op_operands
+{
+    uint8_t p[3];   /* Operands p1, p2 and p3 */
+    uint8_t out;    /* Type of the register written, if any */
+};
+
+static const struct dbm_op_operands dbm_operands[] =
+{
+    [Op_OpenRead]    = {{OPND_OPEN, OPND_INT, OPND_NONE}},
+    [Op_OpenReadConst] = {{OPND_OPEN, OPND_NONE, OPND_NONE}},
+    [Op_OpenWrite]   = {{OPND_OPEN, OPND_INT, OPND_NONE}},
+    [Op_Close]       = {{OPND_CLOSE, OPND_NONE, OPND_NONE}},
+    [Op_Rewind]      = {{OPND_CURSOR, OPND_JUMP, OPND_NONE}},
+    [Op_Next]        = {{OPND_CURSOR, OPND_JUMP, OPND_NONE}},
+    [Op_Prev]        = {{OPND_CURSOR, OPND_JUMP, OPND_NONE}},
+    [Op_Seek]        = {{OPND_CURSOR, OPND_JUMP, OPND_INT}},
+    [Op_SeekGt]      = {{OPND_CURSOR, OPND_JUMP, OPND_INT}},
+    [Op_SeekGe]      = {{OPND_CURSOR, OPND_JUMP, OPND_INT}},
+    [Op_SeekLt]      = {{OPND_CURSOR, OPND_JUMP, OPND_INT}},
+    [Op_SeekLe]      = {{OPND_CURSOR, OPND_JUMP, OPND_INT}},
+    [Op_SeekRange]   = {{OPND_CURSOR, OPND_JUMP, OPND_INT_PAIR}},
+    [Op_HashSeek]    = {{OPND_CURSOR, OPND_JUMP, OPND_INT}},
+    [Op_HashNext]    = {{OPND_CURSOR, OPND_JUMP, OPND_NONE}},
+    [Op_Column]      = {{OPND_CURSOR, OPND_NONE, OPND_WRITE}, DBM_REG_ANY},
+    [Op_Columns]     = {{OPND_CURSOR, OPND_NONE, OPND_WRITES}, DBM_REG_ANY},
+    [Op_ColumnEq]    = {{OPND_READ, OPND_JUMP, OPND_CURSOR}},
+    [Op_ColumnNe]    = {{OPND_READ, OPND_JUMP, OPND_CURSOR}},
+    [Op_ColumnLt]    = {{OPND_READ, OPND_JUMP, OPND_CURSOR}},
+    [Op_ColumnLe]    = {{OPND_READ, OPND_JUMP, OPND_CURSOR}},
+    [Op_ColumnGt]    = {{OPND_READ, OPND_JUMP, OPND_CURSOR}},
+    [Op_ColumnGe]    = {{OPND_READ, OPND_JUMP, OPND_CURSOR}},
+    [Op_Key]         = {{OPND_CURSOR, OPND_WRITE, OPND_NONE}, REG_INT32},
+    [Op_Count]       = {{OPND_CURSOR, OPND_WRITE, OPND_NONE}, REG_INT32},
+    [Op_Integer]     = {{OPND_NONE, OPND_WRITE, OPND_NONE}, REG_INT32},
+    [Op_String]      = {{OPND_NONE, OPND_WRITE, OPND_NONE}, REG_STRING},
+    [Op_Null]        = {{OPND_NONE, OPND_WRITE, OPND_NONE}, REG_NULL},
+    [Op_Variable]    = {{OPND_NONE, OPND_WRITE, OPND_NONE}, DBM_REG_ANY},
+    [Op_ResultRow]   = {{OPND_RANGE, OPND_NONE, OPND_NONE}},
+    [Op_MakeRecord]  = {{OPND_RANGE, OPND_NONE, OPND_WRITE}, REG_BINARY},
+    [Op_Insert]      = {{OPND_CURSOR, OPND_RECORD, OPND_INT}},
+    [Op_Eq]          = {{OPND_READ, OPND_JUMP, OPND_READ}},
+    [Op_Ne]          = {{OPND_READ, OPND_JUMP, OPND_READ}},
+    [Op_Lt]          = {{OPND_READ, OPND_JUMP, OPND_READ}},
+    [Op_Le]          = {{OPND_READ, OPND_JUMP, OPND_READ}},
+    [Op_Gt]          = {{OPND_READ, OPND_JUMP, OPND_READ}},
+    [Op_Ge]          = {{OPND_READ, OPND_JUMP, OPND_READ}},
+    [Op_IdxGt]       = {{OPND_CURSOR, OPND_JUMP, OPND_INT}},
+    [Op_IdxGe]       = {{OPND_CURSOR, OPND_JUMP, OPND_INT}},
+    [Op_IdxLt]       = {{OPND_CURSOR, OPND_JUMP, OPND_INT}},
+    [Op_IdxLe]       = {{OPND_CURSOR, OPND_JUMP, OPND_INT}},
+    [Op_IdxPKey]     = {{OPND_CURSOR, OPND_WRITE, OPND_NONE}, REG_INT32},
+    [Op_IdxInsert]   = {{OPND_CURSOR, OPND_INT, OPND_READ}},
+    [Op_TextKey]     = {{OPND_TEXT, OPND_WRITE, OPND_NONE}, REG_INT32},
+    [Op_CreateTable] = {{OPND_WRITE, OPND_NONE, OPND_NONE}, REG_INT32},
+    [Op_CreateIndex] = {{OPND_WRITE, OPND_NONE, OPND_NONE}, REG_INT32},
+    [Op_CreateHash]  = {{OPND_WRITE, OPND_NONE, OPND_NONE}, REG_INT32},
+    [Op_Copy]        = {{OPND_READ, OPND_WRITE, OPND_NONE}, DBM_REG_COPY},
+    [Op_SCopy]       = {{OPND_READ, OPND_WRITE, OPND_NONE}, DBM_REG_COPY},
+    [Op_Halt]        = {{OPND_NONE, OPND_NONE, OPND_NONE}},
+};
+
+static inline bool dbm_is_register(uint8_t opnd)
+{
+    return opnd >= OPND_READ && opnd <= OPND_WRITES;
+}
+
+static inline bool dbm_is_cursor(uint8_t opnd)
+{
+    return opnd >= OPND_CURSOR && opnd <= OPND_CLOSE;
+}
+
+/* Meet of what two paths into an instruction know of a register or a
+ * cursor: unwritten (or closed) on either path is unwritten. */
+static inline uint8_t dbm_meet(uint8_t a, uint8_t b)
+{
+    if(a == b)
+        return a;
+    if(a == REG_UNSPECIFIED || b == REG_UNSPECIFIED)
+        return REG_UNSPECIFIED;
+    return DBM_REG_ANY;
+}
+
+/* Does a register of static type t fit an operand? */
+static bool dbm_fits(uint8_t opnd, uint8_t t)
+{
+    if(t == REG_UNSPECIFIED)
+        return false;
+    if(t == DBM_REG_ANY)
+        return true;
+    switch(opnd)
+    {
+    case OPND_INT:
+    case OPND_INT_PAIR:
+        return t == REG_INT32;
+    case OPND_TEXT:
+        return t == REG_STRING;
+    case OPND_RECORD:
+        return t == REG_BINARY;
+    default:
+        return true;
+    }
+}
+
+/* What an instruction leaves in the registers and cursors. The nReg
+ * registers come first in state, then the cursors. */
+static void dbm_transfer(chidb_stmt *stmt, chidb_dbm_op_t *op, uint8_t *state)
+{
+    const struct dbm_op_operands *opnds = &dbm_operands[op->opcode];
+    int32_t p[3] = {op->p1, op->p2, op->p3};
+
+    for(int i = 0; i < 3; i++)
+    {
+        if(opnds->p[i] == OPND_WRITE)
+            state[p[i]] = opnds->out == DBM_REG_COPY ? state[op->p1] : opnds->out;
+        else if(opnds->p[i] == OPND_WRITES)
+            memset(state + p[i], opnds->out, op->p5);
+        else if(opnds->p[i] == OPND_OPEN)
+            state[stmt->nReg + p[i]] = 1;
+        else if(opnds->p[i] == OPND_CLOSE)
+            state[stmt->nReg + p[i]] = 0;
+    }
+}
+
+/* Merge what an instruction leaves into what is known on entry to next */
+static bool dbm_merge(uint8_t *in, bool *seen, uint8_t *out, uint32_t nslots, uint32_t next)
+{
+    bool changed = false;
+    uint8_t *dst = in + next * nslots;
+
+    if(!seen[next])
+    {
+        memcpy(dst, out, nslots);
+        seen[next] = true;
+        return true;
+    }
+    for(uint32_t i = 0; i < nslots; i++)
+    {
+        uint8_t t = dbm_meet(dst[i], out[i]);
+        changed = changed || t != dst[i];
+        dst[i] = t;
+    }
+    return changed;
+}
+
+/* Does any instruction jump to pc? */
+static bool dbm_is_jump_target(chidb_stmt *stmt, uint32_t pc)
+{
+    for(uint32_t i = 0; i < stmt->endOp; i++)
+        if(dbm_operands[stmt->ops[i].opcode].p[1] == OPND_JUMP && stmt->ops[i].p2 == pc)
+            return true;
+    return false;
+}
+
+/* Does an instruction read register r? */
+static bool dbm_reads(chidb_dbm_op_t *op, int32_t r)
+{
+    const struct dbm_op_operands *opnds = &dbm_operands[op->opcode];
+    int32_t p[3] = {op->p1, op->p2, op->p3};
+
+    for(int i = 0; i < 3; i++)
+    {
+        switch(opnds->p[i])
+        {
+        case OPND_READ:
+        case OPND_INT:
+        case OPND_TEXT:
+        case OPND_RECORD:
+            if(r == p[i])
+                return true;
+            break;
+        case OPND_INT_PAIR:
+            if(r == p[i] || r == p[i] + 1)
+                return true;
+            break;
+        case OPND_RANGE:
+            if(r >= p[i] && r < p[i] + op->p2)
+                return true;
+            break;
+        }
+    }
+    return false;
+}
+
+/* Does an instruction write register r? */
+static bool dbm_writes(chidb_dbm_op_t *op, int32_t r)
+{
+    const struct dbm_op_operands *opnds = &dbm_operands[op->opcode];
+    int32_t p[3] = {op->p1, op->p2, op->p3};
+
+    for(int i = 0; i < 3; i++)
+    {
+        if(opnds->p[i] == OPND_WRITE && r == p[i])
+            return true;
+        if(opnds->p[i] == OPND_WRITES && r >= p[i] && r < p[i] + op->p5)
+            return true;
+    }
+    return false;
+}
+
+/* Is the value that instruction pc writes in register r only read by the
+ * instruction after it? It is if every other instruction that reads r
+ * comes right after one that writes it, and cannot be jumped to. */
+static bool dbm_reg_local(chidb_stmt *stmt, int32_t r, uint32_t pc)
+{
+    for(uint32_t i = 0; i < stmt->endOp; i++)
+    {
+        if(i == pc + 1 || !dbm_reads(&stmt->ops[i], r))
+            continue;
+        if(i == 0 || !dbm_writes(&stmt->ops[i - 1], r) || dbm_is_jump_target(stmt, i))
+            return false;
+    }
+    return true;
+}
+
+/* The Column* instruction for a comparison, or Noop */
+static opcode_t dbm_column_compare(opcode_t opcode)
+{
+    switch(opcode)
+    {
+    case Op_Eq:
+        return Op_ColumnEq;
+    case Op_Ne:
+        return Op_ColumnNe;
+    case Op_Lt:
+        return Op_ColumnLt;
+    case Op_Le:
+        return Op_ColumnLe;
+    case Op_Gt:
+        return Op_ColumnGt;
+    case Op_Ge:
+        return Op_ColumnGe;
+    default:
+        return Op_Noop;
+    }
+}
+
+static void dbm_set_op(chidb_dbm_op_t *op, opcode_t opcode, int32_t p1, int32_t p2, int32_t p3, int32_t p5)
+{
+    free(op->p4);
+    op->opcode = opcode;
+    op->p1 = p1;
+    op->p2 = p2;
+    op->p3 = p3;
+    op->p4 = NULL;
+    op->p5 = p5;
+}
+
+/* Optimize a DBM program
+ *
+ * Replaces the sequences of instructions that codegen emits again and
+ * again with a single instruction that does the work of all of them:
+ *
+ *  - Integer k r, OpenRead c r n                  -> OpenReadConst c k n
+ *  - Column c i r, Eq (Ne, Lt...) a j r           -> ColumnEq (...) a j c i
+ *  - Column c i r, Column c i+1 r+1, ...          -> Columns c i r n
+ *
+ * The first two are only made when nothing else reads the register, since
+ * it is no longer written. Instructions that can be jumped to are never
+ * folded into the one before them. The Noops left over (and those codegen
+ * emitted) are then removed, and the jumps to them sent to the instruction
+ * that follows.
+ *
+ * Parameters
+ * - stmt: DBM with the program to optimize
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_stmt_peephole(chidb_stmt *stmt)
+{
+    chidb_dbm_op_t *ops = stmt->ops;
+    uint32_t *newpc;
+    uint32_t i, j, n, last;
+
+    for(i = 0; i + 1 < stmt->endOp; i++)
+    {
+        chidb_dbm_op_t *op = &ops[i], *next = &ops[i + 1];
+
+        if(dbm_is_jump_target(stmt, i + 1))
+            continue;
+
+        if(op->opcode == Op_Integer && next->opcode == Op_OpenRead &&
+           next->p2 == op->p2 && dbm_reg_local(stmt, op->p2, i))
+        {
+            dbm_set_op(op, Op_OpenReadConst, next->p1, op->p1, next->p3, 0);
+            dbm_set_op(next, Op_Noop, 0, 0, 0, 0);
+        }
+        else if(op->opcode == Op_Column && dbm_column_compare(next->opcode) != Op_Noop &&
+                next->p3 == op->p3 && next->p1 != op->p3 && op->p2 >= 0 && op->p2 < 255 &&
+                dbm_reg_local(stmt, op->p3, i))
+        {
+            dbm_set_op(op, dbm_column_compare(next->opcode), next->p1, next->p2, op->p1, op->p2);
+            dbm_set_op(next, Op_Noop, 0, 0, 0, 0);
+        }
+        else if(op->opcode == Op_Column)
+        {
+            for(n = 1; i + n < stmt->endOp; n++)
+            {
+                chidb_dbm_op_t *col = &ops[i + n];
+                if(col->opcode != Op_Column || col->p1 != op->p1 || col->p2 != op->p2 + n ||
+                   col->p3 != op->p3 + n || dbm_is_jump_target(stmt, i + n))
+                    break;
+            }
+            if(n > 1 && op->p2 >= 0 && op->p2 + n <= 255)
+            {
+                dbm_set_op(op, Op_Columns, op->p1, op->p2, op->p3, n);
+                for(j = 1; j < n; j++)
+                    dbm_set_op(&ops[i + j], Op_Noop, 0, 0, 0, 0);
+                i += n - 1;
+            }
+        }
+    }
+
+    /* Noops at the end of the program stay, so that jumps to them remain
+     * within the program */
+    for(last = stmt->endOp; last > 0 && ops[last - 1].opcode == Op_Noop; last--);
+
+    newpc = malloc((stmt->endOp + 1) * sizeof(uint32_t));
+    if(newpc == NULL)
+        return CHIDB_ENOMEM;
+    for(i = 0, n = 0; i < stmt->endOp; i++)
+    {
+        newpc[i] = n;
+        if(ops[i].opcode != Op_Noop || i >= last)
+            n++;
+    }
+
+    for(i = 0, j = 0; i < stmt->endOp; i++)
+    {
+        if(ops[i].opcode == Op_Noop && i < last)
+        {
+            free(ops[i].p4);
+            continue;
+        }
+        ops[j] = ops[i];
+        if(dbm_operands[ops[j].opcode].p[1] == OPND_JUMP && ops[j].p2 >= 0 && ops[j].p2 < stmt->endOp)
+            ops[j].p2 = newpc[ops[j].p2];
+        j++;
+    }
+    for(i = j; i < stmt->endOp; i++)
+    {
+        ops[i].opcode = Op_Noop;
+        ops[i].p1 = ops[i].p2 = ops[i].p3 = ops[i].p5 = 0;
+        ops[i].p4 = NULL;
+    }
+    stmt->endOp = j;
+    stmt->verified = false;
+
+    free(newpc);
     return CHIDB_OK;
 }
 
+/* Verify a DBM program
+ *
+ * Checks, once and for all, what the instruction handlers would otherwise
+ * check every time they run: every register, cursor and jump address
+ * must be in range, every register must have been written (with a type
+ * that fits the instruction) and every cursor opened on all the paths
+ * that lead to an instruction that reads it. The registers and cursors
+ * of the DBM are then allocated for the whole program, and the program is
+ * marked as verified, so that chidb_stmt_exec can skip those checks.
+ *
+ * Parameters
+ * - stmt: DBM with the program to verify. Its registers and cursors
+ *         must not have been used yet.
+ *
+ * Return
+ * - CHIDB_OK: The program is valid
+ * - CHIDB_EVALIDEARG: An instruction has an invalid operand
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_stmt_verify(chidb_stmt *stmt)
+{
+    int32_t maxReg = -1, maxCur = -1;
+    uint32_t nslots;
+    uint8_t *in, *out;
+    bool *seen, changed;
+    int rc;
+
+    /* Ranges */
+    for(uint32_t pc = 0; pc < stmt->endOp; pc++)
+    {
+        chidb_dbm_op_t *op = &stmt->ops[pc];
+        const struct dbm_op_operands *opnds = &dbm_operands[op->opcode];
+        int32_t p[3] = {op->p1, op->p2, op->p3};
+
+        for(int i = 0; i < 3; i++)
+        {
+            int32_t last = p[i];
+
+            if(opnds->p[i] == OPND_INT_PAIR)
+                last = p[i] + 1;
+            else if(opnds->p[i] == OPND_RANGE)
+            {
+                if(op->p2 < 0)
+                    return CHIDB_EVALIDEARG;
+                last = p[i] + op->p2 - 1;
+            }
+            else if(opnds->p[i] == OPND_WRITES)
+            {
+                if(op->p5 < 0)
+                    return CHIDB_EVALIDEARG;
+                last = p[i] + op->p5 - 1;
+            }
+
+            if(dbm_is_register(opnds->p[i]))
+            {
+                if(p[i] < 0)
+                    return CHIDB_EVALIDEARG;
+                if(last > maxReg)
+                    maxReg = last;
+            }
+            else if(dbm_is_cursor(opnds->p[i]))
+            {
+                if(p[i] < 0)
+                    return CHIDB_EVALIDEARG;
+                if(p[i] > maxCur)
+                    maxCur = p[i];
+            }
+            else if(opnds->p[i] == OPND_JUMP && !IS_VALID_ADDRESS(stmt, p[i]))
+                return CHIDB_EVALIDEARG;
+        }
+    }
+
+    if(maxReg >= (int32_t) stmt->nReg && (rc = realloc_reg(stmt, maxReg + 1)) != CHIDB_OK)
+        return rc;
+    if(maxCur >= (int32_t) stmt->nCursors && (rc = realloc_cur(stmt, maxCur + 1)) != CHIDB_OK)
+        return rc;
+
+    /* What is known of every register and cursor on entry to every
+     * instruction, until nothing changes */
+    nslots = stmt->nReg + stmt->nCursors;
+    in = calloc(stmt->endOp + 1, nslots);
+    out = malloc(nslots);
+    seen = calloc(stmt->endOp + 1, sizeof(bool));
+    if(in == NULL || out == NULL || seen == NULL)
+    {
+        free(in);
+        free(out);
+        free(seen);
+        return CHIDB_ENOMEM;
+    }
+
+    seen[0] = stmt->endOp > 0;
+    do
+    {
+        changed = false;
+        for(uint32_t pc = 0; pc < stmt->endOp; pc++)
+        {
+            chidb_dbm_op_t *op = &stmt->ops[pc];
+
+            if(!seen[pc] || op->opcode == Op_Halt)
+                continue;
+
+            memcpy(out, in + pc * nslots, nslots);
+            dbm_transfer(stmt, op, out);
+            if(pc + 1 < stmt->endOp)
+                changed = dbm_merge(in, seen, out, nslots, pc + 1) || changed;
+            if(dbm_operands[op->opcode].p[1] == OPND_JUMP)
+                changed = dbm_merge(in, seen, out, nslots, op->p2) || changed;
+        }
+    } while(changed);
+
+    /* Reads */
+    rc = CHIDB_OK;
+    for(uint32_t pc = 0; pc < stmt->endOp && rc == CHIDB_OK; pc++)
+    {
+        chidb_dbm_op_t *op = &stmt->ops[pc];
+        const struct dbm_op_operands *opnds = &dbm_operands[op->opcode];
+        uint8_t *state = in + pc * nslots;
+        int32_t p[3] = {op->p1, op->p2, op->p3};
+
+        if(!seen[pc])
+            continue;
+
+        for(int i = 0; i < 3; i++)
+        {
+            switch(opnds->p[i])
+            {
+            case OPND_READ:
+            case OPND_INT:
+            case OPND_TEXT:
+            case OPND_RECORD:
+                if(!dbm_fits(opnds->p[i], state[p[i]]))
+                    rc = CHIDB_EVALIDEARG;
+                break;
+            case OPND_INT_PAIR:
+                if(!dbm_fits(opnds->p[i], state[p[i]]) || !dbm_fits(opnds->p[i], state[p[i] + 1]))
+                    rc = CHIDB_EVALIDEARG;
+                break;
+            case OPND_RANGE:
+                for(int32_t r = p[i]; r < p[i] + op->p2; r++)
+                    if(!dbm_fits(OPND_READ, state[r]))
+                        rc = CHIDB_EVALIDEARG;
+                break;
+            case OPND_CURSOR:
+                if(!state[stmt->nReg + p[i]])
+                    rc = CHIDB_EVALIDEARG;
+                break;
+            }
+        }
+    }
+
+    free(in);
+    free(out);
+    free(seen);
+
+    stmt->verified = rc == CHIDB_OK;
+    return rc;
+}
+
 /* Forward declaration of instruction handler. See dbm-ops.c for details */
 int chidb_dbm_op_handle (chidb_stmt *stmt, chidb_dbm_op_t *op);
 
 
+/* Dispatch of the instructions run inline by chidb_stmt_exec */
+#ifdef CHIDB_DBM_THREADED
+#define DBM_OP(OP) op_ ## OP:
+#define DBM_DISPATCH() do {                  \
+        if(stmt->pc >= stmt->endOp)          \
+            goto done;                       \
+        op = &stmt->ops[stmt->pc++];         \
+        goto *dispatch[op->opcode];          \
+    } while(0)
+#define DBM_SLOW_ENTRY(OP) [Op_ ## OP] = &&slow,
+#else
+#define DBM_OP(OP) case Op_ ## OP:
+#define DBM_DISPATCH() continue
+#endif
+
+/* Operands of the comparison instructions, when both are integers */
+#define DBM_INT_OPERANDS(stmt, op) (((stmt)->verified ||                                                 \
+                                     (EXISTS_REGISTER(stmt, (op)->p1) && EXISTS_REGISTER(stmt, (op)->p3) && \
+                                      IS_VALID_ADDRESS(stmt, (op)->p2))) &&                                 \
+                                    (stmt)->reg[(op)->p1].type == REG_INT32 &&                             \
+                                    (stmt)->reg[(op)->p3].type == REG_INT32)
+
+#define DBM_INT_COMPARE(OP, CMP)                                                \
+    DBM_OP(OP)                                                                  \
+        if(!DBM_INT_OPERANDS(stmt, op))                                         \
+            goto slow;                                                          \
+        if(stmt->reg[op->p1].value.i CMP stmt->reg[op->p3].value.i)             \
+            stmt->pc = op->p2;                                                  \
+        DBM_DISPATCH();
+
+/* Largest column read by the inline Column */
+#define DBM_MAX_INLINE_COLUMN (32)
+
+/* Read an integer column of the table row at a cursor in place. False if
+ * the column is not an integer, or the row is not a table row. */
+static inline bool dbm_int_column(chidb_dbm_cursor_t *c, int32_t col, int32_t *v)
+{
+    uint32_t types[DBM_MAX_INLINE_COLUMN + 1], offsets[DBM_MAX_INLINE_COLUMN + 1];
+    uint8_t *value;
+    uint8_t n;
+
+    if(col < 0 || col > DBM_MAX_INLINE_COLUMN || c->cur_cell.type != PGTYPE_TABLE_LEAF)
+        return false;
+    chidb_DBRecord_peek(c->cur_cell.fields.tableLeaf.data, col + 1, types, offsets, &n);
+    if(col >= n)
+        return false;
+
+    value = c->cur_cell.fields.tableLeaf.data + offsets[col];
+    if(types[col] == SQL_INTEGER_1BYTE)
+        *v = (int8_t) value[0];
+    else if(types[col] == SQL_INTEGER_2BYTE)
+        *v = (int16_t) get2byte(value);
+    else if(types[col] == SQL_INTEGER_4BYTE)
+        *v = (int32_t) get4byte(value);
+    else
+        return false;
+    return true;
+}
+
+/* Column* made by chidb_stmt_peephole: the jump is taken when
+ * (column p5 of cursor p3) CMP r[p1] holds */
+#define DBM_COLUMN_COMPARE(OP, CMP)                                             \
+    DBM_OP(OP)                                                                  \
+        if(!stmt->verified && (!IS_VALID_CURSOR(stmt, op->p3) ||                \
+                               !EXISTS_REGISTER(stmt, op->p1) ||                \
+                               !IS_VALID_ADDRESS(stmt, op->p2)))                \
+            goto slow;                                                          \
+        if(stmt->reg[op->p1].type != REG_INT32 ||                               \
+           !dbm_int_column(&stmt->cursors[op->p3], op->p5, &v))                 \
+            goto slow;                                                          \
+        if(v CMP stmt->reg[op->p1].value.i)                                     \
+            stmt->pc = op->p2;                                                  \
+        DBM_DISPATCH();
+
 /* Run the DBM
  *
  * This function will run the DBM until one of the following happens:
@@ -187,6 +917,13 @@ int chidb_dbm_op_handle (chidb_stmt *stmt, chidb_dbm_op_t *op);
  *    or CHIDB_ROW. The program stops executing and and the return
  *    value of the instruction handler is returned.
  *
+ * The instructions that run once per row of a scan (moving a cursor,
+ * reading its key or an integer column, comparing integers and returning
+ * a row) are run here, without a call to their handler; all the others,
+ * and these whenever their operands are not the usual ones (an invalid
+ * cursor, text in a register...), go through chidb_dbm_op_handle. The
+ * operands of a program that passed chidb_stmt_verify are not checked.
+ *
  * Parameters
  * - stmt: DBM to run.
  *
@@ -198,16 +935,120 @@ int chidb_dbm_op_handle (chidb_stmt *stmt, chidb_dbm_op_t *op);
 int chidb_stmt_exec(chidb_stmt *stmt)
 {
     int rc = CHIDB_OK;
+    chidb_dbm_op_t *op;
+    int32_t v;
 
+#ifdef CHIDB_DBM_THREADED
+    /* Later entries override the default ones */
+    static void *dispatch[] =
+    {
+        FOREACH_OP(DBM_SLOW_ENTRY)
+        [Op_Next] = &&op_Next,
+        [Op_Prev] = &&op_Prev,
+        [Op_Key] = &&op_Key,
+        [Op_Column] = &&op_Column,
+        [Op_ColumnEq] = &&op_ColumnEq,
+        [Op_ColumnNe] = &&op_ColumnNe,
+        [Op_ColumnLt] = &&op_ColumnLt,
+        [Op_ColumnLe] = &&op_ColumnLe,
+        [Op_ColumnGt] = &&op_ColumnGt,
+        [Op_ColumnGe] = &&op_ColumnGe,
+        [Op_Integer] = &&op_Integer,
+        [Op_Eq] = &&op_Eq,
+        [Op_Ne] = &&op_Ne,
+        [Op_Lt] = &&op_Lt,
+        [Op_Le] = &&op_Le,
+        [Op_Gt] = &&op_Gt,
+        [Op_Ge] = &&op_Ge,
+        [Op_ResultRow] = &&op_ResultRow,
+    };
+
+    DBM_DISPATCH();
+#else
     while(stmt->pc < stmt->endOp)
     {
-        chidb_dbm_op_t *op = &stmt->ops[stmt->pc++];
-        rc = chidb_dbm_op_handle(stmt, op);
+        op = &stmt->ops[stmt->pc++];
+        switch(op->opcode)
+        {
+#endif
+
+    DBM_OP(Next)
+        if(!stmt->verified && (!EXISTS_CURSOR(stmt, op->p1) || !IS_VALID_ADDRESS(stmt, op->p2)))
+            goto slow;
+        if(chidb_dbm_cursor_next(&stmt->cursors[op->p1]) == CHIDB_OK)
+            stmt->pc = op->p2;
+        DBM_DISPATCH();
+
+    DBM_OP(Prev)
+        if(!stmt->verified && (!EXISTS_CURSOR(stmt, op->p1) || !IS_VALID_ADDRESS(stmt, op->p2)))
+            goto slow;
+        if(chidb_dbm_cursor_prev(&stmt->cursors[op->p1]) == CHIDB_OK)
+            stmt->pc = op->p2;
+        DBM_DISPATCH();
+
+    DBM_OP(Key)
+        if(!stmt->verified && (!IS_VALID_CURSOR(stmt, op->p1) || !EXISTS_REGISTER(stmt, op->p2)))
+            goto slow;
+        stmt->reg[op->p2].type = REG_INT32;
+        stmt->reg[op->p2].value.i = stmt->cursors[op->p1].cur_cell.key;
+        DBM_DISPATCH();
+
+    DBM_OP(Column)
+        /* Integer columns of table rows, read in place */
+        if(!stmt->verified && (!IS_VALID_CURSOR(stmt, op->p1) || !EXISTS_REGISTER(stmt, op->p3)))
+            goto slow;
+        if(!dbm_int_column(&stmt->cursors[op->p1], op->p2, &v))
+            goto slow;
+        stmt->reg[op->p3].type = REG_INT32;
+        stmt->reg[op->p3].value.i = v;
+        DBM_DISPATCH();
+
+    DBM_OP(Integer)
+        if(!stmt->verified && !EXISTS_REGISTER(stmt, op->p2))
+            goto slow;
+        stmt->reg[op->p2].type = REG_INT32;
+        stmt->reg[op->p2].value.i = op->p1;
+        DBM_DISPATCH();
+
+    /* The jump is taken when r[p3] CMP r[p1] holds */
+    DBM_INT_COMPARE(Eq, ==)
+    DBM_INT_COMPARE(Ne, !=)
+    DBM_INT_COMPARE(Lt, >)
+    DBM_INT_COMPARE(Le, >=)
+    DBM_INT_COMPARE(Gt, <)
+    DBM_INT_COMPARE(Ge, <=)
+
+    DBM_COLUMN_COMPARE(ColumnEq, ==)
+    DBM_COLUMN_COMPARE(ColumnNe, !=)
+    DBM_COLUMN_COMPARE(ColumnLt, <)
+    DBM_COLUMN_COMPARE(ColumnLe, <=)
+    DBM_COLUMN_COMPARE(ColumnGt, >)
+    DBM_COLUMN_COMPARE(ColumnGe, >=)
+
+    DBM_OP(ResultRow)
+        if(!stmt->verified && (!IS_VALID_REGISTER(stmt, op->p1) || !IS_VALID_REGISTER(stmt, op->p2)))
+            goto slow;
+        stmt->startRR = (uint32_t)op->p1;
+        stmt->nRR = (uint32_t)op->p2;
+        rc = CHIDB_ROW;
+        goto done;
+
+#ifndef CHIDB_DBM_THREADED
+        default:
+            goto slow;
+        }
+#endif
 
+    slow:
+        rc = chidb_dbm_op_handle(stmt, op);
         if (rc != CHIDB_OK)
-            break;
+            goto done;
+        DBM_DISPATCH();
+#ifndef CHIDB_DBM_THREADED
     }
+#endif
 
+done:
     assert(stmt->nRR == stmt->nCols);
 
     if (rc == CHIDB_OK || rc == CHIDB_DONE)
@@ -371,6 +1212,7 @@ int realloc_ops(chidb_stmt *stmt, uint32_t size)
         stmt->ops[i].p2 = 0;
         stmt->ops[i].p3 = 0;
         stmt->ops[i].p4 = NULL;
+        stmt->ops[i].p5 = 0;
     }
 
     stmt->nOps = size;
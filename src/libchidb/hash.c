@@ -0,0 +1,718 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ * This module contains functions to manipulate hash indexes. A hash index
+ * maps a KeyIdx to a KeyPk, like an index B-Tree, but can only be used to
+ * look up a single key: it is an extendible hash table, so finding a key
+ * reads the directory page and then the page of the key's bucket, no matter
+ * how many keys the index has.
+ *
+ * The directory page is the root page of the index. Its global depth d
+ * says how many low bits of the hash of a key select its bucket, among the
+ * 2^d bucket page numbers stored in the directory. A bucket with local
+ * depth l < d is shared by the 2^(d-l) directory entries that agree on the
+ * l low bits. When a bucket fills up, it is split in two buckets with
+ * local depth l+1, doubling the directory first if l == d. Once the
+ * directory fills its page and a bucket cannot be split any further, the
+ * bucket is chained to overflow pages instead.
+ *
+ * Like the B-Tree module, this module only accesses the file through the
+ * pager. Insertions latch the directory page in exclusive mode, and
+ * lookups in shared mode; since buckets can only be reached through the
+ * directory, this also protects them.
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "chidbInt.h"
+#include "hash.h"
+#include "pager.h"
+#include "util.h"
+
+
+/* Hash of a key. Consecutive keys (which are common, since they are often
+ * primary keys or counters) must not end up in the same bucket, so the
+ * bits of the key are mixed using the finalizer of MurmurHash3. */
+static uint32_t chidb_Hash_hash(chidb_key_t key)
+{
+    uint32_t h = key;
+
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+#define HASH_MASK(depth) ((uint32_t)((1ull << (depth)) - 1))
+#define HASHDIR_BUCKET(data, i) ((data) + HASHDIR_BUCKETS_OFFSET + 4 * (i))
+#define HASHBKT_ENTRY(data, i) ((data) + HASHBKT_ENTRIES_OFFSET + HASHBKT_ENTRY_SIZE * (i))
+#define HASHBKT_CAPACITY(page_size) (((page_size) - HASHBKT_ENTRIES_OFFSET) / HASHBKT_ENTRY_SIZE)
+
+
+/* Largest global depth of a directory
+ *
+ * Parameters
+ * - page_size: Size of the pages of the file
+ *
+ * Return
+ * - Largest depth d such that the 2^d bucket page numbers of a directory
+ *   fit in a page.
+ */
+uint32_t chidb_Hash_maxDepth(uint16_t page_size)
+{
+    uint32_t depth = 0;
+
+    while(HASHDIR_BUCKETS_OFFSET + 4 * (2ul << depth) <= page_size)
+        depth++;
+    return depth;
+}
+
+
+/* Checks whether a root page is the directory of a hash index
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Root page of a B-Tree or a hash index
+ * - is_hash: Out parameter. Whether nroot is the directory of a hash index.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EPAGENO: The provided page number is not valid
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Hash_isHash(BTree *bt, npage_t nroot, bool *is_hash)
+{
+    MemPage *page;
+    int rt;
+
+    /* Page 1 is the root of the schema table, which is always a B-Tree */
+    if(nroot == 1)
+    {
+        *is_hash = false;
+        return CHIDB_OK;
+    }
+
+    if(rt = chidb_Pager_readPage(bt->pager, nroot, &page)) { return rt; }
+    *is_hash = page->data[0] == PGTYPE_HASH_DIRECTORY;
+    chidb_Pager_releaseMemPage(bt->pager, page);
+
+    return CHIDB_OK;
+}
+
+
+/* Allocates an empty bucket page with the given local depth */
+static int chidb_Hash_newBucket(BTree *bt, uint8_t depth, npage_t *npage)
+{
+    MemPage *page;
+    int rt;
+
+    if(rt = chidb_Pager_allocatePage(bt->pager, npage)) { return rt; }
+    if(rt = chidb_Pager_readPage(bt->pager, *npage, &page)) { return rt; }
+
+    memset(page->data, 0, bt->pager->page_size);
+    page->data[0] = PGTYPE_HASH_BUCKET;
+    page->data[HASHBKT_DEPTH_OFFSET] = depth;
+    put2byte(page->data + HASHBKT_NENTRIES_OFFSET, 0);
+    put4byte(page->data + HASHBKT_OVERFLOW_OFFSET, HASH_NO_OVERFLOW);
+
+    rt = chidb_Pager_writePage(bt->pager, page);
+    chidb_Pager_releaseMemPage(bt->pager, page);
+    return rt;
+}
+
+
+/* Create a new hash index
+ *
+ * Allocates a directory page with global depth 0, and a single empty
+ * bucket that every key hashes to.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Out parameter. Page number of the directory of the new index.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Hash_create(BTree *bt, npage_t *nroot)
+{
+    MemPage *dir;
+    npage_t nbucket;
+    int rt;
+
+    if(rt = chidb_Pager_allocatePage(bt->pager, nroot)) { return rt; }
+    if(rt = chidb_Hash_newBucket(bt, 0, &nbucket)) { return rt; }
+    if(rt = chidb_Pager_readPage(bt->pager, *nroot, &dir)) { return rt; }
+
+    memset(dir->data, 0, bt->pager->page_size);
+    dir->data[0] = PGTYPE_HASH_DIRECTORY;
+    dir->data[HASHDIR_DEPTH_OFFSET] = 0;
+    put4byte(HASHDIR_BUCKET(dir->data, 0), nbucket);
+
+    rt = chidb_Pager_writePage(bt->pager, dir);
+    chidb_Pager_releaseMemPage(bt->pager, dir);
+    return rt;
+}
+
+
+/* Finds the bucket of a key in a directory. The caller must have latched
+ * the directory. */
+static int chidb_Hash_getBucket(BTree *bt, npage_t nroot, uint32_t hash, npage_t *nbucket)
+{
+    MemPage *dir;
+    int rt;
+
+    if(rt = chidb_Pager_readPage(bt->pager, nroot, &dir)) { return rt; }
+    if(dir->data[0] != PGTYPE_HASH_DIRECTORY)
+    {
+        chidb_Pager_releaseMemPage(bt->pager, dir);
+        return CHIDB_ECORRUPT;
+    }
+
+    *nbucket = get4byte(HASHDIR_BUCKET(dir->data, hash & HASH_MASK(dir->data[HASHDIR_DEPTH_OFFSET])));
+    chidb_Pager_releaseMemPage(bt->pager, dir);
+    return CHIDB_OK;
+}
+
+
+/* What chidb_Hash_searchBucket found out about a bucket, besides the key */
+typedef struct HashChain
+{
+    uint8_t depth;          /* Local depth of the bucket */
+    uint32_t n_pages;       /* Number of pages, including overflow pages */
+    npage_t last_page;      /* Last page of the bucket */
+    npage_t room_page;      /* First page with room for another entry (0 if none) */
+    bool same_hash;         /* Do all the entries have the hash of the key? */
+} HashChain;
+
+/* Looks for the entries of a key in every page of a bucket
+ *
+ * A key can have many entries, one per KeyPk, in no particular order, so
+ * the whole bucket is read, unless the entry (keyIdx, keyPkMin) is found.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nbucket: First page of the bucket
+ * - keyIdx: Key to look for
+ * - keyPkMin: Smallest KeyPk to look for
+ * - keyPk: Out parameter. Smallest KeyPk, not below keyPkMin, of the
+ *          entries with key keyIdx, if there is any.
+ * - chain: Out parameter (might be NULL). Pages of the bucket.
+ *
+ * Return
+ * - CHIDB_OK: Entry found
+ * - CHIDB_ENOTFOUND: Entry not found
+ * - CHIDB_ECORRUPT: A page of the bucket is not a bucket page
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+static int chidb_Hash_searchBucket(BTree *bt, npage_t nbucket, chidb_key_t keyIdx, chidb_key_t keyPkMin, chidb_key_t *keyPk, HashChain *chain)
+{
+    uint32_t capacity = HASHBKT_CAPACITY(bt->pager->page_size);
+    uint32_t hash = chidb_Hash_hash(keyIdx);
+    npage_t npage = nbucket;
+    HashChain tmp = { 0, 0, 0, 0, true };
+    bool found = false;
+    MemPage *page;
+    int rt;
+
+    while(npage != HASH_NO_OVERFLOW)
+    {
+        if(rt = chidb_Pager_readPage(bt->pager, npage, &page)) { return rt; }
+        if(page->data[0] != PGTYPE_HASH_BUCKET)
+        {
+            chidb_Pager_releaseMemPage(bt->pager, page);
+            return CHIDB_ECORRUPT;
+        }
+
+        uint16_t n_entries = get2byte(page->data + HASHBKT_NENTRIES_OFFSET);
+        for(uint16_t i = 0; i < n_entries; i++)
+        {
+            chidb_key_t entryIdx = get4byte(HASHBKT_ENTRY(page->data, i));
+            chidb_key_t entryPk = get4byte(HASHBKT_ENTRY(page->data, i) + 4);
+
+            if(entryIdx != keyIdx)
+            {
+                tmp.same_hash = tmp.same_hash && chidb_Hash_hash(entryIdx) == hash;
+                continue;
+            }
+            if(entryPk < keyPkMin || (found && entryPk >= *keyPk))
+                continue;
+
+            *keyPk = entryPk;
+            found = true;
+            if(entryPk == keyPkMin)
+            {
+                chidb_Pager_releaseMemPage(bt->pager, page);
+                return CHIDB_OK;
+            }
+        }
+
+        if(tmp.n_pages++ == 0)
+            tmp.depth = page->data[HASHBKT_DEPTH_OFFSET];
+        if(tmp.room_page == 0 && n_entries < capacity)
+            tmp.room_page = npage;
+        tmp.last_page = npage;
+
+        npage = get4byte(page->data + HASHBKT_OVERFLOW_OFFSET);
+        chidb_Pager_releaseMemPage(bt->pager, page);
+    }
+
+    if(chain != NULL)
+        *chain = tmp;
+    return found ? CHIDB_OK : CHIDB_ENOTFOUND;
+}
+
+
+/* Finds the entry of a key with the smallest KeyPk not below keyPkMin */
+static int chidb_Hash_findFrom(BTree *bt, npage_t nroot, chidb_key_t keyIdx, chidb_key_t keyPkMin, chidb_key_t *keyPk)
+{
+    npage_t nbucket;
+    int rt;
+
+    if(rt = chidb_Pager_latch(bt->pager, nroot, LATCH_SHARED)) { return rt; }
+
+    if(!(rt = chidb_Hash_getBucket(bt, nroot, chidb_Hash_hash(keyIdx), &nbucket)))
+        rt = chidb_Hash_searchBucket(bt, nbucket, keyIdx, keyPkMin, keyPk, NULL);
+
+    chidb_Pager_unlatch(bt->pager, nroot);
+    return rt;
+}
+
+
+/* Find an entry in a hash index
+ *
+ * A key can have several entries (see chidb_Hash_insert). This finds the
+ * one with the smallest KeyPk, and chidb_Hash_findNext the others.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Directory page of the hash index
+ * - keyIdx: Key to look for
+ * - keyPk: Out parameter. Smallest KeyPk of the entries with key keyIdx.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: No entry with the given key was found
+ * - CHIDB_ECORRUPT: nroot is not the directory of a hash index
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Hash_find(BTree *bt, npage_t nroot, chidb_key_t keyIdx, chidb_key_t *keyPk)
+{
+    return chidb_Hash_findFrom(bt, nroot, keyIdx, 0, keyPk);
+}
+
+
+/* Find the next entry of a key in a hash index
+ *
+ * The entries of a key are in no particular order in their bucket, so
+ * they are visited by increasing KeyPk: this finds the entry that comes
+ * after (keyIdx, keyPk), even if that entry has been removed or others
+ * have been added since it was found.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Directory page of the hash index
+ * - keyIdx: Key of the entries
+ * - keyPk: KeyPk of the current entry
+ * - next: Out parameter. Smallest KeyPk above keyPk of the entries with
+ *         key keyIdx.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: The key has no entry after (keyIdx, keyPk)
+ * - CHIDB_ECORRUPT: nroot is not the directory of a hash index
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Hash_findNext(BTree *bt, npage_t nroot, chidb_key_t keyIdx, chidb_key_t keyPk, chidb_key_t *next)
+{
+    if(keyPk == UINT32_MAX)
+        return CHIDB_ENOTFOUND;
+    return chidb_Hash_findFrom(bt, nroot, keyIdx, keyPk + 1, next);
+}
+
+
+/* Adds an entry to a bucket page that has room for it */
+static int chidb_Hash_addEntry(BTree *bt, npage_t npage, chidb_key_t keyIdx, chidb_key_t keyPk)
+{
+    MemPage *page;
+    int rt;
+
+    if(rt = chidb_Pager_readPage(bt->pager, npage, &page)) { return rt; }
+
+    uint16_t n_entries = get2byte(page->data + HASHBKT_NENTRIES_OFFSET);
+    put4byte(HASHBKT_ENTRY(page->data, n_entries), keyIdx);
+    put4byte(HASHBKT_ENTRY(page->data, n_entries) + 4, keyPk);
+    put2byte(page->data + HASHBKT_NENTRIES_OFFSET, n_entries + 1);
+
+    rt = chidb_Pager_writePage(bt->pager, page);
+    chidb_Pager_releaseMemPage(bt->pager, page);
+    return rt;
+}
+
+
+/* Chains an overflow page with a single entry to the end of a bucket */
+static int chidb_Hash_addOverflow(BTree *bt, HashChain *chain, chidb_key_t keyIdx, chidb_key_t keyPk)
+{
+    MemPage *last;
+    npage_t noverflow;
+    int rt;
+
+    if(rt = chidb_Hash_newBucket(bt, chain->depth, &noverflow)) { return rt; }
+    if(rt = chidb_Hash_addEntry(bt, noverflow, keyIdx, keyPk)) { return rt; }
+
+    if(rt = chidb_Pager_readPage(bt->pager, chain->last_page, &last)) { return rt; }
+    put4byte(last->data + HASHBKT_OVERFLOW_OFFSET, noverflow);
+    rt = chidb_Pager_writePage(bt->pager, last);
+    chidb_Pager_releaseMemPage(bt->pager, last);
+    return rt;
+}
+
+
+/* Splits a (full, single page) bucket in two
+ *
+ * The entries of the bucket whose hash has bit l set, where l is the local
+ * depth of the bucket, are moved to a new bucket, and the directory
+ * entries that point to the bucket and have that bit set are changed to
+ * point to the new bucket. Both buckets get local depth l+1. If l is
+ * the global depth, the directory is doubled first.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Directory page (latched by the caller in exclusive mode)
+ * - nbucket: Page of the bucket
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+static int chidb_Hash_split(BTree *bt, npage_t nroot, npage_t nbucket)
+{
+    MemPage *dir, *old, *new;
+    npage_t nnew;
+    uint8_t depth, local;
+    int rt;
+
+    if(rt = chidb_Pager_readPage(bt->pager, nroot, &dir)) { return rt; }
+    if(rt = chidb_Pager_readPage(bt->pager, nbucket, &old))
+    {
+        chidb_Pager_releaseMemPage(bt->pager, dir);
+        return rt;
+    }
+    depth = dir->data[HASHDIR_DEPTH_OFFSET];
+    local = old->data[HASHBKT_DEPTH_OFFSET];
+
+    if(rt = chidb_Hash_newBucket(bt, local + 1, &nnew)) { goto done; }
+    if(rt = chidb_Pager_readPage(bt->pager, nnew, &new)) { goto done; }
+
+    /* Double the directory: the new half points to the same buckets */
+    if(local == depth)
+    {
+        memcpy(HASHDIR_BUCKET(dir->data, 1u << depth), HASHDIR_BUCKET(dir->data, 0), 4 * (1u << depth));
+        dir->data[HASHDIR_DEPTH_OFFSET] = ++depth;
+    }
+
+    /* Move the entries whose hash has bit "local" set */
+    uint16_t n_entries = get2byte(old->data + HASHBKT_NENTRIES_OFFSET);
+    uint16_t n_old = 0, n_new = 0;
+    uint32_t bucket_hash = 0;
+    for(uint16_t i = 0; i < n_entries; i++)
+    {
+        uint8_t *entry = HASHBKT_ENTRY(old->data, i);
+        uint32_t hash = chidb_Hash_hash(get4byte(entry));
+
+        bucket_hash = hash & HASH_MASK(local);
+        if(hash & (1u << local))
+            memcpy(HASHBKT_ENTRY(new->data, n_new++), entry, HASHBKT_ENTRY_SIZE);
+        else
+            memmove(HASHBKT_ENTRY(old->data, n_old++), entry, HASHBKT_ENTRY_SIZE);
+    }
+    put2byte(old->data + HASHBKT_NENTRIES_OFFSET, n_old);
+    put2byte(new->data + HASHBKT_NENTRIES_OFFSET, n_new);
+    old->data[HASHBKT_DEPTH_OFFSET] = local + 1;
+
+    /* Every directory entry that agrees with the bucket on the low "local"
+     * bits pointed to it, and those with bit "local" set now point to the
+     * new bucket */
+    for(uint32_t i = bucket_hash | (1u << local); i < (1u << depth); i += (2u << local))
+        put4byte(HASHDIR_BUCKET(dir->data, i), nnew);
+
+    if(!(rt = chidb_Pager_writePage(bt->pager, new)) &&
+       !(rt = chidb_Pager_writePage(bt->pager, old)))
+        rt = chidb_Pager_writePage(bt->pager, dir);
+    chidb_Pager_releaseMemPage(bt->pager, new);
+
+done:
+    chidb_Pager_releaseMemPage(bt->pager, old);
+    chidb_Pager_releaseMemPage(bt->pager, dir);
+    return rt;
+}
+
+
+/* Insert an entry into a hash index
+ *
+ * Adds the (keyIdx, keyPk) entry to the bucket of keyIdx. As in a B-Tree
+ * index, a key can have many entries, as long as their KeyPks differ. If
+ * the bucket is full, it is split (see chidb_Hash_split) and the insertion
+ * is tried again; if it cannot be split, or if splitting it would not
+ * separate its entries (they all have the hash of keyIdx), an overflow
+ * page is added to it.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Directory page of the hash index
+ * - keyIdx: See definition of hash indexes above
+ * - keyPk: See definition of hash indexes above
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EDUPLICATE: The (keyIdx, keyPk) entry already exists
+ * - CHIDB_ECORRUPT: nroot is not the directory of a hash index
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Hash_insert(BTree *bt, npage_t nroot, chidb_key_t keyIdx, chidb_key_t keyPk)
+{
+    uint32_t hash = chidb_Hash_hash(keyIdx);
+    uint32_t max_depth = chidb_Hash_maxDepth(bt->pager->page_size);
+    npage_t nbucket;
+    chidb_key_t found;
+    HashChain chain;
+    int rt;
+
+    if(rt = chidb_Pager_latch(bt->pager, nroot, LATCH_EXCLUSIVE)) { return rt; }
+
+    for(;;)
+    {
+        if(rt = chidb_Hash_getBucket(bt, nroot, hash, &nbucket)) { break; }
+
+        rt = chidb_Hash_searchBucket(bt, nbucket, keyIdx, keyPk, &found, &chain);
+        if(rt == CHIDB_OK && found == keyPk)
+        {
+            rt = CHIDB_EDUPLICATE;
+            break;
+        }
+        if(rt != CHIDB_OK && rt != CHIDB_ENOTFOUND) { break; }
+
+        if(chain.room_page != 0)
+        {
+            rt = chidb_Hash_addEntry(bt, chain.room_page, keyIdx, keyPk);
+            break;
+        }
+
+        /* Buckets only get overflow pages once they cannot be split, or
+         * once they are full of entries of keys with the same hash */
+        if(chain.n_pages > 1 || chain.depth >= max_depth || chain.same_hash)
+        {
+            rt = chidb_Hash_addOverflow(bt, &chain, keyIdx, keyPk);
+            break;
+        }
+
+        if(rt = chidb_Hash_split(bt, nroot, nbucket)) { break; }
+    }
+
+    chidb_Pager_unlatch(bt->pager, nroot);
+    return rt;
+}
+
+
+/* Calls f on every bucket of a hash index, once, along with its first page */
+typedef int (*fHashBucketVisitor)(BTree *bt, npage_t nbucket, void *arg);
+
+static int chidb_Hash_forEachBucket(BTree *bt, npage_t nroot, fHashBucketVisitor f, void *arg)
+{
+    MemPage *dir, *bucket;
+    uint8_t depth;
+    int rt = CHIDB_OK;
+
+    if(rt = chidb_Pager_readPage(bt->pager, nroot, &dir)) { return rt; }
+    if(dir->data[0] != PGTYPE_HASH_DIRECTORY)
+    {
+        chidb_Pager_releaseMemPage(bt->pager, dir);
+        return CHIDB_ECORRUPT;
+    }
+    depth = dir->data[HASHDIR_DEPTH_OFFSET];
+
+    /* A bucket with local depth l is pointed to by the directory entries
+     * that agree on the low l bits, the first of which is below 2^l */
+    for(uint32_t i = 0; !rt && i < (1u << depth); i++)
+    {
+        npage_t nbucket = get4byte(HASHDIR_BUCKET(dir->data, i));
+
+        if(rt = chidb_Pager_readPage(bt->pager, nbucket, &bucket)) { break; }
+        bool first = i < (1u << bucket->data[HASHBKT_DEPTH_OFFSET]);
+        chidb_Pager_releaseMemPage(bt->pager, bucket);
+
+        if(first)
+            rt = f(bt, nbucket, arg);
+    }
+
+    chidb_Pager_releaseMemPage(bt->pager, dir);
+    return rt;
+}
+
+
+/* Where chidb_Hash_rebuild inserts the entries it reads */
+typedef struct HashRebuild
+{
+    BTree *dst;
+    npage_t nroot;
+} HashRebuild;
+
+static int chidb_Hash_rebuildBucket(BTree *bt, npage_t nbucket, void *arg)
+{
+    HashRebuild *rb = arg;
+    npage_t npage = nbucket;
+    MemPage *page;
+    int rt = CHIDB_OK;
+
+    while(!rt && npage != HASH_NO_OVERFLOW)
+    {
+        if(rt = chidb_Pager_readPage(bt->pager, npage, &page)) { return rt; }
+
+        uint16_t n_entries = get2byte(page->data + HASHBKT_NENTRIES_OFFSET);
+        for(uint16_t i = 0; !rt && i < n_entries; i++)
+            rt = chidb_Hash_insert(rb->dst, rb->nroot,
+                                   get4byte(HASHBKT_ENTRY(page->data, i)),
+                                   get4byte(HASHBKT_ENTRY(page->data, i) + 4));
+
+        npage = get4byte(page->data + HASHBKT_OVERFLOW_OFFSET);
+        chidb_Pager_releaseMemPage(bt->pager, page);
+    }
+    return rt;
+}
+
+
+/* Rebuild a hash index
+ *
+ * Creates a new hash index, in the same or another B-Tree file, with the
+ * entries of a hash index. Since every bucket of the new index is split
+ * only as much as its entries need, the new index is as small as the old
+ * one or smaller.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Directory page of the hash index to rebuild
+ * - dst: B-Tree file where the new hash index is built (might be bt)
+ * - new_nroot: Out parameter. Directory page of the new hash index.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECORRUPT: nroot is not the directory of a hash index
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Hash_rebuild(BTree *bt, npage_t nroot, BTree *dst, npage_t *new_nroot)
+{
+    HashRebuild rb;
+    int rt;
+
+    if(rt = chidb_Hash_create(dst, new_nroot)) { return rt; }
+
+    rb.dst = dst;
+    rb.nroot = *new_nroot;
+    return chidb_Hash_forEachBucket(bt, nroot, chidb_Hash_rebuildBucket, &rb);
+}
+
+
+static int chidb_Hash_analyzeBucket(BTree *bt, npage_t nbucket, void *arg)
+{
+    HashStats *stats = arg;
+    uint32_t capacity = HASHBKT_CAPACITY(bt->pager->page_size);
+    uint32_t n_pages = 0;
+    npage_t npage = nbucket;
+    MemPage *page;
+    int rt;
+
+    while(npage != HASH_NO_OVERFLOW)
+    {
+        if(rt = chidb_Pager_readPage(bt->pager, npage, &page)) { return rt; }
+
+        uint16_t n_entries = get2byte(page->data + HASHBKT_NENTRIES_OFFSET);
+        stats->n_entries += n_entries;
+        stats->avg_fill += (double) n_entries / capacity;
+        n_pages++;
+
+        npage = get4byte(page->data + HASHBKT_OVERFLOW_OFFSET);
+        chidb_Pager_releaseMemPage(bt->pager, page);
+    }
+
+    stats->n_buckets++;
+    stats->n_overflow += n_pages - 1;
+    if(n_pages > stats->max_chain)
+        stats->max_chain = n_pages;
+    return CHIDB_OK;
+}
+
+
+/* Gather statistics about a hash index
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Directory page of the hash index
+ * - stats: Out parameter. Statistics of the hash index.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECORRUPT: nroot is not the directory of a hash index
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Hash_analyze(BTree *bt, npage_t nroot, HashStats *stats)
+{
+    MemPage *dir;
+    int rt;
+
+    memset(stats, 0, sizeof(HashStats));
+
+    if(rt = chidb_Pager_readPage(bt->pager, nroot, &dir)) { return rt; }
+    stats->depth = dir->data[HASHDIR_DEPTH_OFFSET];
+    stats->max_depth = chidb_Hash_maxDepth(bt->pager->page_size);
+    chidb_Pager_releaseMemPage(bt->pager, dir);
+
+    if(rt = chidb_Hash_forEachBucket(bt, nroot, chidb_Hash_analyzeBucket, stats)) { return rt; }
+    if(stats->n_buckets > 0)
+        stats->avg_fill /= stats->n_buckets + stats->n_overflow;
+
+    return CHIDB_OK;
+}
@@ -0,0 +1,677 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ * This module contains the write buffers of table B-Trees. When a table is
+ * buffered, the rows inserted into it go to an in-memory skiplist sorted by
+ * key (its memtable) instead of its B-Tree, and to a log file, so that
+ * they survive the process dying before they reach the B-Tree. Once the
+ * buffered rows take MEMTABLE_FLUSH_BYTES, every memtable of the file is
+ * merged into its B-Tree with chidb_Btree_insertBatch, which fills each
+ * leaf in a single write, and the log is emptied.
+ *
+ * Lookups (chidb_Btree_find) and DBM cursors look at the memtable of a
+ * table as well as its B-Tree, so buffered rows can be read right away. A
+ * key is either in the memtable or in the B-Tree, never in both once a
+ * flush is over; readers that run during a flush may see a row in both,
+ * and must treat them as a single row.
+ *
+ * When a B-Tree file is opened, the rows of a log left by a process that
+ * died are inserted into their B-Trees before anything else happens.
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "chidbInt.h"
+#include "memtable.h"
+#include "util.h"
+
+
+/* Checksum of a log record (FNV-1a) */
+static uint32_t chidb_Memtable_checksum(const uint8_t *header, const uint8_t *data, uint16_t size)
+{
+    uint32_t h = 2166136261u;
+
+    for(int i = 0; i < WALREC_CHECKSUM_OFFSET; i++)
+        h = (h ^ header[i]) * 16777619u;
+    for(uint16_t i = 0; i < size; i++)
+        h = (h ^ data[i]) * 16777619u;
+    return h;
+}
+
+/* Insert the rows of a log into their B-Trees. Records that do not point
+ * to the root of a table B-Tree are skipped, and rows that are already in
+ * their B-Tree (because the process died between a flush and the end of
+ * the log) are not an error. */
+static int chidb_Memtable_replay(BTree *bt, FILE *f)
+{
+    uint8_t header[WALREC_HEADER_SIZE];
+    uint8_t *data;
+    int rt = CHIDB_OK;
+
+    while(!rt && fread(header, WALREC_HEADER_SIZE, 1, f) == 1)
+    {
+        npage_t nroot = get4byte(header + WALREC_NROOT_OFFSET);
+        chidb_key_t key = get4byte(header + WALREC_KEY_OFFSET);
+        uint16_t size = get2byte(header + WALREC_SIZE_OFFSET);
+        BTreeNode *btn;
+
+        if((data = malloc(size ? size : 1)) == NULL)
+            return CHIDB_ENOMEM;
+        if(fread(data, 1, size, f) != size ||
+           chidb_Memtable_checksum(header, data, size) != get4byte(header + WALREC_CHECKSUM_OFFSET))
+        {
+            free(data);
+            break;
+        }
+
+        if(nroot >= 1 && nroot <= bt->pager->n_pages && !(rt = chidb_Btree_getNodeByPage(bt, nroot, &btn)))
+        {
+            bool table = btn->type == PGTYPE_TABLE_LEAF || btn->type == PGTYPE_TABLE_INTERNAL;
+            chidb_Btree_freeMemNode(bt, btn);
+            if(table && (rt = chidb_Btree_insertInTable(bt, nroot, key, data, size)) == CHIDB_EDUPLICATE)
+                rt = CHIDB_OK;
+        }
+        free(data);
+    }
+
+    return rt;
+}
+
+
+/* Set up the write buffers of a B-Tree file
+ *
+ * No table is buffered at first (see chidb_Memtable_enable). If the file
+ * has a log, its rows are inserted into their B-Trees, and the log is
+ * removed.
+ *
+ * Parameters
+ * - bt: B-Tree file, which must have been opened with filename
+ * - filename: Database file
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Memtable_open(BTree *bt, const char *filename)
+{
+    WriteBuffer *wbuf;
+    FILE *f;
+    int rt = CHIDB_OK;
+
+    if((wbuf = calloc(1, sizeof(WriteBuffer))) == NULL)
+        return CHIDB_ENOMEM;
+    if((wbuf->wal_name = malloc(strlen(filename) + sizeof(MEMTABLE_WAL_SUFFIX))) == NULL)
+    {
+        free(wbuf);
+        return CHIDB_ENOMEM;
+    }
+    strcpy(wbuf->wal_name, filename);
+    strcat(wbuf->wal_name, MEMTABLE_WAL_SUFFIX);
+    pthread_mutex_init(&wbuf->lock, NULL);
+    wbuf->seed = 2463534242u;
+    bt->wbuf = wbuf;
+
+    if((f = fopen(wbuf->wal_name, "rb")) != NULL)
+    {
+        rt = chidb_Memtable_replay(bt, f);
+        fclose(f);
+        if(!rt && unlink(wbuf->wal_name))
+            rt = CHIDB_EIO;
+    }
+
+    return rt;
+}
+
+
+/* Free every entry of a memtable, leaving it empty */
+static void chidb_Memtable_clear(Memtable *mt)
+{
+    MemtableEntry *e = mt->head[0], *next;
+
+    while(e != NULL)
+    {
+        next = e->next[0];
+        free(e);
+        e = next;
+    }
+    memset(mt->head, 0, sizeof(mt->head));
+    mt->height = 1;
+    __atomic_store_n(&mt->n_entries, 0, __ATOMIC_RELEASE);
+}
+
+/* Merge a memtable into its B-Tree. The caller must hold the lock of the
+ * write buffers. */
+static int chidb_Memtable_flushOne(BTree *bt, Memtable *mt)
+{
+    BTreeCell *cells;
+    MemtableEntry *e;
+    size_t n = 0;
+    int rt;
+
+    if(mt->n_entries == 0)
+        return CHIDB_OK;
+
+    if((cells = malloc(mt->n_entries * sizeof(BTreeCell))) == NULL)
+        return CHIDB_ENOMEM;
+
+    for(e = mt->head[0]; e != NULL; e = e->next[0], n++)
+    {
+        cells[n].type = PGTYPE_TABLE_LEAF;
+        cells[n].key = e->key;
+        cells[n].fields.tableLeaf.data_size = e->size;
+        cells[n].fields.tableLeaf.data = e->data;
+    }
+
+    if(!(rt = chidb_Btree_insertBatch(bt, mt->nroot, cells, n)))
+        chidb_Memtable_clear(mt);
+
+    free(cells);
+    return rt;
+}
+
+/* chidb_Memtable_flush, for a caller that holds the lock */
+static int chidb_Memtable_flushLocked(BTree *bt)
+{
+    WriteBuffer *wbuf = bt->wbuf;
+    int rt;
+
+    for(Memtable *mt = wbuf->tables; mt != NULL; mt = mt->next)
+    {
+        if(rt = chidb_Memtable_flushOne(bt, mt)) { return rt; }
+    }
+    wbuf->n_bytes = 0;
+
+    /* Every logged row is in its B-Tree now */
+    if(wbuf->wal != NULL)
+    {
+        if(fflush(wbuf->wal) || ftruncate(fileno(wbuf->wal), 0))
+            return CHIDB_EIO;
+        rewind(wbuf->wal);
+    }
+    return CHIDB_OK;
+}
+
+
+/* Merge the write buffers into their B-Trees
+ *
+ * Inserts the rows of every memtable of a B-Tree file into its B-Tree,
+ * in key order, and empties the log. This is done whenever the buffered
+ * rows take MEMTABLE_FLUSH_BYTES, and must be done before reading the
+ * B-Trees of the file by other means than chidb_Btree_find and DBM
+ * cursors (for example, before copying or analyzing them).
+ *
+ * Parameters
+ * - bt: B-Tree file
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Memtable_flush(BTree *bt)
+{
+    int rt;
+
+    if(bt->wbuf == NULL)
+        return CHIDB_OK;
+
+    pthread_mutex_lock(&bt->wbuf->lock);
+    rt = chidb_Memtable_flushLocked(bt);
+    pthread_mutex_unlock(&bt->wbuf->lock);
+    return rt;
+}
+
+
+/* Count the rows of a table, buffered or not
+ *
+ * Adds the rows in the memtable of the table to those in its B-Tree
+ * (see chidb_Btree_count), without flushing anything. A row is never in
+ * both, since chidb_Memtable_insert checks the B-Tree for its key, and
+ * the lock keeps a flush from moving rows from one to the other while
+ * they are counted.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root of the table B-Tree
+ * - count: Out parameter. Number of rows.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Memtable_count(BTree *bt, npage_t nroot, uint32_t *count)
+{
+    Memtable *mt = chidb_Memtable_get(bt, nroot);
+    int rt;
+
+    if(mt == NULL)
+        return chidb_Btree_count(bt, nroot, count);
+
+    pthread_mutex_lock(&bt->wbuf->lock);
+    if(!(rt = chidb_Btree_count(bt, nroot, count)))
+        *count += mt->n_entries;
+    pthread_mutex_unlock(&bt->wbuf->lock);
+    return rt;
+}
+
+
+/* Stop buffering every table of a B-Tree file
+ *
+ * The memtables are flushed (see chidb_Memtable_flush) and freed, and
+ * rows go straight to their B-Trees again. This must be done whenever the
+ * B-Trees of a file are moved to other root pages, and must not run
+ * concurrently with other operations on the file.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Memtable_freeAll(BTree *bt)
+{
+    WriteBuffer *wbuf = bt->wbuf;
+    int rt;
+
+    if(rt = chidb_Memtable_flush(bt)) { return rt; }
+    if(wbuf == NULL)
+        return CHIDB_OK;
+
+    while(wbuf->tables != NULL)
+    {
+        Memtable *next = wbuf->tables->next;
+        chidb_Memtable_clear(wbuf->tables);
+        free(wbuf->tables);
+        wbuf->tables = next;
+    }
+    return CHIDB_OK;
+}
+
+
+/* Tear down the write buffers of a B-Tree file
+ *
+ * The memtables are flushed and freed, and the log is removed. If the
+ * flush fails, the log is kept, so that its rows are inserted the next
+ * time the file is opened.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Memtable_close(BTree *bt)
+{
+    WriteBuffer *wbuf = bt->wbuf;
+    int rt;
+
+    if(wbuf == NULL)
+        return CHIDB_OK;
+
+    rt = chidb_Memtable_freeAll(bt);
+    if(wbuf->wal != NULL)
+    {
+        fclose(wbuf->wal);
+        if(!rt)
+            unlink(wbuf->wal_name);
+    }
+
+    /* Free whatever a failed flush left behind */
+    while(wbuf->tables != NULL)
+    {
+        Memtable *next = wbuf->tables->next;
+        chidb_Memtable_clear(wbuf->tables);
+        free(wbuf->tables);
+        wbuf->tables = next;
+    }
+    pthread_mutex_destroy(&wbuf->lock);
+    free(wbuf->wal_name);
+    free(wbuf);
+    bt->wbuf = NULL;
+    return rt;
+}
+
+
+/* Get the memtable of a table B-Tree
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root of the B-Tree
+ *
+ * Return
+ * - The memtable of the B-Tree, or NULL if the table is not buffered
+ */
+Memtable *chidb_Memtable_get(BTree *bt, npage_t nroot)
+{
+    if(bt->wbuf == NULL)
+        return NULL;
+
+    for(Memtable *mt = bt->wbuf->tables; mt != NULL; mt = mt->next)
+    {
+        if(mt->nroot == nroot)
+            return mt;
+    }
+    return NULL;
+}
+
+
+/* Buffer the rows inserted into a table
+ *
+ * From now on, chidb_Btree_insert puts the rows inserted into the table
+ * B-Tree in its memtable (see chidb_Memtable_insert). Index B-Trees cannot
+ * be buffered. Like chidb_Memtable_freeAll, this must not run concurrently
+ * with other operations on the file.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root of the table B-Tree
+ *
+ * Return
+ * - CHIDB_OK: Operation successful (also if the table was already buffered)
+ * - CHIDB_EVALIDEARG: The B-Tree is not a table B-Tree
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Memtable_enable(BTree *bt, npage_t nroot)
+{
+    BTreeNode *btn;
+    Memtable *mt;
+    uint8_t type;
+    int rt;
+
+    if(bt->wbuf == NULL)
+        return CHIDB_EVALIDEARG;
+    if(chidb_Memtable_get(bt, nroot) != NULL)
+        return CHIDB_OK;
+
+    if(rt = chidb_Btree_getNodeByPage(bt, nroot, &btn)) { return rt; }
+    type = btn->type;
+    chidb_Btree_freeMemNode(bt, btn);
+    if(type != PGTYPE_TABLE_LEAF && type != PGTYPE_TABLE_INTERNAL)
+        return CHIDB_EVALIDEARG;
+
+    if((mt = calloc(1, sizeof(Memtable))) == NULL)
+        return CHIDB_ENOMEM;
+    mt->nroot = nroot;
+    mt->height = 1;
+    mt->next = bt->wbuf->tables;
+    bt->wbuf->tables = mt;
+    return CHIDB_OK;
+}
+
+
+/* Find, at each level of a memtable, the last entry with a key lower than
+ * key (NULL if there is none). Returns the one found at level 0. */
+static MemtableEntry *chidb_Memtable_lower(Memtable *mt, chidb_key_t key, MemtableEntry **prev)
+{
+    MemtableEntry *e = NULL, *next;
+
+    for(int level = mt->height - 1; level >= 0; level--)
+    {
+        next = e != NULL ? e->next[level] : mt->head[level];
+        while(next != NULL && next->key < key)
+        {
+            e = next;
+            next = e->next[level];
+        }
+        if(prev != NULL)
+            prev[level] = e;
+    }
+    return e;
+}
+
+#define MEMTABLE_NEXT(mt, e) ((e) != NULL ? (e)->next[0] : (mt)->head[0])
+
+/* Height of the tower of a new entry: each level has a 1/4 chance of
+ * having one more above it (xorshift32) */
+static int chidb_Memtable_height(WriteBuffer *wbuf)
+{
+    int height = 1;
+
+    for(;;)
+    {
+        uint32_t x = wbuf->seed;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        wbuf->seed = x;
+        if(height == MEMTABLE_MAX_HEIGHT || (x & 3))
+            return height;
+        height++;
+    }
+}
+
+/* Append a row to the log. The record is flushed to the operating system,
+ * so that the row survives the process dying. */
+static int chidb_Memtable_log(WriteBuffer *wbuf, npage_t nroot, BTreeCell *btc)
+{
+    uint8_t header[WALREC_HEADER_SIZE];
+    uint16_t size = btc->fields.tableLeaf.data_size;
+
+    if(wbuf->wal == NULL && (wbuf->wal = fopen(wbuf->wal_name, "ab")) == NULL)
+        return CHIDB_EIO;
+
+    put4byte(header + WALREC_NROOT_OFFSET, nroot);
+    put4byte(header + WALREC_KEY_OFFSET, btc->key);
+    put2byte(header + WALREC_SIZE_OFFSET, size);
+    put4byte(header + WALREC_CHECKSUM_OFFSET,
+             chidb_Memtable_checksum(header, btc->fields.tableLeaf.data, size));
+
+    if(fwrite(header, WALREC_HEADER_SIZE, 1, wbuf->wal) != 1 ||
+       fwrite(btc->fields.tableLeaf.data, 1, size, wbuf->wal) != size ||
+       fflush(wbuf->wal))
+        return CHIDB_EIO;
+    return CHIDB_OK;
+}
+
+
+/* Insert a row into the memtable of a table
+ *
+ * The row is logged and added to the memtable. Since keys must be unique,
+ * the B-Tree is searched for the key first, unless its Bloom filter rules
+ * the key out (the key is only added to the filter when the row is
+ * flushed, since lookups check the memtable anyway). If the
+ * buffered rows take MEMTABLE_FLUSH_BYTES after this row is added, every
+ * memtable is flushed (see chidb_Memtable_flush).
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root of the table B-Tree, which must be
+ *          buffered (see chidb_Memtable_enable)
+ * - btc: Table leaf cell to insert
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EDUPLICATE: An entry with that key already exists
+ * - CHIDB_EVALIDEARG: The table is not buffered, or btc is not a table
+ *                     leaf cell
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Memtable_insert(BTree *bt, npage_t nroot, BTreeCell *btc)
+{
+    WriteBuffer *wbuf = bt->wbuf;
+    Memtable *mt = chidb_Memtable_get(bt, nroot);
+    MemtableEntry *prev[MEMTABLE_MAX_HEIGHT], *e, *next;
+    uint16_t size = btc->fields.tableLeaf.data_size, found_size;
+    uint8_t *found_data;
+    int height, rt;
+
+    if(mt == NULL || btc->type != PGTYPE_TABLE_LEAF)
+        return CHIDB_EVALIDEARG;
+
+    pthread_mutex_lock(&wbuf->lock);
+
+    next = MEMTABLE_NEXT(mt, chidb_Memtable_lower(mt, btc->key, prev));
+    if(next != NULL && next->key == btc->key)
+    {
+        rt = CHIDB_EDUPLICATE;
+        goto out;
+    }
+
+    if(chidb_Btree_bloomMayContain(bt, nroot, btc->key))
+    {
+        rt = chidb_Btree_findInTree(bt, nroot, btc->key, &found_data, &found_size);
+        if(rt == CHIDB_OK)
+        {
+            free(found_data);
+            rt = CHIDB_EDUPLICATE;
+        }
+        if(rt != CHIDB_ENOTFOUND)
+            goto out;
+    }
+
+    if(rt = chidb_Memtable_log(wbuf, nroot, btc)) { goto out; }
+
+    height = chidb_Memtable_height(wbuf);
+    if((e = malloc(sizeof(MemtableEntry) + height * sizeof(MemtableEntry *) + size)) == NULL)
+    {
+        rt = CHIDB_ENOMEM;
+        goto out;
+    }
+    e->key = btc->key;
+    e->size = size;
+    e->data = (uint8_t *) &e->next[height];
+    memcpy(e->data, btc->fields.tableLeaf.data, size);
+
+    for(int level = mt->height; level < height; level++)
+        prev[level] = NULL;
+    if(height > mt->height)
+        mt->height = height;
+    for(int level = 0; level < height; level++)
+    {
+        MemtableEntry **link = prev[level] != NULL ? &prev[level]->next[level] : &mt->head[level];
+        e->next[level] = *link;
+        *link = e;
+    }
+    __atomic_store_n(&mt->n_entries, mt->n_entries + 1, __ATOMIC_RELEASE);
+    wbuf->n_bytes += sizeof(MemtableEntry) + height * sizeof(MemtableEntry *) + size;
+
+    rt = CHIDB_OK;
+    if(wbuf->n_bytes >= MEMTABLE_FLUSH_BYTES)
+        rt = chidb_Memtable_flushLocked(bt);
+
+out:
+    pthread_mutex_unlock(&wbuf->lock);
+    return rt;
+}
+
+
+/* Look up a row in the memtable of a table
+ *
+ * Finds the buffered row with the given key, or the first (or last) one
+ * after (or before) it, depending on seek.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root of the B-Tree
+ * - key: Key to look for
+ * - seek: MEMTABLE_EQ (the row with that key), MEMTABLE_GE (the first
+ *         row with a key greater than or equal to key), MEMTABLE_GT,
+ *         MEMTABLE_LE or MEMTABLE_LT
+ * - found: Out-parameter where the key of the row is stored (may be NULL)
+ * - data: Out-parameter where a copy of the data is stored (may be NULL,
+ *         otherwise it must be freed with free())
+ * - size: Out-parameter where the number of bytes of data is stored
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: There is no such row (always the case when the
+ *                    table is not buffered)
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_Memtable_seek(BTree *bt, npage_t nroot, chidb_key_t key, chidb_memtable_seek_t seek,
+                        chidb_key_t *found, uint8_t **data, uint16_t *size)
+{
+    Memtable *mt = chidb_Memtable_get(bt, nroot);
+    MemtableEntry *lt, *ge, *e;
+    int rt = CHIDB_OK;
+
+    if(mt == NULL || __atomic_load_n(&mt->n_entries, __ATOMIC_ACQUIRE) == 0)
+        return CHIDB_ENOTFOUND;
+
+    pthread_mutex_lock(&bt->wbuf->lock);
+
+    lt = chidb_Memtable_lower(mt, key, NULL);
+    ge = MEMTABLE_NEXT(mt, lt);
+    switch(seek)
+    {
+    case MEMTABLE_EQ:
+        e = ge != NULL && ge->key == key ? ge : NULL;
+        break;
+    case MEMTABLE_GE:
+        e = ge;
+        break;
+    case MEMTABLE_GT:
+        e = ge != NULL && ge->key == key ? ge->next[0] : ge;
+        break;
+    case MEMTABLE_LE:
+        e = ge != NULL && ge->key == key ? ge : lt;
+        break;
+    case MEMTABLE_LT:
+    default:
+        e = lt;
+        break;
+    }
+
+    if(e == NULL)
+        rt = CHIDB_ENOTFOUND;
+    else
+    {
+        if(found != NULL)
+            *found = e->key;
+        if(data != NULL)
+        {
+            if((*data = malloc(e->size ? e->size : 1)) == NULL)
+                rt = CHIDB_ENOMEM;
+            else
+            {
+                memcpy(*data, e->data, e->size);
+                *size = e->size;
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&bt->wbuf->lock);
+    return rt;
+}
@@ -0,0 +1,125 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Write buffer header file. See memtable.c for description of functions.
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef MEMTABLE_H_
+#define MEMTABLE_H_
+
+#include <pthread.h>
+#include "chidbInt.h"
+#include "btree.h"
+
+/* Tallest tower of a skiplist entry. With one entry in four going up each
+ * level, this is enough for millions of buffered rows per table. */
+#define MEMTABLE_MAX_HEIGHT (12)
+
+/* Buffered rows are merged into their B-Trees once the rows of all the
+ * buffered tables of a file take more than this many bytes */
+#define MEMTABLE_FLUSH_BYTES (256 * 1024)
+
+/* The log of a database file is a file with the same name, followed by
+ * this suffix */
+#define MEMTABLE_WAL_SUFFIX "-wal"
+
+/* Log record: the root page of the table, the key, the size of the data, a
+ * checksum of the header and the data, and then the data. A record with a
+ * wrong checksum (the end of a record that was being written when the
+ * process died) ends the log. */
+#define WALREC_NROOT_OFFSET (0)
+#define WALREC_KEY_OFFSET (4)
+#define WALREC_SIZE_OFFSET (8)
+#define WALREC_CHECKSUM_OFFSET (10)
+#define WALREC_HEADER_SIZE (14)
+
+typedef enum chidb_memtable_seek
+{
+    MEMTABLE_EQ,
+    MEMTABLE_GE,
+    MEMTABLE_GT,
+    MEMTABLE_LE,
+    MEMTABLE_LT
+} chidb_memtable_seek_t;
+
+typedef struct MemtableEntry MemtableEntry;
+typedef struct Memtable Memtable;
+
+/* A buffered row. The data is stored right after the tower of links. */
+struct MemtableEntry
+{
+    chidb_key_t key;
+    uint16_t size;
+    uint8_t *data;
+    MemtableEntry *next[];     /* next[i]: next entry at level i */
+};
+
+/* The write buffer of a table B-Tree: a skiplist of the rows inserted into
+ * the table that are not in the B-Tree yet, sorted by key */
+struct Memtable
+{
+    npage_t nroot;                              /* Root page of the B-Tree */
+    uint32_t n_entries;                         /* Number of buffered rows */
+    int height;                                 /* Tallest tower in the list */
+    MemtableEntry *head[MEMTABLE_MAX_HEIGHT];   /* First entry at each level */
+    Memtable *next;                             /* Buffer of another table */
+};
+
+/* The write buffers of a B-Tree file, and the log that makes the rows they
+ * hold durable. A single mutex protects all of them, since they are
+ * flushed together (see chidb_Memtable_flush). */
+struct WriteBuffer
+{
+    pthread_mutex_t lock;
+    Memtable *tables;          /* Buffers, one per buffered table */
+    size_t n_bytes;            /* Memory used by the buffered rows */
+    uint32_t seed;             /* State of the tower height generator */
+    char *wal_name;            /* Name of the log */
+    FILE *wal;                 /* The log (NULL until a row is buffered) */
+};
+
+int chidb_Memtable_open(BTree *bt, const char *filename);
+int chidb_Memtable_close(BTree *bt);
+int chidb_Memtable_enable(BTree *bt, npage_t nroot);
+Memtable *chidb_Memtable_get(BTree *bt, npage_t nroot);
+int chidb_Memtable_insert(BTree *bt, npage_t nroot, BTreeCell *btc);
+int chidb_Memtable_seek(BTree *bt, npage_t nroot, chidb_key_t key, chidb_memtable_seek_t seek,
+                        chidb_key_t *found, uint8_t **data, uint16_t *size);
+int chidb_Memtable_count(BTree *bt, npage_t nroot, uint32_t *count);
+int chidb_Memtable_flush(BTree *bt);
+int chidb_Memtable_freeAll(BTree *bt);
+
+#endif /*MEMTABLE_H_*/
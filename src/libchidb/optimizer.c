@@ -72,6 +72,7 @@ int chidb_stmt_pushing_sigma(chisql_statement_t *sql_stmt, chisql_statement_t *s
 {
     sql_stmt_opt->type = sql_stmt->type;
     sql_stmt_opt->explain = sql_stmt->explain;
+    sql_stmt_opt->nParams = sql_stmt->nParams;
     sql_stmt_opt->text = strdup(sql_stmt->text);
     sql_stmt_opt->stmt.select = malloc(sizeof(SRA_t));
 
@@ -80,8 +80,8 @@
  */
 int chidb_Pager_open(Pager **pager, const char *filename)
 {
-    *pager = malloc(sizeof(Pager));
-    if (pager == NULL)
+    *pager = calloc(1, sizeof(Pager));
+    if (*pager == NULL)
         return CHIDB_ENOMEM;
     (*pager)->f = fopen(filename, "r+");
 
@@ -135,9 +135,8 @@ int chidb_Pager_setPageSize(Pager *pager, uint16_t pagesize)
  */
 int chidb_Pager_readHeader(Pager *pager, uint8_t *header)
 {
-    int count;
-    count = fseek(pager->f, 0, SEEK_SET);
-    count = fread(header, 1, 100, pager->f);
+    ssize_t count;
+    count = pread(fileno(pager->f), header, 100, 0);
     if (count != 100)
         return CHIDB_NOHEADER;
     else
@@ -158,8 +157,9 @@ int chidb_Pager_readHeader(Pager *pager, uint8_t *header)
 int chidb_Pager_allocatePage(Pager *pager, npage_t *npage)
 {
     /* We simply increment the page number counter. readPage
-     * and writePage take care of the rest. */
-    *npage = ++pager->n_pages;
+     * and writePage take care of the rest. The increment is atomic,
+     * so threads inserting concurrently never get the same page. */
+    *npage = __atomic_add_fetch(&pager->n_pages, 1, __ATOMIC_SEQ_CST);
 
     return CHIDB_OK;
 }
@@ -186,9 +186,9 @@ int chidb_Pager_allocatePage(Pager *pager, npage_t *npage)
  */
 int	chidb_Pager_readPage(Pager *pager, npage_t npage, MemPage **page)
 {
-    if (npage > pager->n_pages || npage <= 0)
+    if (npage > __atomic_load_n(&pager->n_pages, __ATOMIC_SEQ_CST) || npage <= 0)
         return CHIDB_EPAGENO;
-    int n;
+    ssize_t n;
 
     *page = malloc(sizeof(MemPage));
     if (page == NULL)
@@ -197,14 +197,49 @@ int	chidb_Pager_readPage(Pager *pager, npage_t npage, MemPage **page)
     (*page)->data = calloc(pager->page_size, 1);
     if ((*page)->data == NULL)
         return CHIDB_ENOMEM;
-    fseek(pager->f, (npage - 1) * pager->page_size, SEEK_SET);
-    n = fread((*page)->data, 1, pager->page_size, pager->f);
+    n = pread(fileno(pager->f), (*page)->data, pager->page_size, (off_t) (npage - 1) * pager->page_size);
+    if (n < 0)
+        return CHIDB_EIO;
     chilog(TRACE, "Read %i bytes from page %i into memory [%x data: %x]", n, npage, *page, (*page)->data);
 
     return CHIDB_OK;
 }
 
 
+/* Read a page from file into an existing MemPage
+ *
+ * Same as chidb_Pager_readPage, but reuses the memory of a MemPage that
+ * was created by chidb_Pager_readPage, instead of allocating a new one.
+ * Whatever page it held before is overwritten.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - npage: Page number of page to read.
+ * - page: MemPage to read the page into
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EPAGENO: The page number is not valid
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Pager_readPageInto(Pager *pager, npage_t npage, MemPage *page)
+{
+    if (npage > __atomic_load_n(&pager->n_pages, __ATOMIC_SEQ_CST) || npage <= 0)
+        return CHIDB_EPAGENO;
+    ssize_t n;
+
+    page->npage = npage;
+    n = pread(fileno(pager->f), page->data, pager->page_size, (off_t) (npage - 1) * pager->page_size);
+    if (n < 0)
+        return CHIDB_EIO;
+    if (n < pager->page_size)
+        memset(page->data + n, 0, pager->page_size - n);
+    chilog(TRACE, "Read %i bytes from page %i into memory [%x data: %x]", n, npage, page, page->data);
+
+    return CHIDB_OK;
+}
+
+
 /* Write a page to file
  *
  * This page writes the in-memory copy of a page (stored in a MemPage
@@ -221,11 +256,12 @@ int	chidb_Pager_readPage(Pager *pager, npage_t npage, MemPage **page)
  */
 int	chidb_Pager_writePage(Pager *pager, MemPage *page)
 {
-    if (page->npage > pager->n_pages)
+    if (page->npage > __atomic_load_n(&pager->n_pages, __ATOMIC_SEQ_CST))
         return CHIDB_EPAGENO;
-    int n;
-    fseek(pager->f, (page->npage - 1) * pager->page_size, SEEK_SET);
-    n = fwrite(page->data, 1, pager->page_size, pager->f);
+    ssize_t n;
+    n = pwrite(fileno(pager->f), page->data, pager->page_size, (off_t) (page->npage - 1) * pager->page_size);
+    if (n != pager->page_size)
+        return CHIDB_EIO;
     chilog(TRACE, "Wrote %i bytes to page %i", n, page->npage);
     return CHIDB_OK;
 }
@@ -243,7 +279,7 @@ int	chidb_Pager_writePage(Pager *pager, MemPage *page)
  */
 int	chidb_Pager_releaseMemPage(Pager *pager, MemPage *page)
 {
-    if (page->npage > pager->n_pages)
+    if (page->npage > __atomic_load_n(&pager->n_pages, __ATOMIC_SEQ_CST))
         return CHIDB_EPAGENO;
 
     chilog(TRACE, "Releasing page %i from memory [%x data: %x]", page->npage, page, page->data);
@@ -273,6 +309,29 @@ int chidb_Pager_getRealDBSize(Pager *pager, npage_t *npages)
 }
 
 
+/* Changes the size of the file
+ *
+ * Discards the pages after page npages (or, if the file has fewer
+ * pages, adds empty pages at the end of the file).
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - npages: New number of pages of the file.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Pager_truncate(Pager *pager, npage_t npages)
+{
+    if (ftruncate(fileno(pager->f), (off_t) npages * pager->page_size))
+        return CHIDB_EIO;
+    __atomic_store_n(&pager->n_pages, npages, __ATOMIC_SEQ_CST);
+
+    return CHIDB_OK;
+}
+
+
 /* Closes a pager and frees up all resources used by the pager.
  *
  * Parameters
@@ -285,7 +344,235 @@ int chidb_Pager_getRealDBSize(Pager *pager, npage_t *npages)
 int chidb_Pager_close(Pager *pager)
 {
     fclose(pager->f);
+    for (int i = 0; i < PAGER_FRAMEDIR_SIZE; i++)
+    {
+        if (pager->frames[i] == NULL)
+            continue;
+        for (int j = 0; j < PAGER_FRAMEDIR_SIZE; j++)
+        {
+            PagerFrame *chunk = pager->frames[i][j];
+            if (chunk == NULL)
+                continue;
+            for (int k = 0; k < PAGER_FRAMECHUNK_SIZE; k++)
+                pthread_rwlock_destroy(&chunk[k].latch);
+            free(chunk);
+        }
+        free(pager->frames[i]);
+    }
     free(pager);
 
     return CHIDB_OK;
 }
+
+
+/* Returns the buffer frame of a page
+ *
+ * Frames are allocated on demand. Since several threads might try to
+ * allocate the same directory entry or chunk at the same time, they are
+ * installed with an atomic compare-and-swap, and the loser frees its copy.
+ * Looking up a frame that already exists takes no lock.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - npage: Page number.
+ * - frame: Out parameter. Frame of page npage.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EPAGENO: The page number is not valid
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+static int chidb_Pager_getFrame(Pager *pager, npage_t npage, PagerFrame **frame)
+{
+    if (npage <= 0)
+        return CHIDB_EPAGENO;
+
+    uint32_t dir = npage >> (PAGER_FRAMEDIR_BITS + PAGER_FRAMECHUNK_BITS);
+    uint32_t nchunk = (npage >> PAGER_FRAMECHUNK_BITS) & (PAGER_FRAMEDIR_SIZE - 1);
+    uint32_t nframe = npage & (PAGER_FRAMECHUNK_SIZE - 1);
+
+    PagerFrame **chunks = __atomic_load_n(&pager->frames[dir], __ATOMIC_ACQUIRE);
+    if (chunks == NULL)
+    {
+        PagerFrame **new_chunks = calloc(PAGER_FRAMEDIR_SIZE, sizeof(PagerFrame *));
+        if (new_chunks == NULL)
+            return CHIDB_ENOMEM;
+        if (__atomic_compare_exchange_n(&pager->frames[dir], &chunks, new_chunks,
+                                        false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            chunks = new_chunks;
+        else
+            free(new_chunks);
+    }
+
+    PagerFrame *chunk = __atomic_load_n(&chunks[nchunk], __ATOMIC_ACQUIRE);
+    if (chunk == NULL)
+    {
+        pthread_rwlockattr_t attr;
+        PagerFrame *new_chunk = malloc(PAGER_FRAMECHUNK_SIZE * sizeof(PagerFrame));
+        if (new_chunk == NULL)
+            return CHIDB_ENOMEM;
+
+        pthread_rwlockattr_init(&attr);
+#ifdef __GLIBC__
+        /* Do not let a stream of readers starve a thread that wants to
+         * split a node */
+        pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+        for (int k = 0; k < PAGER_FRAMECHUNK_SIZE; k++)
+        {
+            pthread_rwlock_init(&new_chunk[k].latch, &attr);
+            new_chunk[k].version = 0;
+        }
+        pthread_rwlockattr_destroy(&attr);
+
+        if (__atomic_compare_exchange_n(&chunks[nchunk], &chunk, new_chunk,
+                                        false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            chunk = new_chunk;
+        else
+        {
+            for (int k = 0; k < PAGER_FRAMECHUNK_SIZE; k++)
+                pthread_rwlock_destroy(&new_chunk[k].latch);
+            free(new_chunk);
+        }
+    }
+
+    *frame = &chunk[nframe];
+    return CHIDB_OK;
+}
+
+
+/* Latch a page
+ *
+ * Acquires the latch of a page's buffer frame, blocking until it is
+ * available. A shared latch can be held by several threads at once (to
+ * read the page), while an exclusive latch is held by a single thread (to
+ * modify it). Latches are not recursive: a thread must not latch a page
+ * it has already latched.
+ *
+ * Latches only synchronize threads that follow the same protocol; the
+ * other functions of the pager do not acquire them on their own.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - npage: Page number of the page to latch.
+ * - mode: LATCH_SHARED or LATCH_EXCLUSIVE
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EPAGENO: The page number is not valid
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_Pager_latch(Pager *pager, npage_t npage, chidb_latch_mode_t mode)
+{
+    int rt;
+    PagerFrame *frame;
+
+    if ((rt = chidb_Pager_getFrame(pager, npage, &frame)))
+        return rt;
+
+    if (mode == LATCH_EXCLUSIVE)
+    {
+        pthread_rwlock_wrlock(&frame->latch);
+        /* Make the version odd before the page is modified */
+        __atomic_store_n(&frame->version, frame->version + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+    }
+    else
+        pthread_rwlock_rdlock(&frame->latch);
+
+    return CHIDB_OK;
+}
+
+
+/* Release the latch of a page
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - npage: Page number of a page latched by this thread.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EPAGENO: The page number is not valid
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_Pager_unlatch(Pager *pager, npage_t npage)
+{
+    int rt;
+    PagerFrame *frame;
+
+    if ((rt = chidb_Pager_getFrame(pager, npage, &frame)))
+        return rt;
+
+    /* Only the holder of an exclusive latch can see an odd version */
+    uint64_t version = __atomic_load_n(&frame->version, __ATOMIC_RELAXED);
+    if (version & 1)
+        __atomic_store_n(&frame->version, version + 1, __ATOMIC_RELEASE);
+
+    pthread_rwlock_unlock(&frame->latch);
+    return CHIDB_OK;
+}
+
+
+/* Get the version of a page, to read it without latching it
+ *
+ * An optimistic reader gets the version of a page, reads the page, and
+ * then calls chidb_Pager_validate with that version. If the validation
+ * succeeds, nobody latched the page in exclusive mode in the meantime,
+ * and the page that was read is consistent. Otherwise, what was read must
+ * be discarded.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - npage: Page number of the page to read.
+ * - version: Out parameter. Version of the page.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ERESTART: The page is being modified
+ * - CHIDB_EPAGENO: The page number is not valid
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_Pager_readVersion(Pager *pager, npage_t npage, uint64_t *version)
+{
+    int rt;
+    PagerFrame *frame;
+
+    if ((rt = chidb_Pager_getFrame(pager, npage, &frame)))
+        return rt;
+
+    *version = __atomic_load_n(&frame->version, __ATOMIC_ACQUIRE);
+    if (*version & 1)
+        return CHIDB_ERESTART;
+
+    return CHIDB_OK;
+}
+
+
+/* Check that a page has not been modified since its version was read
+ * (see chidb_Pager_readVersion)
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - npage: Page number of the page that was read.
+ * - version: Version returned by chidb_Pager_readVersion.
+ *
+ * Return
+ * - CHIDB_OK: The page has not been modified
+ * - CHIDB_ERESTART: The page has been (or is being) modified
+ * - CHIDB_EPAGENO: The page number is not valid
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_Pager_validate(Pager *pager, npage_t npage, uint64_t version)
+{
+    int rt;
+    PagerFrame *frame;
+
+    if ((rt = chidb_Pager_getFrame(pager, npage, &frame)))
+        return rt;
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&frame->version, __ATOMIC_RELAXED) != version)
+        return CHIDB_ERESTART;
+
+    return CHIDB_OK;
+}
@@ -41,6 +41,7 @@
 #define PAGER_H_
 
 #include <stdio.h>
+#include <pthread.h>
 #include "chidbInt.h"
 
 struct MemPage
@@ -50,11 +51,42 @@ struct MemPage
 };
 typedef struct MemPage MemPage;
 
+/* Every page of the file has a buffer frame, which holds the latch used to
+ * synchronize threads that access the page concurrently. Frames are created
+ * the first time a page is latched, in chunks of PAGER_FRAMECHUNK_SIZE
+ * consecutive pages, and live as long as the Pager.
+ *
+ * The version of a frame is odd while the page is latched in exclusive
+ * mode, and is incremented again when that latch is released. Readers that
+ * do not latch the page use it to check that nobody modified the page
+ * while they were reading it (see chidb_Pager_readVersion). */
+struct PagerFrame
+{
+    pthread_rwlock_t latch;
+    uint64_t version;
+};
+typedef struct PagerFrame PagerFrame;
+
+typedef enum chidb_latch_mode
+{
+    LATCH_SHARED,
+    LATCH_EXCLUSIVE
+} chidb_latch_mode_t;
+
+/* Frames are found through a two-level directory indexed by page number:
+ * the top PAGER_FRAMEDIR_BITS bits select a directory entry, the next
+ * PAGER_FRAMEDIR_BITS bits select a chunk, and the rest select the frame. */
+#define PAGER_FRAMEDIR_BITS (11)
+#define PAGER_FRAMECHUNK_BITS (10)
+#define PAGER_FRAMEDIR_SIZE (1 << PAGER_FRAMEDIR_BITS)
+#define PAGER_FRAMECHUNK_SIZE (1 << PAGER_FRAMECHUNK_BITS)
+
 struct Pager
 {
     FILE *f;
     npage_t n_pages;
     uint16_t page_size;
+    PagerFrame **frames[PAGER_FRAMEDIR_SIZE];
 };
 typedef struct Pager Pager;
 
@@ -64,8 +96,14 @@ int chidb_Pager_readHeader(Pager *pager, uint8_t *header);
 int chidb_Pager_allocatePage(Pager *pager, npage_t *npage);
 int chidb_Pager_releaseMemPage(Pager *pager, MemPage *page);
 int	chidb_Pager_readPage(Pager *pager, npage_t page_num, MemPage **page);
+int chidb_Pager_readPageInto(Pager *pager, npage_t npage, MemPage *page);
 int chidb_Pager_writePage(Pager *pager, MemPage *page);
 int chidb_Pager_getRealDBSize(Pager *pager, npage_t *npages);
+int chidb_Pager_truncate(Pager *pager, npage_t npages);
+int chidb_Pager_latch(Pager *pager, npage_t npage, chidb_latch_mode_t mode);
+int chidb_Pager_unlatch(Pager *pager, npage_t npage);
+int chidb_Pager_readVersion(Pager *pager, npage_t npage, uint64_t *version);
+int chidb_Pager_validate(Pager *pager, npage_t npage, uint64_t version);
 int chidb_Pager_close(Pager *pager);
 
 #endif /*PAGER_H_*/
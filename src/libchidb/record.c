@@ -343,6 +343,58 @@ int chidb_DBRecord_unpack(DBRecord **dbr, uint8_t *raw)
 }
 
 
+/* Locate the fields of a raw binary database record without unpacking it
+ *
+ * Reads the header of a raw record, and returns the type and the position
+ * of each of its first fields. Unlike chidb_DBRecord_unpack, this does not
+ * allocate or copy anything, so it is cheap enough to call on every row of
+ * a scan (see chidb_dbm_cursor_fetch).
+ *
+ * Parameters
+ * - raw: Pointer to first byte of raw binary database record
+ * - nfields: Number of fields to locate (fewer if the record has fewer)
+ * - types: Out parameter. types[i] is the type of field i, as stored in
+ *          the header (see chidb_DBRecord_getType)
+ * - offsets: Out parameter. offsets[i] is the position of field i,
+ *            from the start of raw
+ * - n_found: Out parameter. Number of fields located.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_DBRecord_peek(uint8_t *raw, uint8_t nfields, uint32_t *types, uint32_t *offsets, uint8_t *n_found)
+{
+    uint8_t header_size = raw[0];
+    uint8_t header_pos = 1;
+    uint32_t offset = header_size;
+    uint8_t n = 0;
+
+    while(header_pos < header_size && n < nfields)
+    {
+        if (raw[header_pos] & 0x80)
+        {
+            getVarint32(&raw[header_pos], &types[n]);
+            header_pos += 4;
+        }
+        else
+        {
+            types[n] = raw[header_pos];
+            header_pos += 1;
+        }
+
+        offsets[n] = offset;
+        if (types[n] == SQL_INTEGER_1BYTE || types[n] == SQL_INTEGER_2BYTE || types[n] == SQL_INTEGER_4BYTE)
+            offset += types[n];
+        else if (types[n] >= SQL_TEXT && (types[n] - SQL_TEXT) % 2 == 0)
+            offset += (types[n] - SQL_TEXT) / 2;
+        n++;
+    }
+
+    *n_found = n;
+    return CHIDB_OK;
+}
+
+
 /* Create a raw binary database record from a DBRecord
  *
  * Parameters
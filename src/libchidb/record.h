@@ -74,6 +74,7 @@ int chidb_DBRecord_appendString(DBRecordBuffer *dbrb,  char *v);
 int chidb_DBRecord_finalize(DBRecordBuffer *dbrb, DBRecord **dbr);
 
 int chidb_DBRecord_unpack(DBRecord **dbr, uint8_t *);
+int chidb_DBRecord_peek(uint8_t *raw, uint8_t nfields, uint32_t *types, uint32_t *offsets, uint8_t *n_found);
 int chidb_DBRecord_pack(DBRecord *dbr, uint8_t **);
 
 int chidb_DBRecord_getType(DBRecord *dbr, uint8_t field);
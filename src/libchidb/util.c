@@ -444,6 +444,11 @@ void chisql_statement_free(chisql_statement_t *sql_stmt)
         {
             Delete_free(sql_stmt->stmt.delete);
         } break;
+
+        case STMT_VACUUM:
+        {
+            free(sql_stmt->stmt.vacuum);
+        } break;
     }
 
     free(sql_stmt->text);
@@ -487,4 +492,84 @@ int chidb_check_index_exist(list_t schema, char *table, char *colname)
 
     // 不存在返回0
     return 0;
-}
\ No newline at end of file
+}
+
+int chidb_check_index_hash(list_t schema, char *table, char *colname)
+{
+    list_iterator_start(&schema);
+
+    while (list_iterator_hasnext(&schema))
+    {
+        chidb_schema_t *item = list_iterator_next(&schema);
+        // 找到该列上的索引, 返回它是否为哈希索引
+        if (!strcmp(item->type, "index") && !strcmp(item->assoc, table) && !strcmp(item->stmt->stmt.create->index->column_name, colname))
+        {
+            int is_hash = item->stmt->stmt.create->index->method == INDEX_HASH;
+            list_iterator_stop(&schema);
+            return is_hash;
+        }
+    }
+    list_iterator_stop(&schema);
+
+    // 没有索引返回0
+    return 0;
+}
+
+StrList_t *chidb_get_index_include(list_t schema, char *table, char *colname)
+{
+    list_iterator_start(&schema);
+
+    while (list_iterator_hasnext(&schema))
+    {
+        chidb_schema_t *item = list_iterator_next(&schema);
+        // 找到该列上的索引, 返回它包含的列
+        if (!strcmp(item->type, "index") && !strcmp(item->assoc, table) && !strcmp(item->stmt->stmt.create->index->column_name, colname))
+        {
+            StrList_t *include = item->stmt->stmt.create->index->include;
+            list_iterator_stop(&schema);
+            return include;
+        }
+    }
+    list_iterator_stop(&schema);
+
+    // 没有索引返回NULL
+    return NULL;
+}
+
+/* Prints the statistics collected by chidb_Btree_analyze for the B-Tree
+ * of a table or index (type is "table" or "index") */
+void chidb_Btree_printStats(const char *type, const char *name, npage_t nroot, BTreeStats *stats)
+{
+    printf("%s %s (root page %u)\n", type, name, nroot);
+
+    printf("  depth: %u, pages: %u (", stats->depth, stats->n_pages);
+    for(uint32_t i = 0; i < stats->depth; i++)
+        printf(i == 0 ? "%u" : " / %u", stats->level_pages[i]);
+    printf(" per level), cells: %u\n", stats->n_cells);
+
+    printf("  fill: avg %.1f%%, min %.1f%%, %llu of %llu bytes used, %llu bytes fragmented\n",
+           stats->avg_fill * 100, stats->min_fill * 100,
+           (unsigned long long) stats->used_bytes,
+           (unsigned long long) stats->usable_bytes,
+           (unsigned long long) stats->fragmented_bytes);
+
+    /* Only the leaves after the first one can follow a previous leaf */
+    if(stats->n_leaves > 1)
+        printf("  leaf locality: %u of %u leaves are on the page after the previous leaf (%.1f%%)\n",
+               stats->n_leaves_in_order, stats->n_leaves - 1,
+               100.0 * stats->n_leaves_in_order / (stats->n_leaves - 1));
+
+    printf("  largest cell: %u bytes, cells over 1/4 page: %u\n",
+           stats->max_cell_size, stats->n_large_cells);
+}
+
+void chidb_Hash_printStats(const char *type, const char *name, npage_t nroot, HashStats *stats)
+{
+    printf("%s %s (hash, directory page %u)\n", type, name, nroot);
+
+    printf("  depth: %u (max %u), buckets: %u, overflow pages: %u, entries: %u\n",
+           stats->depth, stats->max_depth, stats->n_buckets, stats->n_overflow, stats->n_entries);
+
+    printf("  fill: avg %.1f%%, longest bucket: %u pages\n",
+           stats->avg_fill * 100, stats->max_chain);
+}
@@ -42,6 +42,7 @@
 
 #include "chidbInt.h"
 #include "btree.h"
+#include "hash.h"
 #include <chidb/utils.h>
 #include "../simclist/simclist.h"
 
@@ -66,6 +67,8 @@ typedef void (*fBTreeCellPrinter)(BTreeNode *, BTreeCell*);
 int chidb_Btree_print(BTree *bt, npage_t nroot, fBTreeCellPrinter printer, bool verbose);
 void chidb_BTree_recordPrinter(BTreeNode *btn, BTreeCell *btc);
 void chidb_BTree_stringPrinter(BTreeNode *btn, BTreeCell *btc);
+void chidb_Btree_printStats(const char *type, const char *name, npage_t nroot, BTreeStats *stats);
+void chidb_Hash_printStats(const char *type, const char *name, npage_t nroot, HashStats *stats);
 
 FILE *copy(const char *from, const char *to);
 
@@ -87,5 +90,9 @@ int index_of_column(list_t *columns, char *name);
 void chisql_statement_free(chisql_statement_t *sql_stmt);
 
 int chidb_check_index_exist(list_t schema, char *table, char *colname);
+// 判断表的某一列上的索引是否为哈希索引
+int chidb_check_index_hash(list_t schema, char *table, char *colname);
+// 获取表的某一列上的索引所包含(INCLUDE)的列, 没有则返回NULL
+StrList_t *chidb_get_index_include(list_t schema, char *table, char *colname);
 
 #endif /*UTIL_H_*/
@@ -154,12 +154,31 @@ Index_t *Index_makeUnique(Index_t *idx)
     return idx;
 }
 
+Index_t *Index_setMethod(Index_t *idx, enum IndexMethod method)
+{
+    idx->method = method;
+    return idx;
+}
+
+Index_t *Index_setInclude(Index_t *idx, StrList_t *include)
+{
+    idx->include = include;
+    return idx;
+}
+
 void Index_print(Index_t *idx)
 {
     printf("Index '%s' on %s (%s)", idx->column_name,
            idx->table_name,
            idx->column_name);
     if (idx->unique) printf(", unique");
+    if (idx->method == INDEX_HASH) printf(", using hash");
+    if (idx->include) {
+        printf(", including (");
+        for (StrList_t *inc = idx->include; inc; inc = inc->next)
+            printf("%s%s", inc->str, inc->next ? ", " : "");
+        printf(")");
+    }
     puts("");
 }
 
@@ -168,6 +187,7 @@ void Index_free(Index_t *idx)
     free(idx->name);
     free(idx->column_name);
     free(idx->table_name);
+    StrList_free(idx->include);
     free(idx);
 }
 
@@ -33,9 +33,24 @@ Literal_t *litText(char *str)
     return lval;
 }
 
+/* The type of a parameter is that of the column it goes with, which the
+ * code generator fills in */
+Literal_t *litParam(int n)
+{
+    Literal_t *lval = (Literal_t *)calloc(1, sizeof(Literal_t));
+    lval->t = TYPE_INT;
+    lval->param = n;
+    return lval;
+}
+
 void Literal_print(Literal_t *val)
 {
     char buf[100];
+    if (val->param)
+    {
+        printf("?%d", val->param);
+        return;
+    }
     printf("%s ", typeToString(val->t, buf));
     switch (val->t)
     {
@@ -2,6 +2,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <strings.h>
 #include <chidb/chidb.h>
 #include <chisql/chisql.h>
 #include "sql-lexer.h"
@@ -52,17 +53,17 @@ chisql_statement_t *__stmt;
 %token VALUES AUTO_INCREMENT ASC DESC UNIQUE IN ON
 %token COUNT SUM AVG MIN MAX INTERSECT EXCEPT DISTINCT
 %token CONCAT TRUE FALSE CASE WHEN DECLARE BIT GROUP
-%token INDEX EXPLAIN
+%token INDEX EXPLAIN VACUUM INCLUDE
 %token <strval> IDENTIFIER
 %token <strval> STRING_LITERAL
 %token <dval> DOUBLE_LITERAL
 %token <ival> INT_LITERAL
 
 %type <ival> column_type bool_op comp_op select_combo
-%type <ival> function_name opt_distinct join opt_unique
+%type <ival> function_name opt_distinct join opt_unique opt_index_method
 %type <strval> column_name table_name opt_alias 
-%type <strval> index_name column_name_or_star
-%type <slist> column_names_list opt_column_names
+%type <strval> index_name column_name_or_star vacuum
+%type <slist> column_names_list opt_column_names opt_index_include
 %type <constr> opt_constraints constraints constraint
 %type <lval> literal_value values_list in_statement
 %type <fkeyref> references_stmt
@@ -100,6 +101,7 @@ sql_line
 	| select 		{ __stmt->stmt.select = $1; __stmt->type = STMT_SELECT; }
 	| insert_into 	{ __stmt->stmt.insert = $1; __stmt->type = STMT_INSERT; }
 	| delete_from 	{ __stmt->stmt.delete = $1; __stmt->type = STMT_DELETE; }
+	| vacuum 		{ __stmt->stmt.vacuum = $1; __stmt->type = STMT_VACUUM; }
 	| /* empty */
 	;
 
@@ -109,13 +111,37 @@ create
 	;
 
 create_index
-        : CREATE opt_unique INDEX index_name ON table_name '(' column_name ')'
+        : CREATE opt_unique INDEX index_name ON table_name '(' column_name ')' opt_index_method opt_index_include
 		{ 
 			$$ = Index_make($4, $6, $8); 
 		  	if ($2 == UNIQUE) $$ = Index_makeUnique($$); 
+		  	$$ = Index_setMethod($$, $10);
+		  	$$ = Index_setInclude($$, $11);
 		}
 	;
 
+opt_index_method
+	: USING IDENTIFIER
+		{
+			if (!strcasecmp($2, "hash"))
+				$$ = INDEX_HASH;
+			else if (!strcasecmp($2, "btree"))
+				$$ = INDEX_BTREE;
+			else {
+				free($2);
+				yyerror("unknown index method");
+				YYERROR;
+			}
+			free($2);
+		}
+	| /* empty */ { $$ = INDEX_BTREE; }
+	;
+
+opt_index_include
+	: INCLUDE '(' column_names_list ')' { $$ = $3; }
+	| /* empty */ { $$ = NULL; }
+	;
+
 opt_unique
 	: UNIQUE { $$ = UNIQUE; }
 	| /* empty */ { $$ = 0; }
@@ -468,6 +494,7 @@ values_list
 literal_value
 	: INT_LITERAL { $$ = litInt($1); }
 	| DOUBLE_LITERAL { $$ = litDouble($1); }
+	| '?' { $$ = litParam(++__stmt->nParams); }
 	| STRING_LITERAL
 		{
 			if (strlen($1) == 1)
@@ -484,6 +511,11 @@ delete_from
 		}
 	;
 
+vacuum
+	: VACUUM { $$ = NULL; }
+	| VACUUM table_name { $$ = $2; }
+	;
+
 %%
 
 void yyerror(const char *s) {
@@ -506,6 +538,9 @@ int chisql_stmt_print(chisql_statement_t *stmt)
     case STMT_DELETE:
         Delete_print(stmt->stmt.delete);
         break;
+    case STMT_VACUUM:
+        printf("Vacuum(%s)\n", stmt->stmt.vacuum ? stmt->stmt.vacuum : "*");
+        break;
     }
 
     return 0;
@@ -529,6 +564,7 @@ int chisql_parser(const char *sql, chisql_statement_t **stmt)
   int rc;
   
   __stmt = malloc(sizeof(chisql_statement_t));
+  __stmt->nParams = 0;
   char *tsql = __sql_semicolon(sql);
     
   YY_BUFFER_STATE my_string_buffer = yy_scan_string (tsql);
@@ -20,6 +20,10 @@ struct handler_entry handlers[] =
     		                  "                     column  Left-aligned columns\n"
     		                  "                     list    Values delimited by | (default)"),
     HANDLER_ENTRY (explain,   ".explain on|off    Turn output mode suitable for EXPLAIN on or off."),
+    HANDLER_ENTRY (analyze,   ".analyze [NAME]    Show the space usage and shape of every B-Tree, or only of\n"
+                              "                   table or index NAME"),
+    HANDLER_ENTRY (bloom,     ".bloom on|off      Turn Bloom filters for key lookups on or off"),
+    HANDLER_ENTRY (buffer,    ".buffer on|off     Turn buffering of table inserts in memory on or off"),
     HANDLER_ENTRY (help,      ".help              Show this message"),
 
     NULL_ENTRY
@@ -444,6 +448,110 @@ int chidb_shell_handle_cmd_explain(chidb_shell_ctx_t *ctx, struct handler_entry
     return CHIDB_OK;
 }
 
+int chidb_shell_handle_cmd_analyze(chidb_shell_ctx_t *ctx, struct handler_entry *e, const char **tokens, int ntokens)
+{
+    int rc;
+
+    if(ntokens > 2)
+    {
+    	usage_error(e, "Invalid arguments");
+    	return 1;
+    }
+
+    if(!ctx->db)
+    {
+        fprintf(stderr, "ERROR: No database is open.\n");
+        return 1;
+    }
+
+    rc = chidb_analyze(ctx->db, ntokens == 2 ? tokens[1] : NULL);
+
+    if(rc == CHIDB_EINVALIDSQL)
+    {
+        fprintf(stderr, "ERROR: No such table or index: %s\n", tokens[1]);
+        return 1;
+    }
+    else if(rc != CHIDB_OK)
+    {
+        fprintf(stderr, "ERROR: Could not analyze the database.\n");
+        return rc;
+    }
+
+    return CHIDB_OK;
+}
+
+int chidb_shell_handle_cmd_bloom(chidb_shell_ctx_t *ctx, struct handler_entry *e, const char **tokens, int ntokens)
+{
+    int rc;
+    bool enable;
+
+    if(ntokens != 2)
+    {
+    	usage_error(e, "Invalid arguments");
+    	return 1;
+    }
+
+    if(strcmp(tokens[1],"on")==0)
+        enable = true;
+    else if(strcmp(tokens[1],"off")==0)
+        enable = false;
+    else
+    {
+    	usage_error(e, "Invalid argument");
+    	return 1;
+    }
+
+    if(!ctx->db)
+    {
+        fprintf(stderr, "ERROR: No database is open.\n");
+        return 1;
+    }
+
+    if((rc = chidb_bloom(ctx->db, enable)) != CHIDB_OK)
+    {
+        fprintf(stderr, "ERROR: Could not build the Bloom filters.\n");
+        return rc;
+    }
+
+    return CHIDB_OK;
+}
+
+int chidb_shell_handle_cmd_buffer(chidb_shell_ctx_t *ctx, struct handler_entry *e, const char **tokens, int ntokens)
+{
+    int rc;
+    bool enable;
+
+    if(ntokens != 2)
+    {
+    	usage_error(e, "Invalid arguments");
+    	return 1;
+    }
+
+    if(strcmp(tokens[1],"on")==0)
+        enable = true;
+    else if(strcmp(tokens[1],"off")==0)
+        enable = false;
+    else
+    {
+    	usage_error(e, "Invalid argument");
+    	return 1;
+    }
+
+    if(!ctx->db)
+    {
+        fprintf(stderr, "ERROR: No database is open.\n");
+        return 1;
+    }
+
+    if((rc = chidb_buffer(ctx->db, enable)) != CHIDB_OK)
+    {
+        fprintf(stderr, "ERROR: Could not write the buffered rows.\n");
+        return rc;
+    }
+
+    return CHIDB_OK;
+}
+
 int chidb_shell_handle_cmd_help(chidb_shell_ctx_t *ctx, struct handler_entry *e, const char **tokens, int ntokens)
 {
     for(int h=0; handlers[h].name != NULL; h++)
@@ -27,6 +27,24 @@ TCase* make_btree_5_tc(void);
 TCase* make_btree_6_tc(void);
 TCase* make_btree_7_tc(void);
 TCase* make_btree_8_tc(void);
+TCase* make_btree_9_tc(void);
+TCase* make_btree_10_tc(void);
+TCase* make_btree_11_tc(void);
+TCase* make_btree_12_tc(void);
+TCase* make_btree_13_tc(void);
+TCase* make_btree_14_tc(void);
+TCase* make_btree_15_tc(void);
+TCase* make_btree_16_tc(void);
+TCase* make_btree_17_tc(void);
+TCase* make_btree_18_tc(void);
+TCase* make_btree_19_tc(void);
+TCase* make_btree_20_tc(void);
+TCase* make_btree_21_tc(void);
+TCase* make_btree_22_tc(void);
+TCase* make_btree_23_tc(void);
+TCase* make_btree_24_tc(void);
+TCase* make_btree_25_tc(void);
+TCase* make_btree_26_tc(void);
 
 
 
@@ -53,3 +71,9 @@ void test_bigfile(chidb *db);
 int chidb_Btree_findInIndex(BTree *bt, npage_t nroot, chidb_key_t ikey, chidb_key_t *pkey);
 
 void test_index_bigfile(chidb *db, npage_t index_nroot);
+
+npage_t get_edge_leaf(BTree *bt, npage_t nroot, bool leftmost);
+
+void test_leaf_chain(BTree *bt, npage_t nroot, chidb_key_t nkeys);
+
+uint32_t check_counts(BTree *bt, npage_t npage);
@@ -0,0 +1,255 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <check.h>
+#include "check_btree.h"
+
+#define NWRITERS (4)
+#define NREADERS (2)
+
+/* Rows of the counted table of test_10_3, each of which two writers try
+ * to insert */
+#define COUNTED_NROWS (4000)
+#define COUNTED_KEY(i) ((chidb_key_t) ((i) * 7919 % 100003 + 1))
+
+struct worker
+{
+    chidb *db;
+    int id;
+    bool *done;
+    npage_t nroot;
+    int inserted;
+};
+
+static void *insert_worker(void *arg)
+{
+    struct worker *w = arg;
+
+    for(int i=w->id; i<bigfile_nvalues; i+=NWRITERS)
+        insert_bigfile(w->db, i);
+
+    return NULL;
+}
+
+static void *find_worker(void *arg)
+{
+    struct worker *w = arg;
+    int rc;
+
+    while(!__atomic_load_n(w->done, __ATOMIC_ACQUIRE))
+    {
+        for(int i=w->id; i<bigfile_nvalues; i+=NREADERS)
+        {
+            uint8_t *buf;
+            uint16_t size;
+            int datalen = ((bigfile_pkeys[i] % 3) + 1) * 64;
+
+            /* A key may or may not be there yet, but if it is,
+             * it must be complete */
+            rc = chidb_Btree_find(w->db->bt, 1, bigfile_pkeys[i], &buf, &size);
+            ck_assert(rc == CHIDB_OK || rc == CHIDB_ENOTFOUND);
+            if(rc == CHIDB_OK)
+            {
+                ck_assert(size == datalen);
+                ck_assert(get4byte(buf) == bigfile_ikeys[i]);
+                free(buf);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static void *counted_insert_worker(void *arg)
+{
+    struct worker *w = arg;
+    uint8_t data[48];
+    int rc;
+
+    for(int i=0; i<COUNTED_NROWS; i++)
+    {
+        if(i % NWRITERS != w->id && (i + 1) % NWRITERS != w->id)
+            continue;
+
+        memset(data, i, sizeof(data));
+        rc = chidb_Btree_insertInTable(w->db->bt, w->nroot, COUNTED_KEY(i), data, i % sizeof(data) + 1);
+        ck_assert(rc == CHIDB_OK || rc == CHIDB_EDUPLICATE);
+        if(rc == CHIDB_OK)
+            w->inserted++;
+    }
+
+    return NULL;
+}
+
+static void *counted_count_worker(void *arg)
+{
+    struct worker *w = arg;
+    uint32_t count, rank;
+
+    while(!__atomic_load_n(w->done, __ATOMIC_ACQUIRE))
+    {
+        /* A count may take in the rows that are on their way down, even
+         * if they turn out to be duplicates */
+        ck_assert(chidb_Btree_count(w->db->bt, w->nroot, &count) == CHIDB_OK);
+        ck_assert(count <= COUNTED_NROWS + NWRITERS);
+        ck_assert(chidb_Btree_rank(w->db->bt, w->nroot, COUNTED_KEY(w->id), &rank) == CHIDB_OK);
+        ck_assert(rank <= COUNTED_NROWS + NWRITERS);
+    }
+
+    return NULL;
+}
+
+START_TEST (test_10_1)
+{
+    chidb *db;
+    int rc;
+    pthread_t writers[NWRITERS], readers[NREADERS];
+    struct worker wwork[NWRITERS], rwork[NREADERS];
+    bool done = false;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    for(int i=0; i<NREADERS; i++)
+    {
+        rwork[i] = (struct worker) {db, i, &done};
+        pthread_create(&readers[i], NULL, find_worker, &rwork[i]);
+    }
+    for(int i=0; i<NWRITERS; i++)
+    {
+        wwork[i] = (struct worker) {db, i, &done};
+        pthread_create(&writers[i], NULL, insert_worker, &wwork[i]);
+    }
+
+    for(int i=0; i<NWRITERS; i++)
+        pthread_join(writers[i], NULL);
+    __atomic_store_n(&done, true, __ATOMIC_RELEASE);
+    for(int i=0; i<NREADERS; i++)
+        pthread_join(readers[i], NULL);
+
+    bt_sanity_check(db->bt, 1);
+    test_leaf_chain(db->bt, 1, bigfile_nvalues);
+    test_bigfile(db);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_10_2)
+{
+    chidb *db;
+    int rc;
+    uint64_t version, version2;
+    BTreeNode *btn;
+
+    db = malloc(sizeof(chidb));
+    char *fname = create_copy(TESTFILE_STRINGS1, "btree-test-10-2.dat");
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    rc = chidb_Btree_getNodeOptimistic(db->bt, 1, &btn, &version);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Btree_freeMemNode(db->bt, btn);
+
+    /* Shared latches do not change the version */
+    chidb_Pager_latch(db->bt->pager, 1, LATCH_SHARED);
+    ck_assert(chidb_Pager_validate(db->bt->pager, 1, version) == CHIDB_OK);
+    chidb_Pager_unlatch(db->bt->pager, 1);
+    ck_assert(chidb_Pager_validate(db->bt->pager, 1, version) == CHIDB_OK);
+
+    /* Exclusive latches do, and readers must wait until they are released */
+    chidb_Pager_latch(db->bt->pager, 1, LATCH_EXCLUSIVE);
+    ck_assert(chidb_Pager_validate(db->bt->pager, 1, version) == CHIDB_ERESTART);
+    ck_assert(chidb_Pager_readVersion(db->bt->pager, 1, &version2) == CHIDB_ERESTART);
+    rc = chidb_Btree_getNodeOptimistic(db->bt, 1, &btn, &version2);
+    ck_assert(rc == CHIDB_ERESTART);
+    chidb_Pager_unlatch(db->bt->pager, 1);
+
+    ck_assert(chidb_Pager_readVersion(db->bt->pager, 1, &version2) == CHIDB_OK);
+    ck_assert(version2 != version);
+    ck_assert(chidb_Pager_validate(db->bt->pager, 1, version) == CHIDB_ERESTART);
+
+    /* Other pages are not affected */
+    rc = chidb_Btree_getNodeOptimistic(db->bt, 2, &btn, &version);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Btree_freeMemNode(db->bt, btn);
+
+    chidb_Btree_close(db->bt);
+    delete_copy(fname);
+    free(db);
+}
+END_TEST
+
+
+/* Concurrent insertions into a table whose internal nodes are counted,
+ * half of which fail because another writer got there first */
+START_TEST (test_10_3)
+{
+    chidb *db;
+    int rc, inserted = 0;
+    npage_t nroot;
+    uint32_t count;
+    BTreeNode *btn;
+    pthread_t writers[NWRITERS], readers[NREADERS];
+    struct worker wwork[NWRITERS], rwork[NREADERS];
+    bool done = false;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+
+    for(int i=0; i<NREADERS; i++)
+    {
+        rwork[i] = (struct worker) {db, i, &done, nroot, 0};
+        pthread_create(&readers[i], NULL, counted_count_worker, &rwork[i]);
+    }
+    for(int i=0; i<NWRITERS; i++)
+    {
+        wwork[i] = (struct worker) {db, i, &done, nroot, 0};
+        pthread_create(&writers[i], NULL, counted_insert_worker, &wwork[i]);
+    }
+
+    for(int i=0; i<NWRITERS; i++)
+    {
+        pthread_join(writers[i], NULL);
+        inserted += wwork[i].inserted;
+    }
+    __atomic_store_n(&done, true, __ATOMIC_RELEASE);
+    for(int i=0; i<NREADERS; i++)
+        pthread_join(readers[i], NULL);
+
+    /* Every row went in once, and the failed insertions left no trace in
+     * the counts */
+    ck_assert(inserted == COUNTED_NROWS);
+    chidb_Btree_getNodeByPage(db->bt, nroot, &btn);
+    ck_assert(btn->flags & PGFLAG_SUBTREE_COUNTS);
+    chidb_Btree_freeMemNode(db->bt, btn);
+    ck_assert(check_counts(db->bt, nroot) == COUNTED_NROWS);
+    ck_assert(chidb_Btree_count(db->bt, nroot, &count) == CHIDB_OK);
+    ck_assert(count == COUNTED_NROWS);
+    bt_sanity_check(db->bt, nroot);
+    test_leaf_chain(db->bt, nroot, COUNTED_NROWS);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_10_tc(void)
+{
+    TCase *tc = tcase_create ("Step 10: Concurrent access");
+    tcase_add_test (tc, test_10_1);
+    tcase_add_test (tc, test_10_2);
+    tcase_add_test (tc, test_10_3);
+
+    return tc;
+}
@@ -0,0 +1,129 @@
+#include <stdlib.h>
+#include <string.h>
+#include <check.h>
+#include "check_btree.h"
+#include "libchidb/pager.h"
+
+static void test_bigfile_at(BTree *bt, npage_t nroot)
+{
+    int rc;
+
+    for(int i=0; i<bigfile_nvalues; i++)
+    {
+        uint8_t* buf;
+        uint16_t size;
+        uint8_t data[192];
+        int datalen = ((bigfile_pkeys[i] % 3) + 1) * 64;
+
+        for(int j=0; j<48; j++)
+            put4byte(data + (4*j), bigfile_ikeys[i]);
+
+        rc = chidb_Btree_find(bt, nroot, bigfile_pkeys[i], &buf, &size);
+        ck_assert(rc == CHIDB_OK);
+        ck_assert(size == datalen);
+        ck_assert(!memcmp(buf, data, datalen));
+        free(buf);
+    }
+}
+
+START_TEST (test_11_1)
+{
+    chidb *db, *db2;
+    int rc;
+    npage_t nroot;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    char *fname2 = create_tmp_file();
+    db2 = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname2, db2, &db2->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    for(int i=0; i<bigfile_nvalues; i++)
+        insert_bigfile(db, i);
+
+    rc = chidb_Btree_rebuild(db->bt, 1, db2->bt, &nroot);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(nroot != 1);
+
+    /* Leaves are packed, so the copy needs fewer pages than the original */
+    ck_assert(db2->bt->pager->n_pages < db->bt->pager->n_pages);
+    bt_sanity_check(db2->bt, nroot);
+    test_leaf_chain(db2->bt, nroot, bigfile_nvalues);
+    test_bigfile_at(db2->bt, nroot);
+
+    /* The rebuilt tree still accepts inserts */
+    rc = chidb_Btree_insertInTable(db2->bt, nroot, 0, (uint8_t *) "x", 1);
+    ck_assert(rc == CHIDB_OK);
+    test_leaf_chain(db2->bt, nroot, bigfile_nvalues + 1);
+
+    chidb_Btree_close(db->bt);
+    chidb_Btree_close(db2->bt);
+    delete_tmp_file(fname);
+    delete_tmp_file(fname2);
+    free(db);
+    free(db2);
+}
+END_TEST
+
+
+START_TEST (test_11_2)
+{
+    chidb *db, *db2;
+    int rc;
+    npage_t npage, nroot;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    char *fname2 = create_tmp_file();
+    db2 = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname2, db2, &db2->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* test_index_bigfile looks the rows up in the table on page 1 */
+    for(int i=0; i<bigfile_nvalues; i++)
+        insert_bigfile(db2, i);
+
+    chidb_Btree_newNode(db->bt, &npage, PGTYPE_INDEX_LEAF);
+    for(int i=bigfile_nvalues-1; i>=0; i--)
+        chidb_Btree_insertInIndex(db->bt, npage, bigfile_ikeys[i], bigfile_pkeys[i]);
+
+    rc = chidb_Btree_rebuild(db->bt, npage, db2->bt, &nroot);
+    ck_assert(rc == CHIDB_OK);
+    test_leaf_chain(db2->bt, nroot, bigfile_nvalues);
+    test_index_bigfile(db2, nroot);
+
+    /* A plain copy keeps the shape of the tree, only the pages move */
+    rc = chidb_Btree_copy(db->bt, npage, db2->bt, &nroot);
+    ck_assert(rc == CHIDB_OK);
+    test_leaf_chain(db2->bt, nroot, bigfile_nvalues);
+    test_index_bigfile(db2, nroot);
+
+    /* The schema table is rebuilt by the caller, never copied */
+    rc = chidb_Btree_copy(db->bt, 1, db2->bt, &nroot);
+    ck_assert(rc == CHIDB_EVALIDEARG);
+
+    chidb_Btree_close(db->bt);
+    chidb_Btree_close(db2->bt);
+    delete_tmp_file(fname);
+    delete_tmp_file(fname2);
+    free(db);
+    free(db2);
+}
+END_TEST
+
+
+TCase* make_btree_11_tc(void)
+{
+    TCase *tc = tcase_create ("Step 11: Rebuilding B-Trees");
+    tcase_add_test (tc, test_11_1);
+    tcase_add_test (tc, test_11_2);
+
+    return tc;
+}
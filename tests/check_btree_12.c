@@ -0,0 +1,99 @@
+#include <stdlib.h>
+#include <check.h>
+#include "check_btree.h"
+
+static void stats_sanity_check(BTreeStats *stats, chidb_key_t nkeys)
+{
+    npage_t n_pages = 0;
+
+    ck_assert(stats->depth >= 1);
+    ck_assert(stats->level_pages[0] == 1);
+    for(uint32_t i = 0; i < stats->depth; i++)
+        n_pages += stats->level_pages[i];
+    ck_assert(n_pages == stats->n_pages);
+    ck_assert(stats->n_leaves == stats->level_pages[stats->depth - 1]);
+    ck_assert(stats->n_cells >= nkeys);
+    ck_assert(stats->used_bytes + stats->fragmented_bytes <= stats->usable_bytes);
+    ck_assert(stats->min_fill > 0 && stats->min_fill <= stats->avg_fill);
+    ck_assert(stats->avg_fill <= 1);
+}
+
+START_TEST (test_12_1)
+{
+    chidb *db;
+    int rc;
+    BTreeStats stats;
+
+    db = malloc(sizeof(chidb));
+    char *fname = create_copy(TESTFILE_STRINGS1, "btree-test-12-1.dat");
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    rc = chidb_Btree_analyze(db->bt, 1, &stats);
+    ck_assert(rc == CHIDB_OK);
+    stats_sanity_check(&stats, 0);
+    ck_assert(stats.type == PGTYPE_TABLE_INTERNAL);
+    ck_assert(stats.fragmented_bytes == 0);
+
+    chidb_Btree_close(db->bt);
+    delete_copy(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_12_2)
+{
+    chidb *db, *db2;
+    int rc;
+    npage_t nroot;
+    BTreeStats stats, stats2;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    char *fname2 = create_tmp_file();
+    db2 = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname2, db2, &db2->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    for(int i=0; i<bigfile_nvalues; i++)
+        insert_bigfile(db, i);
+
+    rc = chidb_Btree_analyze(db->bt, 1, &stats);
+    ck_assert(rc == CHIDB_OK);
+    stats_sanity_check(&stats, bigfile_nvalues);
+    ck_assert(stats.depth >= 2);
+    ck_assert(stats.max_cell_size > 192);
+
+    /* A rebuilt B-Tree has fuller pages, and its leaves are in file order */
+    rc = chidb_Btree_rebuild(db->bt, 1, db2->bt, &nroot);
+    ck_assert(rc == CHIDB_OK);
+    rc = chidb_Btree_analyze(db2->bt, nroot, &stats2);
+    ck_assert(rc == CHIDB_OK);
+    stats_sanity_check(&stats2, bigfile_nvalues);
+    ck_assert(stats2.n_pages < stats.n_pages);
+    ck_assert(stats2.avg_fill > stats.avg_fill);
+    ck_assert(stats2.n_leaves_in_order == stats2.n_leaves - 1);
+    ck_assert(stats2.max_cell_size == stats.max_cell_size);
+
+    chidb_Btree_close(db->bt);
+    chidb_Btree_close(db2->bt);
+    delete_tmp_file(fname);
+    delete_tmp_file(fname2);
+    free(db);
+    free(db2);
+}
+END_TEST
+
+
+TCase* make_btree_12_tc(void)
+{
+    TCase *tc = tcase_create ("Step 12: Analyzing B-Trees");
+    tcase_add_test (tc, test_12_1);
+    tcase_add_test (tc, test_12_2);
+
+    return tc;
+}
@@ -0,0 +1,172 @@
+#include <stdlib.h>
+#include <check.h>
+#include "check_btree.h"
+
+static int cmp_bigfile_pkeys(const void *a, const void *b)
+{
+    chidb_key_t ka = bigfile_pkeys[*(const int *) a];
+    chidb_key_t kb = bigfile_pkeys[*(const int *) b];
+
+    return ka < kb ? -1 : ka > kb;
+}
+
+/* Table cells for the bigfile entries whose position in bigfile_pkeys
+ * is in order[from..to), sorted by key */
+static BTreeCell *bigfile_cells(int *order, int from, int to, uint8_t (*bufs)[192])
+{
+    BTreeCell *cells = malloc((to - from) * sizeof(BTreeCell));
+
+    qsort(order + from, to - from, sizeof(int), cmp_bigfile_pkeys);
+    for(int n = 0; n < to - from; n++)
+    {
+        int i = order[from + n];
+
+        for(int j=0; j<48; j++)
+            put4byte(bufs[i] + (4*j), bigfile_ikeys[i]);
+
+        cells[n].type = PGTYPE_TABLE_LEAF;
+        cells[n].key = bigfile_pkeys[i];
+        cells[n].fields.tableLeaf.data_size = ((bigfile_pkeys[i] % 3) + 1) * 64;
+        cells[n].fields.tableLeaf.data = bufs[i];
+    }
+
+    return cells;
+}
+
+START_TEST (test_13_1)
+{
+    chidb *db;
+    int rc;
+    int *order = malloc(bigfile_nvalues * sizeof(int));
+    uint8_t (*bufs)[192] = malloc(bigfile_nvalues * 192);
+    BTreeCell *cells;
+    BTreeStats stats;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    for(int i=0; i<bigfile_nvalues; i++)
+        order[i] = i;
+    cells = bigfile_cells(order, 0, bigfile_nvalues, bufs);
+
+    rc = chidb_Btree_insertBatch(db->bt, 1, cells, bigfile_nvalues);
+    ck_assert(rc == CHIDB_OK);
+
+    test_bigfile(db);
+    test_leaf_chain(db->bt, 1, bigfile_nvalues);
+
+    /* Appending sorted cells leaves every leaf but the last one full */
+    rc = chidb_Btree_analyze(db->bt, 1, &stats);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(stats.avg_fill > 0.8);
+
+    free(cells);
+    free(bufs);
+    free(order);
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_13_2)
+{
+    chidb *db;
+    int rc;
+    int *order = malloc(bigfile_nvalues * sizeof(int));
+    uint8_t (*bufs)[192] = malloc(bigfile_nvalues * 192);
+    BTreeCell *cells;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* Half of the entries are inserted one by one, and the other half
+     * in batches that go to leaves all over the B-Tree */
+    for(int i=0; i<bigfile_nvalues; i++)
+        order[i] = i;
+    for(int i=0; i<bigfile_nvalues/2; i++)
+        insert_bigfile(db, order[i]);
+
+    for(int from=bigfile_nvalues/2; from<bigfile_nvalues; from+=100)
+    {
+        int to = from + 100 < bigfile_nvalues ? from + 100 : bigfile_nvalues;
+
+        cells = bigfile_cells(order, from, to, bufs);
+        rc = chidb_Btree_insertBatch(db->bt, 1, cells, to - from);
+        ck_assert(rc == CHIDB_OK);
+        free(cells);
+    }
+
+    test_bigfile(db);
+    test_leaf_chain(db->bt, 1, bigfile_nvalues);
+
+    free(bufs);
+    free(order);
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_13_3)
+{
+    chidb *db;
+    int rc;
+    npage_t npage;
+    chidb_key_t pkey;
+    BTreeCell cells[3];
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    chidb_Btree_newNode(db->bt, &npage, PGTYPE_INDEX_LEAF);
+    for(int i = 0; i < 3; i++)
+    {
+        cells[i].type = PGTYPE_INDEX_LEAF;
+        cells[i].key = 10 * (i + 1);
+        cells[i].fields.indexLeaf.keyPk = i;
+        cells[i].fields.indexLeaf.data_size = 0;
+    }
+
+    /* Unsorted */
+    cells[0].key = 40;
+    rc = chidb_Btree_insertBatch(db->bt, npage, cells, 3);
+    ck_assert(rc == CHIDB_EVALIDEARG);
+    cells[0].key = 10;
+
+    rc = chidb_Btree_insertBatch(db->bt, npage, cells, 2);
+    ck_assert(rc == CHIDB_OK);
+
+    /* 20 is already there, but 10 is not */
+    cells[0].key = 5;
+    rc = chidb_Btree_insertBatch(db->bt, npage, cells, 3);
+    ck_assert(rc == CHIDB_EDUPLICATE);
+    ck_assert(chidb_Btree_findInIndex(db->bt, npage, 5, &pkey) == CHIDB_OK);
+    ck_assert(chidb_Btree_findInIndex(db->bt, npage, 10, &pkey) == CHIDB_OK);
+    ck_assert(chidb_Btree_findInIndex(db->bt, npage, 20, &pkey) == CHIDB_OK);
+    ck_assert(chidb_Btree_findInIndex(db->bt, npage, 30, &pkey) == CHIDB_ENOTFOUND);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_13_tc(void)
+{
+    TCase *tc = tcase_create ("Step 13: Batch inserts");
+    tcase_add_test (tc, test_13_1);
+    tcase_add_test (tc, test_13_2);
+    tcase_add_test (tc, test_13_3);
+
+    return tc;
+}
@@ -0,0 +1,181 @@
+#include <stdlib.h>
+#include <check.h>
+#include "check_btree.h"
+
+/* More entries than fit in the buckets of a full directory of 1K pages,
+ * so that some buckets need overflow pages */
+#define HASH_NKEYS (40000)
+
+static void test_hash_bigfile(BTree *bt, npage_t nroot)
+{
+    chidb_key_t keyPk;
+    int rc;
+
+    for(int i=0; i<bigfile_nvalues; i++)
+    {
+        rc = chidb_Hash_find(bt, nroot, bigfile_ikeys[i], &keyPk);
+        ck_assert(rc == CHIDB_OK);
+        ck_assert(keyPk == bigfile_pkeys[i]);
+    }
+}
+
+static void hash_stats_sanity_check(HashStats *stats, uint32_t nkeys)
+{
+    ck_assert(stats->n_entries == nkeys);
+    ck_assert(stats->depth <= stats->max_depth);
+    ck_assert(stats->n_buckets >= 1 && stats->n_buckets <= (1u << stats->depth));
+    ck_assert(stats->max_chain >= 1);
+    ck_assert(stats->avg_fill > 0 && stats->avg_fill <= 1);
+}
+
+START_TEST (test_14_1)
+{
+    chidb *db;
+    int rc;
+    npage_t nroot;
+    chidb_key_t keyPk;
+    HashStats stats;
+    bool is_hash;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    rc = chidb_Hash_create(db->bt, &nroot);
+    ck_assert(rc == CHIDB_OK);
+
+    rc = chidb_Hash_isHash(db->bt, nroot, &is_hash);
+    ck_assert(rc == CHIDB_OK && is_hash);
+    rc = chidb_Hash_isHash(db->bt, 1, &is_hash);
+    ck_assert(rc == CHIDB_OK && !is_hash);
+
+    rc = chidb_Hash_find(db->bt, nroot, bigfile_ikeys[0], &keyPk);
+    ck_assert(rc == CHIDB_ENOTFOUND);
+
+    for(int i=0; i<bigfile_nvalues; i++)
+    {
+        rc = chidb_Hash_insert(db->bt, nroot, bigfile_ikeys[i], bigfile_pkeys[i]);
+        ck_assert(rc == CHIDB_OK);
+    }
+    test_hash_bigfile(db->bt, nroot);
+
+    /* Only an entry equal in both keys is a duplicate (see test_17_4) */
+    rc = chidb_Hash_insert(db->bt, nroot, bigfile_ikeys[42], bigfile_pkeys[42]);
+    ck_assert(rc == CHIDB_EDUPLICATE);
+
+    /* The directory grew, but no bucket needed an overflow page */
+    rc = chidb_Hash_analyze(db->bt, nroot, &stats);
+    ck_assert(rc == CHIDB_OK);
+    hash_stats_sanity_check(&stats, bigfile_nvalues);
+    ck_assert(stats.depth > 0);
+    ck_assert(stats.n_overflow == 0);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_14_2)
+{
+    chidb *db;
+    int rc;
+    npage_t nroot;
+    chidb_key_t keyPk;
+    HashStats stats;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    rc = chidb_Hash_create(db->bt, &nroot);
+    ck_assert(rc == CHIDB_OK);
+
+    for(chidb_key_t i=0; i<HASH_NKEYS; i++)
+    {
+        rc = chidb_Hash_insert(db->bt, nroot, i, i * 2);
+        ck_assert(rc == CHIDB_OK);
+    }
+
+    for(chidb_key_t i=0; i<HASH_NKEYS; i++)
+    {
+        rc = chidb_Hash_find(db->bt, nroot, i, &keyPk);
+        ck_assert(rc == CHIDB_OK);
+        ck_assert(keyPk == i * 2);
+    }
+    rc = chidb_Hash_find(db->bt, nroot, HASH_NKEYS, &keyPk);
+    ck_assert(rc == CHIDB_ENOTFOUND);
+
+    rc = chidb_Hash_analyze(db->bt, nroot, &stats);
+    ck_assert(rc == CHIDB_OK);
+    hash_stats_sanity_check(&stats, HASH_NKEYS);
+    ck_assert(stats.depth == stats.max_depth);
+    ck_assert(stats.n_overflow > 0);
+    ck_assert(stats.max_chain > 1);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_14_3)
+{
+    chidb *db, *db2;
+    int rc;
+    npage_t nroot, new_nroot;
+    HashStats stats, stats2;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    char *fname2 = create_tmp_file();
+    db2 = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname2, db2, &db2->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    rc = chidb_Hash_create(db->bt, &nroot);
+    ck_assert(rc == CHIDB_OK);
+    for(int i=bigfile_nvalues-1; i>=0; i--)
+        chidb_Hash_insert(db->bt, nroot, bigfile_ikeys[i], bigfile_pkeys[i]);
+
+    rc = chidb_Hash_rebuild(db->bt, nroot, db2->bt, &new_nroot);
+    ck_assert(rc == CHIDB_OK);
+    test_hash_bigfile(db2->bt, new_nroot);
+
+    rc = chidb_Hash_analyze(db->bt, nroot, &stats);
+    ck_assert(rc == CHIDB_OK);
+    rc = chidb_Hash_analyze(db2->bt, new_nroot, &stats2);
+    ck_assert(rc == CHIDB_OK);
+    hash_stats_sanity_check(&stats2, bigfile_nvalues);
+    ck_assert(stats2.n_buckets <= stats.n_buckets);
+
+    /* A B-Tree root is not a hash directory */
+    rc = chidb_Hash_rebuild(db->bt, 1, db2->bt, &new_nroot);
+    ck_assert(rc == CHIDB_ECORRUPT);
+
+    chidb_Btree_close(db->bt);
+    chidb_Btree_close(db2->bt);
+    delete_tmp_file(fname);
+    delete_tmp_file(fname2);
+    free(db);
+    free(db2);
+}
+END_TEST
+
+
+TCase* make_btree_14_tc(void)
+{
+    TCase *tc = tcase_create ("Step 14: Hash indexes");
+    tcase_add_test (tc, test_14_1);
+    tcase_add_test (tc, test_14_2);
+    tcase_add_test (tc, test_14_3);
+
+    return tc;
+}
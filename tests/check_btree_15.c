@@ -0,0 +1,157 @@
+#include <stdlib.h>
+#include <check.h>
+#include "check_btree.h"
+
+/* Number of keys, among the first nkeys, that are not in a table B-Tree,
+ * and how many of those its Bloom filter rules out */
+static void count_bloom_misses(BTree *bt, npage_t nroot, chidb_key_t nkeys, int *nabsent, int *nfiltered)
+{
+    uint8_t *data;
+    uint16_t size;
+    int rc;
+
+    *nabsent = *nfiltered = 0;
+    for(chidb_key_t key = 0; key < nkeys; key++)
+    {
+        rc = chidb_Btree_find(bt, nroot, key, &data, &size);
+        if(rc == CHIDB_OK)
+        {
+            ck_assert(chidb_Btree_bloomMayContain(bt, nroot, key));
+            free(data);
+            continue;
+        }
+        ck_assert(rc == CHIDB_ENOTFOUND);
+        (*nabsent)++;
+        if(!chidb_Btree_bloomMayContain(bt, nroot, key))
+            (*nfiltered)++;
+    }
+}
+
+START_TEST (test_15_1)
+{
+    chidb *db;
+    int rc, nabsent, nfiltered;
+    BTreeBloom *bloom;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    for(int i=0; i<bigfile_nvalues; i++)
+        insert_bigfile(db, i);
+
+    /* Without a filter, every key might be there */
+    ck_assert(chidb_Btree_getBloom(db->bt, 1) == NULL);
+    ck_assert(chidb_Btree_bloomMayContain(db->bt, 1, 0));
+
+    rc = chidb_Btree_bloomBuild(db->bt, 1);
+    ck_assert(rc == CHIDB_OK);
+    bloom = chidb_Btree_getBloom(db->bt, 1);
+    ck_assert(bloom != NULL);
+    ck_assert(bloom->n_keys >= bigfile_nvalues);
+
+    /* No false negatives, and few false positives */
+    test_bigfile(db);
+    count_bloom_misses(db->bt, 1, 4 * bigfile_pkeys[bigfile_nvalues - 1], &nabsent, &nfiltered);
+    ck_assert(nabsent > 0);
+    ck_assert(nfiltered > nabsent * 0.95);
+
+    /* Building the filter again replaces it */
+    rc = chidb_Btree_bloomBuild(db->bt, 1);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(chidb_Btree_getBloom(db->bt, 1) == bloom);
+    test_bigfile(db);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_15_2)
+{
+    chidb *db;
+    int rc;
+    npage_t nroot;
+    chidb_key_t pkey;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* Filters of empty B-Trees learn the keys as they are inserted */
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_INDEX_LEAF);
+    rc = chidb_Btree_bloomBuild(db->bt, nroot);
+    ck_assert(rc == CHIDB_OK);
+    rc = chidb_Btree_bloomBuild(db->bt, 1);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(!chidb_Btree_bloomMayContain(db->bt, nroot, bigfile_ikeys[0]));
+
+    for(int i=0; i<bigfile_nvalues; i++)
+    {
+        insert_bigfile(db, i);
+        rc = chidb_Btree_insertInIndex(db->bt, nroot, bigfile_ikeys[i], bigfile_pkeys[i]);
+        ck_assert(rc == CHIDB_OK);
+    }
+    ck_assert(chidb_Btree_getBloom(db->bt, nroot)->n_keys == bigfile_nvalues);
+
+    for(int i=0; i<bigfile_nvalues; i++)
+    {
+        ck_assert(chidb_Btree_bloomMayContain(db->bt, nroot, bigfile_ikeys[i]));
+        rc = chidb_Btree_findInIndex(db->bt, nroot, bigfile_ikeys[i], &pkey);
+        ck_assert(rc == CHIDB_OK && pkey == bigfile_pkeys[i]);
+    }
+    test_bigfile(db);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_15_3)
+{
+    chidb *db;
+    int rc;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    rc = chidb_Btree_bloomBuild(db->bt, 1);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(!chidb_Btree_bloomMayContain(db->bt, 1, bigfile_pkeys[0]));
+
+    rc = chidb_Btree_bloomFreeAll(db->bt);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(chidb_Btree_getBloom(db->bt, 1) == NULL);
+    ck_assert(chidb_Btree_bloomMayContain(db->bt, 1, bigfile_pkeys[0]));
+
+    /* Keys inserted while there is no filter are not lost when it is built */
+    for(int i=0; i<bigfile_nvalues; i++)
+        insert_bigfile(db, i);
+    rc = chidb_Btree_bloomBuild(db->bt, 1);
+    ck_assert(rc == CHIDB_OK);
+    test_bigfile(db);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_15_tc(void)
+{
+    TCase *tc = tcase_create ("Step 15: Bloom filters");
+    tcase_add_test (tc, test_15_1);
+    tcase_add_test (tc, test_15_2);
+    tcase_add_test (tc, test_15_3);
+
+    return tc;
+}
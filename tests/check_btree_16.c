@@ -0,0 +1,305 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <check.h>
+#include "check_btree.h"
+#include "libchidb/memtable.h"
+#include "libchidb/dbm-cursor.h"
+
+#define BUFFER_NKEYS (20000)
+
+/* The row of key k: a few bytes that depend on k */
+static void buffer_row(chidb_key_t k, uint8_t *data, uint16_t *size)
+{
+    *size = 8 + k % 16;
+    for(uint16_t i = 0; i < *size; i++)
+        data[i] = (uint8_t) (k * 31 + i);
+}
+
+static void buffer_insert(BTree *bt, npage_t nroot, chidb_key_t k)
+{
+    uint8_t data[32];
+    uint16_t size;
+
+    buffer_row(k, data, &size);
+    ck_assert(chidb_Btree_insertInTable(bt, nroot, k, data, size) == CHIDB_OK);
+}
+
+static void buffer_check(BTree *bt, npage_t nroot, chidb_key_t k, bool tree_only)
+{
+    uint8_t expected[32], *data;
+    uint16_t esize, size;
+    int rc;
+
+    buffer_row(k, expected, &esize);
+    if(tree_only)
+        rc = chidb_Btree_findInTree(bt, nroot, k, &data, &size);
+    else
+        rc = chidb_Btree_find(bt, nroot, k, &data, &size);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(size == esize);
+    ck_assert(!memcmp(data, expected, size));
+    free(data);
+}
+
+/* Keys 1..n, in a shuffled order */
+static chidb_key_t *shuffled_keys(chidb_key_t n)
+{
+    chidb_key_t *keys = malloc(n * sizeof(chidb_key_t));
+
+    for(chidb_key_t i = 0; i < n; i++)
+        keys[i] = i + 1;
+    srand(16);
+    for(chidb_key_t i = n - 1; i > 0; i--)
+    {
+        chidb_key_t j = rand() % (i + 1), tmp = keys[i];
+        keys[i] = keys[j];
+        keys[j] = tmp;
+    }
+    return keys;
+}
+
+START_TEST (test_16_1)
+{
+    chidb *db;
+    int rc;
+    npage_t nroot;
+    uint8_t data[32], *found;
+    uint16_t size;
+    chidb_key_t *keys = shuffled_keys(BUFFER_NKEYS);
+    Memtable *mt;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+    ck_assert(chidb_Memtable_get(db->bt, nroot) == NULL);
+    ck_assert(chidb_Memtable_enable(db->bt, nroot) == CHIDB_OK);
+    mt = chidb_Memtable_get(db->bt, nroot);
+    ck_assert(mt != NULL);
+
+    /* Index B-Trees cannot be buffered */
+    npage_t nindex;
+    chidb_Btree_newNode(db->bt, &nindex, PGTYPE_INDEX_LEAF);
+    ck_assert(chidb_Memtable_enable(db->bt, nindex) == CHIDB_EVALIDEARG);
+
+    /* The first row stays in the memtable */
+    buffer_insert(db->bt, nroot, keys[0]);
+    ck_assert(mt->n_entries == 1);
+    ck_assert(chidb_Btree_findInTree(db->bt, nroot, keys[0], &found, &size) == CHIDB_ENOTFOUND);
+    buffer_check(db->bt, nroot, keys[0], false);
+
+    /* Enough rows to flush the memtable several times */
+    for(chidb_key_t i = 1; i < BUFFER_NKEYS; i++)
+        buffer_insert(db->bt, nroot, keys[i]);
+    ck_assert(mt->n_entries < BUFFER_NKEYS);
+    buffer_check(db->bt, nroot, keys[0], true);
+    for(chidb_key_t i = 0; i < BUFFER_NKEYS; i++)
+        buffer_check(db->bt, nroot, keys[i], false);
+
+    /* Keys must be unique, whether they are in the memtable or the tree */
+    buffer_row(0, data, &size);
+    ck_assert(chidb_Btree_insertInTable(db->bt, nroot, keys[0], data, size) == CHIDB_EDUPLICATE);
+    ck_assert(chidb_Btree_insertInTable(db->bt, nroot, keys[BUFFER_NKEYS - 1], data, size) == CHIDB_EDUPLICATE);
+
+    /* Counting the rows takes in the memtable, without flushing it */
+    uint32_t count, n_entries = mt->n_entries;
+    ck_assert(n_entries > 0);
+    ck_assert(chidb_Memtable_count(db->bt, nroot, &count) == CHIDB_OK);
+    ck_assert(count == BUFFER_NKEYS);
+    ck_assert(mt->n_entries == n_entries);
+
+    ck_assert(chidb_Memtable_flush(db->bt) == CHIDB_OK);
+    ck_assert(mt->n_entries == 0);
+    for(chidb_key_t i = 0; i < BUFFER_NKEYS; i++)
+        buffer_check(db->bt, nroot, keys[i], true);
+    bt_sanity_check(db->bt, nroot);
+    test_leaf_chain(db->bt, nroot, BUFFER_NKEYS);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(keys);
+    free(db);
+}
+END_TEST
+
+
+/* Walk a cursor through keys 1..n, both ways */
+static void buffer_walk(BTree *bt, npage_t nroot, chidb_key_t n)
+{
+    chidb_dbm_cursor_t c;
+    uint8_t expected[32];
+    uint16_t size;
+    chidb_key_t k;
+
+    ck_assert(chidb_dbm_cursor_init(bt, &c, nroot, 0) == CHIDB_OK);
+
+    ck_assert(chidb_dbm_cursor_rewind(&c) == CHIDB_OK);
+    for(k = 1; ; k++)
+    {
+        ck_assert(c.cur_cell.key == k);
+        buffer_row(k, expected, &size);
+        ck_assert(c.cur_cell.fields.tableLeaf.data_size == size);
+        ck_assert(!memcmp(c.cur_cell.fields.tableLeaf.data, expected, size));
+        if(chidb_dbm_cursor_next(&c) != CHIDB_OK)
+            break;
+    }
+    ck_assert(k == n);
+    ck_assert(c.cur_cell.key == n);
+
+    for(k = n - 1; k >= 1; k--)
+    {
+        ck_assert(chidb_dbm_cursor_prev(&c) == CHIDB_OK);
+        ck_assert(c.cur_cell.key == k);
+    }
+    ck_assert(chidb_dbm_cursor_prev(&c) == CHIDB_EMOVE);
+    ck_assert(c.cur_cell.key == 1);
+
+    /* Changing direction */
+    ck_assert(chidb_dbm_cursor_seek(&c, n / 2, SEEKEQ) == CHIDB_OK);
+    ck_assert(chidb_dbm_cursor_next(&c) == CHIDB_OK);
+    ck_assert(c.cur_cell.key == n / 2 + 1);
+    ck_assert(chidb_dbm_cursor_prev(&c) == CHIDB_OK);
+    ck_assert(chidb_dbm_cursor_prev(&c) == CHIDB_OK);
+    ck_assert(c.cur_cell.key == n / 2 - 1);
+    ck_assert(chidb_dbm_cursor_next(&c) == CHIDB_OK);
+    ck_assert(c.cur_cell.key == n / 2);
+
+    chidb_dbm_cursor_destroy(&c);
+}
+
+START_TEST (test_16_2)
+{
+    chidb *db;
+    int rc;
+    npage_t nroot;
+    chidb_dbm_cursor_t c;
+    chidb_key_t n = 2001;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* Even keys in the tree, odd keys in the memtable */
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+    for(chidb_key_t k = 2; k <= n; k += 2)
+        buffer_insert(db->bt, nroot, k);
+    ck_assert(chidb_Memtable_enable(db->bt, nroot) == CHIDB_OK);
+    for(chidb_key_t k = 1; k <= n; k += 2)
+        buffer_insert(db->bt, nroot, k);
+    ck_assert(chidb_Memtable_get(db->bt, nroot)->n_entries == (n + 1) / 2);
+
+    buffer_walk(db->bt, nroot, n);
+
+    ck_assert(chidb_dbm_cursor_init(db->bt, &c, nroot, 0) == CHIDB_OK);
+    ck_assert(chidb_dbm_cursor_seek(&c, 7, SEEKEQ) == CHIDB_OK);
+    ck_assert(c.cur_cell.key == 7);
+    ck_assert(chidb_dbm_cursor_seek(&c, 8, SEEKEQ) == CHIDB_OK);
+    ck_assert(c.cur_cell.key == 8);
+    ck_assert(chidb_dbm_cursor_seek(&c, n + 1, SEEKEQ) == CHIDB_ENOTFOUND);
+    ck_assert(chidb_dbm_cursor_seek(&c, 7, SEEKGT) == CHIDB_OK);
+    ck_assert(c.cur_cell.key == 8);
+    ck_assert(chidb_dbm_cursor_seek(&c, 8, SEEKGT) == CHIDB_OK);
+    ck_assert(c.cur_cell.key == 9);
+    ck_assert(chidb_dbm_cursor_seek(&c, 8, SEEKLT) == CHIDB_OK);
+    ck_assert(c.cur_cell.key == 7);
+    ck_assert(chidb_dbm_cursor_seek(&c, 7, SEEKLT) == CHIDB_OK);
+    ck_assert(c.cur_cell.key == 6);
+    ck_assert(chidb_dbm_cursor_seek(&c, 0, SEEKGE) == CHIDB_OK);
+    ck_assert(c.cur_cell.key == 1);
+    ck_assert(chidb_dbm_cursor_seek(&c, n, SEEKGT) == CHIDB_ENOTFOUND);
+    ck_assert(chidb_dbm_cursor_seek(&c, 1, SEEKLT) == CHIDB_ENOTFOUND);
+    chidb_dbm_cursor_destroy(&c);
+
+    /* Same rows, all in the tree */
+    ck_assert(chidb_Memtable_flush(db->bt) == CHIDB_OK);
+    buffer_walk(db->bt, nroot, n);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+static void copy_file(const char *from, const char *to)
+{
+    FILE *in = fopen(from, "rb"), *out = fopen(to, "wb");
+    char buf[4096];
+    size_t n;
+
+    ck_assert(in != NULL && out != NULL);
+    while((n = fread(buf, 1, sizeof(buf), in)) > 0)
+        ck_assert(fwrite(buf, 1, n, out) == n);
+    fclose(in);
+    fclose(out);
+}
+
+START_TEST (test_16_3)
+{
+    chidb *db, *db2;
+    int rc;
+    npage_t nroot;
+    chidb_key_t n = 500;
+    char wal[256], fname2[256], wal2[sizeof(fname2) + sizeof(MEMTABLE_WAL_SUFFIX)];
+    FILE *f;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+    ck_assert(chidb_Memtable_enable(db->bt, nroot) == CHIDB_OK);
+    for(chidb_key_t k = 1; k <= n; k++)
+        buffer_insert(db->bt, nroot, k);
+
+    /* What a process that dies now would leave behind: the rows are only
+     * in the log, and the last record was only partly written */
+    snprintf(wal, sizeof(wal), "%s%s", fname, MEMTABLE_WAL_SUFFIX);
+    snprintf(fname2, sizeof(fname2), "%s-crash", fname);
+    snprintf(wal2, sizeof(wal2), "%s%s", fname2, MEMTABLE_WAL_SUFFIX);
+    copy_file(fname, fname2);
+    copy_file(wal, wal2);
+    f = fopen(wal2, "ab");
+    fwrite("\0\0\0\2\0\0\0\1\0\5", 1, 10, f);
+    fclose(f);
+
+    db2 = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname2, db2, &db2->bt);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(access(wal2, F_OK) != 0);
+    for(chidb_key_t k = 1; k <= n; k++)
+        buffer_check(db2->bt, nroot, k, true);
+    bt_sanity_check(db2->bt, nroot);
+    chidb_Btree_close(db2->bt);
+    free(db2);
+
+    /* Closing writes the rows, and removes the log */
+    chidb_Btree_close(db->bt);
+    ck_assert(access(wal, F_OK) != 0);
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+    for(chidb_key_t k = 1; k <= n; k++)
+        buffer_check(db->bt, nroot, k, true);
+
+    chidb_Btree_close(db->bt);
+    unlink(fname2);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_16_tc(void)
+{
+    TCase *tc = tcase_create ("Step 16: Write buffers");
+    tcase_add_test (tc, test_16_1);
+    tcase_add_test (tc, test_16_2);
+    tcase_add_test (tc, test_16_3);
+
+    return tc;
+}
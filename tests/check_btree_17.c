@@ -0,0 +1,306 @@
+#include <stdlib.h>
+#include <string.h>
+#include <check.h>
+#include "check_btree.h"
+#include "libchidb/dbm-cursor.h"
+
+#define DUP_NKEYS (10)
+#define DUP_NENTRIES (5000)
+
+/* Entry i of the index: DUP_NKEYS distinct keys (10, 20, ...), each with
+ * DUP_NENTRIES / DUP_NKEYS primary keys */
+#define DUP_IKEY(i) (10 * ((i) % DUP_NKEYS + 1))
+#define DUP_PKEY(i) ((i) + 1)
+
+/* Rows of the table of test_17_4, whose column c takes DUP_NKEYS values */
+#define DUP_NROWS (300)
+
+/* Walk the whole index with a cursor, both ways, and check that the
+ * entries come in (KeyIdx, KeyPk) order */
+static void dup_walk(BTree *bt, npage_t nroot, uint32_t n)
+{
+    chidb_dbm_cursor_t c;
+    chidb_key_t key, pkey;
+    uint32_t nfound;
+
+    ck_assert(chidb_dbm_cursor_init(bt, &c, nroot, 0) == CHIDB_OK);
+
+    ck_assert(chidb_dbm_cursor_rewind(&c) == CHIDB_OK);
+    for(nfound = 1; ; nfound++)
+    {
+        key = c.cur_cell.key;
+        pkey = c.cur_cell.fields.indexLeaf.keyPk;
+        if(chidb_dbm_cursor_next(&c) != CHIDB_OK)
+            break;
+        ck_assert(c.cur_cell.key > key ||
+                  (c.cur_cell.key == key && c.cur_cell.fields.indexLeaf.keyPk > pkey));
+    }
+    ck_assert(nfound == n);
+
+    for(nfound = 1; chidb_dbm_cursor_prev(&c) == CHIDB_OK; nfound++)
+    {
+        ck_assert(c.cur_cell.key < key ||
+                  (c.cur_cell.key == key && c.cur_cell.fields.indexLeaf.keyPk < pkey));
+        key = c.cur_cell.key;
+        pkey = c.cur_cell.fields.indexLeaf.keyPk;
+    }
+    ck_assert(nfound == n);
+
+    chidb_dbm_cursor_destroy(&c);
+}
+
+START_TEST (test_17_1)
+{
+    chidb *db;
+    int rc;
+    npage_t nroot;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* Primary keys in decreasing order, so every entry goes before the
+     * other entries with its key */
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_INDEX_LEAF);
+    for(int i = DUP_NENTRIES - 1; i >= 0; i--)
+    {
+        rc = chidb_Btree_insertInIndex(db->bt, nroot, DUP_IKEY(i), DUP_PKEY(i));
+        ck_assert(rc == CHIDB_OK);
+    }
+    dup_walk(db->bt, nroot, DUP_NENTRIES);
+
+    /* Only an entry equal in both keys is a duplicate */
+    rc = chidb_Btree_insertInIndex(db->bt, nroot, DUP_IKEY(42), DUP_PKEY(42));
+    ck_assert(rc == CHIDB_EDUPLICATE);
+    rc = chidb_Btree_insertInIndex(db->bt, nroot, DUP_IKEY(42), DUP_NENTRIES + 1);
+    ck_assert(rc == CHIDB_OK);
+    rc = chidb_Btree_insertInIndex(db->bt, nroot, DUP_IKEY(42) + 1, DUP_PKEY(42));
+    ck_assert(rc == CHIDB_OK);
+    dup_walk(db->bt, nroot, DUP_NENTRIES + 2);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_17_2)
+{
+    chidb *db;
+    int rc;
+    npage_t nroot;
+    chidb_dbm_cursor_t c;
+    chidb_key_t first = DUP_PKEY(2), last = DUP_PKEY(DUP_NENTRIES - DUP_NKEYS + 2);
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_INDEX_LEAF);
+    for(int i = 0; i < DUP_NENTRIES; i++)
+        chidb_Btree_insertInIndex(db->bt, nroot, DUP_IKEY(i), DUP_PKEY(i));
+
+    ck_assert(chidb_dbm_cursor_init(db->bt, &c, nroot, 0) == CHIDB_OK);
+
+    /* The entries of key 30 have primary keys first, first + 10, ..., last */
+    ck_assert(chidb_dbm_cursor_seek(&c, 30, SEEKEQ) == CHIDB_OK);
+    ck_assert(c.cur_cell.key == 30 && c.cur_cell.fields.indexLeaf.keyPk == first);
+    ck_assert(chidb_dbm_cursor_seek(&c, 30, SEEKGE) == CHIDB_OK);
+    ck_assert(c.cur_cell.key == 30 && c.cur_cell.fields.indexLeaf.keyPk == first);
+    ck_assert(chidb_dbm_cursor_seek(&c, 25, SEEKGE) == CHIDB_OK);
+    ck_assert(c.cur_cell.key == 30 && c.cur_cell.fields.indexLeaf.keyPk == first);
+    ck_assert(chidb_dbm_cursor_seek(&c, 30, SEEKLE) == CHIDB_OK);
+    ck_assert(c.cur_cell.key == 30 && c.cur_cell.fields.indexLeaf.keyPk == last);
+    ck_assert(chidb_dbm_cursor_seek(&c, 35, SEEKLE) == CHIDB_OK);
+    ck_assert(c.cur_cell.key == 30 && c.cur_cell.fields.indexLeaf.keyPk == last);
+    ck_assert(chidb_dbm_cursor_seek(&c, 40, SEEKLT) == CHIDB_OK);
+    ck_assert(c.cur_cell.key == 30 && c.cur_cell.fields.indexLeaf.keyPk == last);
+    ck_assert(chidb_dbm_cursor_seek(&c, 20, SEEKGT) == CHIDB_OK);
+    ck_assert(c.cur_cell.key == 30 && c.cur_cell.fields.indexLeaf.keyPk == first);
+    ck_assert(chidb_dbm_cursor_seek(&c, 35, SEEKEQ) == CHIDB_ENOTFOUND);
+
+    /* Every entry of the key, in order, and then the next key */
+    ck_assert(chidb_dbm_cursor_seek(&c, 30, SEEKEQ) == CHIDB_OK);
+    for(chidb_key_t pkey = first + DUP_NKEYS; pkey <= last; pkey += DUP_NKEYS)
+    {
+        ck_assert(chidb_dbm_cursor_next(&c) == CHIDB_OK);
+        ck_assert(c.cur_cell.key == 30 && c.cur_cell.fields.indexLeaf.keyPk == pkey);
+    }
+    ck_assert(chidb_dbm_cursor_next(&c) == CHIDB_OK);
+    ck_assert(c.cur_cell.key == 40 && c.cur_cell.fields.indexLeaf.keyPk == first + 1);
+    ck_assert(chidb_dbm_cursor_prev(&c) == CHIDB_OK);
+    ck_assert(c.cur_cell.key == 30 && c.cur_cell.fields.indexLeaf.keyPk == last);
+
+    /* Past either end of the index */
+    ck_assert(chidb_dbm_cursor_seek(&c, 10 * DUP_NKEYS, SEEKGT) == CHIDB_ENOTFOUND);
+    ck_assert(chidb_dbm_cursor_seek(&c, 10 * DUP_NKEYS + 5, SEEKLE) == CHIDB_OK);
+    ck_assert(c.cur_cell.key == 10 * DUP_NKEYS && c.cur_cell.fields.indexLeaf.keyPk == DUP_NENTRIES);
+    ck_assert(chidb_dbm_cursor_seek(&c, 10, SEEKLT) == CHIDB_ENOTFOUND);
+
+    chidb_dbm_cursor_destroy(&c);
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_17_3)
+{
+    chidb *db;
+    int rc;
+    npage_t nroot;
+    BTreeCell *cells;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* A batch sorted by (KeyIdx, KeyPk), with runs of equal keys */
+    cells = malloc(DUP_NENTRIES * sizeof(BTreeCell));
+    for(int i = 0; i < DUP_NENTRIES; i++)
+    {
+        cells[i].type = PGTYPE_INDEX_LEAF;
+        cells[i].key = 10 * (i / (DUP_NENTRIES / DUP_NKEYS) + 1);
+        cells[i].fields.indexLeaf.keyPk = DUP_NKEYS * (i % (DUP_NENTRIES / DUP_NKEYS)) + i / (DUP_NENTRIES / DUP_NKEYS) + 1;
+        cells[i].fields.indexLeaf.data_size = 0;
+    }
+
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_INDEX_LEAF);
+    rc = chidb_Btree_insertBatch(db->bt, nroot, cells, DUP_NENTRIES / 2);
+    ck_assert(rc == CHIDB_OK);
+    rc = chidb_Btree_insertBatch(db->bt, nroot, cells + DUP_NENTRIES / 2, DUP_NENTRIES / 2);
+    ck_assert(rc == CHIDB_OK);
+    dup_walk(db->bt, nroot, DUP_NENTRIES);
+
+    /* An entry that is already there is a duplicate, and the same entry
+     * twice in a batch is not sorted */
+    rc = chidb_Btree_insertBatch(db->bt, nroot, cells, 1);
+    ck_assert(rc == CHIDB_EDUPLICATE);
+    cells[1] = cells[0];
+    rc = chidb_Btree_insertBatch(db->bt, nroot, cells, 2);
+    ck_assert(rc == CHIDB_EVALIDEARG);
+
+    free(cells);
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+static void dup_exec(chidb *db, const char *sql)
+{
+    chidb_stmt *stmt;
+
+    ck_assert(chidb_prepare(db, sql, &stmt) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    chidb_finalize(stmt);
+}
+
+/* Hash indexes have entries with the same key too */
+START_TEST (test_17_4)
+{
+    chidb *db;
+    int rc;
+    npage_t nroot;
+    chidb_dbm_cursor_t c;
+    chidb_stmt *stmt;
+    HashStats stats;
+    chidb_key_t first = DUP_PKEY(2), last = DUP_PKEY(DUP_NENTRIES - DUP_NKEYS + 2);
+    char sql[128];
+    bool hash_next = false;
+    int nrows;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* Primary keys in decreasing order, so the bucket is not in the order
+     * the entries are found in */
+    rc = chidb_Hash_create(db->bt, &nroot);
+    ck_assert(rc == CHIDB_OK);
+    for(int i = DUP_NENTRIES - 1; i >= 0; i--)
+    {
+        rc = chidb_Hash_insert(db->bt, nroot, DUP_IKEY(i), DUP_PKEY(i));
+        ck_assert(rc == CHIDB_OK);
+    }
+    rc = chidb_Hash_insert(db->bt, nroot, DUP_IKEY(42), DUP_PKEY(42));
+    ck_assert(rc == CHIDB_EDUPLICATE);
+    rc = chidb_Hash_analyze(db->bt, nroot, &stats);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(stats.n_entries == DUP_NENTRIES);
+
+    /* The entries of key 30 come by increasing primary key */
+    ck_assert(chidb_dbm_cursor_init(db->bt, &c, nroot, 0) == CHIDB_OK);
+    ck_assert(chidb_dbm_cursor_seek(&c, 30, SEEKEQ) == CHIDB_OK);
+    ck_assert(c.cur_cell.key == 30 && c.cur_cell.fields.indexLeaf.keyPk == first);
+    for(chidb_key_t pkey = first + DUP_NKEYS; pkey <= last; pkey += DUP_NKEYS)
+    {
+        ck_assert(chidb_dbm_cursor_next(&c) == CHIDB_OK);
+        ck_assert(c.cur_cell.key == 30 && c.cur_cell.fields.indexLeaf.keyPk == pkey);
+    }
+    ck_assert(chidb_dbm_cursor_next(&c) == CHIDB_EMOVE);
+    ck_assert(c.cur_cell.key == 30 && c.cur_cell.fields.indexLeaf.keyPk == last);
+    ck_assert(chidb_dbm_cursor_prev(&c) == CHIDB_EMISUSE);
+    ck_assert(chidb_dbm_cursor_seek(&c, 35, SEEKEQ) == CHIDB_ENOTFOUND);
+    chidb_dbm_cursor_destroy(&c);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+
+    /* An equality through a hash index returns every row with the value,
+     * whether it was there when the index was created or not */
+    fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    dup_exec(db, "CREATE TABLE t(id INTEGER PRIMARY KEY, c INTEGER);");
+    for(int id = 1; id <= DUP_NROWS; id++)
+    {
+        if(id == DUP_NROWS / 2)
+            dup_exec(db, "CREATE INDEX ic ON t(c) USING HASH;");
+        sprintf(sql, "INSERT INTO t VALUES (%d, %d);", id, DUP_IKEY(id));
+        dup_exec(db, sql);
+    }
+
+    ck_assert(chidb_prepare(db, "EXPLAIN SELECT id FROM t WHERE c = 30;", &stmt) == CHIDB_OK);
+    while(chidb_step(stmt) == CHIDB_ROW)
+        hash_next = hash_next || !strcmp(chidb_column_text(stmt, 1), "HashNext");
+    chidb_finalize(stmt);
+    ck_assert(hash_next);
+
+    ck_assert(chidb_prepare(db, "SELECT id, c FROM t WHERE c = 30;", &stmt) == CHIDB_OK);
+    for(nrows = 0; (rc = chidb_step(stmt)) == CHIDB_ROW; nrows++)
+    {
+        ck_assert(chidb_column_int(stmt, 0) == 2 + nrows * DUP_NKEYS);
+        ck_assert(chidb_column_int(stmt, 1) == 30);
+    }
+    ck_assert(rc == CHIDB_DONE);
+    ck_assert(nrows == DUP_NROWS / DUP_NKEYS);
+    chidb_finalize(stmt);
+
+    ck_assert(chidb_prepare(db, "SELECT id FROM t WHERE c = 35;", &stmt) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    chidb_finalize(stmt);
+
+    chidb_close(db);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+TCase* make_btree_17_tc(void)
+{
+    TCase *tc = tcase_create ("Step 17: Non-unique indexes");
+    tcase_add_test (tc, test_17_1);
+    tcase_add_test (tc, test_17_2);
+    tcase_add_test (tc, test_17_3);
+    tcase_add_test (tc, test_17_4);
+
+    return tc;
+}
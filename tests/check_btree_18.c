@@ -0,0 +1,90 @@
+#include <stdlib.h>
+#include <string.h>
+#include <check.h>
+#include "check_btree.h"
+#include "libchidb/dbm-cursor.h"
+
+static const char *text_values[] = {
+    "", "a", "ab", "abc", "abcd", "abcde", "abd", "b", "ba", "bandana",
+    "banana", "z", "zz", "\x7f", "\xc3\xa9t\xc3\xa9"
+};
+#define TEXT_NVALUES (sizeof(text_values) / sizeof(text_values[0]))
+
+START_TEST (test_18_1)
+{
+    /* Keys are in the same order as the texts */
+    for(int i = 0; i < TEXT_NVALUES; i++)
+        for(int j = 0; j < TEXT_NVALUES; j++)
+        {
+            int cmp = strcmp(text_values[i], text_values[j]);
+
+            if(cmp < 0)
+                ck_assert(chidb_Btree_textKey(text_values[i]) <= chidb_Btree_textKey(text_values[j]));
+            else if(cmp == 0)
+                ck_assert(chidb_Btree_textKey(text_values[i]) == chidb_Btree_textKey(text_values[j]));
+        }
+
+    /* Only the first four bytes count */
+    ck_assert(chidb_Btree_textKey("abcd") == chidb_Btree_textKey("abcde"));
+    ck_assert(chidb_Btree_textKey("abc") != chidb_Btree_textKey("abcd"));
+    ck_assert(chidb_Btree_textKey("ab") == 0x61620000);
+}
+END_TEST
+
+
+START_TEST (test_18_2)
+{
+    chidb *db;
+    int rc;
+    npage_t nroot;
+    chidb_dbm_cursor_t c;
+    chidb_key_t key;
+    int nfound;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* Row i has text value i % TEXT_NVALUES */
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_INDEX_LEAF);
+    for(int i = 1; i <= 3000; i++)
+    {
+        rc = chidb_Btree_insertInIndex(db->bt, nroot, chidb_Btree_textKey(text_values[i % TEXT_NVALUES]), i);
+        ck_assert(rc == CHIDB_OK);
+    }
+
+    /* "abcd" and "abcde" share their entries */
+    ck_assert(chidb_dbm_cursor_init(db->bt, &c, nroot, 0) == CHIDB_OK);
+    key = chidb_Btree_textKey("abcde");
+    ck_assert(chidb_dbm_cursor_seek(&c, key, SEEKGE) == CHIDB_OK);
+    for(nfound = 0; c.cur_cell.key == key; nfound++)
+    {
+        int value = c.cur_cell.fields.indexLeaf.keyPk % TEXT_NVALUES;
+        ck_assert(!strncmp(text_values[value], "abcd", 4));
+        if(chidb_dbm_cursor_next(&c) != CHIDB_OK)
+            break;
+    }
+    ck_assert(nfound == 2 * 3000 / TEXT_NVALUES);
+
+    key = chidb_Btree_textKey("abce");
+    ck_assert(chidb_dbm_cursor_seek(&c, key, SEEKEQ) == CHIDB_ENOTFOUND);
+    ck_assert(chidb_dbm_cursor_seek(&c, key, SEEKGE) == CHIDB_OK);
+    ck_assert(c.cur_cell.key == chidb_Btree_textKey("abd"));
+
+    chidb_dbm_cursor_destroy(&c);
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_18_tc(void)
+{
+    TCase *tc = tcase_create ("Step 18: Text index keys");
+    tcase_add_test (tc, test_18_1);
+    tcase_add_test (tc, test_18_2);
+
+    return tc;
+}
@@ -0,0 +1,143 @@
+#include <stdlib.h>
+#include <string.h>
+#include <check.h>
+#include "check_btree.h"
+#include "libchidb/dbm-cursor.h"
+
+#define COVER_NENTRIES (3000)
+
+/* Entry i of the index has key i / 2 and primary key i + 1. Every third
+ * entry has no included columns; the others carry (i % 40) + 1 bytes */
+#define COVER_IKEY(i) ((i) / 2)
+#define COVER_PKEY(i) ((i) + 1)
+#define COVER_SIZE(i) ((i) % 3 ? (i) % 40 + 1 : 0)
+
+static void cover_data(int i, uint8_t *data)
+{
+    for(int j = 0; j < COVER_SIZE(i); j++)
+        data[j] = (uint8_t) (i + j);
+}
+
+/* Walk the whole index with a cursor, and check the included columns of
+ * every entry */
+static void cover_walk(BTree *bt, npage_t nroot)
+{
+    chidb_dbm_cursor_t c;
+    uint8_t data[64];
+    int i;
+
+    ck_assert(chidb_dbm_cursor_init(bt, &c, nroot, 0) == CHIDB_OK);
+    ck_assert(chidb_dbm_cursor_rewind(&c) == CHIDB_OK);
+    for(i = 0; ; i++)
+    {
+        ck_assert(c.cur_cell.key == COVER_IKEY(i));
+        ck_assert(c.cur_cell.fields.indexLeaf.keyPk == COVER_PKEY(i));
+        ck_assert(c.cur_cell.fields.indexLeaf.data_size == COVER_SIZE(i));
+        cover_data(i, data);
+        ck_assert(!memcmp(c.cur_cell.fields.indexLeaf.data, data, COVER_SIZE(i)));
+        if(chidb_dbm_cursor_next(&c) != CHIDB_OK)
+            break;
+    }
+    ck_assert(i + 1 == COVER_NENTRIES);
+    chidb_dbm_cursor_destroy(&c);
+}
+
+START_TEST (test_19_1)
+{
+    chidb *db, *db2;
+    int rc;
+    npage_t npage, nroot;
+    BTreeCell cell;
+    uint8_t data[64];
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    char *fname2 = create_tmp_file();
+    db2 = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname2, db2, &db2->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* In decreasing order, so that entries are moved by every split */
+    chidb_Btree_newNode(db->bt, &npage, PGTYPE_INDEX_LEAF);
+    for(int i = COVER_NENTRIES - 1; i >= 0; i--)
+    {
+        cell.type = PGTYPE_INDEX_LEAF;
+        cell.key = COVER_IKEY(i);
+        cell.fields.indexLeaf.keyPk = COVER_PKEY(i);
+        cell.fields.indexLeaf.data_size = COVER_SIZE(i);
+        cell.fields.indexLeaf.data = data;
+        cover_data(i, data);
+        rc = chidb_Btree_insert(db->bt, npage, &cell);
+        ck_assert(rc == CHIDB_OK);
+    }
+    cover_walk(db->bt, npage);
+
+    /* The included columns go along when the tree is rebuilt or copied */
+    rc = chidb_Btree_rebuild(db->bt, npage, db2->bt, &nroot);
+    ck_assert(rc == CHIDB_OK);
+    cover_walk(db2->bt, nroot);
+
+    rc = chidb_Btree_copy(db->bt, npage, db2->bt, &nroot);
+    ck_assert(rc == CHIDB_OK);
+    cover_walk(db2->bt, nroot);
+
+    chidb_Btree_close(db->bt);
+    chidb_Btree_close(db2->bt);
+    delete_tmp_file(fname);
+    delete_tmp_file(fname2);
+    free(db);
+    free(db2);
+}
+END_TEST
+
+
+START_TEST (test_19_2)
+{
+    chidb *db;
+    int rc;
+    npage_t nroot;
+    BTreeCell *cells;
+    uint8_t *data;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    cells = malloc(COVER_NENTRIES * sizeof(BTreeCell));
+    data = malloc(COVER_NENTRIES * 64);
+    for(int i = 0; i < COVER_NENTRIES; i++)
+    {
+        cells[i].type = PGTYPE_INDEX_LEAF;
+        cells[i].key = COVER_IKEY(i);
+        cells[i].fields.indexLeaf.keyPk = COVER_PKEY(i);
+        cells[i].fields.indexLeaf.data_size = COVER_SIZE(i);
+        cells[i].fields.indexLeaf.data = data + 64 * i;
+        cover_data(i, data + 64 * i);
+    }
+
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_INDEX_LEAF);
+    rc = chidb_Btree_insertBatch(db->bt, nroot, cells, COVER_NENTRIES);
+    ck_assert(rc == CHIDB_OK);
+    cover_walk(db->bt, nroot);
+
+    free(cells);
+    free(data);
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_19_tc(void)
+{
+    TCase *tc = tcase_create ("Step 19: Covering index entries");
+    tcase_add_test (tc, test_19_1);
+    tcase_add_test (tc, test_19_2);
+
+    return tc;
+}
@@ -0,0 +1,206 @@
+#include <stdlib.h>
+#include <check.h>
+#include "check_btree.h"
+
+#define COUNT_NROWS (3000)
+
+/* Row i of the table has key 2 * (i + 1), so keys in between are missing */
+#define COUNT_KEY(i) (2 * ((i) + 1))
+
+/* Check count, rank and nthKey on a table with rows 0..nrows-1 */
+static void check_order(BTree *bt, npage_t nroot, uint32_t nrows)
+{
+    uint32_t count;
+    chidb_key_t key;
+
+    ck_assert(chidb_Btree_count(bt, nroot, &count) == CHIDB_OK);
+    ck_assert(count == nrows);
+
+    for(uint32_t i = 0; i < nrows; i += 7)
+    {
+        ck_assert(chidb_Btree_nthKey(bt, nroot, i, &key) == CHIDB_OK);
+        ck_assert(key == COUNT_KEY(i));
+        ck_assert(chidb_Btree_rank(bt, nroot, COUNT_KEY(i), &count) == CHIDB_OK);
+        ck_assert(count == i);
+        ck_assert(chidb_Btree_rank(bt, nroot, COUNT_KEY(i) + 1, &count) == CHIDB_OK);
+        ck_assert(count == i + 1);
+    }
+    ck_assert(chidb_Btree_nthKey(bt, nroot, nrows - 1, &key) == CHIDB_OK);
+    ck_assert(key == COUNT_KEY(nrows - 1));
+    ck_assert(chidb_Btree_nthKey(bt, nroot, nrows, &key) == CHIDB_ENOTFOUND);
+    ck_assert(chidb_Btree_rank(bt, nroot, 0, &count) == CHIDB_OK);
+    ck_assert(count == 0);
+}
+
+static void insert_row(BTree *bt, npage_t nroot, uint32_t i, int expected)
+{
+    uint8_t data[40];
+
+    for(int j = 0; j < sizeof(data); j++)
+        data[j] = (uint8_t) (i + j);
+    ck_assert(chidb_Btree_insertInTable(bt, nroot, COUNT_KEY(i), data, i % sizeof(data) + 1) == expected);
+}
+
+START_TEST (test_20_1)
+{
+    chidb *db;
+    int rc;
+    npage_t nroot;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* Every row goes to a different place, so nodes at every level are
+     * split in the middle of the tree */
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+    for(uint32_t i = 0; i < COUNT_NROWS; i++)
+        insert_row(db->bt, nroot, (i * 1009) % COUNT_NROWS, CHIDB_OK);
+    ck_assert(check_counts(db->bt, nroot) == COUNT_NROWS);
+    check_order(db->bt, nroot, COUNT_NROWS);
+
+    /* A row that is already there does not count twice */
+    insert_row(db->bt, nroot, 42, CHIDB_EDUPLICATE);
+    ck_assert(check_counts(db->bt, nroot) == COUNT_NROWS);
+
+    /* Same, in decreasing order, on page 1 */
+    for(int i = COUNT_NROWS - 1; i >= 0; i--)
+        insert_row(db->bt, 1, i, CHIDB_OK);
+    ck_assert(check_counts(db->bt, 1) == COUNT_NROWS);
+    check_order(db->bt, 1, COUNT_NROWS);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_20_2)
+{
+    chidb *db, *db2;
+    int rc;
+    npage_t nroot, nroot2;
+    BTreeCell *cells;
+    uint8_t data[8] = {0};
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    char *fname2 = create_tmp_file();
+    db2 = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname2, db2, &db2->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    cells = malloc(COUNT_NROWS * sizeof(BTreeCell));
+    for(int i = 0; i < COUNT_NROWS; i++)
+    {
+        cells[i].type = PGTYPE_TABLE_LEAF;
+        cells[i].key = COUNT_KEY(i);
+        cells[i].fields.tableLeaf.data_size = sizeof(data);
+        cells[i].fields.tableLeaf.data = data;
+    }
+
+    /* Even rows one by one, then everything in a batch, which stops at
+     * the first row that is already there */
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+    for(int i = 0; i < COUNT_NROWS / 2; i += 2)
+    {
+        rc = chidb_Btree_insert(db->bt, nroot, &cells[i]);
+        ck_assert(rc == CHIDB_OK);
+    }
+    rc = chidb_Btree_insertBatch(db->bt, nroot, cells + 1, COUNT_NROWS - 1);
+    ck_assert(rc == CHIDB_EDUPLICATE);
+    ck_assert(check_counts(db->bt, nroot) == COUNT_NROWS / 4 + 1);
+    rc = chidb_Btree_insertBatch(db->bt, nroot, cells + COUNT_NROWS / 2, COUNT_NROWS / 2);
+    ck_assert(rc == CHIDB_OK);
+    for(int i = 3; i < COUNT_NROWS / 2; i += 2)
+    {
+        rc = chidb_Btree_insert(db->bt, nroot, &cells[i]);
+        ck_assert(rc == CHIDB_OK);
+    }
+    ck_assert(check_counts(db->bt, nroot) == COUNT_NROWS);
+    check_order(db->bt, nroot, COUNT_NROWS);
+
+    /* Counts are built by the bulk loader, and kept by a copy */
+    rc = chidb_Btree_rebuild(db->bt, nroot, db2->bt, &nroot2);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(check_counts(db2->bt, nroot2) == COUNT_NROWS);
+    check_order(db2->bt, nroot2, COUNT_NROWS);
+
+    rc = chidb_Btree_copy(db->bt, nroot, db2->bt, &nroot2);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(check_counts(db2->bt, nroot2) == COUNT_NROWS);
+
+    free(cells);
+    chidb_Btree_close(db->bt);
+    chidb_Btree_close(db2->bt);
+    delete_tmp_file(fname);
+    delete_tmp_file(fname2);
+    free(db);
+    free(db2);
+}
+END_TEST
+
+
+START_TEST (test_20_3)
+{
+    chidb *db;
+    int rc;
+    BTreeNode *btn;
+    uint32_t count;
+    chidb_key_t key;
+
+    /* A file that was not written by this code has no counts, but can
+     * still be counted (by walking the leaves) */
+    db = malloc(sizeof(chidb));
+    char *fname = create_copy(TESTFILE_STRINGS1, "btree-test-20-3.dat");
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    chidb_Btree_getNodeByPage(db->bt, 1, &btn);
+    ck_assert(btn->type == PGTYPE_TABLE_INTERNAL);
+    ck_assert(!(btn->flags & PGFLAG_SUBTREE_COUNTS));
+    chidb_Btree_freeMemNode(db->bt, btn);
+
+    ck_assert(chidb_Btree_count(db->bt, 1, &count) == CHIDB_OK);
+    ck_assert(count == file1_nvalues);
+    for(int i = 0; i < file1_nvalues; i++)
+    {
+        ck_assert(chidb_Btree_nthKey(db->bt, 1, i, &key) == CHIDB_OK);
+        ck_assert(key == file1_keys[i]);
+        ck_assert(chidb_Btree_rank(db->bt, 1, file1_keys[i], &count) == CHIDB_OK);
+        ck_assert(count == i);
+    }
+    ck_assert(chidb_Btree_nthKey(db->bt, 1, file1_nvalues, &key) == CHIDB_ENOTFOUND);
+
+    /* New rows go in, and are counted, without counts */
+    for(int i = 0; i < 500; i++)
+    {
+        rc = chidb_Btree_insertInTable(db->bt, 1, 10000 + i, (uint8_t *) "foo", 4);
+        ck_assert(rc == CHIDB_OK);
+    }
+    ck_assert(chidb_Btree_count(db->bt, 1, &count) == CHIDB_OK);
+    ck_assert(count == file1_nvalues + 500);
+    ck_assert(chidb_Btree_nthKey(db->bt, 1, file1_nvalues + 250, &key) == CHIDB_OK);
+    ck_assert(key == 10250);
+
+    chidb_Btree_close(db->bt);
+    delete_copy(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_20_tc(void)
+{
+    TCase *tc = tcase_create ("Step 20: Subtree row counts");
+    tcase_add_test (tc, test_20_1);
+    tcase_add_test (tc, test_20_2);
+    tcase_add_test (tc, test_20_3);
+
+    return tc;
+}
@@ -0,0 +1,165 @@
+#include <stdlib.h>
+#include <check.h>
+#include "check_btree.h"
+#include "libchidb/dbm-cursor.h"
+
+/* Walk a whole table with a cursor, forward and then backward, and check
+ * that every row comes once and in order */
+static void walk_table(chidb_dbm_cursor_t *c, uint32_t nrows)
+{
+    chidb_key_t key;
+    uint32_t nfound;
+
+    ck_assert(chidb_dbm_cursor_rewind(c) == CHIDB_OK);
+    for(nfound = 1; ; nfound++)
+    {
+        key = c->cur_cell.key;
+        if(chidb_dbm_cursor_next(c) != CHIDB_OK)
+            break;
+        ck_assert(c->cur_cell.key > key);
+    }
+    ck_assert(nfound == nrows);
+
+    for(nfound = 1; chidb_dbm_cursor_prev(c) == CHIDB_OK; nfound++)
+    {
+        ck_assert(c->cur_cell.key < key);
+        key = c->cur_cell.key;
+    }
+    ck_assert(nfound == nrows);
+}
+
+START_TEST (test_21_1)
+{
+    chidb *db;
+    int rc;
+    BTreeNode *btn, *fresh;
+    BTreeCell cell, fresh_cell;
+    npage_t leaf;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    for(int i=0; i<bigfile_nvalues; i++)
+        insert_bigfile(db, i);
+
+    /* A node loaded over another one is the same as a node read afresh */
+    leaf = get_edge_leaf(db->bt, 1, false);
+    btn = NULL;
+    ck_assert(chidb_Btree_loadNode(db->bt, 1, &btn) == CHIDB_OK);
+    ck_assert(btn->type == PGTYPE_TABLE_INTERNAL);
+    ck_assert(chidb_Btree_getCell(btn, 0, &cell) == CHIDB_OK);
+    ck_assert(chidb_Btree_loadNode(db->bt, leaf, &btn) == CHIDB_OK);
+    ck_assert(chidb_Btree_getNodeByPage(db->bt, leaf, &fresh) == CHIDB_OK);
+
+    ck_assert(btn->page->npage == leaf);
+    ck_assert(btn->type == fresh->type);
+    ck_assert(btn->n_cells == fresh->n_cells);
+    ck_assert(btn->prev_page == fresh->prev_page);
+    ck_assert(btn->next_page == fresh->next_page);
+    for(int i = 0; i < btn->n_cells; i++)
+    {
+        ck_assert(chidb_Btree_getCell(btn, i, &cell) == CHIDB_OK);
+        ck_assert(chidb_Btree_getCell(fresh, i, &fresh_cell) == CHIDB_OK);
+        ck_assert(cell.key == fresh_cell.key);
+    }
+
+    /* A page that does not exist leaves the node to the caller */
+    ck_assert(chidb_Btree_loadNode(db->bt, db->bt->pager->n_pages + 1, &btn) == CHIDB_EPAGENO);
+    ck_assert(btn != NULL);
+
+    chidb_Btree_freeMemNode(db->bt, btn);
+    chidb_Btree_freeMemNode(db->bt, fresh);
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_21_2)
+{
+    chidb *db;
+    int rc;
+    chidb_dbm_cursor_t c;
+    BTreeNode *nodes[CURSOR_MAX_DEPTH + 1];
+    uint32_t depth;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    for(int i=0; i<bigfile_nvalues; i++)
+        insert_bigfile(db, i);
+
+    ck_assert(chidb_dbm_cursor_init(db->bt, &c, 1, 0) == CHIDB_OK);
+    walk_table(&c, bigfile_nvalues);
+    depth = c.trail_depth;
+    ck_assert(depth > 1);
+
+    /* Moving and seeking reuse the nodes pinned in the frames */
+    for(int i = 0; i <= depth; i++)
+    {
+        ck_assert(c.trail[i].btn != NULL);
+        nodes[i] = c.trail[i].btn;
+    }
+    walk_table(&c, bigfile_nvalues);
+    for(int i = 0; i < bigfile_nvalues; i += 97)
+    {
+        ck_assert(chidb_dbm_cursor_seek(&c, bigfile_pkeys[i], SEEKEQ) == CHIDB_OK);
+        ck_assert(c.cur_cell.key == bigfile_pkeys[i]);
+        ck_assert(c.trail_depth == depth);
+    }
+    for(int i = 0; i <= depth; i++)
+    {
+        bool found = false;
+        for(int j = 0; j <= depth; j++)
+            found = found || c.trail[i].btn == nodes[j];
+        ck_assert(found);
+    }
+    ck_assert(depth == CURSOR_MAX_DEPTH || c.trail[depth + 1].btn == NULL);
+
+    chidb_dbm_cursor_destroy(&c);
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_21_3)
+{
+    chidb *db;
+    int rc;
+    chidb_dbm_cursor_t c;
+
+    /* Leaves without sibling links, where the cursor goes back up the
+     * trail to move between leaves */
+    db = malloc(sizeof(chidb));
+    char *fname = create_copy(TESTFILE_STRINGS1, "btree-test-21-3.dat");
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    ck_assert(chidb_dbm_cursor_init(db->bt, &c, 1, 0) == CHIDB_OK);
+    walk_table(&c, file1_nvalues);
+    walk_table(&c, file1_nvalues);
+    chidb_dbm_cursor_destroy(&c);
+
+    chidb_Btree_close(db->bt);
+    delete_copy(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_21_tc(void)
+{
+    TCase *tc = tcase_create ("Step 21: Cursor frame reuse");
+    tcase_add_test (tc, test_21_1);
+    tcase_add_test (tc, test_21_2);
+    tcase_add_test (tc, test_21_3);
+
+    return tc;
+}
@@ -0,0 +1,261 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <check.h>
+#include "check_btree.h"
+#include "libchidb/memtable.h"
+#include "libchidb/record.h"
+#include "libchidb/dbm-cursor.h"
+
+#define BATCH_NROWS (3000)
+#define BATCH_CAPACITY (128)
+#define BATCH_NCOLS (5)
+
+/* The row of key k has four columns: k * 3 (4-byte integer), "row<k>",
+ * k % 100 - 50 (1-byte integer, or 2-byte for odd keys) and NULL */
+static void batch_insert(BTree *bt, npage_t nroot, chidb_key_t k)
+{
+    DBRecord *dbr;
+    uint8_t *data;
+    char text[16];
+
+    sprintf(text, "row%u", k);
+    if(k % 2)
+        chidb_DBRecord_create(&dbr, "|i4|s|i2|0|", k * 3, text, k % 100 - 50);
+    else
+        chidb_DBRecord_create(&dbr, "|i4|s|i1|0|", k * 3, text, k % 100 - 50);
+    chidb_DBRecord_pack(dbr, &data);
+    ck_assert(chidb_Btree_insertInTable(bt, nroot, k, data, dbr->packed_len) == CHIDB_OK);
+    free(data);
+    chidb_DBRecord_destroy(dbr);
+}
+
+/* Columns 2, 0, 1, 3, and 7, which no row has */
+static const uint8_t batch_cols[BATCH_NCOLS] = {2, 0, 1, 3, 7};
+
+struct batch_bufs
+{
+    chidb_key_t keys[BATCH_CAPACITY];
+    chidb_dbm_column_t cols[BATCH_NCOLS];
+    int8_t types[BATCH_NCOLS][BATCH_CAPACITY];
+    int32_t ints[BATCH_NCOLS][BATCH_CAPACITY];
+    uint8_t *texts[BATCH_NCOLS][BATCH_CAPACITY];
+    uint16_t lens[BATCH_NCOLS][BATCH_CAPACITY];
+    uint8_t text[BATCH_CAPACITY * 16];
+};
+
+static void batch_setup(chidb_dbm_batch_t *batch, struct batch_bufs *bufs, uint32_t text_size)
+{
+    batch->capacity = BATCH_CAPACITY;
+    batch->keys = bufs->keys;
+    batch->keyPks = NULL;
+    batch->n_cols = BATCH_NCOLS;
+    batch->cols = bufs->cols;
+    batch->text = bufs->text;
+    batch->text_size = text_size;
+    for(int j = 0; j < BATCH_NCOLS; j++)
+    {
+        bufs->cols[j].col = batch_cols[j];
+        bufs->cols[j].types = bufs->types[j];
+        bufs->cols[j].ints = bufs->ints[j];
+        bufs->cols[j].texts = bufs->texts[j];
+        bufs->cols[j].lens = bufs->lens[j];
+    }
+}
+
+/* Check row i of a batch against the row of key k */
+static void batch_check_row(chidb_dbm_batch_t *batch, uint32_t i, chidb_key_t k)
+{
+    char text[16];
+
+    sprintf(text, "row%u", k);
+    ck_assert(batch->keys[i] == k);
+    ck_assert(batch->cols[0].types[i] == SQL_INTEGER_4BYTE);
+    ck_assert(batch->cols[0].ints[i] == (int32_t) (k % 100) - 50);
+    ck_assert(batch->cols[1].types[i] == SQL_INTEGER_4BYTE);
+    ck_assert(batch->cols[1].ints[i] == k * 3);
+    ck_assert(batch->cols[2].types[i] == SQL_TEXT);
+    ck_assert(batch->cols[2].lens[i] == strlen(text));
+    ck_assert(!memcmp(batch->cols[2].texts[i], text, strlen(text)));
+    ck_assert(batch->cols[3].types[i] == SQL_NULL);
+    ck_assert(batch->cols[4].types[i] == SQL_NULL);
+}
+
+/* Read a whole table (keys step, 2 * step, ...) by batches, and return the
+ * number of batches */
+static uint32_t batch_scan(BTree *bt, npage_t nroot, uint32_t text_size, chidb_key_t step, chidb_key_t nrows)
+{
+    chidb_dbm_cursor_t c;
+    chidb_dbm_batch_t batch;
+    struct batch_bufs *bufs = malloc(sizeof(struct batch_bufs));
+    chidb_key_t k = step;
+    uint32_t nbatches = 0;
+    int rc;
+
+    batch_setup(&batch, bufs, text_size);
+    ck_assert(chidb_dbm_cursor_init(bt, &c, nroot, 0) == CHIDB_OK);
+    rc = chidb_dbm_cursor_rewind(&c);
+    while(rc == CHIDB_OK)
+    {
+        rc = chidb_dbm_cursor_fetch(&c, &batch);
+        ck_assert(rc == CHIDB_OK || rc == CHIDB_EMOVE);
+        ck_assert(batch.n_rows > 0 && batch.n_rows <= BATCH_CAPACITY);
+        ck_assert(batch.text_used <= text_size);
+        for(uint32_t i = 0; i < batch.n_rows; i++, k += step)
+            batch_check_row(&batch, i, k);
+        if(rc == CHIDB_OK)
+            ck_assert(c.cur_cell.key == k);
+        nbatches++;
+    }
+    ck_assert(rc == CHIDB_EMOVE);
+    ck_assert(k == step * (nrows + 1));
+
+    chidb_dbm_cursor_destroy(&c);
+    free(bufs);
+    return nbatches;
+}
+
+START_TEST (test_22_1)
+{
+    chidb *db;
+    int rc;
+    npage_t nroot;
+    uint8_t data[4] = {1, 0, 0, 0};
+    uint32_t types[4], offsets[4];
+    uint8_t n;
+
+    /* Fields past the end of the record are not located */
+    chidb_DBRecord_peek(data, 4, types, offsets, &n);
+    ck_assert(n == 0);
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+    for(chidb_key_t k = 1; k <= BATCH_NROWS; k++)
+        batch_insert(db->bt, nroot, k);
+
+    ck_assert(batch_scan(db->bt, nroot, sizeof(((struct batch_bufs *) 0)->text), 1, BATCH_NROWS)
+              == (BATCH_NROWS + BATCH_CAPACITY - 1) / BATCH_CAPACITY);
+
+    /* A text buffer that only fits a few rows makes smaller batches */
+    ck_assert(batch_scan(db->bt, nroot, 20, 1, BATCH_NROWS) >= BATCH_NROWS / 3);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_22_2)
+{
+    chidb *db;
+    int rc;
+    npage_t nroot;
+    chidb_dbm_cursor_t c;
+    chidb_dbm_batch_t batch;
+    struct batch_bufs *bufs = malloc(sizeof(struct batch_bufs));
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* Even keys in the tree, odd keys in the memtable: batches must still
+     * come in key order */
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+    for(chidb_key_t k = 2; k <= BATCH_NROWS; k += 2)
+        batch_insert(db->bt, nroot, k);
+    ck_assert(chidb_Memtable_enable(db->bt, nroot) == CHIDB_OK);
+    for(chidb_key_t k = 1; k <= BATCH_NROWS; k += 2)
+        batch_insert(db->bt, nroot, k);
+    batch_scan(db->bt, nroot, sizeof(bufs->text), 1, BATCH_NROWS);
+
+    /* A batch that starts in the middle, and a row that does not fit */
+    batch_setup(&batch, bufs, 3);
+    ck_assert(chidb_dbm_cursor_init(db->bt, &c, nroot, 0) == CHIDB_OK);
+    ck_assert(chidb_dbm_cursor_seek(&c, 1000, SEEKGE) == CHIDB_OK);
+    ck_assert(chidb_dbm_cursor_fetch(&c, &batch) == CHIDB_ENOMEM);
+    ck_assert(batch.n_rows == 0);
+    batch.text_size = sizeof(bufs->text);
+    ck_assert(chidb_dbm_cursor_fetch(&c, &batch) == CHIDB_OK);
+    ck_assert(batch.n_rows == BATCH_CAPACITY);
+    for(uint32_t i = 0; i < batch.n_rows; i++)
+        batch_check_row(&batch, i, 1000 + i);
+    chidb_dbm_cursor_destroy(&c);
+
+    /* Same rows, all in the tree */
+    ck_assert(chidb_Memtable_flush(db->bt) == CHIDB_OK);
+    batch_scan(db->bt, nroot, sizeof(bufs->text), 1, BATCH_NROWS);
+
+    free(bufs);
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_22_3)
+{
+    chidb *db;
+    int rc;
+    npage_t nroot;
+    chidb_dbm_cursor_t c;
+    chidb_dbm_batch_t batch;
+    struct batch_bufs *bufs = malloc(sizeof(struct batch_bufs));
+    chidb_key_t keyPks[BATCH_CAPACITY];
+    uint32_t nfound = 0;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* Index entries without included columns only have their keys */
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_INDEX_LEAF);
+    for(chidb_key_t k = 1; k <= BATCH_NROWS; k++)
+        chidb_Btree_insertInIndex(db->bt, nroot, k % 10, k);
+
+    batch_setup(&batch, bufs, sizeof(bufs->text));
+    batch.keyPks = keyPks;
+    ck_assert(chidb_dbm_cursor_init(db->bt, &c, nroot, 0) == CHIDB_OK);
+    rc = chidb_dbm_cursor_rewind(&c);
+    while(rc == CHIDB_OK)
+    {
+        rc = chidb_dbm_cursor_fetch(&c, &batch);
+        for(uint32_t i = 0; i < batch.n_rows; i++, nfound++)
+        {
+            /* Key j comes with primary keys j, j + 10, ... (10 for key 0) */
+            chidb_key_t ikey = nfound / (BATCH_NROWS / 10);
+            chidb_key_t pkey = (nfound % (BATCH_NROWS / 10)) * 10 + (ikey ? ikey : 10);
+            ck_assert(batch.keys[i] == ikey);
+            ck_assert(batch.keyPks[i] == pkey);
+            for(int j = 0; j < BATCH_NCOLS; j++)
+                ck_assert(batch.cols[j].types[i] == SQL_NULL);
+        }
+    }
+    ck_assert(rc == CHIDB_EMOVE);
+    ck_assert(nfound == BATCH_NROWS);
+    chidb_dbm_cursor_destroy(&c);
+
+    free(bufs);
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_22_tc(void)
+{
+    TCase *tc = tcase_create ("Step 22: Batch cursor fetches");
+    tcase_add_test (tc, test_22_1);
+    tcase_add_test (tc, test_22_2);
+    tcase_add_test (tc, test_22_3);
+
+    return tc;
+}
@@ -0,0 +1,143 @@
+#include <stdlib.h>
+#include <check.h>
+#include "check_btree.h"
+#include "libchidb/memtable.h"
+#include "libchidb/dbm-cursor.h"
+
+#define RANGE_NROWS (4000)
+
+/* Walk a cursor bounded to [lo, hi] both ways, on a table with the keys
+ * 1..RANGE_NROWS */
+static void range_walk(chidb_dbm_cursor_t *c, chidb_key_t lo, chidb_key_t hi)
+{
+    chidb_key_t first = lo < 1 ? 1 : lo;
+    chidb_key_t last = hi > RANGE_NROWS ? RANGE_NROWS : hi;
+    chidb_key_t k;
+
+    ck_assert(chidb_dbm_cursor_set_range(c, lo, hi) == CHIDB_OK);
+    if(first > last)
+    {
+        ck_assert(chidb_dbm_cursor_rewind(c) == CHIDB_ENOTFOUND);
+        return;
+    }
+
+    ck_assert(chidb_dbm_cursor_rewind(c) == CHIDB_OK);
+    for(k = first; k < last; k++)
+    {
+        ck_assert(c->cur_cell.key == k);
+        ck_assert(chidb_dbm_cursor_next(c) == CHIDB_OK);
+    }
+    ck_assert(c->cur_cell.key == last);
+    ck_assert(chidb_dbm_cursor_next(c) == CHIDB_EMOVE);
+    ck_assert(c->cur_cell.key == last);
+
+    for(k = last; k > first; k--)
+        ck_assert(chidb_dbm_cursor_prev(c) == CHIDB_OK && c->cur_cell.key == k - 1);
+    ck_assert(chidb_dbm_cursor_prev(c) == CHIDB_EMOVE);
+    ck_assert(c->cur_cell.key == first);
+
+    /* Seeks from outside the range start at its bounds */
+    ck_assert(chidb_dbm_cursor_seek(c, first - 1, SEEKGT) == CHIDB_OK && c->cur_cell.key == first);
+    ck_assert(chidb_dbm_cursor_seek(c, last + 1, SEEKLT) == CHIDB_OK && c->cur_cell.key == last);
+    ck_assert(chidb_dbm_cursor_seek(c, last + 1, SEEKGE) == CHIDB_ENOTFOUND);
+    if(first > 1)
+        ck_assert(chidb_dbm_cursor_seek(c, first - 1, SEEKEQ) == CHIDB_ENOTFOUND);
+}
+
+static void range_walks(BTree *bt, npage_t nroot)
+{
+    chidb_dbm_cursor_t c;
+
+    ck_assert(chidb_dbm_cursor_init(bt, &c, nroot, 0) == CHIDB_OK);
+    range_walk(&c, 1000, 1100);
+    range_walk(&c, 1001, 1001);
+    range_walk(&c, 0, 17);
+    range_walk(&c, RANGE_NROWS - 10, UINT32_MAX);
+    range_walk(&c, 50, 40);
+    range_walk(&c, RANGE_NROWS + 1, UINT32_MAX);
+    range_walk(&c, 0, UINT32_MAX);
+    chidb_dbm_cursor_destroy(&c);
+}
+
+START_TEST (test_23_1)
+{
+    chidb *db;
+    int rc;
+    npage_t nroot;
+    uint8_t data[4] = {0};
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+    for(chidb_key_t k = 1; k <= RANGE_NROWS; k++)
+        ck_assert(chidb_Btree_insertInTable(db->bt, nroot, k, data, sizeof(data)) == CHIDB_OK);
+    range_walks(db->bt, nroot);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_23_2)
+{
+    chidb *db;
+    int rc;
+    npage_t nroot;
+    uint8_t data[4] = {0};
+    chidb_dbm_cursor_t c;
+    chidb_dbm_batch_t batch;
+    chidb_key_t keys[64];
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* Even keys in the tree, odd keys in the memtable: the bounds hold for
+     * rows from both */
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+    for(chidb_key_t k = 2; k <= RANGE_NROWS; k += 2)
+        chidb_Btree_insertInTable(db->bt, nroot, k, data, sizeof(data));
+    ck_assert(chidb_Memtable_enable(db->bt, nroot) == CHIDB_OK);
+    for(chidb_key_t k = 1; k <= RANGE_NROWS; k += 2)
+        chidb_Btree_insertInTable(db->bt, nroot, k, data, sizeof(data));
+    range_walks(db->bt, nroot);
+
+    /* A batch stops at the upper bound */
+    ck_assert(chidb_Memtable_flush(db->bt) == CHIDB_OK);
+    batch.capacity = 64;
+    batch.keys = keys;
+    batch.keyPks = NULL;
+    batch.n_cols = 0;
+    batch.cols = NULL;
+    batch.text = NULL;
+    batch.text_size = 0;
+    ck_assert(chidb_dbm_cursor_init(db->bt, &c, nroot, 0) == CHIDB_OK);
+    ck_assert(chidb_dbm_cursor_set_range(&c, 100, 130) == CHIDB_OK);
+    ck_assert(chidb_dbm_cursor_rewind(&c) == CHIDB_OK);
+    ck_assert(chidb_dbm_cursor_fetch(&c, &batch) == CHIDB_EMOVE);
+    ck_assert(batch.n_rows == 31);
+    for(uint32_t i = 0; i < batch.n_rows; i++)
+        ck_assert(keys[i] == 100 + i);
+    chidb_dbm_cursor_destroy(&c);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_23_tc(void)
+{
+    TCase *tc = tcase_create ("Step 23: Bounded cursors");
+    tcase_add_test (tc, test_23_1);
+    tcase_add_test (tc, test_23_2);
+
+    return tc;
+}
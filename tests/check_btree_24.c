@@ -0,0 +1,118 @@
+#include <stdlib.h>
+#include <check.h>
+#include "check_btree.h"
+#include "libchidb/dbm-cursor.h"
+
+#define REVAL_NROWS (4000)
+
+START_TEST (test_24_1)
+{
+    chidb *db;
+    int rc;
+    npage_t nroot;
+    uint8_t data[4] = {0};
+    chidb_dbm_cursor_t c;
+    uint64_t epoch;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* Inserting into a leaf that has room does not change the epoch */
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+    for(chidb_key_t k = 10; k <= 50; k += 10)
+        ck_assert(chidb_Btree_insertInTable(db->bt, nroot, k, data, sizeof(data)) == CHIDB_OK);
+    ck_assert(chidb_dbm_cursor_init(db->bt, &c, nroot, 0) == CHIDB_OK);
+    ck_assert(chidb_dbm_cursor_seek(&c, 30, SEEKEQ) == CHIDB_OK);
+    epoch = chidb_Btree_epoch(db->bt);
+    ck_assert(c.epoch == epoch);
+
+    ck_assert(chidb_dbm_cursor_revalidate(&c) == CHIDB_OK);
+    ck_assert(c.cur_cell.key == 30);
+
+    /* A key before the current one moves it in the leaf */
+    ck_assert(chidb_Btree_insertInTable(db->bt, nroot, 5, data, sizeof(data)) == CHIDB_OK);
+    ck_assert(chidb_Btree_epoch(db->bt) == epoch);
+    ck_assert(chidb_dbm_cursor_revalidate(&c) == CHIDB_OK);
+    ck_assert(c.cur_cell.key == 30);
+    ck_assert(c.trail[0].n_cur_cell == 3);
+    ck_assert(chidb_dbm_cursor_next(&c) == CHIDB_OK && c.cur_cell.key == 40);
+    ck_assert(chidb_dbm_cursor_prev(&c) == CHIDB_OK && c.cur_cell.key == 30);
+    ck_assert(chidb_dbm_cursor_prev(&c) == CHIDB_OK && c.cur_cell.key == 20);
+
+    /* Splits change it */
+    for(chidb_key_t k = 100; k <= REVAL_NROWS; k++)
+        ck_assert(chidb_Btree_insertInTable(db->bt, nroot, k, data, sizeof(data)) == CHIDB_OK);
+    ck_assert(chidb_Btree_epoch(db->bt) != epoch);
+    ck_assert(chidb_dbm_cursor_revalidate(&c) == CHIDB_OK);
+    ck_assert(c.cur_cell.key == 20);
+    ck_assert(c.epoch == chidb_Btree_epoch(db->bt));
+    ck_assert(c.trail_depth > 1);
+    chidb_dbm_cursor_destroy(&c);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_24_2)
+{
+    chidb *db;
+    int rc;
+    npage_t nroot;
+    uint8_t data[4] = {0};
+    chidb_dbm_cursor_t c;
+    chidb_key_t k;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* A cursor that stays on its row while rows go in around it, some of
+     * them splitting its leaf */
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+    for(k = 2; k <= REVAL_NROWS; k += 2)
+        ck_assert(chidb_Btree_insertInTable(db->bt, nroot, k, data, sizeof(data)) == CHIDB_OK);
+    ck_assert(chidb_dbm_cursor_init(db->bt, &c, nroot, 0) == CHIDB_OK);
+    ck_assert(chidb_dbm_cursor_seek(&c, REVAL_NROWS / 2, SEEKEQ) == CHIDB_OK);
+    for(k = 1; k <= REVAL_NROWS; k += 2)
+    {
+        ck_assert(chidb_Btree_insertInTable(db->bt, nroot, k, data, sizeof(data)) == CHIDB_OK);
+        ck_assert(chidb_dbm_cursor_revalidate(&c) == CHIDB_OK);
+        ck_assert(c.cur_cell.key == REVAL_NROWS / 2);
+    }
+
+    /* The trail is right after the last revalidation */
+    for(k = REVAL_NROWS / 2 + 1; k <= REVAL_NROWS; k++)
+        ck_assert(chidb_dbm_cursor_next(&c) == CHIDB_OK && c.cur_cell.key == k);
+    ck_assert(chidb_dbm_cursor_next(&c) == CHIDB_EMOVE);
+
+    /* A cursor appending rows at the end of the table */
+    ck_assert(chidb_dbm_cursor_seek(&c, REVAL_NROWS, SEEKEQ) == CHIDB_OK);
+    for(k = REVAL_NROWS + 1; k <= 2 * REVAL_NROWS; k++)
+    {
+        ck_assert(chidb_Btree_insertInTable(db->bt, nroot, k, data, sizeof(data)) == CHIDB_OK);
+        ck_assert(chidb_dbm_cursor_revalidate(&c) == CHIDB_OK);
+        ck_assert(chidb_dbm_cursor_next(&c) == CHIDB_OK && c.cur_cell.key == k);
+    }
+    chidb_dbm_cursor_destroy(&c);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_24_tc(void)
+{
+    TCase *tc = tcase_create ("Step 24: Cursor revalidation");
+    tcase_add_test (tc, test_24_1);
+    tcase_add_test (tc, test_24_2);
+
+    return tc;
+}
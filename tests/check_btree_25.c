@@ -0,0 +1,170 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <check.h>
+#include "check_btree.h"
+
+#define PARAM_NROWS (500)
+
+static void param_exec(chidb *db, const char *sql)
+{
+    chidb_stmt *stmt;
+
+    ck_assert(chidb_prepare(db, sql, &stmt) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    chidb_finalize(stmt);
+}
+
+/* Number of rows of a prepared SELECT, which is reset afterwards */
+static int param_count(chidb_stmt *stmt)
+{
+    int rc, nrows = 0;
+
+    while((rc = chidb_step(stmt)) == CHIDB_ROW)
+        nrows++;
+    ck_assert(rc == CHIDB_DONE);
+    ck_assert(chidb_reset(stmt) == CHIDB_OK);
+    return nrows;
+}
+
+/* The table t has the rows (k, "row<k>", k % 10) for k in 1..PARAM_NROWS,
+ * all inserted with the same statement */
+static chidb *param_open(char *fname)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    char name[16];
+
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    param_exec(db, "CREATE TABLE t(id INTEGER PRIMARY KEY, name TEXT, n INTEGER);");
+    param_exec(db, "CREATE INDEX idx ON t(n);");
+
+    ck_assert(chidb_prepare(db, "INSERT INTO t VALUES (?, ?, ?);", &stmt) == CHIDB_OK);
+    for(int k = 1; k <= PARAM_NROWS; k++)
+    {
+        sprintf(name, "row%d", k);
+        ck_assert(chidb_bind_int(stmt, 1, k) == CHIDB_OK);
+        ck_assert(chidb_bind_text(stmt, 2, name) == CHIDB_OK);
+        ck_assert(chidb_bind_int(stmt, 3, k % 10) == CHIDB_OK);
+        ck_assert(chidb_step(stmt) == CHIDB_DONE);
+        ck_assert(chidb_reset(stmt) == CHIDB_OK);
+    }
+
+    /* Parameters go by number, and must be of the type of their column */
+    ck_assert(chidb_bind_text(stmt, 1, "1") == CHIDB_EMISMATCH);
+    ck_assert(chidb_bind_int(stmt, 2, 1) == CHIDB_EMISMATCH);
+    ck_assert(chidb_bind_int(stmt, 0, 1) == CHIDB_EMISUSE);
+    ck_assert(chidb_bind_int(stmt, 4, 1) == CHIDB_EMISUSE);
+    chidb_finalize(stmt);
+
+    return db;
+}
+
+START_TEST (test_25_1)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    char name[16];
+
+    char *fname = create_tmp_file();
+    db = param_open(fname);
+
+    /* Lookups by primary key, by an indexed column and by text */
+    ck_assert(chidb_prepare(db, "SELECT id, name FROM t WHERE id = ?;", &stmt) == CHIDB_OK);
+    for(int k = 1; k <= PARAM_NROWS; k += 7)
+    {
+        sprintf(name, "row%d", k);
+        ck_assert(chidb_bind_int(stmt, 1, k) == CHIDB_OK);
+        ck_assert(chidb_step(stmt) == CHIDB_ROW);
+        ck_assert(chidb_column_int(stmt, 0) == k);
+        ck_assert(!strcmp(chidb_column_text(stmt, 1), name));
+        ck_assert(chidb_step(stmt) == CHIDB_DONE);
+        ck_assert(chidb_reset(stmt) == CHIDB_OK);
+    }
+    ck_assert(chidb_bind_int(stmt, 1, PARAM_NROWS + 1) == CHIDB_OK);
+    ck_assert(param_count(stmt) == 0);
+    chidb_finalize(stmt);
+
+    ck_assert(chidb_prepare(db, "SELECT id FROM t WHERE n = ?;", &stmt) == CHIDB_OK);
+    for(int n = 0; n < 10; n++)
+    {
+        ck_assert(chidb_bind_int(stmt, 1, n) == CHIDB_OK);
+        ck_assert(param_count(stmt) == PARAM_NROWS / 10);
+    }
+    chidb_finalize(stmt);
+
+    ck_assert(chidb_prepare(db, "SELECT id FROM t WHERE name = ?;", &stmt) == CHIDB_OK);
+    ck_assert(chidb_bind_text(stmt, 1, "row42") == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_ROW);
+    ck_assert(chidb_column_int(stmt, 0) == 42);
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    chidb_finalize(stmt);
+
+    chidb_close(db);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_25_2)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+
+    char *fname = create_tmp_file();
+    db = param_open(fname);
+
+    /* Ranges of primary keys whose bounds are parameters */
+    ck_assert(chidb_prepare(db, "SELECT id FROM t WHERE id > ? AND id < ?;", &stmt) == CHIDB_OK);
+    ck_assert(chidb_bind_int(stmt, 1, 100) == CHIDB_OK);
+    ck_assert(chidb_bind_int(stmt, 2, 200) == CHIDB_OK);
+    ck_assert(param_count(stmt) == 99);
+    ck_assert(chidb_bind_int(stmt, 1, 0) == CHIDB_OK);
+    ck_assert(chidb_bind_int(stmt, 2, 1) == CHIDB_OK);
+    ck_assert(param_count(stmt) == 0);
+    ck_assert(chidb_bind_int(stmt, 2, 0) == CHIDB_OK);
+    ck_assert(param_count(stmt) == 0);
+    ck_assert(chidb_bind_int(stmt, 1, PARAM_NROWS - 3) == CHIDB_OK);
+    ck_assert(chidb_bind_int(stmt, 2, PARAM_NROWS + 100) == CHIDB_OK);
+    ck_assert(param_count(stmt) == 3);
+    chidb_finalize(stmt);
+
+    ck_assert(chidb_prepare(db, "SELECT id FROM t WHERE id >= ?;", &stmt) == CHIDB_OK);
+    ck_assert(chidb_bind_int(stmt, 1, 101) == CHIDB_OK);
+    ck_assert(param_count(stmt) == PARAM_NROWS - 100);
+
+    /* A statement reset halfway starts over, and its parameters can only
+     * change while it is not running */
+    ck_assert(chidb_step(stmt) == CHIDB_ROW);
+    ck_assert(chidb_step(stmt) == CHIDB_ROW);
+    ck_assert(chidb_column_int(stmt, 0) == 102);
+    ck_assert(chidb_bind_int(stmt, 1, 1) == CHIDB_EMISUSE);
+    ck_assert(chidb_reset(stmt) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_ROW);
+    ck_assert(chidb_column_int(stmt, 0) == 101);
+    ck_assert(chidb_reset(stmt) == CHIDB_OK);
+    ck_assert(chidb_bind_int(stmt, 1, 1) == CHIDB_OK);
+    ck_assert(param_count(stmt) == PARAM_NROWS);
+    chidb_finalize(stmt);
+
+    /* A parameter that is not bound, and one that shares its bound with a
+     * literal */
+    ck_assert(chidb_prepare(db, "SELECT id FROM t WHERE id <= ?;", &stmt) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_EMISUSE);
+    chidb_finalize(stmt);
+    ck_assert(chidb_prepare(db, "SELECT id FROM t WHERE id > 5 AND id > ?;", &stmt) == CHIDB_EINVALIDSQL);
+
+    chidb_close(db);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+TCase* make_btree_25_tc(void)
+{
+    TCase *tc = tcase_create ("Step 25: Statement parameters");
+    tcase_add_test (tc, test_25_1);
+    tcase_add_test (tc, test_25_2);
+
+    return tc;
+}
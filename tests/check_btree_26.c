@@ -0,0 +1,176 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <check.h>
+#include "check_btree.h"
+#include "libchidb/dbm-cache.h"
+
+#define CACHE_NROWS (300)
+
+static void cache_exec(chidb *db, const char *sql)
+{
+    chidb_stmt *stmt;
+
+    ck_assert(chidb_prepare(db, sql, &stmt) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    chidb_finalize(stmt);
+}
+
+/* Number of rows of a SELECT, and the first column of the last one */
+static int cache_count(chidb *db, const char *sql, int *last)
+{
+    chidb_stmt *stmt;
+    int rc, nrows = 0;
+
+    ck_assert(chidb_prepare(db, sql, &stmt) == CHIDB_OK);
+    while((rc = chidb_step(stmt)) == CHIDB_ROW)
+    {
+        nrows++;
+        if(last)
+            *last = chidb_column_int(stmt, 0);
+    }
+    ck_assert(rc == CHIDB_DONE);
+    chidb_finalize(stmt);
+    return nrows;
+}
+
+/* Insert the rows (k, "row <k>", k % 10) for k in first..last, each with its
+ * own literal statement */
+static void cache_insert(chidb *db, int first, int last)
+{
+    char sql[128];
+
+    for(int k = first; k <= last; k++)
+    {
+        sprintf(sql, "INSERT INTO t VALUES (%d, \"row %d\", %d);", k, k, k % 10);
+        cache_exec(db, sql);
+    }
+}
+
+START_TEST (test_26_1)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    char sql[1024];
+    int last;
+    uint64_t hits;
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    cache_exec(db, "CREATE TABLE t(id INTEGER PRIMARY KEY, name TEXT, n INTEGER);");
+
+    /* Statements that only differ in their literals and whitespace share
+     * the same program */
+    hits = db->cache->hits;
+    cache_insert(db, 1, CACHE_NROWS);
+    ck_assert(db->cache->hits == hits + CACHE_NROWS - 1);
+
+    for(int k = 1; k <= CACHE_NROWS; k += 13)
+    {
+        sprintf(sql, "SELECT id, name FROM t WHERE id = %d;", k);
+        ck_assert(chidb_prepare(db, sql, &stmt) == CHIDB_OK);
+        sprintf(sql, "row %d", k);
+        ck_assert(chidb_step(stmt) == CHIDB_ROW);
+        ck_assert(chidb_column_int(stmt, 0) == k);
+        ck_assert(!strcmp(chidb_column_text(stmt, 1), sql));
+        ck_assert(chidb_step(stmt) == CHIDB_DONE);
+        chidb_finalize(stmt);
+    }
+
+    hits = db->cache->hits;
+    ck_assert(cache_count(db, "SELECT id FROM t WHERE id > 100 AND id <= 150;", &last) == 50);
+    ck_assert(last == 150);
+    ck_assert(cache_count(db, "SELECT id  FROM t\n WHERE id > 5 AND id <= 7;", &last) == 2);
+    ck_assert(last == 7);
+    ck_assert(cache_count(db, "SELECT id FROM t WHERE name = \"row 42\";", &last) == 1);
+    ck_assert(last == 42);
+    ck_assert(cache_count(db, "SELECT id FROM t WHERE name = \"row 43\";", &last) == 1);
+    ck_assert(last == 43);
+    ck_assert(db->cache->hits == hits + 2);
+
+    /* A statement with ?'s of its own shares the program too */
+    ck_assert(chidb_prepare(db, "SELECT id FROM t WHERE name = ?;", &stmt) == CHIDB_OK);
+    ck_assert(db->cache->hits == hits + 3);
+    ck_assert(chidb_bind_text(stmt, 1, "row 7") == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_ROW);
+    ck_assert(chidb_column_int(stmt, 0) == 7);
+    chidb_finalize(stmt);
+
+    /* Literals that do not fit the program of the cached statement still
+     * work, and EXPLAIN is not cached */
+    ck_assert(cache_count(db, "SELECT id FROM t WHERE id > 5 AND id > 290;", NULL) == CACHE_NROWS - 290);
+    hits = db->cache->hits;
+    ck_assert(chidb_prepare(db, "EXPLAIN SELECT id FROM t WHERE id = 5;", &stmt) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_ROW);
+    chidb_finalize(stmt);
+    ck_assert(chidb_prepare(db, "EXPLAIN SELECT id FROM t WHERE id = 5;", &stmt) == CHIDB_OK);
+    chidb_finalize(stmt);
+    ck_assert(db->cache->hits == hits);
+
+    /* Only the most recently used statements are kept */
+    strcpy(sql, "SELECT id");
+    for(int i = 0; i <= DBM_CACHE_SIZE; i++)
+    {
+        char *end = sql + strlen(sql);
+        strcpy(end, " FROM t WHERE id > 290;");
+        ck_assert(cache_count(db, sql, NULL) == CACHE_NROWS - 290);
+        strcpy(end, ", n");
+    }
+    ck_assert(db->cache->n_entries == DBM_CACHE_SIZE);
+
+    chidb_close(db);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_26_2)
+{
+    chidb *db;
+    chidb_stmt *create, *stmt;
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    cache_exec(db, "CREATE TABLE t(id INTEGER PRIMARY KEY, name TEXT, n INTEGER);");
+    cache_insert(db, 1, CACHE_NROWS / 2);
+    ck_assert(cache_count(db, "SELECT id FROM t WHERE n = 3;", NULL) == CACHE_NROWS / 20);
+
+    /* The programs compiled before an index is created do not keep it up
+     * to date, so they are not used once it exists, even if they were
+     * compiled after the CREATE INDEX statement was */
+    ck_assert(chidb_prepare(db, "CREATE INDEX idx ON t(n);", &create) == CHIDB_OK);
+    cache_insert(db, CACHE_NROWS / 2 + 1, CACHE_NROWS / 2 + 1);
+    ck_assert(chidb_step(create) == CHIDB_DONE);
+    chidb_finalize(create);
+    cache_insert(db, CACHE_NROWS / 2 + 2, CACHE_NROWS);
+
+    ck_assert(chidb_prepare(db, "EXPLAIN SELECT id FROM t WHERE n = 3;", &stmt) == CHIDB_OK);
+    bool idx = false;
+    while(chidb_step(stmt) == CHIDB_ROW)
+        idx = idx || !strcmp(chidb_column_text(stmt, 1), "IdxPKey");
+    chidb_finalize(stmt);
+    ck_assert(idx);
+    ck_assert(cache_count(db, "SELECT id FROM t WHERE n = 3;", NULL) == CACHE_NROWS / 10);
+    ck_assert(cache_count(db, "SELECT id FROM t WHERE n = 1;", NULL) == CACHE_NROWS / 10);
+
+    /* Nor after a VACUUM, which moves the tables */
+    ck_assert(cache_count(db, "SELECT id FROM t WHERE id > 280;", NULL) == CACHE_NROWS - 280);
+    cache_exec(db, "VACUUM;");
+    ck_assert(cache_count(db, "SELECT id FROM t WHERE id > 280;", NULL) == CACHE_NROWS - 280);
+    ck_assert(cache_count(db, "SELECT id FROM t WHERE n = 7;", NULL) == CACHE_NROWS / 10);
+    ck_assert(db->cache->n_entries == 2);
+
+    chidb_close(db);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+TCase* make_btree_26_tc(void)
+{
+    TCase *tc = tcase_create ("Step 26: Statement cache");
+    tcase_add_test (tc, test_26_1);
+    tcase_add_test (tc, test_26_2);
+
+    return tc;
+}
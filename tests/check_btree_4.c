@@ -140,6 +140,60 @@ START_TEST (test_4_4)
 END_TEST
 
 
+START_TEST (test_4_5)
+{
+    chidb *db;
+    BTreeNode *btn;
+    BTreeCell btc;
+    ncell_t ncell;
+    char string[128];
+
+    char *fname = create_copy(TESTFILE_STRINGS1, "btree-test-4-5.dat");
+    db = malloc(sizeof(chidb));
+    chidb_Btree_open(fname, db, &db->bt);
+    chidb_Btree_getNodeByPage(db->bt, 5, &btn);
+
+    /* The cells are decoded the first time they are needed */
+    ck_assert(btn->cells == NULL);
+    ck_assert(chidb_Btree_searchNode(btn, 127, &ncell) == CHIDB_OK);
+    ck_assert(btn->cells != NULL);
+    ck_assert(ncell == 2);
+    for(ncell_t i = 0; i < btn->n_cells; i++)
+    {
+        chidb_Btree_getCell(btn, i, &btc);
+        ck_assert(btc.key == btn->cells->keys[i]);
+        chidb_Btree_searchNode(btn, btc.key, &ncell);
+        ck_assert(ncell == i);
+    }
+    chidb_Btree_searchNode(btn, 0xFFFFFFFF, &ncell);
+    ck_assert(ncell == btn->n_cells);
+    ck_assert(chidb_Btree_getCell(btn, btn->n_cells, &btc) == CHIDB_ECELLNO);
+
+    /* ...and discarded when the node is modified */
+    chidb_Btree_searchNode(btn, 126, &ncell);
+    btc.key = 126;
+    btc.type = PGTYPE_TABLE_LEAF;
+    btc.fields.tableLeaf.data_size = 128;
+    bzero(string, 128);
+    strcpy(string, "foo126");
+    btc.fields.tableLeaf.data = (uint8_t*) string;
+    chidb_Btree_insertCell(btn, ncell, &btc);
+    ck_assert(btn->cells == NULL);
+
+    chidb_Btree_getCell(btn, ncell, &btc);
+    ck_assert(btc.key == 126);
+    ck_assert(!memcmp(btc.fields.tableLeaf.data, "foo126", 6));
+    chidb_Btree_getCell(btn, ncell + 1, &btc);
+    ck_assert(btc.key == 127);
+
+    chidb_Btree_freeMemNode(db->bt, btn);
+    chidb_Btree_close(db->bt);
+    delete_copy(fname);
+    free(db);
+}
+END_TEST
+
+
 TCase* make_btree_4_tc(void)
 {
     TCase *tc = tcase_create ("Step 4: Manipulating B-Tree cells");
@@ -147,6 +201,7 @@ TCase* make_btree_4_tc(void)
     tcase_add_test (tc, test_4_2);
     tcase_add_test (tc, test_4_3);
     tcase_add_test (tc, test_4_4);
+    tcase_add_test (tc, test_4_5);
 
     return tc;
 }
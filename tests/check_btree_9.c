@@ -0,0 +1,169 @@
+#include <stdlib.h>
+#include <check.h>
+#include "check_btree.h"
+
+npage_t get_edge_leaf(BTree *bt, npage_t nroot, bool leftmost)
+{
+    BTreeNode *btn;
+    BTreeCell btc;
+    npage_t npage = nroot;
+
+    for(;;)
+    {
+        chidb_Btree_getNodeByPage(bt, npage, &btn);
+        if(btn->type == PGTYPE_TABLE_LEAF || btn->type == PGTYPE_INDEX_LEAF)
+        {
+            chidb_Btree_freeMemNode(bt, btn);
+            return npage;
+        }
+
+        if(leftmost)
+        {
+            chidb_Btree_getCell(btn, 0, &btc);
+            npage = btc.type == PGTYPE_TABLE_INTERNAL ?
+                        btc.fields.tableInternal.child_page :
+                        btc.fields.indexInternal.child_page;
+        }
+        else
+            npage = btn->right_page;
+        chidb_Btree_freeMemNode(bt, btn);
+    }
+}
+
+void test_leaf_chain(BTree *bt, npage_t nroot, chidb_key_t nkeys)
+{
+    BTreeNode *btn;
+    BTreeCell btc;
+    npage_t npage, prev;
+    chidb_key_t nfound = 0, last_key = 0;
+
+    /* Forward, from the leftmost leaf */
+    npage = get_edge_leaf(bt, nroot, true);
+    prev = SIBLING_NONE;
+    while(npage != SIBLING_NONE)
+    {
+        ck_assert(npage != SIBLING_UNKNOWN);
+        chidb_Btree_getNodeByPage(bt, npage, &btn);
+        btn_sanity_check(bt, btn, false);
+        ck_assert(btn->flags & PGFLAG_LEAF_SIBLINGS);
+        ck_assert(btn->prev_page == prev);
+        for(int i = 0; i < btn->n_cells; i++)
+        {
+            chidb_Btree_getCell(btn, i, &btc);
+            if(nfound > 0)
+                ck_assert(btc.key > last_key);
+            last_key = btc.key;
+            nfound++;
+        }
+        prev = npage;
+        npage = btn->next_page;
+        chidb_Btree_freeMemNode(bt, btn);
+    }
+    ck_assert(nfound == nkeys);
+    ck_assert(prev == get_edge_leaf(bt, nroot, false));
+
+    /* Backward, from the rightmost leaf */
+    nfound = 0;
+    npage = prev;
+    while(npage != SIBLING_NONE)
+    {
+        chidb_Btree_getNodeByPage(bt, npage, &btn);
+        for(int i = btn->n_cells - 1; i >= 0; i--)
+        {
+            chidb_Btree_getCell(btn, i, &btc);
+            if(nfound > 0)
+                ck_assert(btc.key < last_key);
+            last_key = btc.key;
+            nfound++;
+        }
+        npage = btn->prev_page;
+        chidb_Btree_freeMemNode(bt, btn);
+    }
+    ck_assert(nfound == nkeys);
+}
+
+START_TEST (test_9_1)
+{
+    chidb *db;
+    int rc;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    for(int i=0; i<bigfile_nvalues; i++)
+        insert_bigfile(db, i);
+
+    test_leaf_chain(db->bt, 1, bigfile_nvalues);
+    test_bigfile(db);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_9_2)
+{
+    chidb *db;
+    int rc;
+    npage_t npage;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    for(int i=0; i<bigfile_nvalues; i++)
+        insert_bigfile(db, i);
+
+    chidb_Btree_newNode(db->bt, &npage, PGTYPE_INDEX_LEAF);
+    for(int i=bigfile_nvalues-1; i>=0; i--)
+        chidb_Btree_insertInIndex(db->bt, npage, bigfile_ikeys[i], bigfile_pkeys[i]);
+
+    test_leaf_chain(db->bt, npage, bigfile_nvalues);
+    test_index_bigfile(db, npage);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_9_3)
+{
+    chidb *db;
+    int rc;
+    BTreeNode *btn;
+
+    /* Leaves of a file that was not written by a split have no links */
+    db = malloc(sizeof(chidb));
+    char *fname = create_copy(TESTFILE_STRINGS1, "btree-test-9-3.dat");
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    chidb_Btree_getNodeByPage(db->bt, get_edge_leaf(db->bt, 1, true), &btn);
+    ck_assert(!(btn->flags & PGFLAG_LEAF_SIBLINGS));
+    ck_assert(btn->prev_page == SIBLING_UNKNOWN);
+    ck_assert(btn->next_page == SIBLING_UNKNOWN);
+    chidb_Btree_freeMemNode(db->bt, btn);
+
+    chidb_Btree_close(db->bt);
+    delete_copy(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_9_tc(void)
+{
+    TCase *tc = tcase_create ("Step 9: Leaf sibling links");
+    tcase_add_test (tc, test_9_1);
+    tcase_add_test (tc, test_9_2);
+    tcase_add_test (tc, test_9_3);
+
+    return tc;
+}
@@ -207,3 +207,34 @@ void test_index_bigfile(chidb *db, npage_t index_nroot)
     }
 }
 
+/* Check that every counted node of a B-Tree has the right counts, and
+ * return the number of rows under npage */
+uint32_t check_counts(BTree *bt, npage_t npage)
+{
+    BTreeNode *btn;
+    BTreeCell btc;
+    uint32_t count = 0, child_count;
+
+    chidb_Btree_getNodeByPage(bt, npage, &btn);
+    if(btn->type == PGTYPE_TABLE_LEAF)
+    {
+        count = btn->n_cells;
+        chidb_Btree_freeMemNode(bt, btn);
+        return count;
+    }
+
+    ck_assert(btn->flags & PGFLAG_SUBTREE_COUNTS);
+    for(int i = 0; i < btn->n_cells; i++)
+    {
+        chidb_Btree_getCell(btn, i, &btc);
+        child_count = check_counts(bt, btc.fields.tableInternal.child_page);
+        ck_assert(btc.fields.tableInternal.count == child_count);
+        count += child_count;
+    }
+    child_count = check_counts(bt, btn->right_page);
+    ck_assert(btn->right_count == child_count);
+    count += child_count;
+
+    chidb_Btree_freeMemNode(bt, btn);
+    return count;
+}
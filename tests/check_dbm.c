@@ -89,17 +89,210 @@ START_TEST (test_dbm)
 END_TEST
 
 
+/* Load a hand-built program into a DBM. The passes below do not look at
+ * the database, so an empty one will do. */
+static void dbm_program(chidb_stmt *stmt, chidb *db, chidb_dbm_op_t *ops, uint32_t n)
+{
+    ck_assert(chidb_stmt_init(stmt, db) == CHIDB_OK);
+    for(uint32_t i = 0; i < n; i++)
+        ck_assert(chidb_stmt_set_op(stmt, &ops[i], i) == CHIDB_OK);
+}
+
+/* What chidb_stmt_verify makes of a program, with instruction pos
+ * replaced by op (if op is not NULL) */
+static int dbm_verify(chidb_dbm_op_t *ops, uint32_t n, uint32_t pos, chidb_dbm_op_t *op)
+{
+    chidb db = {0};
+    chidb_stmt stmt;
+    int rc;
+
+    dbm_program(&stmt, &db, ops, n);
+    if(op != NULL)
+        ck_assert(chidb_stmt_set_op(&stmt, op, pos) == CHIDB_OK);
+    rc = chidb_stmt_verify(&stmt);
+    ck_assert(stmt.verified == (rc == CHIDB_OK));
+    chidb_stmt_free(&stmt);
+    return rc;
+}
+
+START_TEST (test_verify)
+{
+    /* Keys of the table on page 2 */
+    chidb_dbm_op_t scan[] =
+    {
+        /* 0 */ {Op_Integer, 2, 0, 0, NULL, 0},
+        /* 1 */ {Op_OpenRead, 0, 0, 4, NULL, 0},
+        /* 2 */ {Op_Rewind, 0, 6, 0, NULL, 0},
+        /* 3 */ {Op_Key, 0, 1, 0, NULL, 0},
+        /* 4 */ {Op_ResultRow, 1, 1, 0, NULL, 0},
+        /* 5 */ {Op_Next, 0, 3, 0, NULL, 0},
+        /* 6 */ {Op_Close, 0, 0, 0, NULL, 0},
+        /* 7 */ {Op_Halt, 0, 0, 0, NULL, 0},
+    };
+    uint32_t n = sizeof(scan) / sizeof(scan[0]);
+    chidb_dbm_op_t negative_reg = {Op_Integer, 2, -1, 0, NULL, 0};
+    chidb_dbm_op_t closed_cursor = {Op_Rewind, 1, 6, 0, NULL, 0};
+    chidb_dbm_op_t past_end = {Op_Rewind, 0, 8, 0, NULL, 0};
+    chidb_dbm_op_t string_page = {Op_String, 3, 0, 0, "two", 0};
+    chidb_dbm_op_t result_after_loop = {Op_ResultRow, 1, 1, 0, NULL, 0};
+    chidb_dbm_op_t next_to_key = {Op_Next, 0, 3, 0, NULL, 0};
+    chidb_dbm_op_t rewind_past_loop = {Op_Rewind, 0, 5, 0, NULL, 0};
+    chidb db = {0};
+    chidb_stmt stmt;
+
+    ck_assert(dbm_verify(scan, n, 0, NULL) == CHIDB_OK);
+    ck_assert(dbm_verify(scan, n, 0, &negative_reg) == CHIDB_EVALIDEARG);
+    ck_assert(dbm_verify(scan, n, 2, &closed_cursor) == CHIDB_EVALIDEARG);
+    ck_assert(dbm_verify(scan, n, 2, &past_end) == CHIDB_EVALIDEARG);
+    ck_assert(dbm_verify(scan, n, 0, &string_page) == CHIDB_EVALIDEARG);
+
+    /* R_1 is read after the loop, but the loop is skipped when the table
+     * is empty: it is only written on one of the paths to ResultRow */
+    dbm_program(&stmt, &db, scan, n);
+    ck_assert(chidb_stmt_set_op(&stmt, &rewind_past_loop, 2) == CHIDB_OK);
+    ck_assert(chidb_stmt_set_op(&stmt, &next_to_key, 4) == CHIDB_OK);
+    ck_assert(chidb_stmt_set_op(&stmt, &result_after_loop, 5) == CHIDB_OK);
+    ck_assert(chidb_stmt_verify(&stmt) == CHIDB_EVALIDEARG);
+    ck_assert(!stmt.verified);
+    chidb_stmt_free(&stmt);
+
+    /* Changing an instruction of a verified program takes the verdict
+     * back */
+    dbm_program(&stmt, &db, scan, n);
+    ck_assert(chidb_stmt_verify(&stmt) == CHIDB_OK);
+    ck_assert(stmt.verified);
+    ck_assert(chidb_stmt_set_op(&stmt, &scan[3], 3) == CHIDB_OK);
+    ck_assert(!stmt.verified);
+    chidb_stmt_free(&stmt);
+}
+END_TEST
+
+
+/* Run chidb_stmt_peephole on a program and check what it leaves */
+static void dbm_peephole(chidb_dbm_op_t *ops, uint32_t n, chidb_dbm_op_t *expected, uint32_t nexpected)
+{
+    chidb db = {0};
+    chidb_stmt stmt;
+
+    dbm_program(&stmt, &db, ops, n);
+    ck_assert(chidb_stmt_peephole(&stmt) == CHIDB_OK);
+    ck_assert_msg(stmt.endOp == nexpected, "Peephole left %u instructions, expected %u", stmt.endOp, nexpected);
+    for(uint32_t i = 0; i < nexpected; i++)
+    {
+        chidb_dbm_op_t *op = &stmt.ops[i], *e = &expected[i];
+
+        ck_assert_msg(op->opcode == e->opcode && op->p1 == e->p1 && op->p2 == e->p2 &&
+                      op->p3 == e->p3 && op->p5 == e->p5,
+                      "Instruction %u is %s %i %i %i %i, expected %s %i %i %i %i", i,
+                      opcode_to_str(op->opcode), op->p1, op->p2, op->p3, op->p5,
+                      opcode_to_str(e->opcode), e->p1, e->p2, e->p3, e->p5);
+    }
+
+    /* The passes agree on what they leave */
+    ck_assert(chidb_stmt_verify(&stmt) == CHIDB_OK);
+    chidb_stmt_free(&stmt);
+}
+
+START_TEST (test_peephole)
+{
+    /* Keys of the rows of page 2 whose column 1 is not 5. Both pairs are
+     * fused, and the jumps (the one of Next to a Noop, in particular) are
+     * sent where their instructions went once the Noops are removed */
+    chidb_dbm_op_t filter[] =
+    {
+        /* 0 */ {Op_Integer, 2, 0, 0, NULL, 0},
+        /* 1 */ {Op_OpenRead, 0, 0, 3, NULL, 0},
+        /* 2 */ {Op_Rewind, 0, 11, 0, NULL, 0},
+        /* 3 */ {Op_Noop, 0, 0, 0, NULL, 0},
+        /* 4 */ {Op_Integer, 5, 2, 0, NULL, 0},
+        /* 5 */ {Op_Column, 0, 1, 1, NULL, 0},
+        /* 6 */ {Op_Ne, 2, 9, 1, NULL, 0},
+        /* 7 */ {Op_Key, 0, 3, 0, NULL, 0},
+        /* 8 */ {Op_ResultRow, 3, 1, 0, NULL, 0},
+        /* 9 */ {Op_Next, 0, 3, 0, NULL, 0},
+        /* 10 */ {Op_Close, 0, 0, 0, NULL, 0},
+        /* 11 */ {Op_Halt, 0, 0, 0, NULL, 0},
+    };
+    chidb_dbm_op_t filter_fused[] =
+    {
+        {Op_OpenReadConst, 0, 2, 3, NULL, 0},
+        {Op_Rewind, 0, 8, 0, NULL, 0},
+        {Op_Integer, 5, 2, 0, NULL, 0},
+        {Op_ColumnNe, 2, 6, 0, NULL, 1},
+        {Op_Key, 0, 3, 0, NULL, 0},
+        {Op_ResultRow, 3, 1, 0, NULL, 0},
+        {Op_Next, 0, 2, 0, NULL, 0},
+        {Op_Close, 0, 0, 0, NULL, 0},
+        {Op_Halt, 0, 0, 0, NULL, 0},
+    };
+
+    /* Next jumps back to OpenRead, which needs R_0 to be loaded on that
+     * path too */
+    chidb_dbm_op_t target[] =
+    {
+        {Op_Integer, 2, 0, 0, NULL, 0},
+        {Op_OpenRead, 0, 0, 3, NULL, 0},
+        {Op_Rewind, 0, 4, 0, NULL, 0},
+        {Op_Next, 0, 1, 0, NULL, 0},
+        {Op_Close, 0, 0, 0, NULL, 0},
+        {Op_Halt, 0, 0, 0, NULL, 0},
+    };
+
+    /* Column 1 of the rows whose column 1 is not 5: the column is read by
+     * ResultRow too, so Column and Ne stay as they are */
+    chidb_dbm_op_t select[] =
+    {
+        {Op_Integer, 2, 0, 0, NULL, 0},
+        {Op_OpenRead, 0, 0, 3, NULL, 0},
+        {Op_Integer, 5, 2, 0, NULL, 0},
+        {Op_Rewind, 0, 8, 0, NULL, 0},
+        {Op_Column, 0, 1, 1, NULL, 0},
+        {Op_Ne, 2, 7, 1, NULL, 0},
+        {Op_ResultRow, 1, 1, 0, NULL, 0},
+        {Op_Next, 0, 4, 0, NULL, 0},
+        {Op_Close, 0, 0, 0, NULL, 0},
+        {Op_Halt, 0, 0, 0, NULL, 0},
+    };
+    chidb_dbm_op_t select_fused[] =
+    {
+        {Op_OpenReadConst, 0, 2, 3, NULL, 0},
+        {Op_Integer, 5, 2, 0, NULL, 0},
+        {Op_Rewind, 0, 7, 0, NULL, 0},
+        {Op_Column, 0, 1, 1, NULL, 0},
+        {Op_Ne, 2, 6, 1, NULL, 0},
+        {Op_ResultRow, 1, 1, 0, NULL, 0},
+        {Op_Next, 0, 3, 0, NULL, 0},
+        {Op_Close, 0, 0, 0, NULL, 0},
+        {Op_Halt, 0, 0, 0, NULL, 0},
+    };
+
+#define NOPS(ops) (sizeof(ops) / sizeof(ops[0]))
+    dbm_peephole(filter, NOPS(filter), filter_fused, NOPS(filter_fused));
+    dbm_peephole(target, NOPS(target), target, NOPS(target));
+    dbm_peephole(select, NOPS(select), select_fused, NOPS(select_fused));
+#undef NOPS
+}
+END_TEST
+
 
 int main (void)
 {
     SRunner *sr;
     int number_failed;
 
+    Suite *s;
+
     sr = srunner_create (NULL);
 
+    s = suite_create ("dbm-passes");
+    TCase *passes = tcase_create ("passes");
+    tcase_add_test (passes, test_verify);
+    tcase_add_test (passes, test_peephole);
+    suite_add_tcase (s, passes);
+    srunner_add_suite (sr, s);
+
     int i = 0;
     DIR *dir1 = opendir (DBM_PROGRAMS_DIR);
-    Suite *s;
     if (dir1)
     {
         struct dirent *ent1;